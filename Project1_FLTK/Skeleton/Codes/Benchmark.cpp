@@ -0,0 +1,2014 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Benchmark.cpp
+//
+//      Implementation of CBenchmark methods.  Each benchmark runs an
+//  operation on a synthetic image and prints its throughput.  Where a
+//  benchmark compares two ways of doing the same thing, and in the checks,
+//  a mismatch prints a FAILED line and fails the run.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include "Globals.h"
+#include "Benchmark.h"
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <vector>
+#include <string>
+#include "TargaImage.h"
+#include "Simd.h"
+#include "ThreadPool.h"
+#include "FilterChain.h"
+#include "Scratch.h"
+#include "TargaFile.h"
+#include "libtarga.h"
+#include <stdio.h>
+#include <thread>
+
+using namespace std;
+
+// constants
+const int       c_benchWidth            = 2048;                         // width of the synthetic benchmark image
+const int       c_benchHeight           = 1536;                         // height of the synthetic benchmark image
+const unsigned  c_aGaussianSizes[]      = { 3, 5, 9, 15, 31, 51, 75, 101 };
+const int       c_aFilterRadii[]        = { 1, 2, 5, 10, 25, 50 };
+const float     c_aSigmas[]             = { 1, 5, 20, 50, 100, 200 };
+const int       c_aAccuracySigmas[]     = { 1, 2, 3, 4, 5, 7, 10 };     // binomial N = 4 * sigma^2 + 1 is odd
+const int       c_accuracyWidth         = 1024;                         // image size for the exact comparisons
+const int       c_accuracyHeight        = 768;
+const int       c_aDiskRadii[]          = { 1, 2, 4, 8, 12, 16, 24, 32 };
+const int       c_maxDirectTaps         = 1700;                         // larger direct convolutions take too long to time
+const char      c_asMethodNames[][12]   = { "auto", "direct", "separable", "fft" };
+const char      c_asSimdFilters[][20]   = { "box 3x3", "box 5x5", "bartlett 5x5", "gauss 5x5", "convolve 3x3", "unnormalized 3x3" };
+const int       c_numSimdFilters        = sizeof(c_asSimdFilters) / sizeof(c_asSimdFilters[0]);
+const int       c_scalingWidth          = 6000;                         // 24 megapixel image for the thread scaling runs
+const int       c_scalingHeight         = 4000;
+const char      c_asScalingFilters[][16] = { "box 5", "gauss 5x5", "gauss-n 15", "gauss-sig 5", "convolve fft", "gray" };
+const int       c_numScalingFilters     = sizeof(c_asScalingFilters) / sizeof(c_asScalingFilters[0]);
+const char      c_asChains[][40]        = { "gauss, edge, enhance", "box 1, box 1, box 1", "bartlett 2, gauss-n 7", "gauss, gauss, gauss, gauss" };
+const int       c_numChains             = sizeof(c_asChains) / sizeof(c_asChains[0]);
+const int       c_unpremultiplyRuns     = 10;                           // row conversions are too quick to time once
+const char      c_asOpaqueOps[][16]     = { "gray", "quant-unif", "dither-cluster", "difference", "gauss 5x5", "gauss-sig 5", "enhance", "gauss, edge" };
+const int       c_numOpaqueOps          = sizeof(c_asOpaqueOps) / sizeof(c_asOpaqueOps[0]);
+const int       c_opaqueRuns            = 3;                            // best of, as the two paths are close
+const char      c_asPlanarOps[][16]     = { "gray", "quant-unif", "box 5x5", "bartlett 5x5", "gauss 5x5", "gauss-n 15" };
+const int       c_numPlanarOps          = sizeof(c_asPlanarOps) / sizeof(c_asPlanarOps[0]);
+const int       c_aPipelinePasses[]     = { 1, 2, 4, 8, 16, 32 };
+const char      c_asIoFiles[][16]       = { "bench.tga", "bench.rgba16" };  // scratch files for Raw_16_IO, removed after
+const int       c_ioRuns                = 3;                            // best of, as the disk cache makes single runs noisy
+const char      c_asScratchOps[][20]    = { "gray", "dither-fs", "gauss 5x5", "gauss-sig 5", "enhance", "convolve fft",
+                                            "gauss, edge", "half, double", "float gauss 5x5", "16 gauss 5x5" };
+const int       c_numScratchOps         = sizeof(c_asScratchOps) / sizeof(c_asScratchOps[0]);
+const int       c_scratchWarmRuns       = 2;                            // runs to let the arenas grow before counting
+const int       c_scratchRuns           = 5;
+const char      c_asTargaTypes[][16]    = { "24 raw", "32 raw", "24 rle", "32 rle", "16 raw", "8 paletted" };
+const int       c_aTargaImageTypes[]    = { 2, 2, 10, 10, 2, 1 };       // targa image type of each
+const int       c_aTargaDepths[]        = { 24, 32, 24, 32, 16, 8 };    // and its bits per pixel
+const int       c_numTargaTypes         = sizeof(c_asTargaTypes) / sizeof(c_asTargaTypes[0]);
+const char      c_sTargaLoadFile[]      = "bench_load.tga";             // scratch file for Targa_Load, removed after
+const char      c_asSaveImages[][16]    = { "noise", "translucent", "runs of 8" };
+const int       c_numSaveImages         = sizeof(c_asSaveImages) / sizeof(c_asSaveImages[0]);
+const char      c_asSaveFiles[][16]     = { "bench_raw.tga", "bench_rle.tga" };   // scratch files for Targa_Save, removed after
+const char      c_asIndexFiles[][20]    = { "bench_serial.tga", "bench_index.tga" }; // scratch files for Rle_Index, removed after
+const int       c_checkWidth            = 317;                          // odd sizes for the checks, so rows are padded and bands uneven
+const int       c_checkHeight           = 203;
+const int       c_checkThreads          = 7;                            // threads for the checks, whatever the processor count, so bands split unevenly
+
+const unsigned  c_aLongGaussianSizes[]  = { 1019, 1021, 1025, 2001, 4095 };  // binomial rows past 1020 overflow a double
+const int       c_numLongGaussians      = sizeof(c_aLongGaussianSizes) / sizeof(c_aLongGaussianSizes[0]);
+const int       c_aLargeKernelSizes[][2] = { { 257, 257 }, { 301, 3 }, { 3, 301 }, { 129, 201 } };   // past the largest FFT tile that fits cache
+const int       c_numLargeKernels       = sizeof(c_aLargeKernelSizes) / sizeof(c_aLargeKernelSizes[0]);
+const int       c_largeKernelWidth      = 33;                           // image size for them, small as direct convolution is slow
+const int       c_largeKernelHeight     = 25;
+const char      c_asCheckChains[][32]   = { "box 1, box 1", "bartlett 2, gauss", "gauss-n 7, box 2", "box 3, gauss, gauss-n 9",
+                                            "edge", "enhance", "edge, gauss", "enhance, box 1", "edge, enhance", "edge 6",
+                                            "enhance 10", "gauss, edge 10", "edge 6 1.5, enhance 10 0.5" };
+const int       c_numCheckChains        = sizeof(c_asCheckChains) / sizeof(c_asCheckChains[0]);
+const char      c_asCheckTypes[][20]    = { "8 paletted", "8 paletted rle", "16 raw", "24 raw", "32 raw", "24 rle", "32 rle" };
+const int       c_aCheckImageTypes[]    = { 1, 9, 2, 2, 2, 10, 10 };    // targa image type of each
+const int       c_aCheckDepths[]        = { 8, 8, 16, 24, 32, 24, 32 }; // and its bits per pixel
+const int       c_numCheckTypes         = sizeof(c_asCheckTypes) / sizeof(c_asCheckTypes[0]);
+const char      c_asDamages[][28]       = { "no image data", "no width", "7-bit colormap entries", "a colormap for grayscale" };
+const int       c_numDamages            = sizeof(c_asDamages) / sizeof(c_asDamages[0]);
+const char      c_asCheckFiles[][20]    = { "check.tga", "check_damaged.tga" };  // scratch files for Check_Damaged_Files, removed after
+const char      c_sCheckRaw16File[]     = "check.rgba16";               // scratch file for Check_Formats, removed after
+const char      c_asCheckSaves[][24]    = { "raw", "rle", "rle without the index", "raw written top down" };
+const int       c_numCheckSaves         = sizeof(c_asCheckSaves) / sizeof(c_asCheckSaves[0]);
+const char      c_asIndexDamages[][32]  = { "entries a byte late", "an entry past the end", "entries out of order", "a first entry past 0",
+                                            "0 rows to an entry", "16 rows to an entry", "a directory past the end", "no footer signature" };
+const int       c_numIndexDamages       = sizeof(c_asIndexDamages) / sizeof(c_asIndexDamages[0]);
+
+int CBenchmark::s_failures = 0;
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      The per pixel float division RGBA_To_RGB used before the reciprocal
+//  table, kept as the baseline to time against.
+//
+///////////////////////////////////////////////////////////////////////////////
+static void Float_RGBA_To_RGB(const unsigned char* rgba, unsigned char* rgb)
+{
+    unsigned char alpha = rgba[3];
+
+    if (alpha == 0)
+    {
+        rgb[0] = rgb[1] = rgb[2] = 0;
+        return;
+    }// if
+
+    float alpha_scale = (float)255 / (float)alpha;
+    for (int i = 0; i < 3; i++)
+    {
+        int val = (int)floor(rgba[i] * alpha_scale);
+        rgb[i] = (val > 255) ? 255 : val;
+    }// for
+}// Float_RGBA_To_RGB
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Write a targa of the given image type and depth filled with noise, in
+//  which half the pixels repeat the one before so run length encoding finds
+//  runs.  An 8-bit file is paletted, with a 256 entry 24-bit colormap.
+//
+///////////////////////////////////////////////////////////////////////////////
+static bool Write_Test_Targa(const char* sFilename, int imageType, int depth, int width, int height)
+{
+    int bytesPerPixel = depth / 8;
+    int numPixels = width * height;
+    vector<unsigned char> pixels((size_t)numPixels * bytesPerPixel);
+    for (int p = 0; p < numPixels; ++p)
+    {
+        bool bRepeat = p > 0 && rand() % 2;
+        for (int k = 0; k < bytesPerPixel; ++k)
+            pixels[p * bytesPerPixel + k] = bRepeat ? pixels[(p - 1) * bytesPerPixel + k] : (unsigned char)rand();
+    }// for
+
+    unsigned char header[18] = { 0 };
+    header[1] = (depth == 8);
+    header[2] = (unsigned char)imageType;
+    if (depth == 8)
+    {
+        header[6] = 1;                              // 256 colormap entries
+        header[7] = 24;
+    }// if
+    header[12] = (unsigned char)width;
+    header[13] = (unsigned char)(width >> 8);
+    header[14] = (unsigned char)height;
+    header[15] = (unsigned char)(height >> 8);
+    header[16] = (unsigned char)depth;
+    header[17] = (depth == 32) ? 8 : 0;
+
+    vector<unsigned char> body;
+    if (depth == 8)
+    {
+        for (int e = 0; e < 256 * 3; ++e)
+            body.push_back((unsigned char)rand());
+    }// if
+
+    if (imageType == 2 || imageType == 1)
+        body.insert(body.end(), pixels.begin(), pixels.end());
+    else
+    {
+        // a run packet for two or more equal pixels, raw packets between
+        for (int p = 0; p < numPixels; )
+        {
+            const unsigned char* pixel = &pixels[p * bytesPerPixel];
+            int run = 1;
+            while (p + run < numPixels && run < 128 && !memcmp(pixel, pixel + run * bytesPerPixel, bytesPerPixel))
+                ++run;
+
+            if (run > 1)
+            {
+                body.push_back((unsigned char)(0x80 | (run - 1)));
+                body.insert(body.end(), pixel, pixel + bytesPerPixel);
+                p += run;
+                continue;
+            }// if
+
+            int raw = 1;
+            while (p + raw < numPixels && raw < 128
+                   && !(p + raw + 1 < numPixels && !memcmp(pixel + raw * bytesPerPixel, pixel + (raw + 1) * bytesPerPixel, bytesPerPixel)))
+                ++raw;
+            body.push_back((unsigned char)(raw - 1));
+            body.insert(body.end(), pixel, pixel + raw * bytesPerPixel);
+            p += raw;
+        }// for
+    }// else
+
+    FILE* pFile = fopen(sFilename, "wb");
+    if (!pFile)
+        return false;
+    bool bWritten = fwrite(header, 1, sizeof(header), pFile) == sizeof(header)
+                 && fwrite(&body[0], 1, body.size(), pFile) == body.size();
+    fclose(pFile);
+    return bWritten;
+}// Write_Test_Targa
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Whether two images are the same size with the same pixels, compared
+//  as interleaved bytes, which both are made.
+//
+///////////////////////////////////////////////////////////////////////////////
+static bool Same_Pixels(TargaImage& first, TargaImage& second)
+{
+    first.Set_Format(FORMAT_BYTE);
+    first.Set_Layout(LAYOUT_INTERLEAVED);
+    second.Set_Format(FORMAT_BYTE);
+    second.Set_Layout(LAYOUT_INTERLEAVED);
+    if (first.width != second.width || first.height != second.height)
+        return false;
+
+    for (int y = 0; y < first.height; ++y)
+        if (memcmp(first.data + y * first.stride, second.data + y * second.stride, first.width * 4))
+            return false;
+    return true;
+}// Same_Pixels
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Read a whole file into bytes, and write bytes to a file.  False if
+//  the file can not be read, or is empty, or can not be written.
+//
+///////////////////////////////////////////////////////////////////////////////
+static bool Read_File(const char* sFilename, vector<unsigned char>& bytes)
+{
+    FILE* pFile = fopen(sFilename, "rb");
+    if (!pFile)
+        return false;
+
+    bytes.clear();
+    unsigned char buffer[4096];
+    size_t read;
+    while ((read = fread(buffer, 1, sizeof(buffer), pFile)) > 0)
+        bytes.insert(bytes.end(), buffer, buffer + read);
+    bool bRead = !ferror(pFile) && !bytes.empty();
+    fclose(pFile);
+    return bRead;
+}// Read_File
+
+
+static bool Write_File(const char* sFilename, const unsigned char* bytes, size_t size)
+{
+    FILE* pFile = fopen(sFilename, "wb");
+    if (!pFile)
+        return false;
+
+    bool bWritten = fwrite(bytes, 1, size, pFile) == size;
+    return fclose(pFile) == 0 && bWritten;
+}// Write_File
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Read and write the little endian 32-bit field at byte at of a file.
+//
+///////////////////////////////////////////////////////////////////////////////
+static size_t Field_32(const vector<unsigned char>& bytes, size_t at)
+{
+    return bytes[at] | bytes[at + 1] << 8 | bytes[at + 2] << 16 | (size_t)bytes[at + 3] << 24;
+}// Field_32
+
+
+static void Put_Field_32(vector<unsigned char>& bytes, size_t at, size_t value)
+{
+    for (int b = 0; b < 4; ++b)
+        bytes[at + b] = (unsigned char)(value >> (8 * b));
+}// Put_Field_32
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Seconds elapsed since the given start time.
+//
+///////////////////////////////////////////////////////////////////////////////
+static double Seconds_Since(const chrono::steady_clock::time_point& start)
+{
+    return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}// Seconds_Since
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Run every benchmark, then Run_Checks, and print the results to
+//  standard out.  False if any check failed.
+//
+///////////////////////////////////////////////////////////////////////////////
+bool CBenchmark::Run_All()
+{
+    int failures = s_failures;
+    Gaussian_N();
+    Box_Bartlett();
+    Gaussian_Sigma();
+    Convolve_Methods();
+    Simd_Levels();
+    Thread_Scaling();
+    Filter_Chains();
+    Unpremultiply();
+    Opaque_Fast_Path();
+    Planar_Layout();
+    Float_Pipeline();
+    Raw_16_IO();
+    Scratch_Reuse();
+    Targa_Load();
+    Targa_Save();
+    Rle_Index();
+    return Run_Checks() && s_failures == failures;
+}// Run_All
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Run every check and print how many failed.  False if any did.
+//
+///////////////////////////////////////////////////////////////////////////////
+bool CBenchmark::Run_Checks()
+{
+    int failures = s_failures;
+    Check_Unpremultiply();
+    Check_Layouts();
+    Check_Formats();
+    Check_Chains();
+    Check_Unsharp_Mask();
+    Check_Long_Gaussians();
+    Check_Large_Kernels();
+    Check_Damaged_Files();
+    Check_Targa_Saves();
+    Check_Row_Index();
+
+    failures = s_failures - failures;
+    if (failures)
+        cout << failures << " checks FAILED" << endl;
+    else
+        cout << "all checks passed" << endl;
+    return failures == 0;
+}// Run_Checks
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Time Filter_Gaussian_N for a range of N and report MPix/s.  The cost
+//  per pixel of the separable filter should grow linearly with N.
+//
+///////////////////////////////////////////////////////////////////////////////
+void CBenchmark::Gaussian_N()
+{
+    TargaImage* pSource = Make_Noise_Image(c_benchWidth, c_benchHeight);
+    double megaPixels = c_benchWidth * c_benchHeight / 1e6;
+
+    cout << "filter-gauss-n on " << c_benchWidth << "x" << c_benchHeight << endl;
+    cout << setw(6) << "N" << setw(12) << "ms" << setw(12) << "MPix/s" << endl;
+    for (unsigned int i = 0; i < sizeof(c_aGaussianSizes) / sizeof(c_aGaussianSizes[0]); ++i)
+    {
+        TargaImage image(*pSource);
+
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        image.Filter_Gaussian_N(c_aGaussianSizes[i]);
+        double seconds = Seconds_Since(start);
+
+        cout << setw(6) << c_aGaussianSizes[i] << setw(12) << fixed << setprecision(1) << seconds * 1000
+             << setw(12) << setprecision(2) << megaPixels / seconds << endl;
+    }// for
+
+    delete pSource;
+}// Gaussian_N
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Time Filter_Box and Filter_Bartlett for a range of radii.  Both are
+//  running sums, so the throughput should not drop as the radius grows.
+//
+///////////////////////////////////////////////////////////////////////////////
+void CBenchmark::Box_Bartlett()
+{
+    TargaImage* pSource = Make_Noise_Image(c_benchWidth, c_benchHeight);
+    double megaPixels = c_benchWidth * c_benchHeight / 1e6;
+
+    cout << "filter-box / filter-bartlett on " << c_benchWidth << "x" << c_benchHeight << endl;
+    cout << setw(8) << "radius" << setw(12) << "box MPix/s" << setw(16) << "bartlett MPix/s" << endl;
+    for (unsigned int i = 0; i < sizeof(c_aFilterRadii) / sizeof(c_aFilterRadii[0]); ++i)
+    {
+        TargaImage box(*pSource);
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        box.Filter_Box(c_aFilterRadii[i]);
+        double boxSeconds = Seconds_Since(start);
+
+        TargaImage bartlett(*pSource);
+        start = chrono::steady_clock::now();
+        bartlett.Filter_Bartlett(c_aFilterRadii[i]);
+        double bartlettSeconds = Seconds_Since(start);
+
+        cout << setw(8) << c_aFilterRadii[i] << setw(12) << fixed << setprecision(2) << megaPixels / boxSeconds
+             << setw(16) << megaPixels / bartlettSeconds << endl;
+    }// for
+
+    delete pSource;
+}// Box_Bartlett
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Time Filter_Gaussian_Sigma and report its error against the exact
+//  binomial Filter_Gaussian_N of the same standard deviation.  Binomial row
+//  N - 1 has variance (N - 1) / 4, so sigma s matches N = 4 * s^2 + 1.
+//
+///////////////////////////////////////////////////////////////////////////////
+void CBenchmark::Gaussian_Sigma()
+{
+    TargaImage* pSource = Make_Noise_Image(c_benchWidth, c_benchHeight);
+    double megaPixels = c_benchWidth * c_benchHeight / 1e6;
+
+    cout << "filter-gauss-sigma on " << c_benchWidth << "x" << c_benchHeight << endl;
+    cout << setw(8) << "sigma" << setw(12) << "ms" << setw(12) << "MPix/s" << endl;
+    for (unsigned int i = 0; i < sizeof(c_aSigmas) / sizeof(c_aSigmas[0]); ++i)
+    {
+        TargaImage image(*pSource);
+
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        image.Filter_Gaussian_Sigma(c_aSigmas[i]);
+        double seconds = Seconds_Since(start);
+
+        cout << setw(8) << c_aSigmas[i] << setw(12) << fixed << setprecision(1) << seconds * 1000
+             << setw(12) << setprecision(2) << megaPixels / seconds << endl;
+    }// for
+    delete pSource;
+
+    // error of the recursive filter against the exact one, with the pixels
+    // whose window reaches past the image edge reported separately
+    pSource = Make_Noise_Image(c_accuracyWidth, c_accuracyHeight);
+    cout << "filter-gauss-sigma vs filter-gauss-n on " << c_accuracyWidth << "x" << c_accuracyHeight << endl;
+    cout << setw(8) << "sigma" << setw(6) << "N" << setw(10) << "max err" << setw(10) << "mean err"
+         << setw(12) << "within 1" << setw(14) << "border max" << endl;
+    for (unsigned int i = 0; i < sizeof(c_aAccuracySigmas) / sizeof(c_aAccuracySigmas[0]); ++i)
+    {
+        int sigma = c_aAccuracySigmas[i];
+        int N = 4 * sigma * sigma + 1;
+        int margin = (N - 1) / 2;
+
+        TargaImage exact(*pSource);
+        TargaImage fast(*pSource);
+        exact.Filter_Gaussian_N(N);
+        fast.Filter_Gaussian_Sigma((float)sigma);
+
+        int maxError = 0, borderMaxError = 0, within = 0, count = 0;
+        double totalError = 0;
+        for (int y = 0; y < c_accuracyHeight; ++y)
+            for (int x = 0; x < c_accuracyWidth; ++x)
+                for (int k = 0; k < 3; ++k)
+                {
+                    int index = (y * c_accuracyWidth + x) * 4 + k;
+                    int error = abs(exact.data[index] - fast.data[index]);
+                    if (x < margin || y < margin || x >= c_accuracyWidth - margin || y >= c_accuracyHeight - margin)
+                    {
+                        borderMaxError = Max(borderMaxError, error);
+                        continue;
+                    }// if
+
+                    maxError = Max(maxError, error);
+                    totalError += error;
+                    within += error <= 1;
+                    ++count;
+                }// for
+
+        cout << setw(8) << sigma << setw(6) << N << setw(10) << maxError << setw(10) << setprecision(3)
+             << (count ? totalError / count : 0) << setw(11) << setprecision(1)
+             << (count ? 100.0 * within / count : 0) << "%" << setw(14) << borderMaxError << endl;
+    }// for
+    delete pSource;
+}// Gaussian_Sigma
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Time the direct and FFT methods of Convolve on disk kernels, which are
+//  not separable, and print the method the planner picks for each.  The FFT
+//  output is compared against the exact direct output.
+//
+///////////////////////////////////////////////////////////////////////////////
+void CBenchmark::Convolve_Methods()
+{
+    TargaImage* pSource = Make_Noise_Image(c_accuracyWidth, c_accuracyHeight);
+    double megaPixels = c_accuracyWidth * c_accuracyHeight / 1e6;
+
+    cout << "convolve with a disk on " << c_accuracyWidth << "x" << c_accuracyHeight << endl;
+    cout << setw(6) << "size" << setw(14) << "direct MPix/s" << setw(12) << "fft MPix/s" << setw(10) << "fft size"
+         << setw(10) << "planned" << setw(10) << "max err" << endl;
+    for (unsigned int i = 0; i < sizeof(c_aDiskRadii) / sizeof(c_aDiskRadii[0]); ++i)
+    {
+        int radius = c_aDiskRadii[i];
+        int size = 2 * radius + 1;
+        std::vector<int> taps(size * size);
+        int total = 0;
+        for (int y = 0; y < size; ++y)
+            for (int x = 0; x < size; ++x)
+                total += taps[y * size + x] = (x - radius) * (x - radius) + (y - radius) * (y - radius) <= radius * radius;
+        Kernel disk(size, size, &taps[0], total);
+
+        TargaImage fft(*pSource);
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        fft.Convolve(disk, BORDER_ZERO, CONVOLVE_FFT);
+        double fftSeconds = Seconds_Since(start);
+
+        cout << setw(6) << size;
+        if (size * size <= c_maxDirectTaps)
+        {
+            TargaImage direct(*pSource);
+            start = chrono::steady_clock::now();
+            direct.Convolve(disk, BORDER_ZERO, CONVOLVE_DIRECT);
+            double directSeconds = Seconds_Since(start);
+
+            int maxError = 0;
+            for (int j = 0; j < c_accuracyWidth * c_accuracyHeight * 4; ++j)
+                maxError = Max(maxError, abs(direct.data[j] - fft.data[j]));
+
+            cout << setw(14) << fixed << setprecision(2) << megaPixels / directSeconds << setw(12) << megaPixels / fftSeconds
+                 << setw(10) << disk.FFT_Size() << setw(10) << c_asMethodNames[disk.Plan(c_accuracyWidth, c_accuracyHeight)]
+                 << setw(10) << maxError << endl;
+        }// if
+        else
+        {
+            cout << setw(14) << "-" << setw(12) << fixed << setprecision(2) << megaPixels / fftSeconds
+                 << setw(10) << disk.FFT_Size() << setw(10) << c_asMethodNames[disk.Plan(c_accuracyWidth, c_accuracyHeight)]
+                 << setw(10) << "-" << endl;
+        }// else
+    }// for
+
+    delete pSource;
+}// Convolve_Methods
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Time the small filters at every instruction set level the processor
+//  supports, and check each level's output against the scalar one.
+//
+///////////////////////////////////////////////////////////////////////////////
+void CBenchmark::Simd_Levels()
+{
+    TargaImage* pSource = Make_Noise_Image(c_benchWidth, c_benchHeight);
+    double megaPixels = c_benchWidth * c_benchHeight / 1e6;
+    int sharpen[9] = { 0, 1, 0, 1, 4, 1, 0, 1, 0 };     // non-separable, so it takes the direct path
+    Kernel cross(3, 3, sharpen, 8);
+    int brighten[9] = { 8, 16, 8, 16, 64, 16, 8, 16, 8 };   // non-separable too, with quotients past 32767 to clamp
+    Kernel bright(3, 3, brighten, 1);
+    TargaImage* apScalar[c_numSimdFilters];
+    ESimdLevel detected = Simd_Detect();
+
+    cout << "16-bit filters on " << c_benchWidth << "x" << c_benchHeight << ", MPix/s" << endl;
+    cout << setw(18) << "filter";
+    for (int level = SIMD_SCALAR; level <= detected; ++level)
+        cout << setw(10) << c_asSimdLevels[level];
+    cout << setw(12) << "identical" << endl;
+
+    for (int i = 0; i < c_numSimdFilters; ++i)
+    {
+        bool bIdentical = true;
+        cout << setw(18) << c_asSimdFilters[i];
+        for (int level = SIMD_SCALAR; level <= detected; ++level)
+        {
+            Simd_Set_Level((ESimdLevel)level);
+            TargaImage* pImage = new TargaImage(*pSource);
+
+            chrono::steady_clock::time_point start = chrono::steady_clock::now();
+            switch (i)
+            {
+                case 0:     pImage->Filter_Box(1);          break;
+                case 1:     pImage->Filter_Box(2);          break;
+                case 2:     pImage->Filter_Bartlett(2);     break;
+                case 3:     pImage->Filter_Gaussian();      break;
+                case 4:     pImage->Convolve(cross);        break;
+                default:    pImage->Convolve(bright);       break;
+            }// switch
+            double seconds = Seconds_Since(start);
+            cout << setw(10) << fixed << setprecision(2) << megaPixels / seconds;
+
+            if (level == SIMD_SCALAR)
+                apScalar[i] = pImage;
+            else
+            {
+                bIdentical = bIdentical && !memcmp(pImage->data, apScalar[i]->data, c_benchWidth * c_benchHeight * 4);
+                delete pImage;
+            }// else
+        }// for
+        cout << setw(12) << (bIdentical ? "yes" : "NO") << endl;
+        Check(bIdentical, string("every instruction set level gives the scalar output for ") + c_asSimdFilters[i]);
+        delete apScalar[i];
+    }// for
+
+    Simd_Set_Level(detected);
+    delete pSource;
+}// Simd_Levels
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Time the filters on a 24 megapixel image at 1, 2, 4 ... threads up to
+//  one per processor.  Each count prints MPix/s and its speedup over one
+//  thread, and the output must match the one thread output byte for byte.
+//
+///////////////////////////////////////////////////////////////////////////////
+void CBenchmark::Thread_Scaling()
+{
+    TargaImage* pSource = Make_Noise_Image(c_scalingWidth, c_scalingHeight);
+    double megaPixels = c_scalingWidth * c_scalingHeight / 1e6;
+    int previous = ThreadPool::Threads();
+    int processors = Max((int)thread::hardware_concurrency(), 1);
+    vector<int> counts;
+    for (int count = 1; count < processors; count *= 2)
+        counts.push_back(count);
+    counts.push_back(processors);
+
+    // a disk of radius 12 is not separable, run through the FFT path
+    const int radius = 12, size = 2 * radius + 1;
+    vector<int> taps(size * size);
+    long long total = 0;
+    for (int v = -radius; v <= radius; ++v)
+        for (int u = -radius; u <= radius; ++u)
+            total += taps[(v + radius) * size + u + radius] = (u * u + v * v <= radius * radius);
+    Kernel disk(size, size, &taps[0], total);
+
+    cout << "thread scaling on " << c_scalingWidth << "x" << c_scalingHeight << ", MPix/s (speedup)" << endl;
+    cout << setw(14) << "filter";
+    for (size_t c = 0; c < counts.size(); ++c)
+        cout << setw(14) << counts[c];
+    cout << setw(12) << "identical" << endl;
+
+    for (int i = 0; i < c_numScalingFilters; ++i)
+    {
+        TargaImage* pSingle = NULL;
+        double singleSeconds = 0;
+        bool bIdentical = true;
+        cout << setw(14) << c_asScalingFilters[i];
+        for (size_t c = 0; c < counts.size(); ++c)
+        {
+            ThreadPool::Set_Threads(counts[c]);
+            TargaImage* pImage = new TargaImage(*pSource);
+
+            chrono::steady_clock::time_point start = chrono::steady_clock::now();
+            switch (i)
+            {
+                case 0:     pImage->Filter_Box(5);                                              break;
+                case 1:     pImage->Filter_Gaussian();                                          break;
+                case 2:     pImage->Filter_Gaussian_N(15);                                      break;
+                case 3:     pImage->Filter_Gaussian_Sigma(5);                                   break;
+                case 4:     pImage->Convolve(disk, BORDER_ZERO, CONVOLVE_FFT);                  break;
+                default:    pImage->To_Grayscale();                                             break;
+            }// switch
+            double seconds = Seconds_Since(start);
+            if (c == 0)
+                singleSeconds = seconds;
+            cout << setw(8) << fixed << setprecision(1) << megaPixels / seconds
+                 << " (" << setprecision(1) << singleSeconds / seconds << ")";
+
+            if (c == 0)
+                pSingle = pImage;
+            else
+            {
+                bIdentical = bIdentical && !memcmp(pImage->data, pSingle->data, c_scalingWidth * c_scalingHeight * 4);
+                delete pImage;
+            }// else
+        }// for
+        cout << setw(12) << (bIdentical ? "yes" : "NO") << endl;
+        Check(bIdentical, string("every thread count gives the 1 thread output for ") + c_asScalingFilters[i]);
+        delete pSingle;
+    }// for
+
+    ThreadPool::Set_Threads(previous);
+    delete pSource;
+}// Thread_Scaling
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Time chains of neighborhood filters run one filter at a time and fused
+//  into one pass over cache sized tiles by FilterChain.  The fused chain
+//  must give the same image byte for byte.
+//
+///////////////////////////////////////////////////////////////////////////////
+void CBenchmark::Filter_Chains()
+{
+    TargaImage* pSource = Make_Noise_Image(c_benchWidth, c_benchHeight);
+    double megaPixels = c_benchWidth * c_benchHeight / 1e6;
+
+    cout << "filter chains on " << c_benchWidth << "x" << c_benchHeight << ", MPix/s" << endl;
+    cout << setw(30) << "chain" << setw(12) << "one by one" << setw(12) << "fused" << setw(12) << "identical" << endl;
+    for (int i = 0; i < c_numChains; ++i)
+    {
+        TargaImage separate(*pSource);
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        switch (i)
+        {
+            case 0:     separate.Filter_Gaussian(); separate.Filter_Edge(); separate.Filter_Enhance();              break;
+            case 1:     separate.Filter_Box(1); separate.Filter_Box(1); separate.Filter_Box(1);                     break;
+            case 2:     separate.Filter_Bartlett(2); separate.Filter_Gaussian_N(7);                                 break;
+            default:    for (int n = 0; n < 4; ++n) separate.Filter_Gaussian();                                    break;
+        }// switch
+        double separateSeconds = Seconds_Since(start);
+
+        FilterChain chain;
+        switch (i)
+        {
+            case 0:     chain.Add(Kernel::Gaussian(5)); chain.Add_Edge(); chain.Add_Enhance();                      break;
+            case 1:     for (int n = 0; n < 3; ++n) chain.Add(Kernel::Box(1));                                     break;
+            case 2:     chain.Add(Kernel::Bartlett(2)); chain.Add(Kernel::Gaussian(7));                             break;
+            default:    for (int n = 0; n < 4; ++n) chain.Add(Kernel::Gaussian(5));                                break;
+        }// switch
+        TargaImage fused(*pSource);
+        start = chrono::steady_clock::now();
+        fused.Filter_Chain(chain);
+        double fusedSeconds = Seconds_Since(start);
+
+        bool bIdentical = !memcmp(separate.data, fused.data, c_benchWidth * c_benchHeight * 4);
+        cout << setw(30) << c_asChains[i] << setw(12) << fixed << setprecision(2) << megaPixels / separateSeconds
+             << setw(12) << megaPixels / fusedSeconds << setw(12) << (bIdentical ? "yes" : "NO") << endl;
+        Check(bIdentical, string("the fused chain gives the one by one output for ") + c_asChains[i]);
+    }// for
+
+    delete pSource;
+}// Filter_Chains
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Time un-premultiplying the whole image, one pixel at a time with the
+//  old float division and a row at a time with the reciprocal table at each
+//  instruction set level, and premultiplying it back.  Then count the
+//  channel and alpha pairs where the float division was off by one, and
+//  time Filter_Gaussian, which un-premultiplies every pixel, on the image.
+//
+///////////////////////////////////////////////////////////////////////////////
+void CBenchmark::Unpremultiply()
+{
+    TargaImage* pSource = Make_Translucent_Image(c_benchWidth, c_benchHeight);
+    int pixels = c_benchWidth * c_benchHeight;
+    double megaPixels = c_unpremultiplyRuns * pixels / 1e6;
+    vector<unsigned char> rgb(pixels * 3), reference(pixels * 3);
+    ESimdLevel detected = Simd_Detect();
+
+    cout << "Un-premultiply on " << c_benchWidth << "x" << c_benchHeight << ", MPix/s" << endl;
+
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    for (int run = 0; run < c_unpremultiplyRuns; ++run)
+        for (int p = 0; p < pixels; ++p)
+            Float_RGBA_To_RGB(pSource->data + p * 4, &reference[p * 3]);
+    cout << setw(14) << "float" << setw(10) << fixed << setprecision(2) << megaPixels / Seconds_Since(start) << endl;
+
+    for (int level = SIMD_SCALAR; level <= detected; ++level)
+    {
+        Simd_Set_Level((ESimdLevel)level);
+        start = chrono::steady_clock::now();
+        for (int run = 0; run < c_unpremultiplyRuns; ++run)
+            for (int i = 0; i < c_benchHeight; ++i)
+                Unpremultiply_Row(pSource->data + i * c_benchWidth * 4, c_benchWidth, &rgb[i * c_benchWidth * 3]);
+        double unpremultiply = megaPixels / Seconds_Since(start);
+
+        vector<unsigned char> copy(pSource->data, pSource->data + pixels * 4);
+        start = chrono::steady_clock::now();
+        for (int i = 0; i < c_benchHeight; ++i)
+            Premultiply_Row(&copy[i * c_benchWidth * 4], c_benchWidth);
+        double premultiply = pixels / 1e6 / Seconds_Since(start);
+
+        cout << setw(14) << c_asSimdLevels[level] << setw(10) << unpremultiply
+             << "   premultiply " << setw(10) << premultiply << endl;
+    }// for
+    Simd_Set_Level(detected);
+
+    int floatErrors = 0;
+    for (int alpha = 1; alpha < 256; ++alpha)
+        for (int c = 0; c <= alpha; ++c)
+        {
+            unsigned char rgba[4] = { (unsigned char)c, 0, 0, (unsigned char)alpha }, exact[3];
+            Float_RGBA_To_RGB(rgba, exact);
+            floatErrors += (exact[0] != c * 255 / alpha);
+        }// for
+    cout << "float division is off in " << floatErrors << " channel, alpha pairs" << endl;
+
+    TargaImage* pImage = new TargaImage(*pSource);
+    start = chrono::steady_clock::now();
+    pImage->Filter_Gaussian();
+    cout << "Filter_Gaussian on translucent image: " << setprecision(2) << pixels / 1e6 / Seconds_Since(start) << " MPix/s" << endl;
+
+    delete pImage;
+    delete pSource;
+}// Unpremultiply
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Time each op on an opaque image with the opaque flag set, so it reads
+//  RGB straight from the pixel data, and with the flag cleared, so it
+//  un-premultiplies.  Both must give the same image.  The last column is
+//  the flag the op leaves, which decides whether the op after it gets the
+//  fast path.  Then run all the ops in turn on a loaded translucent image
+//  and count how many of them find the flag set.
+//
+///////////////////////////////////////////////////////////////////////////////
+void CBenchmark::Opaque_Fast_Path()
+{
+    TargaImage* pSource = Make_Noise_Image(c_benchWidth, c_benchHeight);
+    TargaImage* pOther = Make_Noise_Image(c_benchWidth, c_benchHeight);
+    double megaPixels = c_benchWidth * c_benchHeight / 1e6;
+    FilterChain chain;
+    chain.Add(Kernel::Gaussian(5));
+    chain.Add_Edge();
+
+    cout << "Opaque fast path on " << c_benchWidth << "x" << c_benchHeight << ", MPix/s" << endl;
+    cout << setw(16) << "op" << setw(12) << "opaque" << setw(12) << "translucent" << setw(12) << "identical" << setw(14) << "opaque after" << endl;
+    for (int i = 0; i < c_numOpaqueOps; ++i)
+    {
+        TargaImage* apImage[2] = { NULL, NULL };
+        double seconds[2] = { 0, 0 };
+
+        for (int n = 0; n < c_opaqueRuns * 2; ++n)
+        {
+            int run = n % 2;
+            delete apImage[run];
+            TargaImage* pImage = apImage[run] = new TargaImage(*pSource);
+            pImage->opaque = (run == 0);
+
+            chrono::steady_clock::time_point start = chrono::steady_clock::now();
+            Run_Opaque_Op(pImage, i, pOther, chain);
+            double elapsed = Seconds_Since(start);
+            if (n < 2 || elapsed < seconds[run])
+                seconds[run] = elapsed;
+        }// for
+
+        bool bIdentical = !memcmp(apImage[0]->data, apImage[1]->data, c_benchWidth * c_benchHeight * 4);
+        cout << setw(16) << c_asOpaqueOps[i] << setw(12) << fixed << setprecision(2) << megaPixels / seconds[0]
+             << setw(12) << megaPixels / seconds[1] << setw(12) << (bIdentical ? "yes" : "NO")
+             << setw(14) << (apImage[0]->opaque ? "yes" : "no") << endl;
+        Check(bIdentical, string("the opaque fast path gives the un-premultiplied output for ") + c_asOpaqueOps[i]);
+        delete apImage[0];
+        delete apImage[1];
+    }// for
+
+    TargaImage* pImage = Make_Translucent_Image(c_benchWidth, c_benchHeight);
+    int fastPaths = 0;
+    for (int i = 0; i < c_numOpaqueOps; ++i)
+    {
+        fastPaths += pImage->opaque;
+        Run_Opaque_Op(pImage, i, pOther, chain);
+    }// for
+    cout << "in turn from a translucent image, " << fastPaths << " of " << c_numOpaqueOps << " ops take the fast path" << endl;
+
+    delete pImage;
+    delete pOther;
+    delete pSource;
+}// Opaque_Fast_Path
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Time the ops with planar versions on an opaque and a translucent
+//  image, interleaved and planar, and check both layouts give the same
+//  image.  The planar times leave out the conversions, which are timed
+//  on their own first.
+//
+///////////////////////////////////////////////////////////////////////////////
+void CBenchmark::Planar_Layout()
+{
+    double megaPixels = c_benchWidth * c_benchHeight / 1e6;
+    TargaImage* apSource[2] = { Make_Noise_Image(c_benchWidth, c_benchHeight), Make_Translucent_Image(c_benchWidth, c_benchHeight) };
+
+    cout << "Planar layout on " << c_benchWidth << "x" << c_benchHeight << ", MPix/s" << endl;
+    TargaImage convert(*apSource[0]);
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    convert.Set_Layout(LAYOUT_PLANAR);
+    double toPlanar = megaPixels / Seconds_Since(start);
+    start = chrono::steady_clock::now();
+    convert.Set_Layout(LAYOUT_INTERLEAVED);
+    cout << "to planar " << fixed << setprecision(2) << toPlanar << ", to interleaved " << megaPixels / Seconds_Since(start) << endl;
+
+    cout << setw(16) << "op" << setw(14) << "image" << setw(14) << "interleaved" << setw(10) << "planar" << setw(12) << "identical" << endl;
+    for (int i = 0; i < c_numPlanarOps; ++i)
+    {
+        for (int s = 0; s < 2; ++s)
+        {
+            TargaImage* apImage[2] = { new TargaImage(*apSource[s]), new TargaImage(*apSource[s]) };
+            double seconds[2];
+            apImage[1]->Set_Layout(LAYOUT_PLANAR);
+
+            for (int layout = 0; layout < 2; ++layout)
+            {
+                TargaImage* pImage = apImage[layout];
+                start = chrono::steady_clock::now();
+                Run_Planar_Op(pImage, i);
+                seconds[layout] = Seconds_Since(start);
+            }// for
+
+            apImage[1]->Set_Layout(LAYOUT_INTERLEAVED);
+            bool bIdentical = !memcmp(apImage[0]->data, apImage[1]->data, c_benchWidth * c_benchHeight * 4);
+            cout << setw(16) << c_asPlanarOps[i] << setw(14) << (s ? "translucent" : "opaque")
+                 << setw(14) << megaPixels / seconds[0] << setw(10) << megaPixels / seconds[1]
+                 << setw(12) << (bIdentical ? "yes" : "NO") << endl;
+            Check(bIdentical, string("planar gives the interleaved output for ") + c_asPlanarOps[i] + (s ? " on a translucent image" : ""));
+            delete apImage[0];
+            delete apImage[1];
+        }// for
+    }// for
+
+    delete apSource[0];
+    delete apSource[1];
+}// Planar_Layout
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      P passes of the 3x3 binomial Gaussian add up to one binomial Gaussian
+//  of 2P + 1 taps, which rounds once.  The byte format rounds down after
+//  every pass, so its error grows with P; the float format rounds once, at
+//  the end, whatever P is, and the 16-bit format rounds down by 1 / 257 of
+//  a byte per pass.  Pixels within P of the edges are left out, as the
+//  black outside the image is not blurred between passes.  The float and
+//  16-bit times include converting from bytes and back.
+//
+///////////////////////////////////////////////////////////////////////////////
+void CBenchmark::Float_Pipeline()
+{
+    TargaImage* pSource = Make_Noise_Image(c_accuracyWidth, c_accuracyHeight);
+    double megaPixels = c_accuracyWidth * c_accuracyHeight / 1e6;
+
+    cout << "3x3 gauss passes against one gauss on " << c_accuracyWidth << "x" << c_accuracyHeight << ", MPix/s per pass" << endl;
+    cout << setw(8) << "passes" << setw(12) << "byte max" << setw(12) << "byte mean" << setw(12) << "float max" << setw(12) << "float mean"
+         << setw(12) << "16 max" << setw(12) << "16 mean" << setw(12) << "byte" << setw(12) << "float" << setw(12) << "16" << endl;
+    for (unsigned int i = 0; i < sizeof(c_aPipelinePasses) / sizeof(c_aPipelinePasses[0]); ++i)
+    {
+        int passes = c_aPipelinePasses[i];
+        int maxError[3];
+        double meanError[3], seconds[3];
+        for (int format = FORMAT_BYTE; format <= FORMAT_16; ++format)
+        {
+            TargaImage image(*pSource), exact(*pSource);
+
+            chrono::steady_clock::time_point start = chrono::steady_clock::now();
+            image.Set_Format((EPixelFormat)format);
+            for (int p = 0; p < passes; ++p)
+                image.Filter_Gaussian_N(3);
+            image.Set_Format(FORMAT_BYTE);
+            seconds[format] = Seconds_Since(start);
+
+            exact.Set_Format((EPixelFormat)format);
+            exact.Filter_Gaussian_N(2 * passes + 1);
+            exact.Set_Format(FORMAT_BYTE);
+
+            long long totalError = 0;
+            int count = 0;
+            maxError[format] = 0;
+            for (int y = passes; y < c_accuracyHeight - passes; ++y)
+            {
+                for (int x = passes * 4; x < (c_accuracyWidth - passes) * 4; ++x)
+                {
+                    if (x % 4 == 3)
+                        continue;
+                    int index = y * c_accuracyWidth * 4 + x;
+                    int error = abs(image.data[index] - exact.data[index]);
+                    maxError[format] = Max(maxError[format], error);
+                    totalError += error;
+                    ++count;
+                }// for
+            }// for
+            meanError[format] = (double)totalError / count;
+        }// for
+
+        cout << setw(8) << passes << setw(12) << maxError[FORMAT_BYTE] << setw(12) << fixed << setprecision(3) << meanError[FORMAT_BYTE]
+             << setw(12) << maxError[FORMAT_FLOAT] << setw(12) << meanError[FORMAT_FLOAT]
+             << setw(12) << maxError[FORMAT_16] << setw(12) << meanError[FORMAT_16]
+             << setw(12) << setprecision(2) << megaPixels * passes / seconds[FORMAT_BYTE]
+             << setw(12) << megaPixels * passes / seconds[FORMAT_FLOAT]
+             << setw(12) << megaPixels * passes / seconds[FORMAT_16] << endl;
+    }// for
+
+    delete pSource;
+}// Float_Pipeline
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Save and load the same 16-bit image as a targa, which goes down to
+//  bytes, and as a raw 16-bit file, and report MB/s of pixels at 8 bytes per
+//  pixel.  Each file is written to the current directory and removed.
+//
+///////////////////////////////////////////////////////////////////////////////
+void CBenchmark::Raw_16_IO()
+{
+    TargaImage* pSource = Make_Translucent_Image(c_benchWidth, c_benchHeight);
+    pSource->Set_Format(FORMAT_16);
+    double megaBytes = c_benchWidth * c_benchHeight * 8 / 1e6;
+
+    cout << "16-bit save and load of " << c_benchWidth << "x" << c_benchHeight << ", MB/s" << endl;
+    cout << setw(16) << "file" << setw(12) << "save" << setw(12) << "load" << setw(12) << "exact" << endl;
+    for (int f = 0; f < 2; ++f)
+    {
+        double saveSeconds = 1e30, loadSeconds = 1e30;
+        bool bExact = false;
+        for (int run = 0; run < c_ioRuns; ++run)
+        {
+            chrono::steady_clock::time_point start = chrono::steady_clock::now();
+            if (!pSource->Save_Image(c_asIoFiles[f]))
+                break;
+            saveSeconds = Min(saveSeconds, Seconds_Since(start));
+
+            start = chrono::steady_clock::now();
+            TargaImage* pLoaded = TargaImage::Load_Image((char*)c_asIoFiles[f]);
+            loadSeconds = Min(loadSeconds, Seconds_Since(start));
+            if (!pLoaded)
+                break;
+
+            pLoaded->Set_Format(FORMAT_16);
+            bExact = !memcmp(pLoaded->wide, pSource->wide, c_benchWidth * c_benchHeight * 8);
+            delete pLoaded;
+        }// for
+        remove(c_asIoFiles[f]);
+
+        cout << setw(16) << c_asIoFiles[f] << setw(12) << fixed << setprecision(1) << megaBytes / saveSeconds
+             << setw(12) << megaBytes / loadSeconds << setw(12) << (bExact ? "yes" : "no") << endl;
+        if (f == 1)
+            Check(bExact, string(c_asIoFiles[f]) + " loads to the 16-bit pixels saved");
+    }// for
+
+    delete pSource;
+}// Raw_16_IO
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Run each op on a fresh copy of the same image until the scratch arenas
+//  of every thread have grown to what it needs, then count the heap
+//  allocations of further runs, copy and delete included.  Every op should
+//  report none.
+//
+///////////////////////////////////////////////////////////////////////////////
+void CBenchmark::Scratch_Reuse()
+{
+    TargaImage* pSource = Make_Translucent_Image(c_accuracyWidth, c_accuracyHeight);
+    double megaPixels = c_accuracyWidth * c_accuracyHeight / 1e6;
+    Kernel disk = Kernel::Box(8);
+    FilterChain chain;
+    chain.Add(Kernel::Gaussian(5));
+    chain.Add_Edge();
+
+    cout << "heap allocations per run once the scratch arenas have grown, on " << c_accuracyWidth << "x" << c_accuracyHeight << endl;
+    cout << setw(20) << "op" << setw(12) << "MPix/s" << setw(12) << "allocs" << endl;
+    for (int i = 0; i < c_numScratchOps; ++i)
+    {
+        long long allocations = 0;
+        double seconds = 1e30;
+        for (int run = 0; run < c_scratchWarmRuns + c_scratchRuns; ++run)
+        {
+            long long before = Scratch_Heap_Allocations();
+            chrono::steady_clock::time_point start = chrono::steady_clock::now();
+            TargaImage* pImage = new TargaImage(*pSource);
+            switch (i)
+            {
+                case 0:     pImage->To_Grayscale();                                         break;
+                case 1:     pImage->Dither_FS();                                            break;
+                case 2:     pImage->Filter_Gaussian();                                      break;
+                case 3:     pImage->Filter_Gaussian_Sigma(5);                               break;
+                case 4:     pImage->Filter_Enhance();                                       break;
+                case 5:     pImage->Convolve(disk, BORDER_CLAMP, CONVOLVE_FFT);             break;
+                case 6:     pImage->Filter_Chain(chain);                                    break;
+                case 7:     pImage->Half_Size(); pImage->Double_Size();                     break;
+                case 8:     pImage->Set_Format(FORMAT_FLOAT); pImage->Filter_Gaussian();    break;
+                default:    pImage->Set_Format(FORMAT_16); pImage->Filter_Gaussian();       break;
+            }// switch
+            delete pImage;
+            if (run < c_scratchWarmRuns)
+                continue;
+
+            seconds = Min(seconds, Seconds_Since(start));
+            allocations += Scratch_Heap_Allocations() - before;
+        }// for
+
+        cout << setw(20) << c_asScratchOps[i] << setw(12) << fixed << setprecision(2) << megaPixels / seconds
+             << setw(12) << setprecision(1) << (double)allocations / c_scratchRuns << endl;
+    }// for
+
+    delete pSource;
+}// Scratch_Reuse
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Load a targa of each kind with libtarga's tga_load and with
+//  Load_Targa, and report MB/s of RGBA pixels at 4 bytes per pixel.  The 16
+//  and 8-bit files go from Load_Targa to tga_load, so both columns time the
+//  same code for them.  Each file is written to the current directory and
+//  removed.
+//
+///////////////////////////////////////////////////////////////////////////////
+void CBenchmark::Targa_Load()
+{
+    double megaBytes = c_benchWidth * c_benchHeight * 4 / 1e6;
+
+    cout << "targa loads of " << c_benchWidth << "x" << c_benchHeight << ", MB/s" << endl;
+    cout << setw(14) << "file" << setw(12) << "libtarga" << setw(12) << "by rows" << setw(12) << "identical" << endl;
+    for (int t = 0; t < c_numTargaTypes; ++t)
+    {
+        if (!Write_Test_Targa(c_sTargaLoadFile, c_aTargaImageTypes[t], c_aTargaDepths[t], c_benchWidth, c_benchHeight))
+        {
+            cout << "Unable to write " << c_sTargaLoadFile << endl;
+            return;
+        }// if
+
+        double libSeconds = 1e30, rowSeconds = 1e30;
+        bool bIdentical = true;
+        for (int run = 0; run < c_ioRuns; ++run)
+        {
+            int width, height;
+            chrono::steady_clock::time_point start = chrono::steady_clock::now();
+            unsigned char* pLibtarga = (unsigned char*)tga_load(c_sTargaLoadFile, &width, &height, TGA_TRUECOLOR_32);
+            libSeconds = Min(libSeconds, Seconds_Since(start));
+
+            start = chrono::steady_clock::now();
+            unsigned char* pRows = Load_Targa(c_sTargaLoadFile, &width, &height);
+            rowSeconds = Min(rowSeconds, Seconds_Since(start));
+
+            bIdentical = bIdentical && pLibtarga && pRows && !memcmp(pLibtarga, pRows, c_benchWidth * c_benchHeight * 4);
+            free(pLibtarga);
+            free(pRows);
+        }// for
+        remove(c_sTargaLoadFile);
+
+        cout << setw(14) << c_asTargaTypes[t] << setw(12) << fixed << setprecision(1) << megaBytes / libSeconds
+             << setw(12) << megaBytes / rowSeconds << setw(12) << (bIdentical ? "yes" : "NO") << endl;
+        Check(bIdentical, string("Load_Targa gives tga_load's pixels for ") + c_asTargaTypes[t]);
+    }// for
+}// Targa_Load
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Save images that do and do not compress as raw and run length encoded
+//  targas, the latter on one thread and on all of them, and report MB/s of
+//  RGBA pixels at 4 bytes per pixel and the size of the encoded file against
+//  the raw one.  Both files must load to the same pixels.  Each file is
+//  written to the current directory and removed.
+//
+///////////////////////////////////////////////////////////////////////////////
+void CBenchmark::Targa_Save()
+{
+    double megaBytes = c_benchWidth * c_benchHeight * 4 / 1e6;
+    int previous = ThreadPool::Threads();
+    int processors = Max((int)thread::hardware_concurrency(), 1);
+
+    cout << "targa saves of " << c_benchWidth << "x" << c_benchHeight << ", MB/s" << endl;
+    cout << setw(14) << "image" << setw(12) << "raw" << setw(12) << "rle 1" << setw(12) << "rle " + to_string(processors)
+         << setw(12) << "size %" << setw(12) << "identical" << endl;
+    for (int i = 0; i < c_numSaveImages; ++i)
+    {
+        TargaImage* pSource = Make_Save_Image(i, c_benchWidth, c_benchHeight);
+
+        double aSeconds[3] = { 1e30, 1e30, 1e30 };
+        for (int run = 0; run < c_ioRuns; ++run)
+        {
+            for (int s = 0; s < 3; ++s)
+            {
+                ThreadPool::Set_Threads(s == 1 ? 1 : processors);
+                chrono::steady_clock::time_point start = chrono::steady_clock::now();
+                pSource->Save_Image(c_asSaveFiles[s ? 1 : 0], s != 0);
+                aSeconds[s] = Min(aSeconds[s], Seconds_Since(start));
+            }// for
+        }// for
+        ThreadPool::Set_Threads(previous);
+
+        long long aBytes[2] = { 0, 0 };
+        unsigned char* apLoaded[2];
+        for (int f = 0; f < 2; ++f)
+        {
+            FILE* file = fopen(c_asSaveFiles[f], "rb");
+            if (file)
+            {
+                fseek(file, 0, SEEK_END);
+                aBytes[f] = ftell(file);
+                fclose(file);
+            }// if
+
+            int width, height;
+            apLoaded[f] = Load_Targa(c_asSaveFiles[f], &width, &height);
+            remove(c_asSaveFiles[f]);
+        }// for
+        bool bIdentical = apLoaded[0] && apLoaded[1] && !memcmp(apLoaded[0], apLoaded[1], c_benchWidth * c_benchHeight * 4);
+        free(apLoaded[0]);
+        free(apLoaded[1]);
+
+        cout << setw(14) << c_asSaveImages[i] << setw(12) << fixed << setprecision(1) << megaBytes / aSeconds[0]
+             << setw(12) << megaBytes / aSeconds[1] << setw(12) << megaBytes / aSeconds[2]
+             << setw(12) << (aBytes[0] ? 100.0 * aBytes[1] / aBytes[0] : 0.0) << setw(12) << (bIdentical ? "yes" : "NO") << endl;
+        Check(bIdentical, string("the raw and run length encoded saves load the same for ") + c_asSaveImages[i]);
+        delete pSource;
+    }// for
+}// Targa_Save
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Write the images of Targa_Save run length encoded without and with
+//  the row index, and report MB/s of RGBA pixels at 4 bytes per pixel for
+//  loading the first, which decodes a row after another, and the second on
+//  one thread and on all of them.  All must load to the same pixels.  Each
+//  file is written to the current directory and removed.
+//
+///////////////////////////////////////////////////////////////////////////////
+void CBenchmark::Rle_Index()
+{
+    double megaBytes = c_benchWidth * c_benchHeight * 4 / 1e6;
+    int previous = ThreadPool::Threads();
+    int processors = Max((int)thread::hardware_concurrency(), 1);
+
+    cout << "run length encoded targa loads of " << c_benchWidth << "x" << c_benchHeight << " without and with the row index, MB/s" << endl;
+    cout << setw(14) << "image" << setw(12) << "no index" << setw(12) << "index 1" << setw(12) << "index " + to_string(processors)
+         << setw(12) << "identical" << endl;
+    for (int i = 0; i < c_numSaveImages; ++i)
+    {
+        TargaImage* pSource = Make_Save_Image(i, c_benchWidth, c_benchHeight);
+
+        for (int f = 0; f < 2; ++f)
+        {
+            TargaWriter writer(c_asIndexFiles[f], c_benchWidth, c_benchHeight, true, f != 0);
+            for (int y = c_benchHeight - 1; y >= 0; --y)
+                writer.Write_Row(y, pSource->data + y * pSource->stride, pSource->opaque);
+            writer.Close();
+        }// for
+
+        double aSeconds[3] = { 1e30, 1e30, 1e30 };
+        unsigned char* apLoaded[3] = { NULL, NULL, NULL };
+        for (int run = 0; run < c_ioRuns; ++run)
+        {
+            for (int l = 0; l < 3; ++l)
+            {
+                int width, height;
+                ThreadPool::Set_Threads(l == 1 ? 1 : processors);
+                chrono::steady_clock::time_point start = chrono::steady_clock::now();
+                unsigned char* pLoaded = Load_Targa(c_asIndexFiles[l ? 1 : 0], &width, &height);
+                aSeconds[l] = Min(aSeconds[l], Seconds_Since(start));
+                free(apLoaded[l]);
+                apLoaded[l] = pLoaded;
+            }// for
+        }// for
+        ThreadPool::Set_Threads(previous);
+        remove(c_asIndexFiles[0]);
+        remove(c_asIndexFiles[1]);
+
+        bool bIdentical = apLoaded[0] && apLoaded[1] && apLoaded[2] && !memcmp(apLoaded[0], apLoaded[1], c_benchWidth * c_benchHeight * 4)
+                          && !memcmp(apLoaded[0], apLoaded[2], c_benchWidth * c_benchHeight * 4);
+        for (int l = 0; l < 3; ++l)
+            free(apLoaded[l]);
+
+        cout << setw(14) << c_asSaveImages[i] << setw(12) << fixed << setprecision(1) << megaBytes / aSeconds[0]
+             << setw(12) << megaBytes / aSeconds[1] << setw(12) << megaBytes / aSeconds[2] << setw(12) << (bIdentical ? "yes" : "NO") << endl;
+        Check(bIdentical, string("the row index loads the same as decoding a row after another for ") + c_asSaveImages[i]);
+        delete pSource;
+    }// for
+}// Rle_Index
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Un-premultiply a row of every premultiplied channel and alpha pair at
+//  each instruction set level, and compare it with floor(255 * c / alpha),
+//  which the reciprocal table stands in for.
+//
+///////////////////////////////////////////////////////////////////////////////
+void CBenchmark::Check_Unpremultiply()
+{
+    vector<unsigned char> rgba, rgb;
+    for (int alpha = 0; alpha < 256; ++alpha)
+        for (int c = 0; c <= alpha; ++c)
+        {
+            unsigned char pixel[4] = { (unsigned char)c, (unsigned char)(alpha - c), (unsigned char)(c / 2), (unsigned char)alpha };
+            rgba.insert(rgba.end(), pixel, pixel + 4);
+        }// for
+    int pixels = (int)rgba.size() / 4;
+    rgb.resize(pixels * 3);
+
+    ESimdLevel detected = Simd_Detect();
+    for (int level = SIMD_SCALAR; level <= detected; ++level)
+    {
+        Simd_Set_Level((ESimdLevel)level);
+        Unpremultiply_Row(&rgba[0], pixels, &rgb[0]);
+
+        bool bExact = true;
+        for (int p = 0; p < pixels; ++p)
+        {
+            int alpha = rgba[p * 4 + 3];
+            for (int k = 0; k < 3; ++k)
+                bExact = bExact && rgb[p * 3 + k] == (alpha ? rgba[p * 4 + k] * 255 / alpha : 0);
+        }// for
+        Check(bExact, string("Unpremultiply_Row divides exactly at level ") + c_asSimdLevels[level]);
+    }// for
+    Simd_Set_Level(detected);
+}// Check_Unpremultiply
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Put small opaque and translucent images through planar and back, and
+//  run each op of Planar_Layout on both layouts.  Rows of an odd number of
+//  pixels and bands of uneven height catch what the benchmark's even sizes
+//  do not.
+//
+///////////////////////////////////////////////////////////////////////////////
+void CBenchmark::Check_Layouts()
+{
+    TargaImage* apSource[2] = { Make_Noise_Image(c_checkWidth, c_checkHeight), Make_Translucent_Image(c_checkWidth, c_checkHeight) };
+    for (int s = 0; s < 2; ++s)
+    {
+        string sImage = s ? " on a translucent image" : " on an opaque image";
+        TargaImage converted(*apSource[s]);
+        converted.Set_Layout(LAYOUT_PLANAR);
+        Check(Same_Pixels(converted, *apSource[s]), "planar and back gives the same pixels" + sImage);
+
+        for (int i = 0; i < c_numPlanarOps; ++i)
+        {
+            TargaImage interleaved(*apSource[s]), planar(*apSource[s]);
+            planar.Set_Layout(LAYOUT_PLANAR);
+            Run_Planar_Op(&interleaved, i);
+            Run_Planar_Op(&planar, i);
+            Check(Same_Pixels(planar, interleaved), string("planar gives the interleaved output for ") + c_asPlanarOps[i] + sImage);
+        }// for
+    }// for
+
+    delete apSource[0];
+    delete apSource[1];
+}// Check_Layouts
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Convert opaque and translucent byte images to float, to 16 bits and
+//  to both in turn, and back, which Set_Format says gives the bytes that
+//  were there.  16 bits made from bytes must also come back exactly from
+//  float and from a raw 16-bit file, and a raw 16-bit file cut short must
+//  fail to load.  The file is written to the current directory and
+//  removed.
+//
+///////////////////////////////////////////////////////////////////////////////
+void CBenchmark::Check_Formats()
+{
+    const EPixelFormat aaeTrips[][2] = { { FORMAT_FLOAT, FORMAT_FLOAT }, { FORMAT_16, FORMAT_16 },
+                                         { FORMAT_16, FORMAT_FLOAT }, { FORMAT_FLOAT, FORMAT_16 } };
+    const char asTrips[][24] = { "float", "16 bits", "16 bits then float", "float then 16 bits" };
+    size_t wideBytes = (size_t)c_checkWidth * c_checkHeight * 8;
+
+    TargaImage* apSource[2] = { Make_Noise_Image(c_checkWidth, c_checkHeight), Make_Translucent_Image(c_checkWidth, c_checkHeight) };
+    for (int s = 0; s < 2; ++s)
+    {
+        string sImage = s ? " on a translucent image" : " on an opaque image";
+        for (int t = 0; t < 4; ++t)
+        {
+            TargaImage converted(*apSource[s]);
+            converted.Set_Format(aaeTrips[t][0]);
+            converted.Set_Format(aaeTrips[t][1]);
+            Check(Same_Pixels(converted, *apSource[s]), string("bytes to ") + asTrips[t] + " and back gives the same pixels" + sImage);
+        }// for
+
+        TargaImage wide(*apSource[s]), throughFloat(*apSource[s]);
+        wide.Set_Format(FORMAT_16);
+        throughFloat.Set_Format(FORMAT_16);
+        throughFloat.Set_Format(FORMAT_FLOAT);
+        throughFloat.Set_Format(FORMAT_16);
+        Check(!memcmp(wide.wide, throughFloat.wide, wideBytes), "16 bits to float and back gives the same pixels" + sImage);
+
+        TargaImage* pLoaded = wide.Save_Image(c_sCheckRaw16File) ? TargaImage::Load_Image((char*)c_sCheckRaw16File) : NULL;
+        if (pLoaded)
+            pLoaded->Set_Format(FORMAT_16);
+        Check(pLoaded && !memcmp(pLoaded->wide, wide.wide, wideBytes), string(c_sCheckRaw16File) + " loads to the 16-bit pixels saved" + sImage);
+        delete pLoaded;
+
+        vector<unsigned char> file;
+        if (Read_File(c_sCheckRaw16File, file))
+        {
+            Write_File(c_sCheckRaw16File, &file[0], file.size() - 1);
+            pLoaded = TargaImage::Load_Image((char*)c_sCheckRaw16File);
+            Check(!pLoaded, "a raw 16-bit file one byte short does not load");
+            delete pLoaded;
+        }// if
+        remove(c_sCheckRaw16File);
+    }// for
+
+    delete apSource[0];
+    delete apSource[1];
+}// Check_Formats
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Run each chain of c_asCheckChains one filter at a time and fused, on
+//  an opaque and a translucent image, the fused one on one thread and on
+//  c_checkThreads, and compare the fused output with the one filter at a
+//  time output.
+//
+///////////////////////////////////////////////////////////////////////////////
+void CBenchmark::Check_Chains()
+{
+    int previous = ThreadPool::Threads();
+    int aThreads[2] = { 1, c_checkThreads };
+    TargaImage* apSource[2] = { Make_Noise_Image(c_checkWidth, c_checkHeight), Make_Translucent_Image(c_checkWidth, c_checkHeight) };
+    for (int c = 0; c < c_numCheckChains; ++c)
+    {
+        for (int s = 0; s < 2; ++s)
+        {
+            TargaImage separate(*apSource[s]);
+            FilterChain chain;
+            Run_Check_Chain(c, &separate, chain);
+
+            for (int t = 0; t < 2; ++t)
+            {
+                ThreadPool::Set_Threads(aThreads[t]);
+                TargaImage fused(*apSource[s]);
+                Check(fused.Filter_Chain(chain) && Same_Pixels(fused, separate),
+                      string("the fused chain gives the one by one output for ") + c_asCheckChains[c]
+                      + (s ? " on a translucent image" : " on an opaque image") + " on " + to_string(aThreads[t]) + " threads");
+            }// for
+            ThreadPool::Set_Threads(previous);
+        }// for
+    }// for
+
+    delete apSource[0];
+    delete apSource[1];
+}// Check_Chains
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Run Filter_Edge and Filter_Enhance at radii 1, 6 and 10 in each
+//  format on one thread and on c_checkThreads.  Each thread count splits the
+//  rows into its own bands, whose edge rows come from the copies made
+//  before any band writes, so a missed copy shows as a difference.
+//
+///////////////////////////////////////////////////////////////////////////////
+void CBenchmark::Check_Unsharp_Mask()
+{
+    const int aRadii[] = { 1, 6, 10 };
+    const EPixelFormat aeFormats[] = { FORMAT_BYTE, FORMAT_FLOAT, FORMAT_16 };
+    const char asFormats[][8] = { "byte", "float", "16-bit" };
+    int previous = ThreadPool::Threads();
+
+    TargaImage* apSource[2] = { Make_Noise_Image(c_checkWidth, c_checkHeight), Make_Translucent_Image(c_checkWidth, c_checkHeight) };
+    for (int s = 0; s < 2; ++s)
+        for (int f = 0; f < 3; ++f)
+            for (int r = 0; r < 3; ++r)
+                for (int edge = 0; edge < 2; ++edge)
+                {
+                    TargaImage* apImage[2];
+                    for (int t = 0; t < 2; ++t)
+                    {
+                        ThreadPool::Set_Threads(t ? c_checkThreads : 1);
+                        apImage[t] = new TargaImage(*apSource[s]);
+                        apImage[t]->Set_Format(aeFormats[f]);
+                        if (edge)
+                            apImage[t]->Filter_Edge(aRadii[r], 1.5f);
+                        else
+                            apImage[t]->Filter_Enhance(aRadii[r], 1.5f);
+                    }// for
+                    ThreadPool::Set_Threads(previous);
+
+                    Check(Same_Pixels(*apImage[0], *apImage[1]), string(edge ? "Filter_Edge " : "Filter_Enhance ") + to_string(aRadii[r])
+                          + " gives the 1 thread output on " + to_string(c_checkThreads) + " threads in " + asFormats[f]
+                          + (s ? " on a translucent image" : " on an opaque image"));
+                    delete apImage[0];
+                    delete apImage[1];
+                }// for
+
+    delete apSource[0];
+    delete apSource[1];
+}// Check_Unsharp_Mask
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Build the Gaussians of c_aLongGaussianSizes.  Each row must total
+//  2^12 and, but for the center tap that takes the rounding error, come
+//  within half of the binomial coefficient over 2^(N - 1 - 12), taken from
+//  lgamma.  Filter_Gaussian_N must refuse N past 2 * 2047 + 1.
+//
+///////////////////////////////////////////////////////////////////////////////
+void CBenchmark::Check_Long_Gaussians()
+{
+    for (int g = 0; g < c_numLongGaussians; ++g)
+    {
+        unsigned N = c_aLongGaussianSizes[g];
+        Kernel gaussian = Kernel::Gaussian(N);
+        bool bClose = gaussian.row.size() == N && gaussian.divisor == (1LL << 24);
+        long long total = 0;
+        for (unsigned i = 0; bClose && i < N; ++i)
+        {
+            double exact = exp(lgamma(N) - lgamma(i + 1.0) - lgamma((double)(N - i)) - (N - 1 - 12.0) * log(2.0));
+            bClose = gaussian.row[i] >= 0 && (i == N / 2 || fabs(gaussian.row[i] - exact) <= 0.5 + 1e-6);
+            total += gaussian.row[i];
+        }// for
+        Check(bClose && total == 1 << 12, "the Gaussian row of N = " + to_string(N) + " is the binomial row rescaled");
+    }// for
+
+    TargaImage image(c_checkWidth, c_checkHeight);
+    Check(!image.Filter_Gaussian_N(4097), "Filter_Gaussian_N refuses N = 4097");
+}// Check_Long_Gaussians
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Convolve with random kernels of c_aLargeKernelSizes, which take FFT
+//  tiles past c_maxFFTSize, by each method and border.  Every tile must be
+//  at least twice the kernel, and FFT and the planned method must come
+//  within 1 of direct convolution.
+//
+///////////////////////////////////////////////////////////////////////////////
+void CBenchmark::Check_Large_Kernels()
+{
+    TargaImage* pSource = Make_Noise_Image(c_largeKernelWidth, c_largeKernelHeight);
+    for (int k = 0; k < c_numLargeKernels; ++k)
+    {
+        int width = c_aLargeKernelSizes[k][0], height = c_aLargeKernelSizes[k][1];
+        std::vector<int> taps(width * height);
+        long long total = 0;
+        for (int i = 0; i < width * height; ++i)
+            total += taps[i] = rand() % 16;
+        Kernel kernel(width, height, &taps[0], total);
+        string sKernel = " for a " + to_string(width) + "x" + to_string(height) + " kernel";
+        if (!Check(kernel.FFT_Size() >= 2 * Max(width, height), "the FFT tile is twice the kernel" + sKernel))
+            continue;
+
+        for (int b = 0; b < 2; ++b)
+        {
+            EBorderMode eBorder = b ? BORDER_MIRROR : BORDER_ZERO;
+            TargaImage direct(*pSource), fft(*pSource), planned(*pSource);
+            string sBorder = b ? " with a mirror border" : " with a black border";
+            if (!Check(direct.Convolve(kernel, eBorder, CONVOLVE_DIRECT) && fft.Convolve(kernel, eBorder, CONVOLVE_FFT)
+                       && planned.Convolve(kernel, eBorder, CONVOLVE_AUTO), "every method convolves" + sKernel + sBorder))
+                continue;
+
+            int fftError = 0, plannedError = 0;
+            for (int y = 0; y < c_largeKernelHeight; ++y)
+            {
+                for (int i = 0; i < c_largeKernelWidth * 4; ++i)
+                {
+                    int expected = direct.data[y * direct.stride + i];
+                    fftError = Max(fftError, abs(fft.data[y * fft.stride + i] - expected));
+                    plannedError = Max(plannedError, abs(planned.data[y * planned.stride + i] - expected));
+                }// for
+            }// for
+            Check(fftError <= 1, "FFT convolution comes within 1 of direct" + sKernel + sBorder);
+            Check(plannedError <= 1, "planned convolution comes within 1 of direct" + sKernel + sBorder);
+        }// for
+    }// for
+
+    delete pSource;
+}// Check_Large_Kernels
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Write a targa of each kind in c_asCheckTypes, load it whole, then cut
+//  short and with its header damaged.  A file cut in its header or colormap
+//  must not load; one cut in its pixels must load, with the pixels before
+//  the cut as they were in the whole file when it is not run length
+//  encoded, as pixels past the end read as 0.  The truecolor kinds take
+//  Load_Targa's own decoder, which must give tga_load's pixels for the
+//  same cut.  A damaged header must not load.  Each file is written to the
+//  current directory and removed.
+//
+///////////////////////////////////////////////////////////////////////////////
+void CBenchmark::Check_Damaged_Files()
+{
+    for (int t = 0; t < c_numCheckTypes; ++t)
+    {
+        string sType = string(" for ") + c_asCheckTypes[t];
+        vector<unsigned char> file;
+        if (!Check(Write_Test_Targa(c_asCheckFiles[0], c_aCheckImageTypes[t], c_aCheckDepths[t], c_checkWidth, c_checkHeight)
+                   && Read_File(c_asCheckFiles[0], file), string("writing ") + c_asCheckFiles[0] + sType))
+            continue;
+
+        int width, height;
+        unsigned char* pWhole = Load_Targa(c_asCheckFiles[0], &width, &height);
+        Check(pWhole != NULL, "the whole file loads" + sType);
+
+        bool bPaletted = c_aCheckDepths[t] == 8;
+        bool bRaw = c_aCheckImageTypes[t] == 1 || c_aCheckImageTypes[t] == 2;
+        size_t dataOffset = c_targaHeaderSize + (bPaletted ? 256 * 3 : 0);
+        size_t aCuts[] = { 0, c_targaHeaderSize - 1, dataOffset - 1, dataOffset + (file.size() - dataOffset) / 2, file.size() - 1 };
+        for (int c = 0; c < (int)(sizeof(aCuts) / sizeof(aCuts[0])); ++c)
+        {
+            Write_File(c_asCheckFiles[1], &file[0], aCuts[c]);
+            unsigned char* pCut = Load_Targa(c_asCheckFiles[1], &width, &height);
+            string sCut = " cut to " + to_string(aCuts[c]) + " bytes";
+            if (aCuts[c] < dataOffset)
+                Check(!pCut, "a file" + sCut + " does not load" + sType);
+            else if (Check(pCut != NULL, "a file" + sCut + " loads" + sType))
+            {
+                if (bRaw)
+                {
+                    size_t kept = (aCuts[c] - dataOffset) / (c_aCheckDepths[t] / 8);
+                    Check(pWhole && !memcmp(pCut, pWhole, kept * 4), "a file" + sCut + " keeps the pixels before the cut" + sType);
+                }// if
+
+                unsigned char* pLibtarga = (unsigned char*)tga_load(c_asCheckFiles[1], &width, &height, TGA_TRUECOLOR_32);
+                Check(pLibtarga && !memcmp(pCut, pLibtarga, (size_t)c_checkWidth * c_checkHeight * 4),
+                      "a file" + sCut + " loads to tga_load's pixels" + sType);
+                free(pLibtarga);
+            }// else if
+            free(pCut);
+        }// for
+
+        for (int d = 0; d < c_numDamages; ++d)
+        {
+            if (d >= 2 && !bPaletted)
+                continue;               // the colormap damage needs a colormap
+
+            vector<unsigned char> damaged(file);
+            switch (d)
+            {
+                case 0:     damaged[2] = 0;                     break;
+                case 1:     damaged[12] = damaged[13] = 0;      break;
+                case 2:     damaged[7] = 7;                     break;
+                default:    damaged[2] = 3;                     break;
+            }// switch
+            Write_File(c_asCheckFiles[1], &damaged[0], damaged.size());
+            unsigned char* pDamaged = Load_Targa(c_asCheckFiles[1], &width, &height);
+            Check(!pDamaged, string("a file with ") + c_asDamages[d] + " does not load" + sType);
+            free(pDamaged);
+        }// for
+
+        free(pWhole);
+    }// for
+
+    remove(c_asCheckFiles[0]);
+    remove(c_asCheckFiles[1]);
+}// Check_Damaged_Files
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Save the images of Targa_Save in each way of c_asCheckSaves on
+//  c_checkThreads threads.  Each file must load through tga_load, through
+//  Load_Targa on one thread and on c_checkThreads, and a row at a time
+//  through TargaReader, to the pixels of the raw save, which for an opaque
+//  image are the pixels saved.  Saves of an image wider or taller than a targa
+//  holds must fail, and so must a run length encoded row out of order.
+//  Each file is written to the current directory and removed.
+//
+///////////////////////////////////////////////////////////////////////////////
+void CBenchmark::Check_Targa_Saves()
+{
+    int previous = ThreadPool::Threads();
+    size_t bytes = (size_t)c_checkWidth * c_checkHeight * 4;
+    vector<unsigned char> row(c_checkWidth * 4);
+
+    for (int i = 0; i < c_numSaveImages; ++i)
+    {
+        TargaImage* pSource = Make_Save_Image(i, c_checkWidth, c_checkHeight);
+        vector<unsigned char> raw;
+        for (int f = 0; f < c_numCheckSaves; ++f)
+        {
+            string sSave = string(" after a ") + c_asCheckSaves[f] + " save of " + c_asSaveImages[i];
+            ThreadPool::Set_Threads(c_checkThreads);
+            bool bSaved;
+            if (f < 2)
+                bSaved = pSource->Save_Image(c_asCheckFiles[0], f == 1);
+            else
+            {
+                TargaWriter writer(c_asCheckFiles[0], c_checkWidth, c_checkHeight, f == 2, false);
+                bSaved = writer.Opened();
+                for (int r = 0; r < c_checkHeight; ++r)
+                {
+                    int y = (f == 2) ? c_checkHeight - 1 - r : r;
+                    bSaved = writer.Write_Row(y, pSource->data + y * pSource->stride, pSource->opaque) && bSaved;
+                }// for
+                bSaved = writer.Close() && bSaved;
+            }// else
+            ThreadPool::Set_Threads(previous);
+            if (!Check(bSaved, "the file is written" + sSave))
+                continue;
+
+            if (pSource->opaque)
+            {
+                TargaImage* pLoaded = TargaImage::Load_Image((char*)c_asCheckFiles[0]);
+                Check(pLoaded && Same_Pixels(*pLoaded, *pSource), "the file loads to the pixels saved" + sSave);
+                delete pLoaded;
+            }// if
+
+            int width, height;
+            unsigned char* apLoaded[3];
+            for (int l = 0; l < 3; ++l)
+            {
+                ThreadPool::Set_Threads(l == 1 ? 1 : c_checkThreads);
+                apLoaded[l] = l ? Load_Targa(c_asCheckFiles[0], &width, &height)
+                                : (unsigned char*)tga_load(c_asCheckFiles[0], &width, &height, TGA_TRUECOLOR_32);
+            }// for
+            ThreadPool::Set_Threads(previous);
+            if (f == 0 && apLoaded[0])
+                raw.assign(apLoaded[0], apLoaded[0] + bytes);
+            Check(raw.size() == bytes && apLoaded[0] && !memcmp(apLoaded[0], &raw[0], bytes), "tga_load gives the pixels of the raw save" + sSave);
+            for (int l = 1; l < 3; ++l)
+                Check(apLoaded[l] && apLoaded[0] && !memcmp(apLoaded[l], apLoaded[0], bytes),
+                      "Load_Targa gives tga_load's pixels on " + to_string(l == 1 ? 1 : c_checkThreads) + " threads" + sSave);
+
+            TargaReader reader(c_asCheckFiles[0]);
+            bool bRead = reader.Opened() && reader.Width() == c_checkWidth && reader.Height() == c_checkHeight;
+            for (int r = 0; bRead && r < c_checkHeight; ++r)
+            {
+                int y = reader.Top_First() ? c_checkHeight - 1 - r : r;
+                bRead = reader.Read_Row(&row[0]) && apLoaded[0] && !memcmp(&row[0], apLoaded[0] + (size_t)y * c_checkWidth * 4, row.size());
+            }// for
+            Check(bRead && !reader.Read_Row(&row[0]), "TargaReader reads every row as tga_load does" + sSave);
+            reader.Close();
+
+            for (int l = 0; l < 3; ++l)
+                free(apLoaded[l]);
+        }// for
+
+        TargaWriter writer(c_asCheckFiles[0], c_checkWidth, c_checkHeight, true);
+        Check(writer.Opened() && !writer.Write_Row(0, pSource->data, pSource->opaque),
+              string("a run length encoded row out of order is refused for ") + c_asSaveImages[i]);
+        writer.Close();
+        delete pSource;
+    }// for
+
+    for (int r = 0; r < 2; ++r)
+    {
+        string sSide = r ? " run length encoded" : " raw";
+        TargaImage widest(c_maxTargaSide, 1), tooWide(c_maxTargaSide + 1, 1);
+        Check(widest.Save_Image(c_asCheckFiles[0], r != 0), "an image " + to_string(c_maxTargaSide) + " wide saves" + sSide);
+        Check(!tooWide.Save_Image(c_asCheckFiles[0], r != 0), "an image " + to_string(c_maxTargaSide + 1) + " wide does not save" + sSide);
+
+        TargaWriter writer(c_asCheckFiles[0], 1, c_maxTargaSide + 1, r != 0);
+        Check(!writer.Opened(), "a writer " + to_string(c_maxTargaSide + 1) + " tall does not open" + sSide);
+    }// for
+
+    remove(c_asCheckFiles[0]);
+}// Check_Targa_Saves
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Save the images of Targa_Save run length encoded, which writes the
+//  row index, and damage the index each way of c_asIndexDamages.  Load_Targa
+//  must give tga_load's pixels for the whole file on one thread and on
+//  c_checkThreads, as it must for every damaged index, which it either
+//  rejects or finds wrong as it decodes and then decodes a row after
+//  another.  A file cut in its index or footer must load the pixels whole,
+//  and one cut in its pixels must load as tga_load loads it.  Each file is
+//  written to the current directory and removed.
+//
+///////////////////////////////////////////////////////////////////////////////
+void CBenchmark::Check_Row_Index()
+{
+    int previous = ThreadPool::Threads();
+    size_t bytes = (size_t)c_checkWidth * c_checkHeight * 4;
+
+    for (int i = 0; i < c_numSaveImages; ++i)
+    {
+        string sImage = string(" for ") + c_asSaveImages[i];
+        TargaImage* pSource = Make_Save_Image(i, c_checkWidth, c_checkHeight);
+        vector<unsigned char> file;
+        bool bSaved = pSource->Save_Image(c_asCheckFiles[0], true) && Read_File(c_asCheckFiles[0], file);
+        delete pSource;
+
+        // the footer points to the directory, whose one tag points to the index
+        int width, height;
+        unsigned char* pWhole = (unsigned char*)tga_load(c_asCheckFiles[0], &width, &height, TGA_TRUECOLOR_32);
+        size_t directory = bSaved && file.size() > 26 ? Field_32(file, file.size() - 22) : file.size();
+        bool bIndexed = directory + 12 <= file.size() && file[directory] == 1 && file[directory + 2] == 0x49 && file[directory + 3] == 0x52;
+        if (!Check(pWhole && bIndexed, "a run length encoded save has the row index" + sImage))
+        {
+            free(pWhole);
+            continue;
+        }// if
+        size_t index = Field_32(file, directory + 4);
+        size_t count = (Field_32(file, directory + 8) - 4) / 4;
+        size_t entries = index + 4;
+
+        for (int d = -1; d < c_numIndexDamages; ++d)
+        {
+            vector<unsigned char> damaged(file);
+            switch (d)
+            {
+                case -1:                                                                                    break;
+                case 0:     for (size_t e = 1; e < count; ++e)
+                                Put_Field_32(damaged, entries + 4 * e, Field_32(file, entries + 4 * e) + 1);
+                            break;
+                case 1:     Put_Field_32(damaged, entries + 4 * (count - 1), 0xFFFFFFF0);                   break;
+                case 2:     Put_Field_32(damaged, entries + 4, Field_32(file, entries + 8));
+                            Put_Field_32(damaged, entries + 8, Field_32(file, entries + 4));                break;
+                case 3:     Put_Field_32(damaged, entries, 1);                                              break;
+                case 4:     Put_Field_32(damaged, index, 0);                                                break;
+                case 5:     Put_Field_32(damaged, index, 16);                                               break;
+                case 6:     Put_Field_32(damaged, file.size() - 22, file.size() + 100);                     break;
+                default:    damaged[file.size() - 2] = 'X';                                                 break;
+            }// switch
+            Write_File(c_asCheckFiles[1], &damaged[0], damaged.size());
+
+            string sDamage = d < 0 ? " with the row index" : string(" with ") + c_asIndexDamages[d] + " in the row index";
+            for (int t = 0; t < 2; ++t)
+            {
+                ThreadPool::Set_Threads(t ? c_checkThreads : 1);
+                unsigned char* pLoaded = Load_Targa(c_asCheckFiles[1], &width, &height);
+                Check(pLoaded && !memcmp(pLoaded, pWhole, bytes),
+                      "a file" + sDamage + " loads on " + to_string(t ? c_checkThreads : 1) + " threads to tga_load's pixels" + sImage);
+                free(pLoaded);
+            }// for
+            ThreadPool::Set_Threads(previous);
+        }// for
+
+        size_t aCuts[] = { file.size() - 1, directory + 6, entries + 4 * (count / 2), index / 2 };
+        for (int c = 0; c < (int)(sizeof(aCuts) / sizeof(aCuts[0])); ++c)
+        {
+            Write_File(c_asCheckFiles[1], &file[0], aCuts[c]);
+            string sCut = " cut to " + to_string(aCuts[c]) + " of " + to_string(file.size()) + " bytes";
+            unsigned char* pLibtarga = (unsigned char*)tga_load(c_asCheckFiles[1], &width, &height, TGA_TRUECOLOR_32);
+            if (aCuts[c] >= index)
+                Check(pLibtarga && !memcmp(pLibtarga, pWhole, bytes), "tga_load loads every pixel of a file" + sCut + sImage);
+
+            ThreadPool::Set_Threads(c_checkThreads);
+            unsigned char* pLoaded = Load_Targa(c_asCheckFiles[1], &width, &height);
+            ThreadPool::Set_Threads(previous);
+            Check(pLoaded && pLibtarga && !memcmp(pLoaded, pLibtarga, bytes), "a file" + sCut + " loads to tga_load's pixels" + sImage);
+            free(pLoaded);
+            free(pLibtarga);
+        }// for
+
+        free(pWhole);
+    }// for
+
+    remove(c_asCheckFiles[0]);
+    remove(c_asCheckFiles[1]);
+}// Check_Row_Index
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Count a failed check and print what was checked.
+//
+///////////////////////////////////////////////////////////////////////////////
+bool CBenchmark::Check(bool bPassed, const string& sWhat)
+{
+    if (!bPassed)
+    {
+        ++s_failures;
+        cout << "FAILED: " << sWhat << endl;
+    }// if
+    return bPassed;
+}// Check
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Run the op numbered in c_asOpaqueOps on the image.
+//
+///////////////////////////////////////////////////////////////////////////////
+void CBenchmark::Run_Opaque_Op(TargaImage* pImage, int op, TargaImage* pOther, const FilterChain& chain)
+{
+    switch (op)
+    {
+        case 0:     pImage->To_Grayscale();             break;
+        case 1:     pImage->Quant_Uniform();            break;
+        case 2:     pImage->Dither_Cluster();           break;
+        case 3:     pImage->Difference(pOther);         break;
+        case 4:     pImage->Filter_Gaussian();          break;
+        case 5:     pImage->Filter_Gaussian_Sigma(5);   break;
+        case 6:     pImage->Filter_Enhance();           break;
+        default:    pImage->Filter_Chain(chain);        break;
+    }// switch
+}// Run_Opaque_Op
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Run the op numbered in c_asPlanarOps on the image.
+//
+///////////////////////////////////////////////////////////////////////////////
+void CBenchmark::Run_Planar_Op(TargaImage* pImage, int op)
+{
+    switch (op)
+    {
+        case 0:     pImage->To_Grayscale();             break;
+        case 1:     pImage->Quant_Uniform();            break;
+        case 2:     pImage->Filter_Box(2);              break;
+        case 3:     pImage->Filter_Bartlett(2);         break;
+        case 4:     pImage->Filter_Gaussian();          break;
+        default:    pImage->Filter_Gaussian_N(15);      break;
+    }// switch
+}// Run_Planar_Op
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Run the chain numbered in c_asCheckChains on the image one filter at
+//  a time, and add its stages to chain.
+//
+///////////////////////////////////////////////////////////////////////////////
+void CBenchmark::Run_Check_Chain(int c, TargaImage* pImage, FilterChain& chain)
+{
+    switch (c)
+    {
+        case 0:     pImage->Filter_Box(1); pImage->Filter_Box(1);
+                    chain.Add(Kernel::Box(1)); chain.Add(Kernel::Box(1));                                           break;
+        case 1:     pImage->Filter_Bartlett(2); pImage->Filter_Gaussian();
+                    chain.Add(Kernel::Bartlett(2)); chain.Add(Kernel::Gaussian(5));                                 break;
+        case 2:     pImage->Filter_Gaussian_N(7); pImage->Filter_Box(2);
+                    chain.Add(Kernel::Gaussian(7)); chain.Add(Kernel::Box(2));                                      break;
+        case 3:     pImage->Filter_Box(3); pImage->Filter_Gaussian(); pImage->Filter_Gaussian_N(9);
+                    chain.Add(Kernel::Box(3)); chain.Add(Kernel::Gaussian(5)); chain.Add(Kernel::Gaussian(9));      break;
+        case 4:     pImage->Filter_Edge();
+                    chain.Add_Edge();                                                                               break;
+        case 5:     pImage->Filter_Enhance();
+                    chain.Add_Enhance();                                                                            break;
+        case 6:     pImage->Filter_Edge(); pImage->Filter_Gaussian();
+                    chain.Add_Edge(); chain.Add(Kernel::Gaussian(5));                                               break;
+        case 7:     pImage->Filter_Enhance(); pImage->Filter_Box(1);
+                    chain.Add_Enhance(); chain.Add(Kernel::Box(1));                                                 break;
+        case 8:     pImage->Filter_Edge(); pImage->Filter_Enhance();
+                    chain.Add_Edge(); chain.Add_Enhance();                                                          break;
+        case 9:     pImage->Filter_Edge(6);
+                    chain.Add_Edge(6);                                                                              break;
+        case 10:    pImage->Filter_Enhance(10);
+                    chain.Add_Enhance(10);                                                                          break;
+        case 11:    pImage->Filter_Gaussian(); pImage->Filter_Edge(10);
+                    chain.Add(Kernel::Gaussian(5)); chain.Add_Edge(10);                                             break;
+        default:    pImage->Filter_Edge(6, 1.5f); pImage->Filter_Enhance(10, 0.5f);
+                    chain.Add_Edge(6, 1.5f); chain.Add_Enhance(10, 0.5f);                                           break;
+    }// switch
+}// Run_Check_Chain
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Make an opaque image of the given size filled with noise.
+//
+///////////////////////////////////////////////////////////////////////////////
+TargaImage* CBenchmark::Make_Noise_Image(int width, int height)
+{
+    TargaImage* pImage = new TargaImage(width, height);
+
+    for (int y = 0; y < height; ++y)
+    {
+        unsigned char* row = pImage->data + y * pImage->stride;
+        for (int i = 0; i < width * 4; i += 4)
+        {
+            row[i] = rand() % 256;
+            row[i + 1] = rand() % 256;
+            row[i + 2] = rand() % 256;
+            row[i + 3] = 255;
+        }// for
+    }// for
+    pImage->opaque = true;
+
+    return pImage;
+}// Make_Noise_Image
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Make a premultiplied image of the given size filled with noise, alpha
+//  included, so every pixel takes the un-premultiply division.
+//
+///////////////////////////////////////////////////////////////////////////////
+TargaImage* CBenchmark::Make_Translucent_Image(int width, int height)
+{
+    TargaImage* pImage = new TargaImage(width, height);
+
+    for (int y = 0; y < height; ++y)
+    {
+        unsigned char* row = pImage->data + y * pImage->stride;
+        for (int i = 0; i < width * 4; i += 4)
+        {
+            int alpha = rand() % 256;
+            row[i] = rand() % (alpha + 1);
+            row[i + 1] = rand() % (alpha + 1);
+            row[i + 2] = rand() % (alpha + 1);
+            row[i + 3] = alpha;
+        }// for
+    }// for
+
+    return pImage;
+}// Make_Translucent_Image
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Make image number i of c_asSaveImages: noise, translucent noise, or
+//  noise repeated in runs of 8 pixels along each row.
+//
+///////////////////////////////////////////////////////////////////////////////
+TargaImage* CBenchmark::Make_Save_Image(int i, int width, int height)
+{
+    TargaImage* pImage = (i == 1) ? Make_Translucent_Image(width, height) : Make_Noise_Image(width, height);
+    if (i == 2)
+    {
+        for (int y = 0; y < height; ++y)
+        {
+            unsigned char* row = pImage->data + y * pImage->stride;
+            for (int x = 1; x < width; ++x)
+                if (x % 8)
+                    memcpy(row + x * 4, row + x * 4 - 4, 4);
+        }// for
+    }// if
+
+    return pImage;
+}// Make_Save_Image
@@ -0,0 +1,281 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Benchmark.h
+//
+//      Timing runs of the image operations on synthetic images, and checks
+//  that the faster ways of doing each give the same pixels as the plain
+//  one.  Run from the command line with the -bench switch, or the checks
+//  alone with the -check switch.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+
+#ifndef _C_BENCHMARK
+#define _C_BENCHMARK
+
+#include <string>
+
+class TargaImage;
+class FilterChain;
+
+class CBenchmark
+{
+    // methods
+    public:
+        ///////////////////////////////////////////////////////////////////////////////
+        //
+        //      Run every benchmark, then Run_Checks, and print the results to
+        //  standard out.  False if any check failed.
+        //
+        ///////////////////////////////////////////////////////////////////////////////
+        static bool Run_All();
+
+        ///////////////////////////////////////////////////////////////////////////////
+        //
+        //      Run every check on small images, untimed, and print each failure
+        //  and a summary to standard out.  False if any check failed.
+        //
+        ///////////////////////////////////////////////////////////////////////////////
+        static bool Run_Checks();
+
+        ///////////////////////////////////////////////////////////////////////////////
+        //
+        //      Check Unpremultiply_Row at every instruction set level against the
+        //  exact integer division for every channel and alpha pair.
+        //
+        ///////////////////////////////////////////////////////////////////////////////
+        static void Check_Unpremultiply();
+
+        ///////////////////////////////////////////////////////////////////////////////
+        //
+        //      Check that converting to planar and back keeps every pixel, and
+        //  that the ops with planar versions give the interleaved output.
+        //
+        ///////////////////////////////////////////////////////////////////////////////
+        static void Check_Layouts();
+
+        ///////////////////////////////////////////////////////////////////////////////
+        //
+        //      Check that converting bytes to float or 16 bits and back keeps
+        //  every pixel, and that raw 16-bit files load to what was saved.
+        //
+        ///////////////////////////////////////////////////////////////////////////////
+        static void Check_Formats();
+
+        ///////////////////////////////////////////////////////////////////////////////
+        //
+        //      Check that chains fused by FilterChain, edge and enhance stages
+        //  included, give the image the same filters give one at a time, on
+        //  opaque and translucent images.
+        //
+        ///////////////////////////////////////////////////////////////////////////////
+        static void Check_Chains();
+
+        ///////////////////////////////////////////////////////////////////////////////
+        //
+        //      Check that Filter_Edge and Filter_Enhance give the same image on
+        //  one thread and on several, in every format.
+        //
+        ///////////////////////////////////////////////////////////////////////////////
+        static void Check_Unsharp_Mask();
+
+        ///////////////////////////////////////////////////////////////////////////////
+        //
+        //      Check that Gaussian rows too long for a double to hold their
+        //  binomial coefficients still come out as the rescaled binomial row.
+        //
+        ///////////////////////////////////////////////////////////////////////////////
+        static void Check_Long_Gaussians();
+
+        ///////////////////////////////////////////////////////////////////////////////
+        //
+        //      Check that kernels larger than the largest FFT tile that fits
+        //  cache convolve by FFT and as planned to what direct convolution gives.
+        //
+        ///////////////////////////////////////////////////////////////////////////////
+        static void Check_Large_Kernels();
+
+        ///////////////////////////////////////////////////////////////////////////////
+        //
+        //      Check that targas cut short or with a damaged header load as far
+        //  as they go or fail cleanly.
+        //
+        ///////////////////////////////////////////////////////////////////////////////
+        static void Check_Damaged_Files();
+
+        ///////////////////////////////////////////////////////////////////////////////
+        //
+        //      Check that raw and run length encoded saves, whole and a row at a
+        //  time, load to the pixels saved every way a targa is read, and that
+        //  saves too big for a targa fail.
+        //
+        ///////////////////////////////////////////////////////////////////////////////
+        static void Check_Targa_Saves();
+
+        ///////////////////////////////////////////////////////////////////////////////
+        //
+        //      Check that run length encoded files load through the row index as
+        //  they load without it, on one thread and several, and that a damaged
+        //  index or a file cut short loads as libtarga loads it.
+        //
+        ///////////////////////////////////////////////////////////////////////////////
+        static void Check_Row_Index();
+
+        ///////////////////////////////////////////////////////////////////////////////
+        //
+        //      Time Filter_Gaussian_N for a range of N and report MPix/s.
+        //
+        ///////////////////////////////////////////////////////////////////////////////
+        static void Gaussian_N();
+
+        ///////////////////////////////////////////////////////////////////////////////
+        //
+        //      Time Filter_Box and Filter_Bartlett for a range of radii.
+        //
+        ///////////////////////////////////////////////////////////////////////////////
+        static void Box_Bartlett();
+
+        ///////////////////////////////////////////////////////////////////////////////
+        //
+        //      Time Filter_Gaussian_Sigma and report its error against the exact
+        //  binomial Filter_Gaussian_N of the same standard deviation.
+        //
+        ///////////////////////////////////////////////////////////////////////////////
+        static void Gaussian_Sigma();
+
+        ///////////////////////////////////////////////////////////////////////////////
+        //
+        //      Time the direct and FFT methods of Convolve on kernels that are not
+        //  separable, and show which method the planner picks.
+        //
+        ///////////////////////////////////////////////////////////////////////////////
+        static void Convolve_Methods();
+
+        ///////////////////////////////////////////////////////////////////////////////
+        //
+        //      Time the small filters at every instruction set level the processor
+        //  supports, and check that every level gives the scalar output.
+        //
+        ///////////////////////////////////////////////////////////////////////////////
+        static void Simd_Levels();
+
+        ///////////////////////////////////////////////////////////////////////////////
+        //
+        //      Time the filters on a 24 megapixel image at 1, 2, 4 ... threads up
+        //  to one per processor, and check every count gives the 1 thread output.
+        //
+        ///////////////////////////////////////////////////////////////////////////////
+        static void Thread_Scaling();
+
+        ///////////////////////////////////////////////////////////////////////////////
+        //
+        //      Time chains of neighborhood filters run one filter at a time and
+        //  fused by FilterChain, and check both give the same image.
+        //
+        ///////////////////////////////////////////////////////////////////////////////
+        static void Filter_Chains();
+
+        ///////////////////////////////////////////////////////////////////////////////
+        //
+        //      Time un-premultiplying rows by float division and by the reciprocal
+        //  table at every instruction set level, and Filter_Gaussian on a
+        //  translucent image.
+        //
+        ///////////////////////////////////////////////////////////////////////////////
+        static void Unpremultiply();
+
+        ///////////////////////////////////////////////////////////////////////////////
+        //
+        //      Time the ops that un-premultiply on an opaque image with and without
+        //  the opaque flag, and report which leave the flag set for the next op.
+        //
+        ///////////////////////////////////////////////////////////////////////////////
+        static void Opaque_Fast_Path();
+
+        ///////////////////////////////////////////////////////////////////////////////
+        //
+        //      Time the ops that have planar versions on interleaved and planar
+        //  images, and the conversions between the two layouts.
+        //
+        ///////////////////////////////////////////////////////////////////////////////
+        static void Planar_Layout();
+
+        ///////////////////////////////////////////////////////////////////////////////
+        //
+        //      Run growing numbers of 3x3 Gaussian passes in the byte, float and
+        //  16-bit formats, time them and report how far each drifts from the
+        //  one larger Gaussian the passes add up to.
+        //
+        ///////////////////////////////////////////////////////////////////////////////
+        static void Float_Pipeline();
+
+        ///////////////////////////////////////////////////////////////////////////////
+        //
+        //      Time saving and loading a 16-bit image as a targa and as a raw
+        //  16-bit file.
+        //
+        ///////////////////////////////////////////////////////////////////////////////
+        static void Raw_16_IO();
+
+        ///////////////////////////////////////////////////////////////////////////////
+        //
+        //      Count the heap allocations of ops run again on images of the same
+        //  size, which the scratch arenas should bring to none.
+        //
+        ///////////////////////////////////////////////////////////////////////////////
+        static void Scratch_Reuse();
+
+        ///////////////////////////////////////////////////////////////////////////////
+        //
+        //      Time loading each kind of targa with libtarga and with the row
+        //  decoder of Load_Targa, and check both give the same pixels.
+        //
+        ///////////////////////////////////////////////////////////////////////////////
+        static void Targa_Load();
+
+        ///////////////////////////////////////////////////////////////////////////////
+        //
+        //      Time saving raw and run length encoded targas, the latter on one
+        //  and on every thread, and check both load to the same pixels.
+        //
+        ///////////////////////////////////////////////////////////////////////////////
+        static void Targa_Save();
+
+        ///////////////////////////////////////////////////////////////////////////////
+        //
+        //      Time loading run length encoded targas without the row index and
+        //  with it, on one and on every thread, and check all give the same
+        //  pixels.
+        //
+        ///////////////////////////////////////////////////////////////////////////////
+        static void Rle_Index();
+
+    private:
+        // count a failed check and print what it was; returns bPassed
+        static bool Check(bool bPassed, const std::string& sWhat);
+
+        // make an opaque image of the given size filled with noise
+        static TargaImage* Make_Noise_Image(int width, int height);
+
+        // make a premultiplied image of the given size with noise in every channel
+        static TargaImage* Make_Translucent_Image(int width, int height);
+
+        // make image number i of c_asSaveImages at the given size
+        static TargaImage* Make_Save_Image(int i, int width, int height);
+
+        // run op number op of Opaque_Fast_Path on the image
+        static void Run_Opaque_Op(TargaImage* pImage, int op, TargaImage* pOther, const FilterChain& chain);
+
+        // run op number op of Planar_Layout on the image
+        static void Run_Planar_Op(TargaImage* pImage, int op);
+
+        // run chain number c of Check_Chains on the image a filter at a time,
+        // and add its stages to chain
+        static void Run_Check_Chain(int c, TargaImage* pImage, FilterChain& chain);
+
+    // members
+    private:
+        static int  s_failures;                 // checks failed so far
+};// CBenchmark
+
+#endif // _C_BENCHMARK
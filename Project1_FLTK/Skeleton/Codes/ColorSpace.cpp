@@ -0,0 +1,174 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+//      ColorSpace.cpp
+//
+//      The sRGB tables.  The curve is stored as the linear value of each of
+//  the 256 codes and taken as straight between them, so a fractional code
+//  decodes by interpolating two entries and a value encodes by finding the
+//  two entries around it.  A coarse table indexed by the value gives the
+//  first entry to try, which is at most a couple of entries short.
+//
+//      Premultiplied pixels are converted through their straight colors as
+//  fractional codes, 255 * c / alpha, without rounding them to whole codes,
+//  so the premultiplied bytes of any pixel come back unchanged.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include "Globals.h"
+#include "ColorSpace.h"
+#include <math.h>
+
+// entries of the coarse encoding table, over linear values 0 to 1
+const int c_encodeBuckets = 4096;
+
+static struct SrgbTables
+{
+	SrgbTables()
+	{
+		for (int k = 0; k < 256; k++)
+		{
+			double c = k / 255.0;
+			decode[k] = (float)((c <= 0.04045) ? c / 12.92 : pow((c + 0.055) / 1.055, 2.4));
+		}
+
+		int code = 0;
+		for (int b = 0; b <= c_encodeBuckets; b++)
+		{
+			float value = (float)b / c_encodeBuckets;
+			while (code < 255 && value >= decode[code + 1])
+				code++;
+			first[b] = (unsigned char)code;
+		}
+	}
+
+	float			decode[256];                    // linear value of each code
+	unsigned char	first[c_encodeBuckets + 1];     // whole code at or below the value b / c_encodeBuckets
+} s_srgb;
+
+
+// the linear value of a fractional code from 0 to 255
+static inline float Decode(float code)
+{
+	int k = (int)code;
+	if (k >= 255)
+		return 1.0f;
+	return s_srgb.decode[k] + (code - k) * (s_srgb.decode[k + 1] - s_srgb.decode[k]);
+}// Decode
+
+// the fractional code, 0 to 255, of a linear value, which is clamped
+static inline float Encode(float value)
+{
+	if (!(value > 0))
+		return 0.0f;
+	if (value >= 1)
+		return 255.0f;
+
+	int k = s_srgb.first[(int)(value * c_encodeBuckets)];
+	while (k < 255 && value >= s_srgb.decode[k + 1])
+		k++;
+	if (k == 255)
+		return 255.0f;
+	return k + (value - s_srgb.decode[k]) / (s_srgb.decode[k + 1] - s_srgb.decode[k]);
+}// Encode
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      The linear light value of an sRGB code.
+//
+///////////////////////////////////////////////////////////////////////////////
+float Srgb_To_Linear(unsigned char code)
+{
+	return s_srgb.decode[code];
+}// Srgb_To_Linear
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      The nearest sRGB code to a linear light value.  Values outside 0 to 1,
+//  and NaN, are clamped.
+//
+///////////////////////////////////////////////////////////////////////////////
+unsigned char Linear_To_Srgb(float value)
+{
+	return (unsigned char)(Encode(value) + 0.5f);
+}// Linear_To_Srgb
+
+
+// Linearize_Row and Delinearize_Row for pixels whose channels run 0 to
+// maximum, 255 for bytes and 65535 for 16 bits.
+template <class T>
+static void Linearize(const T* rgba, int n, unsigned int maximum, float* linear)
+{
+	for (int p = 0; p < n; p++, rgba += 4, linear += 4)
+	{
+		float a = (float)rgba[3] / maximum;
+		float scale = rgba[3] ? 255.0f / rgba[3] : 0.0f;
+		for (int k = 0; k < 3; k++)
+			linear[k] = Decode(Min(rgba[k] * scale, 255.0f)) * a;
+		linear[3] = a;
+	}
+}// Linearize
+
+template <class T>
+static void Delinearize(const float* linear, int n, unsigned int maximum, T* rgba)
+{
+	for (int p = 0; p < n; p++, linear += 4, rgba += 4)
+	{
+		float a = Min(linear[3], 1.0f);
+		unsigned int alpha = (a > 0) ? (unsigned int)(a * maximum + 0.5f) : 0;
+		if (alpha == 0)
+		{
+			rgba[0] = rgba[1] = rgba[2] = rgba[3] = 0;
+			continue;
+		}
+
+		for (int k = 0; k < 3; k++)
+			rgba[k] = (T)(Encode(linear[k] / a) * alpha / 255 + 0.5f);
+		rgba[3] = (T)alpha;
+	}
+}// Delinearize
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Premultiplied sRGB to premultiplied linear light: each channel's
+//  straight code is decoded and multiplied by the alpha again.
+//
+///////////////////////////////////////////////////////////////////////////////
+void Linearize_Row(const unsigned char* rgba, int n, float* linear)
+{
+	Linearize(rgba, n, 255, linear);
+}// Linearize_Row
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Premultiplied linear light to premultiplied sRGB, the inverse of
+//  Linearize_Row.  Alpha rounds to the nearest step of 1 / 255, and each
+//  straight color is encoded, multiplied by that alpha and rounded to the
+//  nearest byte.
+//
+///////////////////////////////////////////////////////////////////////////////
+void Delinearize_Row(const float* linear, int n, unsigned char* rgba)
+{
+	Delinearize(linear, n, 255, rgba);
+}// Delinearize_Row
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Linearize_Row and Delinearize_Row for 16-bit pixels, whose straight
+//  colors are sRGB codes scaled by 257.
+//
+///////////////////////////////////////////////////////////////////////////////
+void Linearize_Row_16(const unsigned short* rgba, int n, float* linear)
+{
+	Linearize(rgba, n, 65535, linear);
+}// Linearize_Row_16
+
+
+void Delinearize_Row_16(const float* linear, int n, unsigned short* rgba)
+{
+	Delinearize(linear, n, 65535, rgba);
+}// Delinearize_Row_16
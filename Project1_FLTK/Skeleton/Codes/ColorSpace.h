@@ -0,0 +1,33 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+//      ColorSpace.h
+//
+//      Conversions between the 8 and 16-bit sRGB pixels of TargaImage's
+//  byte and 16-bit formats and the linear light floats of its float format.
+//  Both directions go through tables built once, so the conversions cost a
+//  lookup per channel.
+//  A pixel converted to linear light and back comes out unchanged.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef _COLOR_SPACE_H_
+#define _COLOR_SPACE_H_
+
+// the linear light value, 0 to 1, of an sRGB code
+float Srgb_To_Linear(unsigned char code);
+
+// the sRGB code nearest to a linear light value, which is clamped to 0 to 1
+unsigned char Linear_To_Srgb(float value);
+
+// n premultiplied sRGB RGBA pixels to premultiplied linear RGBA, alpha 0 to 1
+void Linearize_Row(const unsigned char* rgba, int n, float* linear);
+
+// n premultiplied linear RGBA pixels to premultiplied sRGB RGBA, rounding
+// each channel once, to the nearest byte
+void Delinearize_Row(const float* linear, int n, unsigned char* rgba);
+
+// the same for 16-bit pixels, whose channels run 0 to 65535
+void Linearize_Row_16(const unsigned short* rgba, int n, float* linear);
+void Delinearize_Row_16(const float* linear, int n, unsigned short* rgba);
+
+#endif
@@ -0,0 +1,95 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+//      FFT.cpp
+//
+//      Implementation of FFTPlan methods.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include "Globals.h"
+#include "FFT.h"
+#include <math.h>
+
+using namespace std;
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Constructor.  Build the twiddle factors and the bit reversal
+//  permutation for transforms of n points.
+//
+///////////////////////////////////////////////////////////////////////////////
+FFTPlan::FFTPlan(int n) : size(n), twiddles(n / 2), reversed(n)
+{
+	const double twoPi = 6.283185307179586;
+	for (int k = 0; k < n / 2; k++)
+		twiddles[k] = complex<float>((float)cos(twoPi * k / n), (float)-sin(twoPi * k / n));
+
+	int bits = 0;
+	while ((1 << bits) < n)
+		bits++;
+	for (int i = 0; i < n; i++)
+	{
+		int r = 0;
+		for (int b = 0; b < bits; b++)
+			r |= ((i >> b) & 1) << (bits - 1 - b);
+		reversed[i] = r;
+	}
+}// FFTPlan
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Transform size contiguous values in place.  The inverse transform is
+//  not divided by size.
+//
+///////////////////////////////////////////////////////////////////////////////
+void FFTPlan::Transform(complex<float>* v, bool inverse) const
+{
+	for (int i = 0; i < size; i++)
+	{
+		if (i < reversed[i])
+			swap(v[i], v[reversed[i]]);
+	}
+
+	for (int half = 1; half < size; half *= 2)
+	{
+		int step = size / (2 * half);
+		for (int start = 0; start < size; start += 2 * half)
+		{
+			for (int k = 0; k < half; k++)
+			{
+				complex<float> w = twiddles[k * step];
+				if (inverse)
+					w = conj(w);
+				complex<float> odd = v[start + half + k] * w;
+				v[start + half + k] = v[start + k] - odd;
+				v[start + k] += odd;
+			}
+		}
+	}
+}// Transform
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Transform a size x size row major array in place, every row and then
+//  every column.  Columns are gathered into a local buffer so the
+//  butterflies always run on adjacent memory.
+//
+///////////////////////////////////////////////////////////////////////////////
+void FFTPlan::Transform_2D(complex<float>* values, bool inverse) const
+{
+	for (int i = 0; i < size; i++)
+		Transform(values + i * size, inverse);
+
+	vector<complex<float> > column(size);
+	for (int j = 0; j < size; j++)
+	{
+		for (int i = 0; i < size; i++)
+			column[i] = values[i * size + j];
+		Transform(&column[0], inverse);
+		for (int i = 0; i < size; i++)
+			values[i * size + j] = column[i];
+	}
+}// Transform_2D
@@ -0,0 +1,38 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+//      FFT.h
+//
+//      Radix-2 fast Fourier transform of a fixed power of two size, with its
+//  twiddle factors and bit reversal table computed once up front.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef _FFT_H_
+#define _FFT_H_
+
+#include <complex>
+#include <vector>
+
+class FFTPlan
+{
+	// methods
+public:
+	FFTPlan(int n);                 // n must be a power of two
+
+	int Size() const { return size; }
+
+	// in place transform of size contiguous values, the inverse is unscaled
+	void Transform(std::complex<float>* values, bool inverse) const;
+
+	// in place transform of a size x size row major array, rows then columns.
+	// Safe to call from several threads at once.
+	void Transform_2D(std::complex<float>* values, bool inverse) const;
+
+	// members
+private:
+	int		size;
+	std::vector<std::complex<float> > twiddles;    // exp(-2 pi i k / size) for k < size / 2
+	std::vector<int> reversed;                      // bit reversed index of each position
+};
+
+#endif
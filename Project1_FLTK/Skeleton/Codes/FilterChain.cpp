@@ -0,0 +1,393 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+//      FilterChain.cpp
+//
+//      Implementation of FilterChain methods.  A tile and its halo are
+//  un-premultiplied into an RGB buffer, every stage convolves one buffer
+//  into the next, shrinking the region by the stage's radius, and the last
+//  stage leaves exactly the tile to write out.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include "Globals.h"
+#include "FilterChain.h"
+#include "Simd.h"
+#include "ThreadPool.h"
+#include "Scratch.h"
+#include <limits.h>
+#include <memory.h>
+#include <math.h>
+
+using namespace std;
+
+// constants
+const int           c_maxChainHalo = 32;            // largest halo on either axis, wider chains run one filter at a time
+const int           c_chainCacheBytes = 256 * 1024; // working set of one tile, about an L2 cache
+// bytes of working set per pixel of a tile and its halo: the in, next and
+// blur buffers of Run, 3 channels of bytes each, and the row sums of a
+// separable pass, 3 channels of int (of long long for kernels too big for
+// int, which then get tiles somewhat over the cache)
+const int           c_chainBytesPerPixel = 3 * 3 * (int)sizeof(unsigned char) + 3 * (int)sizeof(int);
+const int           c_minChainTile = 32;            // smallest tile, however wide the halo
+
+
+// Largest magnitude a sum over 8-bit pixels can reach in either pass of the
+// kernel.
+static long long Sum_Bound(const Kernel& kernel)
+{
+	long long bound = 0;
+	if (kernel.Is_Separable())
+	{
+		long long rowTotal = 0, columnTotal = 0;
+		for (int u = 0; u < kernel.width; u++)
+			rowTotal += abs(kernel.row[u]);
+		for (int v = 0; v < kernel.height; v++)
+			columnTotal += abs(kernel.column[v]);
+		bound = rowTotal * columnTotal;
+	}
+	else
+	{
+		for (size_t t = 0; t < kernel.taps.size(); t++)
+			bound += abs(kernel.taps[t]);
+	}
+	return 255 * bound;
+}// Sum_Bound
+
+
+// Convolves an RGB region of (outWidth + kernel.width - 1) x (outHeight +
+// kernel.height - 1) pixels into outWidth x outHeight pixels, with sums of
+// type Sum.  Separable kernels take a row pass over the whole region first.
+template <class Sum>
+static void Convolve_Tile(const Kernel& kernel, const unsigned char* in, int outWidth, int outHeight, unsigned char* out)
+{
+	int inWidth = outWidth + kernel.width - 1;
+	int inHeight = outHeight + kernel.height - 1;
+	int rowSize = outWidth * 3;
+
+	Scratch scratch;
+	Sum* sums = scratch.New<Sum>((kernel.Is_Separable() ? inHeight : 0) * rowSize);
+	Sum* total = scratch.New<Sum>(rowSize);
+	if (kernel.Is_Separable())
+	{
+		for (int r = 0; r < inHeight; r++)
+		{
+			Sum* sum = sums + r * rowSize;
+			memset(sum, 0, rowSize * sizeof(Sum));
+			for (int u = 0; u < kernel.width; u++)
+			{
+				Sum weight = kernel.row[u];
+				const unsigned char* line = in + (r * inWidth + u) * 3;
+				for (int m = 0; m < rowSize; m++)
+					sum[m] += line[m] * weight;
+			}
+		}
+	}
+
+	for (int y = 0; y < outHeight; y++)
+	{
+		memset(total, 0, rowSize * sizeof(Sum));
+		if (kernel.Is_Separable())
+		{
+			for (int v = 0; v < kernel.height; v++)
+			{
+				Sum weight = kernel.column[v];
+				const Sum* sum = sums + (y + v) * rowSize;
+				for (int m = 0; m < rowSize; m++)
+					total[m] += sum[m] * weight;
+			}
+		}
+		else
+		{
+			for (int v = 0; v < kernel.height; v++)
+			{
+				for (int u = 0; u < kernel.width; u++)
+				{
+					Sum weight = kernel.taps[v * kernel.width + u];
+					if (!weight)
+						continue;
+
+					const unsigned char* line = in + ((y + v) * inWidth + u) * 3;
+					for (int m = 0; m < rowSize; m++)
+						total[m] += line[m] * weight;
+				}
+			}
+		}
+
+		unsigned char* row = out + y * rowSize;
+		for (int m = 0; m < rowSize; m++)
+		{
+			long long val = total[m] / kernel.divisor;
+			row[m] = (unsigned char)(val < 0 ? 0 : (val > 255 ? 255 : val));
+		}
+	}
+}// Convolve_Tile
+
+
+// Convolve_Tile for kernels whose sums fit 16 bits, through the vector
+// multiply-adds in Simd.h.
+static void Convolve_Tile_16(const Kernel& kernel, const unsigned char* in, int outWidth, int outHeight, unsigned char* out)
+{
+	int inWidth = outWidth + kernel.width - 1;
+	int inHeight = outHeight + kernel.height - 1;
+	int rowSize = outWidth * 3;
+
+	Scratch scratch;
+	unsigned short* sums = scratch.New<unsigned short>((kernel.Is_Separable() ? inHeight : 0) * rowSize);
+	unsigned short* total = scratch.New<unsigned short>(rowSize);
+	if (kernel.Is_Separable())
+	{
+		for (int r = 0; r < inHeight; r++)
+		{
+			unsigned short* sum = sums + r * rowSize;
+			memset(sum, 0, rowSize * sizeof(unsigned short));
+			for (int u = 0; u < kernel.width; u++)
+			{
+				if (kernel.row[u])
+					Multiply_Add_U8(in + (r * inWidth + u) * 3, rowSize, (unsigned short)kernel.row[u], sum);
+			}
+		}
+	}
+
+	for (int y = 0; y < outHeight; y++)
+	{
+		memset(total, 0, rowSize * sizeof(unsigned short));
+		for (int v = 0; v < kernel.height; v++)
+		{
+			if (kernel.Is_Separable())
+			{
+				if (kernel.column[v])
+					Multiply_Add_U16(sums + (y + v) * rowSize, rowSize, (unsigned short)kernel.column[v], total);
+				continue;
+			}
+
+			for (int u = 0; u < kernel.width; u++)
+			{
+				int weight = kernel.taps[v * kernel.width + u];
+				if (weight)
+					Multiply_Add_U8(in + ((y + v) * inWidth + u) * 3, rowSize, (unsigned short)weight, total);
+			}
+		}
+		Divide_U16(total, rowSize, (unsigned int)kernel.divisor, out + y * rowSize);
+	}
+}// Convolve_Tile_16
+
+
+// Picks the narrowest sums that hold every total of the kernel.
+static void Convolve_Tile(const Kernel& kernel, const unsigned char* in, int outWidth, int outHeight, unsigned char* out)
+{
+	if (kernel.Fits_16_Bits())
+		Convolve_Tile_16(kernel, in, outWidth, outHeight, out);
+	else if (Sum_Bound(kernel) <= INT_MAX)
+		Convolve_Tile<int>(kernel, in, outWidth, outHeight, out);
+	else
+		Convolve_Tile<long long>(kernel, in, outWidth, outHeight, out);
+}// Convolve_Tile
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Return the fixed point multiplier for an edge amount.
+//
+///////////////////////////////////////////////////////////////////////////////
+int Amount_Scale(float amount)
+{
+	return (int)(Min(amount, 256.0f) * (1 << c_amountShift) + 0.5f);
+}// Amount_Scale
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Constructor.  The chain starts empty.
+//
+///////////////////////////////////////////////////////////////////////////////
+FilterChain::FilterChain() : hHalo(0), vHalo(0)
+{}// FilterChain
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Return whether a stage of the given radii can join the chain without
+//  the halo growing past c_maxChainHalo.
+//
+///////////////////////////////////////////////////////////////////////////////
+bool FilterChain::Fits(int hRadius, int vRadius) const
+{
+	return hRadius >= 0 && vRadius >= 0 && hHalo + hRadius <= c_maxChainHalo && vHalo + vRadius <= c_maxChainHalo;
+}// Fits
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Append a convolution with the kernel, with a black border.  Return
+//  false if it does not fit.
+//
+///////////////////////////////////////////////////////////////////////////////
+bool FilterChain::Add(const Kernel& kernel)
+{
+	return Add(STAGE_KERNEL, kernel, 0);
+}// Add
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Append the edges of Filter_Edge: amount times what the image has
+//  above its Gaussian blur of the given radius.
+//
+///////////////////////////////////////////////////////////////////////////////
+bool FilterChain::Add_Edge(int radius, float amount)
+{
+	return radius >= 1 && amount >= 0 && Fits(radius, radius) && Add(STAGE_EDGE, Kernel::Gaussian(2 * radius + 1), Amount_Scale(amount));
+}// Add_Edge
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Append the sharpening of Filter_Enhance: the image plus amount times
+//  its edges.
+//
+///////////////////////////////////////////////////////////////////////////////
+bool FilterChain::Add_Enhance(int radius, float amount)
+{
+	return radius >= 1 && amount >= 0 && Fits(radius, radius) && Add(STAGE_ENHANCE, Kernel::Gaussian(2 * radius + 1), Amount_Scale(amount));
+}// Add_Enhance
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Append a stage, growing the halo by the kernel radius.
+//
+///////////////////////////////////////////////////////////////////////////////
+bool FilterChain::Add(EChainStage type, const Kernel& kernel, int scale)
+{
+	if (!Fits(kernel.width / 2, kernel.height / 2))
+		return false;
+
+	Stage stage = { type, kernel, scale };
+	stages.push_back(stage);
+	hHalo += kernel.width / 2;
+	vHalo += kernel.height / 2;
+	return true;
+}// Add
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Run the chain over the premultiplied RGBA image and write the opaque
+//  result to out, a view of the same size that does not overlap it.  Tiles
+//  are handed out to the thread pool; each thread keeps its buffers in its
+//  scratch arena.  After every stage but the last, the pixels of the region
+//  that fall outside the image are cleared, as the next filter would see
+//  them as black.
+//
+///////////////////////////////////////////////////////////////////////////////
+void FilterChain::Run(const ImageView& image, const ImageView& out, bool opaque) const
+{
+	int width = image.width, height = image.height;
+	int side = (int)sqrt((double)c_chainCacheBytes / c_chainBytesPerPixel);
+	int tileSize = Max(side - 2 * Max(hHalo, vHalo), c_minChainTile);
+	int tilesAcross = (width + tileSize - 1) / tileSize;
+	int tilesDown = (height + tileSize - 1) / tileSize;
+	int regionSize = (tileSize + 2 * hHalo) * (tileSize + 2 * vHalo) * 3;
+
+	ThreadPool::Run_Bands(tilesAcross * tilesDown, [&](int begin, int end)
+	{
+		Scratch scratch;
+		unsigned char* in = scratch.New<unsigned char>(regionSize);
+		unsigned char* next = scratch.New<unsigned char>(regionSize);
+		unsigned char* blur = scratch.New<unsigned char>(regionSize);
+
+		for (int t = begin; t < end; t++)
+		{
+			int x0 = (t % tilesAcross) * tileSize;
+			int y0 = (t / tilesAcross) * tileSize;
+			int tileWidth = Min(tileSize, width - x0);
+			int tileHeight = Min(tileSize, height - y0);
+
+			//the tile and its halo, black outside the image
+			int regionWidth = tileWidth + 2 * hHalo;
+			int regionHeight = tileHeight + 2 * vHalo;
+			for (int r = 0; r < regionHeight; r++)
+			{
+				int i = y0 - vHalo + r;
+				unsigned char* line = in + r * regionWidth * 3;
+				if (i < 0 || i >= height)
+				{
+					memset(line, 0, regionWidth * 3);
+					continue;
+				}
+
+				int left = Max(x0 - hHalo, 0), right = Min(x0 + tileWidth + hHalo, width);
+				int skip = left - (x0 - hHalo);
+				memset(line, 0, skip * 3);
+				if (opaque)
+					Strip_Alpha_Row(image.Row(i) + left * 4, right - left, line + skip * 3);
+				else
+					Unpremultiply_Row(image.Row(i) + left * 4, right - left, line + skip * 3);
+				memset(line + (skip + right - left) * 3, 0, (regionWidth - skip - (right - left)) * 3);
+			}
+
+			int hRest = hHalo, vRest = vHalo;
+			for (size_t s = 0; s < stages.size(); s++)
+			{
+				const Stage& stage = stages[s];
+				int hRadius = stage.kernel.width / 2;
+				int vRadius = stage.kernel.height / 2;
+				hRest -= hRadius;
+				vRest -= vRadius;
+				int outWidth = tileWidth + 2 * hRest;
+				int outHeight = tileHeight + 2 * vRest;
+
+				if (stage.type == STAGE_KERNEL)
+					Convolve_Tile(stage.kernel, in, outWidth, outHeight, next);
+				else
+				{
+					Convolve_Tile(stage.kernel, in, outWidth, outHeight, blur);
+					for (int y = 0; y < outHeight; y++)
+					{
+						const unsigned char* center = in + ((y + vRadius) * (outWidth + 2 * hRadius) + hRadius) * 3;
+						const unsigned char* blurred = blur + y * outWidth * 3;
+						unsigned char* row = next + y * outWidth * 3;
+						for (int m = 0; m < outWidth * 3; m++)
+						{
+							int edge = (Max(center[m] - blurred[m], 0) * stage.scale) >> c_amountShift;
+							row[m] = (unsigned char)Min((stage.type == STAGE_EDGE) ? edge : center[m] + edge, 255);
+						}
+					}
+				}
+
+				if (s + 1 < stages.size())
+				{
+					for (int y = 0; y < outHeight; y++)
+					{
+						int i = y0 - vRest + y;
+						unsigned char* row = next + y * outWidth * 3;
+						if (i < 0 || i >= height)
+						{
+							memset(row, 0, outWidth * 3);
+							continue;
+						}
+
+						int left = Min(Max(hRest - x0, 0), outWidth);
+						int right = Min(Max(x0 - hRest + outWidth - width, 0), outWidth);
+						memset(row, 0, left * 3);
+						memset(row + (outWidth - right) * 3, 0, right * 3);
+					}
+				}
+				swap(in, next);
+			}
+
+			for (int y = 0; y < tileHeight; y++)
+			{
+				const unsigned char* rgb = in + y * tileWidth * 3;
+				unsigned char* pixel = out.Row(y0 + y) + x0 * 4;
+				for (int x = 0; x < tileWidth; x++, rgb += 3, pixel += 4)
+				{
+					pixel[0] = rgb[0];
+					pixel[1] = rgb[1];
+					pixel[2] = rgb[2];
+					pixel[3] = 255;
+				}
+			}
+		}
+	});
+}// Run
@@ -0,0 +1,69 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+//      FilterChain.h
+//
+//      A run of neighborhood filters applied tile by tile.  Each tile is
+//  read with the halo the whole chain needs, and every stage runs on it
+//  while it is still in cache, so the image crosses memory once per chain
+//  instead of once per filter.  Pixels outside the image are black at every
+//  stage, so the result matches running the filters one after another.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef _FILTER_CHAIN_H_
+#define _FILTER_CHAIN_H_
+
+#include <vector>
+#include "Kernel.h"
+#include "ImageView.h"
+
+// edge amounts are applied in fixed point with this many fraction bits, so
+// an amount of 1 is exact
+const int c_amountShift = 8;
+
+// the fixed point multiplier for an edge amount; past 255 every edge saturates
+int Amount_Scale(float amount);
+
+// what a stage of the chain does
+enum EChainStage
+{
+	STAGE_KERNEL,               // convolve with the kernel
+	STAGE_EDGE,                 // the part of the image above its blur by the kernel
+	STAGE_ENHANCE               // the image plus its edges
+};
+
+class FilterChain
+{
+	// methods
+public:
+	FilterChain();
+
+	bool Fits(int hRadius, int vRadius) const;      // a stage of these radii keeps the halo within bounds
+	bool Add(const Kernel& kernel);                 // false, leaving the chain as it was, if the stage does not fit
+	bool Add_Edge(int radius = 2, float amount = 1.0f);         // Filter_Edge, false as well for a radius below 1
+	bool Add_Enhance(int radius = 2, float amount = 1.0f);      // Filter_Enhance
+
+	int Stages() const { return (int)stages.size(); }
+
+	// filter the premultiplied RGBA image into out, a view of the same size
+	// which must not overlap it.  An opaque image is read as RGB without
+	// un-premultiplying
+	void Run(const ImageView& image, const ImageView& out, bool opaque = false) const;
+
+private:
+	bool Add(EChainStage type, const Kernel& kernel, int scale);
+
+	struct Stage
+	{
+		EChainStage	type;
+		Kernel		kernel;
+		int			scale;          // edge amount, see Amount_Scale
+	};
+
+	// members
+	std::vector<Stage> stages;
+	int		hHalo;          // columns the first stage reads past a tile on either side
+	int		vHalo;          // rows the first stage reads past a tile above and below
+};
+
+#endif
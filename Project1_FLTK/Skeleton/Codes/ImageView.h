@@ -0,0 +1,35 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+//      ImageView.h
+//
+//      A rectangle of premultiplied RGBA pixels that belongs to someone else:
+//  a whole TargaImage, or a crop, tile or band of one.  Rows are stride
+//  bytes apart, so a view of part of an image points into the image's own
+//  rows, and copying a view copies the pointer, not the pixels.  Wrap a view
+//  in a TargaImage to run ops on its pixels in place.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef _IMAGE_VIEW_H_
+#define _IMAGE_VIEW_H_
+
+#include <stddef.h>
+
+struct ImageView
+{
+	ImageView() : data(NULL), width(0), height(0), stride(0) {}
+	ImageView(unsigned char* d, int w, int h, int s) : data(d), width(w), height(h), stride(s) {}
+
+	// the first pixel of row i
+	unsigned char* Row(int i) const { return data + (size_t)i * stride; }
+
+	// the w x h rectangle at (x, y), which must lie inside this view
+	ImageView Sub(int x, int y, int w, int h) const { return ImageView(Row(y) + x * 4, w, h, stride); }
+
+	unsigned char* data;	    // first pixel of the top row
+	int		width;	    // pixels in a row
+	int		height;	    // rows
+	int		stride;	    // bytes from the start of one row to the start of the next
+};
+
+#endif
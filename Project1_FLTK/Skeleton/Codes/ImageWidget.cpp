@@ -19,6 +19,7 @@
 #include <string.h>
 #include "TargaImage.h"
 #include "ScriptHandler.h"
+#include "Scratch.h"
 
 // constants
 const int   c_border                = 10;                                       // border width between window elements in pixels
@@ -35,7 +36,8 @@ const int   c_minWindowHeight       = 100;
 //      Constructor.  Add the buttons to the window.
 //
 ///////////////////////////////////////////////////////////////////////////////
-ImageWidget::ImageWidget(int x, int y, int w, int h, const char *title) : Fl_Widget(x, y, Max(w, c_minWindowWidth), Max(h, c_minWindowHeight), title), m_pImage(NULL)
+ImageWidget::ImageWidget(int x, int y, int w, int h, const char *title) : Fl_Widget(x, y, Max(w, c_minWindowWidth), Max(h, c_minWindowHeight), title), m_pImage(NULL),
+    m_pDisplay(NULL), m_displaySize(0), m_displayGeneration(0)
 {
     // add controls-
     int horizontalCenter = Max(w, c_minWindowWidth) / 2;
@@ -60,6 +62,8 @@ ImageWidget::ImageWidget(int x, int y, int w, int h, const char *title) : Fl_Wid
 ImageWidget::~ImageWidget()
 {
     delete m_pImage;
+    delete[] m_pDisplay;
+    Count_Other_Bytes(-(long long)m_displaySize);
 }// ~ImageWidget
 
 
@@ -76,19 +80,50 @@ TargaImage* ImageWidget::Get_Image()
 
 ///////////////////////////////////////////////////////////////////////////////
 //
-//      Draw the window contents.
+//      Draw the window contents.  An opaque interleaved byte image is its own
+//  RGB, so it is drawn straight from its pixel data, skipping every fourth
+//  byte and stepping a row by its stride.  Other images, float ones
+//  included, are converted to RGB once per change of the image, into a
+//  buffer kept between redraws.
 //
 ///////////////////////////////////////////////////////////////////////////////
 void ImageWidget::draw()
 {
-    if (!m_pImage)          // Don't do anything if the image is empty.
+    if (!m_pImage || (!m_pImage->data && !m_pImage->linear && !m_pImage->wide))   // Don't do anything if the image is empty.
     	return;
     
-    unsigned char   *rgb;
-    rgb = m_pImage->To_RGB(); // Convert the pre-multiplied RGBA image into RGB.
-    unsigned int imageX = x() + (w() > m_pImage->width) ? (w() - m_pImage->width) / 2 : 0;
-    fl_draw_image(rgb, imageX, y() + c_border * 2 + c_buttonHeight, m_pImage->width, m_pImage->height, 3);
-    delete[] rgb;
+    unsigned char*  rgb;
+    int             delta;
+    int             lineDelta;
+    if (m_pImage->opaque && m_pImage->layout == LAYOUT_INTERLEAVED && m_pImage->format == FORMAT_BYTE)
+    {
+        rgb = m_pImage->data;
+        delta = 4;
+        lineDelta = m_pImage->stride;
+    }// if
+    else
+    {
+        // Convert the pre-multiplied RGBA image into RGB if it has changed since the last draw.
+        if (m_displayGeneration != m_pImage->generation)
+        {
+            int size = m_pImage->width * m_pImage->height * 3;
+            if (size > m_displaySize)
+            {
+                delete[] m_pDisplay;
+                m_pDisplay = new unsigned char[size];
+                Count_Other_Bytes((long long)size - m_displaySize);
+                m_displaySize = size;
+            }// if
+            m_pImage->To_RGB(m_pDisplay);
+            m_displayGeneration = m_pImage->generation;
+        }// if
+        rgb = m_pDisplay;
+        delta = 3;
+        lineDelta = m_pImage->width * 3;
+    }// else
+
+    unsigned int imageX = x() + ((w() > m_pImage->width) ? (w() - m_pImage->width) / 2 : 0);
+    fl_draw_image(rgb, imageX, y() + c_border * 2 + c_buttonHeight, m_pImage->width, m_pImage->height, delta, lineDelta);
 }// draw
 
 
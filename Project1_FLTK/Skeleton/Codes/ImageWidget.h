@@ -40,6 +40,10 @@ class ImageWidget : public Fl_Widget
         TargaImage* m_pImage;	                // The image to display (current image).
         Fl_Box*     m_pStaticTextBox;           // static text
         Fl_Input*   m_pCommandInput;            // input box
+
+        unsigned char*  m_pDisplay;             // RGB of a translucent image, as last drawn
+        int             m_displaySize;          // bytes allocated for m_pDisplay
+        unsigned int    m_displayGeneration;    // generation of the image m_pDisplay holds, 0 for none
 };
 
 
@@ -0,0 +1,532 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Kernel.cpp
+//
+//      Implementation of Kernel methods, including the cost model used to
+//  choose between direct, separable and FFT convolution.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include "Globals.h"
+#include "Kernel.h"
+#include <stdlib.h>
+#include <limits.h>
+#include <math.h>
+#include <iostream>
+#include <fstream>
+
+using namespace std;
+
+// constants
+const int           c_fixedPointBits = 20;          // a float kernel is scaled so its taps total about 2^c_fixedPointBits
+const int           c_factorBits = 15;              // each factor of a separable float kernel totals about 2^c_factorBits
+const int           c_exactBits = 16;               // weights with at most this many fraction and integer bits are stored exactly
+const float         c_separableTolerance = 1e-5f;   // relative error allowed when factoring a float kernel
+const int           c_minFFTSize = 16;              // smallest FFT tile
+const int           c_maxFFTSize = 256;             // largest FFT tile unless the kernel needs more; bigger tiles fall out of cache
+const double        c_fftPointCost = 1.5;           // multiply-adds per point per radix-2 stage, measured by the benchmark
+const double        c_passCost = 2;                 // fixed overhead of one image pass, in multiply-adds per pixel
+
+
+// Largest weight total of one binomial row is 2^c_kernelShift, so both passes
+// of a separable Gaussian fit 255 * 2^(2 * c_kernelShift) into 32 bits.
+const int           c_kernelShift = 12;
+
+
+// Computes n choose s, efficiently
+static double Binomial(int n, int s)
+{
+	double        res;
+
+	res = 1;
+	for (int i = 1; i <= s; i++)
+		res = (n - i + 1) * res / i;
+
+	return res;
+}// Binomial
+
+
+// Greatest common divisor of two non-negative integers
+static int GCD(int a, int b)
+{
+	while (b)
+	{
+		int t = a % b;
+		a = b;
+		b = t;
+	}
+	return a;
+}// GCD
+
+
+// Power of two shift, at most maxShift, that scales values totalling sum to
+// about 2^bits
+static int Fixed_Point_Shift(double sum, int bits, int maxShift)
+{
+	if (sum <= 0)
+		return Min(bits, maxShift);
+	int shift = bits - (int)ceil(log(sum) / log(2.0));
+	return Max(0, Min(shift, maxShift));
+}// Fixed_Point_Shift
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Map index i along an axis of n pixels to the pixel that stands in for
+//  it under the given border mode.  Return -1 when it should be black.
+//
+///////////////////////////////////////////////////////////////////////////////
+int Border_Index(int i, int n, EBorderMode border)
+{
+	if (i >= 0 && i < n)
+		return i;
+
+	switch (border)
+	{
+	case BORDER_CLAMP:
+		return i < 0 ? 0 : n - 1;
+
+	case BORDER_MIRROR:
+	{
+		if (n == 1)
+			return 0;
+		int period = 2 * (n - 1);
+		i %= period;
+		if (i < 0)
+			i += period;
+		return i < n ? i : period - i;
+	}
+
+	case BORDER_WRAP:
+		i %= n;
+		return i < 0 ? i + n : i;
+
+	default:
+		return -1;
+	}
+}// Border_Index
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Constructor.  w x h integer taps over divisor d.  The taps are
+//  factored if they are an outer product.
+//
+///////////////////////////////////////////////////////////////////////////////
+Kernel::Kernel(int w, int h, const int* t, long long d) : width(w), height(h), divisor(d), taps(t, t + w * h), boxes(0)
+{
+	Factor();
+}// Kernel
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Constructor.  w x h float weights.  Short binary fractions are stored
+//  exactly.  Otherwise a kernel that is an outer product within
+//  c_separableTolerance keeps its two factors in fixed point, and anything
+//  else is stored as one fixed point matrix.
+//
+///////////////////////////////////////////////////////////////////////////////
+Kernel::Kernel(int w, int h, const float* weights) : width(w), height(h), boxes(0)
+{
+	// weights that are exact binary fractions, like a binomial over a power
+	// of two, are kept exact
+	for (int shift = 0; shift <= c_exactBits; shift++)
+	{
+		bool exact = true;
+		for (int i = 0; i < w * h && exact; i++)
+		{
+			double scaled = ldexp(weights[i], shift);
+			exact = fabs(scaled) < (1 << c_exactBits) && scaled == floor(scaled);
+		}
+		if (exact)
+		{
+			divisor = 1 << shift;
+			taps.resize(w * h);
+			for (int i = 0; i < w * h; i++)
+				taps[i] = (int)ldexp(weights[i], shift);
+			Factor();
+			return;
+		}// if
+	}// for
+
+	// pivot on the largest weight and test weights[y][x] * pivot == weights[y][q] * weights[p][x]
+	int p = 0, q = 0;
+	float largest = 0;
+	for (int i = 0; i < w * h; i++)
+	{
+		if (fabs(weights[i]) > largest)
+		{
+			largest = (float)fabs(weights[i]);
+			p = i / w;
+			q = i % w;
+		}
+	}
+
+	bool separable = largest > 0;
+	float pivot = weights[p * w + q];
+	for (int y = 0; y < h && separable; y++)
+	{
+		for (int x = 0; x < w && separable; x++)
+		{
+			float product = weights[y * w + q] * weights[p * w + x] / pivot;
+			separable = fabs(weights[y * w + x] - product) <= c_separableTolerance * largest;
+		}
+	}
+
+	if (separable)
+	{
+		// column is weights[.][q] / pivot, row is weights[p][.]
+		double rowSum = 0, columnSum = 0;
+		for (int x = 0; x < w; x++)
+			rowSum += fabs(weights[p * w + x]);
+		for (int y = 0; y < h; y++)
+			columnSum += fabs(weights[y * w + q] / pivot);
+
+		// the column peaks at 1, so columnShift <= c_factorBits and the divisor fits in 2^30
+		int columnShift = Fixed_Point_Shift(columnSum, c_factorBits, c_factorBits);
+		int rowShift = Fixed_Point_Shift(rowSum, c_factorBits, 30 - columnShift);
+		row.resize(w);
+		column.resize(h);
+		for (int x = 0; x < w; x++)
+			row[x] = (int)floor(ldexp(weights[p * w + x], rowShift) + 0.5);
+		for (int y = 0; y < h; y++)
+			column[y] = (int)floor(ldexp(weights[y * w + q] / pivot, columnShift) + 0.5);
+
+		divisor = 1 << (rowShift + columnShift);
+		taps.resize(w * h);
+		for (int y = 0; y < h; y++)
+			for (int x = 0; x < w; x++)
+				taps[y * w + x] = column[y] * row[x];
+	}
+	else
+	{
+		double sum = 0;
+		for (int i = 0; i < w * h; i++)
+			sum += fabs(weights[i]);
+
+		int shift = Fixed_Point_Shift(sum, c_fixedPointBits, 30);
+		divisor = 1 << shift;
+		taps.resize(w * h);
+		for (int i = 0; i < w * h; i++)
+			taps[i] = (int)floor(ldexp(weights[i], shift) + 0.5);
+	}
+}// Kernel
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Constructor.  Outer product of the column c and the row r over
+//  divisor d.
+//
+///////////////////////////////////////////////////////////////////////////////
+Kernel::Kernel(int rowSize, const int* r, int columnSize, const int* c, long long d) :
+	width(rowSize), height(columnSize), divisor(d), taps(rowSize * columnSize), row(r, r + rowSize), column(c, c + columnSize), boxes(0)
+{
+	for (int y = 0; y < height; y++)
+		for (int x = 0; x < width; x++)
+			taps[y * width + x] = column[y] * row[x];
+}// Kernel
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Read a kernel from a text file: the width and height, both odd,
+//  followed by width * height weights in row major order.  Return a new
+//  Kernel which must be deleted by the caller, or NULL on failure.
+//
+///////////////////////////////////////////////////////////////////////////////
+Kernel* Kernel::Load(const char* filename)
+{
+	if (!filename)
+	{
+		cout << "No filename given." << endl;
+		return NULL;
+	}// if
+
+	ifstream inFile(filename);
+	if (!inFile.is_open())
+	{
+		cout << "Unable to open file:  " << filename << endl;
+		return NULL;
+	}// if
+
+	int w = 0, h = 0;
+	inFile >> w >> h;
+	if (!inFile || w <= 0 || h <= 0 || w % 2 != 1 || h % 2 != 1)
+	{
+		cout << "Kernel: width and height must be positive odd numbers" << endl;
+		return NULL;
+	}// if
+
+	std::vector<float> weights(w * h);
+	for (int i = 0; i < w * h; i++)
+		inFile >> weights[i];
+	if (!inFile)
+	{
+		cout << "Kernel: expected " << w * h << " weights in " << filename << endl;
+		return NULL;
+	}// if
+
+	return new Kernel(w, h, &weights[0]);
+}// Load
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Return the (2 * radius + 1) square box filter.  Its factors are one
+//  box each, so it is applied as running sums.
+//
+///////////////////////////////////////////////////////////////////////////////
+Kernel Kernel::Box(int radius)
+{
+	std::vector<int> ones(2 * radius + 1, 1);
+	long long taps = 2 * radius + 1;
+
+	Kernel box(2 * radius + 1, &ones[0], 2 * radius + 1, &ones[0], taps * taps);
+	box.boxes = 1;
+	return box;
+}// Box
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Return the (2 * radius + 1) square Bartlett filter.  The triangle
+//  along each axis is two cascaded boxes of radius + 1 taps.
+//
+///////////////////////////////////////////////////////////////////////////////
+Kernel Kernel::Bartlett(int radius)
+{
+	std::vector<int> triangle(2 * radius + 1);
+	for (int i = 0; i <= 2 * radius; i++)
+		triangle[i] = Min(i, 2 * radius - i) + 1;
+	long long taps = radius + 1;
+
+	Kernel bartlett(2 * radius + 1, &triangle[0], 2 * radius + 1, &triangle[0], taps * taps * taps * taps);
+	bartlett.boxes = 2;
+	return bartlett;
+}// Bartlett
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Return the N x N Gaussian, the outer product of binomial row N - 1
+//  with itself.  Rows up to N = c_kernelShift + 1 are exact; longer rows are
+//  rescaled to 2^c_kernelShift, with the rounding error folded into the
+//  center tap.  The rescaled row is built a coefficient from the last, as
+//  Binomial does, with its power of two kept apart, so rows too long for a
+//  double to hold their middle coefficients still come out.
+//
+///////////////////////////////////////////////////////////////////////////////
+Kernel Kernel::Gaussian(unsigned int N)
+{
+	std::vector<int> binomial(N);
+	long long total;
+	if (N - 1 <= c_kernelShift)
+	{
+		for (unsigned int i = 0; i < N; i++)
+			binomial[i] = (int)(Binomial(N - 1, i) + 0.5);
+		total = 1LL << (N - 1);
+	}
+	else
+	{
+		int sum = 0;
+		double mantissa = 1;
+		int exponent = c_kernelShift - (int)(N - 1);
+		for (unsigned int i = 0; i < N; i++)
+		{
+			if (i > 0)
+			{
+				int shift;
+				mantissa = frexp((N - i) * mantissa / i, &shift);
+				exponent += shift;
+			}
+			binomial[i] = (int)floor(ldexp(mantissa, exponent) + 0.5);
+			sum += binomial[i];
+		}
+		binomial[N / 2] += (1 << c_kernelShift) - sum;
+		total = 1LL << c_kernelShift;
+	}
+
+	return Kernel(N, &binomial[0], N, &binomial[0], total * total);
+}// Gaussian
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Return the method that should be cheapest for an image of the given
+//  size.
+//
+///////////////////////////////////////////////////////////////////////////////
+EConvolveMethod Kernel::Plan(int imageWidth, int imageHeight) const
+{
+	EConvolveMethod method = CONVOLVE_DIRECT;
+	double cost = Direct_Cost();
+
+	if (Is_Separable() && Separable_Cost() < cost)
+	{
+		method = CONVOLVE_SEPARABLE;
+		cost = Separable_Cost();
+	}// if
+
+	if (FFT_Cost(imageWidth, imageHeight) < cost)
+		method = CONVOLVE_FFT;
+
+	return method;
+}// Plan
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Return the FFT tile size, a power of two, that wastes the least work on
+//  the kernel overlap between tiles.  A tile is at least twice the kernel,
+//  past c_maxFFTSize if it must be, so every tile has as many output pixels
+//  as the kernel has taps across.
+//
+///////////////////////////////////////////////////////////////////////////////
+int Kernel::FFT_Size() const
+{
+	int largest = Max(width, height);
+	int best = 0;
+	double bestCost = 0;
+
+	for (int size = c_minFFTSize; size <= c_maxFFTSize || !best; size *= 2)
+	{
+		if (size < 2 * largest)
+			continue;
+
+		double cost = size * size * log((double)size) / ((size - width + 1) * (size - height + 1));
+		if (!best || cost < bestCost)
+		{
+			best = size;
+			bestCost = cost;
+		}// if
+	}// for
+
+	return best;
+}// FFT_Size
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Return whether the kernel can run in 16-bit fixed point: no negative
+//  taps or factors, and 255 times the tap total no larger than 65535, so no
+//  partial sum over 8-bit pixels overflows an unsigned short.
+//
+///////////////////////////////////////////////////////////////////////////////
+bool Kernel::Fits_16_Bits() const
+{
+	long long total = 0;
+	for (int i = 0; i < width * height; i++)
+	{
+		if (taps[i] < 0)
+			return false;
+		total += taps[i];
+	}
+	for (int x = 0; x < (int)row.size(); x++)
+		if (row[x] < 0)
+			return false;
+	for (int y = 0; y < (int)column.size(); y++)
+		if (column[y] < 0)
+			return false;
+
+	return 255 * total <= 65535 && divisor <= UINT_MAX;
+}// Fits_16_Bits
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Estimated cost per pixel and channel of applying every tap directly.
+//
+///////////////////////////////////////////////////////////////////////////////
+double Kernel::Direct_Cost() const
+{
+	return width * height + c_passCost;
+}// Direct_Cost
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Estimated cost per pixel and channel of a row pass and a column pass.
+//  A running sum box costs an add and a subtract whatever its length.
+//
+///////////////////////////////////////////////////////////////////////////////
+double Kernel::Separable_Cost() const
+{
+	if (boxes > 0)
+		return 4 * boxes + 2 * c_passCost;
+	return width + height + 2 * c_passCost;
+}// Separable_Cost
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Estimated cost per pixel and channel of FFT overlap-add on an image of
+//  the given size.  Each tile takes two forward and two inverse 2D
+//  transforms for its three channels, plus the spectrum product.
+//
+///////////////////////////////////////////////////////////////////////////////
+double Kernel::FFT_Cost(int imageWidth, int imageHeight) const
+{
+	int size = FFT_Size();
+	int tileWidth = size - width + 1;
+	int tileHeight = size - height + 1;
+	double tiles = (double)((imageWidth + tileWidth - 1) / tileWidth) * ((imageHeight + tileHeight - 1) / tileHeight);
+
+	double points = (double)size * size;
+	double stages = 2 * log((double)size) / log(2.0);
+	double perTile = 4 * points * stages * c_fftPointCost + 2 * points * 4;
+
+	return tiles * perTile / (3.0 * imageWidth * imageHeight) + 2 * c_passCost;
+}// FFT_Cost
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Fill row and column when the integer taps are an outer product.  The
+//  column through the largest tap, reduced by its gcd, is the only primitive
+//  candidate, and every other column must be an integer multiple of it.
+//
+///////////////////////////////////////////////////////////////////////////////
+void Kernel::Factor()
+{
+	row.clear();
+	column.clear();
+
+	int p = 0, q = 0;
+	for (int i = 0; i < width * height; i++)
+	{
+		if (abs(taps[i]) > abs(taps[p * width + q]))
+		{
+			p = i / width;
+			q = i % width;
+		}
+	}
+	int pivot = taps[p * width + q];
+	if (!pivot)
+		return;
+
+	int g = 0;
+	for (int y = 0; y < height; y++)
+		g = GCD(abs(taps[y * width + q]), g);
+	if (pivot < 0)
+		g = -g;
+
+	std::vector<int> c(height), r(width);
+	for (int y = 0; y < height; y++)
+		c[y] = taps[y * width + q] / g;
+	for (int x = 0; x < width; x++)
+	{
+		if (taps[p * width + x] % c[p])
+			return;
+		r[x] = taps[p * width + x] / c[p];
+	}
+
+	for (int y = 0; y < height; y++)
+		for (int x = 0; x < width; x++)
+			if ((long long)c[y] * r[x] != taps[y * width + x])
+				return;
+
+	row.swap(r);
+	column.swap(c);
+}// Factor
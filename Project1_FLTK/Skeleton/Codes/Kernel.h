@@ -0,0 +1,74 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Kernel.h
+//
+//      Convolution kernel for TargaImage::Convolve.  Taps are integers over
+//  a common divisor so small filters stay exact; float kernels are stored in
+//  fixed point.  The kernel also plans how it is best applied to an image.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef _KERNEL_H_
+#define _KERNEL_H_
+
+#include <vector>
+
+// ways to apply a kernel
+enum EConvolveMethod
+{
+	CONVOLVE_AUTO,              // let the kernel plan it
+	CONVOLVE_DIRECT,            // every tap at every pixel
+	CONVOLVE_SEPARABLE,         // a row pass then a column pass
+	CONVOLVE_FFT                // tiled overlap-add in the frequency domain
+};
+
+// how pixels outside the image are filled in
+enum EBorderMode
+{
+	BORDER_ZERO,                // black, like the original filters
+	BORDER_CLAMP,               // repeat the edge pixel
+	BORDER_MIRROR,              // reflect about the edge pixel, 2 1 | 0 1 2
+	BORDER_WRAP                 // tile the image
+};
+
+// the pixel inside [0, n) that stands in for index i, or -1 for black
+int Border_Index(int i, int n, EBorderMode border);
+
+class Kernel
+{
+	// methods
+public:
+	Kernel(int w, int h, const int* t, long long d);           // w x h integer taps over divisor d
+	Kernel(int w, int h, const float* weights);                // w x h float weights, stored in fixed point
+	Kernel(int rowSize, const int* r, int columnSize, const int* c, long long d);  // outer product of c and r over divisor d
+
+	static Kernel* Load(const char* filename);                  // read "width height weights..." from a text file, NULL on failure
+	static Kernel Box(int radius);                              // (2 * radius + 1) square average
+	static Kernel Bartlett(int radius);                         // (2 * radius + 1) square triangle
+	static Kernel Gaussian(unsigned int N);                     // N x N binomial approximation of a Gaussian
+
+	bool Is_Separable() const { return !row.empty(); }
+	EConvolveMethod Plan(int imageWidth, int imageHeight) const;    // cheapest method for an image of this size
+	int FFT_Size() const;                                        // FFT tile size used by the frequency domain path
+	bool Fits_16_Bits() const;                                   // every sum over 8-bit pixels fits an unsigned short
+
+	// estimated cost per pixel and channel of each method, in multiply-adds
+	double Direct_Cost() const;
+	double Separable_Cost() const;
+	double FFT_Cost(int imageWidth, int imageHeight) const;
+
+private:
+	void Factor();              // fill row and column if the taps are an outer product
+
+	// members
+public:
+	int		width;	            // odd number of columns
+	int		height;	            // odd number of rows
+	long long divisor;          // the taps are divided by this, always positive
+	std::vector<int> taps;      // width * height taps, row major
+	std::vector<int> row;       // separable factors, empty when the kernel is not separable;
+	std::vector<int> column;    // column[y] * row[x] == taps[y * width + x]
+	int		boxes;              // when positive, row and column are each this many cascaded boxes of equal length
+};
+
+#endif
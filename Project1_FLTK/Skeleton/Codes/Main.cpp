@@ -17,11 +17,14 @@
 #include <Fl/Fl.h>
 #include <Fl/Fl_Window.h>
 #include <string.h>
+#include <stdlib.h>
 #include <iostream>
 #include <vector>
 #include "TargaImage.h"
 #include "ImageWidget.h"
 #include "ScriptHandler.h"
+#include "Benchmark.h"
+#include "ThreadPool.h"
 
 
 using namespace std;
@@ -29,6 +32,10 @@ using namespace std;
 // constants
 const char      c_sNames[]          = "-names";             // display student names command line switch
 const char      c_sHeadless[]       = "-headless";          // headless command line switch
+const char      c_sBench[]          = "-bench";             // run benchmarks command line switch
+const char      c_sCheck[]          = "-check";             // run checks command line switch
+const char      c_sThreads[]        = "-threads";           // set the number of worker threads command line switch
+const char      c_sMemStats[]       = "-memstats";          // memory report command line switch
 
 // globals
 std::vector<char*>  vsStudentNames;
@@ -99,18 +106,42 @@ int main(int argc, char *argv[])
     // check command line arguments
     TargaImage* pImage = NULL;
     bool bHeadless = false;
+    bool bFailed = false;
 
     for (int i = script_arg; i < argc; ++i)
     {
         if (!strcmp(argv[i], c_sNames))                                 // display names
             DisplayNames();
+        else if (!strcmp(argv[i], c_sThreads) && i + 1 < argc)          // thread count, 0 for one per processor
+        {
+            char* sEnd;
+            long threads = strtol(argv[++i], &sEnd, 10);
+            if (sEnd == argv[i] || *sEnd || threads < 0 || threads > c_maxThreads)
+            {
+                cerr << "Invalid thread count:  " << argv[i] << "; give a number from 0, for one per processor, to " << c_maxThreads << endl;
+                return 1;
+            }// if
+            ThreadPool::Set_Threads((int)threads);
+        }// else if
+        else if (!strcmp(argv[i], c_sMemStats))                         // memory report per script command
+            CScriptHandler::SetMemStats(true);
         else if (!bHeadless && !strcmp(argv[i], c_sHeadless))           // go headless
             bHeadless = true;
+        else if (!bHeadless && !strcmp(argv[i], c_sBench))              // run benchmarks, no gui
+        {
+            bFailed = !CBenchmark::Run_All() || bFailed;
+            bHeadless = true;
+        }// else if
+        else if (!bHeadless && !strcmp(argv[i], c_sCheck))              // run checks, no gui
+        {
+            bFailed = !CBenchmark::Run_Checks() || bFailed;
+            bHeadless = true;
+        }// else if
         else if (bHeadless && strcmp(argv[i], c_sHeadless))             // run script file
             CScriptHandler::HandleScriptFile(argv[i], pImage);
         else
         {
-            cerr << "Usage:" << endl << "Project1 [-names] [-headless scriptFilenames . . .]" << endl;
+            cerr << "Usage:" << endl << "Project1 [-names] [-threads N] [-memstats] [-bench | -check] [-headless scriptFilenames . . .]" << endl;
             return 0;
         }// else
     }// for
@@ -137,7 +168,7 @@ int main(int argc, char *argv[])
         return Fl::run();
     }// else
 
-    return 0;
+    return bFailed ? 1 : 0;
 }// main
 
 
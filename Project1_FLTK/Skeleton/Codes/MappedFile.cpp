@@ -0,0 +1,119 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+//      MappedFile.cpp
+//
+//      Implementation of MappedFile, with a file mapping on Windows and mmap
+//  elsewhere.  The file itself is closed once it is mapped; the mapping
+//  keeps its pages.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include "Globals.h"
+#include "MappedFile.h"
+#include "Scratch.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+#ifdef _WIN32
+	#define WIN32_LEAN_AND_MEAN
+	#define NOMINMAX
+	#include <windows.h>
+#else
+	#include <sys/mman.h>
+	#include <sys/stat.h>
+	#include <fcntl.h>
+	#include <unistd.h>
+#endif
+
+
+// the whole file in a malloc'd buffer, for files that can not be mapped
+static const unsigned char* Read_File(const char* filename, size_t& size)
+{
+	FILE* file = fopen(filename, "rb");
+	if (!file)
+		return NULL;
+
+	fseek(file, 0, SEEK_END);
+	long length = ftell(file);
+	fseek(file, 0, SEEK_SET);
+	unsigned char* bytes = (unsigned char*)malloc(length > 0 ? length : 1);
+	size = (bytes && length > 0) ? fread(bytes, 1, length, file) : 0;
+	fclose(file);
+	return bytes;
+}// Read_File
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Constructor.  Map the file, or failing that read it.
+//
+///////////////////////////////////////////////////////////////////////////////
+MappedFile::MappedFile(const char* filename) : data(NULL), size(0), mapped(false)
+{
+	if (!filename)
+		return;
+
+#ifdef _WIN32
+	HANDLE file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (file != INVALID_HANDLE_VALUE)
+	{
+		LARGE_INTEGER length;
+		if (GetFileSizeEx(file, &length) && length.QuadPart > 0)
+		{
+			HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+			if (mapping)
+			{
+				data = (const unsigned char*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+				CloseHandle(mapping);
+			}
+			size = data ? (size_t)length.QuadPart : 0;
+			mapped = data != NULL;
+		}
+		CloseHandle(file);
+	}
+#else
+	int file = open(filename, O_RDONLY);
+	if (file >= 0)
+	{
+		struct stat status;
+		if (fstat(file, &status) == 0 && S_ISREG(status.st_mode) && status.st_size > 0)
+		{
+			void* view = mmap(NULL, status.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+			if (view != MAP_FAILED)
+			{
+				data = (const unsigned char*)view;
+				size = status.st_size;
+				mapped = true;
+				madvise(view, size, MADV_SEQUENTIAL);
+			}
+		}
+		close(file);
+	}
+#endif
+
+	if (!mapped)
+		data = Read_File(filename, size);
+	Count_Other_Bytes(size);
+}// MappedFile
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Destructor.  Unmap or free the bytes.
+//
+///////////////////////////////////////////////////////////////////////////////
+MappedFile::~MappedFile()
+{
+	Count_Other_Bytes(-(long long)size);
+	if (!mapped)
+	{
+		free((void*)data);
+		return;
+	}
+
+#ifdef _WIN32
+	UnmapViewOfFile(data);
+#else
+	munmap((void*)data, size);
+#endif
+}// ~MappedFile
@@ -0,0 +1,38 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+//      MappedFile.h
+//
+//      A whole file mapped into memory read only, so its bytes can be used
+//  where they are instead of being copied out with fread.  The mapping is
+//  private: nothing written to the file after it is mapped shows up in it,
+//  and nothing in it can be written.  Where the file can not be mapped,
+//  such as an empty one, it is read into a buffer instead.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef _MAPPED_FILE_H_
+#define _MAPPED_FILE_H_
+
+#include <stddef.h>
+
+class MappedFile
+{
+	// methods
+public:
+	MappedFile(const char* filename);           // Data() is NULL if the file can not be opened
+	~MappedFile();
+
+	const unsigned char* Data() const { return data; }
+	size_t Size() const { return size; }
+
+private:
+	MappedFile(const MappedFile&);
+	MappedFile& operator=(const MappedFile&);
+
+	// members
+	const unsigned char*	data;
+	size_t					size;
+	bool					mapped;             // data is a mapping rather than a malloc'd copy
+};
+
+#endif
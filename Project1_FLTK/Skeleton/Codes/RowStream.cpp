@@ -0,0 +1,135 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+//      RowStream.cpp
+//
+//      Implementation of RowStream methods.  Rows are read into a ring of
+//  line buffers, row y in slot y modulo the ring's size, which holds a strip
+//  and its halo on both sides.  Once a strip's rows and the halo past it
+//  have been read, they are copied in order out of the ring into a window,
+//  the ops run on the window, and the strip is written from it.  Strips go
+//  in the order the file stores its rows, so each row is read once and
+//  written in file order to a file that stores them the same way.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include "Globals.h"
+#include "RowStream.h"
+#include "TargaImage.h"
+#include "TargaFile.h"
+#include "Simd.h"
+#include "Scratch.h"
+#include <iostream>
+#include <string.h>
+
+using namespace std;
+
+// constants
+const int           c_streamStripRows = 64;         // rows in a strip, unless the halo is wider
+const int           c_streamRowPeriod = 4;          // strips and halos are whole multiples of this many rows, so ops that pattern by row, such as Dither_Cluster, line up with the image
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Constructor.  No ops.
+//
+///////////////////////////////////////////////////////////////////////////////
+RowStream::RowStream() : halo(0)
+{
+}// RowStream
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Append an op.  Each op loses its halo from the rows left good at the
+//  edges of a strip's window by the ops before it, so the halos add up.
+//
+///////////////////////////////////////////////////////////////////////////////
+void RowStream::Add(int opHalo, const std::function<bool(TargaImage&)>& op)
+{
+	Stage stage = { opHalo, op };
+	stages.push_back(stage);
+	halo += opHalo;
+}// Add
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Stream the file through the ops.  Strips are c_streamStripRows rows,
+//  or four times the halo when that is more, so the ops run on at most half
+//  as many rows again as they write.  With no halo a strip is a whole ring, in
+//  order, and the ops run on the ring itself.
+//
+///////////////////////////////////////////////////////////////////////////////
+bool RowStream::Run(const char* inFile, const char* outFile) const
+{
+	TargaReader reader(inFile);
+	if (!reader.Opened())
+	{
+		cout << "Stream: unable to read " << (inFile ? inFile : "") << "; only truecolor targas can be streamed" << endl;
+		return false;
+	}
+
+	int width = reader.Width(), height = reader.Height();
+	TargaWriter writer(outFile, width, height);
+	if (!writer.Opened())
+	{
+		cout << "Stream: unable to write " << (outFile ? outFile : "") << endl;
+		return false;
+	}
+
+	int rowHalo = (halo + c_streamRowPeriod - 1) / c_streamRowPeriod * c_streamRowPeriod;
+	int stripRows = Max(c_streamStripRows, 4 * rowHalo);
+	int ringRows = stripRows + 2 * rowHalo;
+	int stride = Aligned_Stride(width * 4);
+
+	Scratch scratch;
+	unsigned char* ring = scratch.New<unsigned char>((size_t)ringRows * stride);
+	unsigned char* window = rowHalo ? scratch.New<unsigned char>((size_t)ringRows * stride) : ring;
+
+	bool topFirst = reader.Top_First();
+	int strips = (height + stripRows - 1) / stripRows;
+	int rowsRead = 0;
+	for (int s = 0; s < strips; s++)
+	{
+		int top = (topFirst ? s : strips - 1 - s) * stripRows;
+		int bottom = Min(top + stripRows, height);
+		int windowTop = Max(top - rowHalo, 0);
+		int windowBottom = Min(bottom + rowHalo, height);
+
+		// read down to the bottom of the window, or up to its top
+		for (int needed = topFirst ? windowBottom : height - windowTop; rowsRead < needed; rowsRead++)
+		{
+			int y = topFirst ? rowsRead : height - 1 - rowsRead;
+			reader.Read_Row(ring + (size_t)(y % ringRows) * stride);
+		}
+
+		if (window != ring)
+		{
+			for (int y = windowTop; y < windowBottom; y++)
+				memcpy(window + (size_t)(y - windowTop) * stride, ring + (size_t)(y % ringRows) * stride, width * 4);
+		}
+
+		TargaImage image(ImageView(window, width, windowBottom - windowTop, stride));
+		for (size_t i = 0; i < stages.size(); i++)
+		{
+			if (!stages[i].op(image))
+			{
+				cout << "Stream: an op failed on rows " << top << " to " << bottom - 1 << endl;
+				return false;
+			}
+		}
+
+		for (int i = 0; i < bottom - top; i++)
+		{
+			int y = topFirst ? top + i : bottom - 1 - i;
+			writer.Write_Row(y, window + (size_t)(y - windowTop) * stride, image.opaque);
+		}
+	}
+
+	if (!writer.Close())
+	{
+		cout << "Stream: unable to write " << outFile << endl;
+		return false;
+	}
+	return true;
+}// Run
@@ -0,0 +1,54 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+//      RowStream.h
+//
+//      A run of image ops applied to a targa file on its way to another one,
+//  a strip of rows at a time, for images too big to load.  The ops are the
+//  TargaImage ones, run on each strip wrapped in a TargaImage.  Each op says
+//  how many rows it reads above and below a row it writes, and each strip
+//  is read with that many rows more on either side for the ops together, so
+//  the result matches running the ops on the whole image.  Memory grows
+//  with the width of the image and the reach of the ops, not the height.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef _ROW_STREAM_H_
+#define _ROW_STREAM_H_
+
+#include <vector>
+#include <functional>
+
+class TargaImage;
+
+class RowStream
+{
+	// methods
+public:
+	RowStream();
+
+	// append an op.  opHalo is the rows it reads above and below each row
+	// it writes, 0 for ops that work on each pixel by itself; pixels outside
+	// the strip must count as black to it, as outside the image.  The op
+	// must not change the size of the image
+	void Add(int opHalo, const std::function<bool(TargaImage&)>& op);
+
+	int Stages() const { return (int)stages.size(); }
+
+	// read inFile, which must be a truecolor targa, run the ops over it and
+	// write the result to outFile as Save_Image would.  False, with a
+	// message, if a file can not be read or written or an op fails
+	bool Run(const char* inFile, const char* outFile) const;
+
+private:
+	struct Stage
+	{
+		int		halo;
+		std::function<bool(TargaImage&)> op;
+	};
+
+	// members
+	std::vector<Stage> stages;
+	int		halo;           // rows read past a strip above and below, for every stage together
+};
+
+#endif
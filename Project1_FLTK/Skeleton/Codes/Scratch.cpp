@@ -0,0 +1,286 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Scratch.cpp
+//
+//      Implementation of the scratch arenas and the pixel buffer cache.
+//  An arena allocates by bumping an offset in its current block, moving on
+//  to the next block, or a new one twice the size of the last, when a
+//  request does not fit.  When the outermost Scratch of a thread rewinds an
+//  arena that needed more than one block, the blocks are replaced by one as
+//  large as all of them, so the next run of the same op fits in it.
+//
+//      The heap counter includes those replacements, so it settles once
+//  every arena has a block big enough.  The byte counts cover the arena
+//  blocks and every pixel buffer, in use or kept.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include "Globals.h"
+#include "Scratch.h"
+#include "Simd.h"
+#include <vector>
+#include <atomic>
+
+using namespace std;
+
+// size of the first block of an arena
+const size_t c_firstBlockSize = 1 << 20;
+
+// freed pixel buffers each thread keeps for reuse
+const int c_keptPixelBuffers = 2;
+
+static atomic<long long> s_heapAllocations(0);
+static atomic<long long> s_heldBytes(0);
+static atomic<long long> s_peakBytes(0);
+static atomic<long long> s_imageBytes(0);
+
+// note bytes taken from or given back to the heap, and raise the peak
+static void Count_Held(long long bytes)
+{
+	long long held = s_heldBytes += bytes;
+	long long peak = s_peakBytes;
+	while (held > peak && !s_peakBytes.compare_exchange_weak(peak, held))
+		;
+}// Count_Held
+
+
+// a block of an arena
+struct ScratchBlock
+{
+	unsigned char*	memory;
+	size_t			size;
+};
+
+struct ScratchArena
+{
+	ScratchArena() : block(0), used(0) {}
+	~ScratchArena()
+	{
+		for (size_t b = 0; b < blocks.size(); b++)
+		{
+			Aligned_Delete(blocks[b].memory);
+			Count_Held(-(long long)blocks[b].size);
+		}
+	}
+
+	vector<ScratchBlock>	blocks;
+	int						block;              // block being allocated from
+	size_t					used;               // bytes of it in use
+};
+
+static thread_local ScratchArena t_arena;
+
+
+// a pixel buffer starts c_rowAlignment bytes into its allocation, after its
+// size
+static size_t& Capacity(unsigned char* pixels)
+{
+	return *(size_t*)(pixels - c_rowAlignment);
+}// Capacity
+
+static void Free_Pixels(unsigned char* pixels)
+{
+	Count_Held(-(long long)(Capacity(pixels) + c_rowAlignment));
+	Aligned_Delete(pixels - c_rowAlignment);
+}// Free_Pixels
+
+// a thread's freed buffers wait in its cache
+struct PixelCache
+{
+	~PixelCache()
+	{
+		for (int k = 0; k < c_keptPixelBuffers; k++)
+		{
+			if (kept[k])
+				Free_Pixels(kept[k]);
+		}
+	}
+
+	unsigned char*	kept[c_keptPixelBuffers] = {};
+};
+
+static thread_local PixelCache t_pixelCache;
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Constructor.  Mark the top of the calling thread's arena.
+//
+///////////////////////////////////////////////////////////////////////////////
+Scratch::Scratch() : arena(t_arena), block(t_arena.block), used(t_arena.used)
+{
+}// Scratch
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Destructor.  Rewind the arena to the mark, and if this was the
+//  outermost Scratch and the arena spilled into more than one block, trade
+//  the blocks for a single one holding all of them.
+//
+///////////////////////////////////////////////////////////////////////////////
+Scratch::~Scratch()
+{
+	arena.block = block;
+	arena.used = used;
+	if (block != 0 || used != 0 || arena.blocks.size() < 2)
+		return;
+
+	size_t total = 0;
+	for (size_t b = 0; b < arena.blocks.size(); b++)
+	{
+		total += arena.blocks[b].size;
+		Aligned_Delete(arena.blocks[b].memory);
+	}
+	arena.blocks.clear();
+
+	ScratchBlock merged = { Aligned_New(total), total };
+	arena.blocks.push_back(merged);
+	s_heapAllocations++;
+}// ~Scratch
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Take bytes from the top of the arena, rounded up to keep the next
+//  buffer aligned.
+//
+///////////////////////////////////////////////////////////////////////////////
+void* Scratch::Allocate(size_t bytes)
+{
+	bytes = (bytes + c_rowAlignment - 1) / c_rowAlignment * c_rowAlignment;
+	for (;;)
+	{
+		if (arena.block < (int)arena.blocks.size())
+		{
+			ScratchBlock& current = arena.blocks[arena.block];
+			if (arena.used + bytes <= current.size)
+			{
+				unsigned char* buffer = current.memory + arena.used;
+				arena.used += bytes;
+				return buffer;
+			}
+			if (arena.block + 1 < (int)arena.blocks.size())
+			{
+				arena.block++;
+				arena.used = 0;
+				continue;
+			}
+		}
+
+		size_t size = arena.blocks.empty() ? c_firstBlockSize : arena.blocks.back().size * 2;
+		ScratchBlock added = { NULL, Max(size, bytes) };
+		added.memory = Aligned_New(added.size);
+		arena.blocks.push_back(added);
+		s_heapAllocations++;
+		Count_Held(added.size);
+		if (arena.blocks.size() > 1)
+		{
+			arena.block = (int)arena.blocks.size() - 1;
+			arena.used = 0;
+		}
+	}
+}// Allocate
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Pixel buffers.  A request takes the thread's kept buffer that fits it
+//  best without being more than twice its size, or a new one from the heap.
+//  A freed buffer is kept, pushing out the oldest kept one.
+//
+///////////////////////////////////////////////////////////////////////////////
+void* Pixels_Allocate(size_t bytes)
+{
+	bytes = Max(bytes, (size_t)1);
+	PixelCache& cache = t_pixelCache;
+	int best = -1;
+	for (int k = 0; k < c_keptPixelBuffers; k++)
+	{
+		size_t capacity = cache.kept[k] ? Capacity(cache.kept[k]) : 0;
+		if (capacity >= bytes && capacity / 2 <= bytes && (best < 0 || capacity < Capacity(cache.kept[best])))
+			best = k;
+	}
+	if (best >= 0)
+	{
+		unsigned char* pixels = cache.kept[best];
+		cache.kept[best] = NULL;
+		s_imageBytes += Capacity(pixels);
+		return pixels;
+	}
+
+	unsigned char* pixels = Aligned_New(bytes + c_rowAlignment) + c_rowAlignment;
+	Capacity(pixels) = bytes;
+	s_heapAllocations++;
+	Count_Held(bytes + c_rowAlignment);
+	s_imageBytes += bytes;
+	return pixels;
+}// Pixels_Allocate
+
+
+void Pixels_Delete(void* pixels)
+{
+	if (!pixels)
+		return;
+
+	s_imageBytes -= Capacity((unsigned char*)pixels);
+	PixelCache& cache = t_pixelCache;
+	if (cache.kept[c_keptPixelBuffers - 1])
+		Free_Pixels(cache.kept[c_keptPixelBuffers - 1]);
+	for (int k = c_keptPixelBuffers - 1; k > 0; k--)
+		cache.kept[k] = cache.kept[k - 1];
+	cache.kept[0] = (unsigned char*)pixels;
+}// Pixels_Delete
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      The heap allocations made for scratch and pixels so far.
+//
+///////////////////////////////////////////////////////////////////////////////
+long long Scratch_Heap_Allocations()
+{
+	return s_heapAllocations;
+}// Scratch_Heap_Allocations
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Bytes of memory the arenas and pixel buffers hold, the most they have
+//  held at once since the last Reset_Peak_Bytes, and the bytes of the pixel
+//  buffers images are using.
+//
+///////////////////////////////////////////////////////////////////////////////
+long long Scratch_Held_Bytes()
+{
+	return s_heldBytes;
+}// Scratch_Held_Bytes
+
+
+long long Scratch_Peak_Bytes()
+{
+	return s_peakBytes;
+}// Scratch_Peak_Bytes
+
+
+long long Image_Bytes()
+{
+	return s_imageBytes;
+}// Image_Bytes
+
+
+void Reset_Peak_Bytes()
+{
+	s_peakBytes = (long long)s_heldBytes;
+}// Reset_Peak_Bytes
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Count memory the arenas do not hand out with what they hold.
+//
+///////////////////////////////////////////////////////////////////////////////
+void Count_Other_Bytes(long long bytes)
+{
+	Count_Held(bytes);
+}// Count_Other_Bytes
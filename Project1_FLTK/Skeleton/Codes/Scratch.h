@@ -0,0 +1,88 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Scratch.h
+//
+//      Memory for the temporaries of image ops.  Each thread has an arena,
+//  a stack of large blocks; a Scratch marks the top of the calling thread's
+//  arena, hands out buffers above the mark, and rewinds to the mark when it
+//  goes out of scope.  Once the arena has grown to what an op needs, running
+//  the op again takes no memory from the heap.
+//
+//      Pixel buffers that outlive an op go through Pixels_New and
+//  Pixels_Delete, which keep the last few freed buffers of each thread for
+//  the next image of the same size.  Both keep count of the bytes they hold,
+//  for reporting memory use per script command.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef _SCRATCH_H_
+#define _SCRATCH_H_
+
+#include <stddef.h>
+#include <algorithm>
+
+struct ScratchArena;
+
+class Scratch
+{
+	// methods
+public:
+	Scratch();                                  // mark the calling thread's arena
+	~Scratch();                                 // give back everything allocated since
+
+	// count uninitialized Ts, the first on a c_rowAlignment boundary, valid
+	// until this Scratch goes out of scope.  T must need no constructor
+	template <class T> T* New(size_t count)
+	{
+		return (T*)Allocate(count * sizeof(T));
+	}
+
+	// the same, every element set to value
+	template <class T> T* New(size_t count, T value)
+	{
+		T* buffer = New<T>(count);
+		std::fill(buffer, buffer + count, value);
+		return buffer;
+	}
+
+private:
+	Scratch(const Scratch&);
+	Scratch& operator=(const Scratch&);
+
+	void* Allocate(size_t bytes);
+
+	// members
+	ScratchArena&	arena;
+	int				block;                      // the mark: block in use and bytes used of it
+	size_t			used;
+};
+
+// bytes for the pixels of an image, on a c_rowAlignment boundary, and give
+// them back.  Pixels_Delete of NULL does nothing
+void* Pixels_Allocate(size_t bytes);
+void Pixels_Delete(void* pixels);
+
+template <class T> T* Pixels_New(size_t count)
+{
+	return (T*)Pixels_Allocate(count * sizeof(T));
+}
+
+// the number of times the arenas and pixel buffers of every thread have gone
+// to the heap since the program started
+long long Scratch_Heap_Allocations();
+
+// bytes the arenas and pixel buffers of every thread hold from the heap now,
+// with those noted by Count_Other_Bytes, and the most they have held at
+// once since Reset_Peak_Bytes.  Kept pixel buffers count as held;
+// Image_Bytes is just the buffers images are using
+long long Scratch_Held_Bytes();
+long long Scratch_Peak_Bytes();
+long long Image_Bytes();
+void Reset_Peak_Bytes();
+
+// note bytes held outside the arenas and pixel buffers, such as file
+// mappings, libtarga's buffers and the display buffer, or given back when
+// negative, so they count in Scratch_Held_Bytes and its peak
+void Count_Other_Bytes(long long bytes);
+
+#endif
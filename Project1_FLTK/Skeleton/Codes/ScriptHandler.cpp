@@ -12,15 +12,36 @@
 #include "Globals.h"
 #include "ScriptHandler.h"
 #include <iostream>
+#include <iomanip>
 #include <fstream>
+#include <sstream>
 #include <string.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <errno.h>
+#include <math.h>
+#include <string>
+#include <vector>
 #include "TargaImage.h"
+#include "ThreadPool.h"
+#include "FilterChain.h"
+#include "RowStream.h"
+#include "Scratch.h"
 
 using namespace std;
 
 // constants
 const int       c_maxLineLength         = 1000;                         // maximum length of a command in a script
 const char      c_sWhiteSpace[]         = " \t\n\r"; 
+const char      c_sStreamSeparator[]    = ",";                          // between the commands of a stream
+const char      c_sRleOption[]          = "rle";                        // save option for a run length encoded targa
+const char      c_asConvolveMethods[][16] = { "auto", "direct", "separable", "fft" };   // in EConvolveMethod order
+const char      c_asBorderModes[][16]   = { "zero", "clamp", "mirror", "wrap" };          // in EBorderMode order
+const char      c_asLayouts[][16]       = { "interleaved", "planar" };                      // in EPixelLayout order
+const char      c_asFormats[][16]       = { "byte", "float", "16" };                        // in EPixelFormat order
+const int       c_defaultFilterRadius   = 2;                            // radius of filter-box and filter-bartlett when none is given
+const int       c_defaultUnsharpRadius  = 2;                            // blur radius of filter-edge and filter-enhance when none is given
+const double    c_bytesPerMB            = 1024.0 * 1024.0;
 const char      c_asCommands[][32]      = { "load",                     // valid commands
                                             "save",
                                             "run",
@@ -38,6 +59,7 @@ const char      c_asCommands[][32]      = { "load",                     // valid
                                             "filter-bartlett",
                                             "filter-gauss",
                                             "filter-gauss-n",
+                                            "filter-gauss-sigma",
                                             "filter-edge",
                                             "filter-enhance",
                                             "npr-paint",
@@ -50,7 +72,12 @@ const char      c_asCommands[][32]      = { "load",                     // valid
                                             "comp-atop",
                                             "comp-xor",
                                             "diff",
-                                            "rotate"
+                                            "rotate",
+                                            "convolve",
+                                            "threads",
+                                            "layout",
+                                            "format",
+                                            "stream"
                                           };
 
 enum ECommands          // command ids
@@ -72,6 +99,7 @@ enum ECommands          // command ids
     FILTER_BARTLETT,
     FILTER_GAUSS,
     FILTER_GAUSS_N,
+    FILTER_GAUSS_SIGMA,
     FILTER_EDGE,
     FILTER_ENHANCE,
     NPR_PAINT,
@@ -85,22 +113,139 @@ enum ECommands          // command ids
     COMP_XOR,
     DIFF,
     ROTATE,
+    CONVOLVE,
+    THREADS,
+    LAYOUT,
+    FORMAT,
+    STREAM,
     NUM_COMMANDS
 };// ECommands
 
+// globals
+static bool         s_bMemStats = false;                                // report memory after every command, see SetMemStats
+static long long    s_peakBytes = 0;                                    // most memory held by the commands of the innermost running script or command
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Parse the whole of sNumber as a decimal integer.  False, leaving
+//  value alone, if there is no number, anything follows it or it does not
+//  fit an int.
+//
+///////////////////////////////////////////////////////////////////////////////
+static bool ParseInt(const char* sNumber, int& value)
+{
+    if (!sNumber)
+        return false;
+
+    char* sEnd;
+    errno = 0;
+    long parsed = strtol(sNumber, &sEnd, 10);
+    if (sEnd == sNumber || *sEnd || errno == ERANGE || parsed < INT_MIN || parsed > INT_MAX)
+        return false;
+
+    value = (int)parsed;
+    return true;
+}// ParseInt
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Parse the whole of sNumber as a finite float.  False, leaving value
+//  alone, if there is no number, anything follows it or it is out of range.
+//
+///////////////////////////////////////////////////////////////////////////////
+static bool ParseFloat(const char* sNumber, float& value)
+{
+    if (!sNumber)
+        return false;
+
+    char* sEnd;
+    double parsed = strtod(sNumber, &sEnd);
+    if (sEnd == sNumber || *sEnd || !(fabs(parsed) <= 3.0e38))
+        return false;
+
+    value = (float)parsed;
+    return true;
+}// ParseFloat
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Print the memory held after sWhat ran, the change since it started
+//  with startBytes held, and the most it held at once.  The line is
+//  formatted on its own stream, leaving cout's precision and flags alone.
+//
+///////////////////////////////////////////////////////////////////////////////
+static void PrintMemory(const char* sWhat, long long startBytes, long long peakBytes)
+{
+    long long heldBytes = Scratch_Held_Bytes();
+    ostringstream line;
+    line << "memory: " << sWhat << fixed << setprecision(1)
+         << ": " << showpos << (heldBytes - startBytes) / c_bytesPerMB << noshowpos
+         << " MB, held " << heldBytes / c_bytesPerMB
+         << " MB, peak " << peakBytes / c_bytesPerMB
+         << " MB, in images " << Image_Bytes() / c_bytesPerMB << " MB";
+    cout << line.str() << endl;
+}// PrintMemory
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Turn the memory report after every command and script on or off.
+//  Turning it on says what the report counts.
+//
+///////////////////////////////////////////////////////////////////////////////
+void CScriptHandler::SetMemStats(bool bMemStats)
+{
+    if (bMemStats && !s_bMemStats)
+        cout << "memory: counts image pixels, scratch, mapped or read files, libtarga's load buffers and the display "
+             << "buffer; not buffers returned by TargaImage::To_RGB(), which their callers own" << endl;
+    s_bMemStats = bMemStats;
+}// SetMemStats
+
 
 ///////////////////////////////////////////////////////////////////////////////
 //
 //      Execute the given command string on the given image.  If the command
 //  string could not be parsed, an error message is displayed and false is 
-//  returned.  Otherwise return true.
+//  returned.  Otherwise return true.  With SetMemStats on, print the memory
+//  the command took and the most it held at once.
 //  
 ///////////////////////////////////////////////////////////////////////////////
 bool CScriptHandler::HandleCommand(const char* sCommand, TargaImage*& pImage)
+{
+    if (!s_bMemStats || !sCommand || !strlen(sCommand))
+        return ExecuteCommand(sCommand, pImage);
+
+    long long startBytes = Scratch_Held_Bytes(),
+              outerPeakBytes = s_peakBytes;
+    Reset_Peak_Bytes();
+    s_peakBytes = startBytes;
+
+    bool bResult = ExecuteCommand(sCommand, pImage);
+
+    long long peakBytes = Max(s_peakBytes, Scratch_Peak_Bytes());
+    s_peakBytes = Max(outerPeakBytes, peakBytes);
+    PrintMemory(sCommand, startBytes, peakBytes);
+    return bResult;
+}// HandleCommand
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      HandleCommand without the memory report.
+//  
+///////////////////////////////////////////////////////////////////////////////
+bool CScriptHandler::ExecuteCommand(const char* sCommand, TargaImage*& pImage)
 {
     if (!sCommand || !strlen(sCommand))
         return true;
 
+    // several commands may share a line
+    if (strchr(sCommand, ';'))
+        return HandleCommandList(sCommand, pImage);
+
     char* sCommandLine = new char[strlen(sCommand) + 1];
     strcpy(sCommandLine, sCommand);
     char* sToken = strtok(sCommandLine, c_sWhiteSpace);
@@ -112,7 +257,7 @@ bool CScriptHandler::HandleCommand(const char* sCommand, TargaImage*& pImage)
             break;
 
     // if there's no image only a subset of commands are valid
-    if (!pImage && command != LOAD && command != RUN && command != NUM_COMMANDS)
+    if (!pImage && command != LOAD && command != RUN && command != THREADS && command != STREAM && command != NUM_COMMANDS)
     {
         cout << "No image to operate on.  Use \"load\" command to load image." << endl;
         return false;
@@ -145,12 +290,16 @@ bool CScriptHandler::HandleCommand(const char* sCommand, TargaImage*& pImage)
 
         case SAVE:
         {
+            // save file [rle]
             char* sFilename = strtok(NULL, c_sWhiteSpace);
+            char* sOption = sFilename ? strtok(NULL, c_sWhiteSpace) : NULL;
             if (!sFilename)
                 cout << "No filename given." << endl;
+            else if (sOption && strcmp(sOption, c_sRleOption))
+                cout << "Unknown save option:  " << sOption << endl;
 
-            bParsed = sFilename != NULL;
-            bResult =  bParsed && pImage->Save_Image(sFilename);//OPERATION 2: save image
+            bParsed = sFilename != NULL && (!sOption || !strcmp(sOption, c_sRleOption));
+            bResult =  bParsed && pImage->Save_Image(sFilename, sOption != NULL);//OPERATION 2: save image
             break;
         }// SAVE
 
@@ -216,13 +365,31 @@ bool CScriptHandler::HandleCommand(const char* sCommand, TargaImage*& pImage)
 
         case FILTER_BOX:
         {
-            bResult = pImage->Filter_Box();//OPERATION 14: Box Filter
+            char *sRadius = strtok(NULL, c_sWhiteSpace);
+            int radius = c_defaultFilterRadius;
+
+            if ((sRadius && !ParseInt(sRadius, radius)) || radius < 0)
+            {
+                cout << "Invalid filter radius." << endl;
+                bParsed = bResult = false;
+            }// if
+            else
+                bResult = pImage->Filter_Box(radius);//OPERATION 14: Box Filter
             break;
         }// DITHER_BOX
 
         case FILTER_BARTLETT:
         {
-            bResult = pImage->Filter_Bartlett();//OPERATION 15: Bartlett Filter
+            char *sRadius = strtok(NULL, c_sWhiteSpace);
+            int radius = c_defaultFilterRadius;
+
+            if ((sRadius && !ParseInt(sRadius, radius)) || radius < 0)
+            {
+                cout << "Invalid filter radius." << endl;
+                bParsed = bResult = false;
+            }// if
+            else
+                bResult = pImage->Filter_Bartlett(radius);//OPERATION 15: Bartlett Filter
             break;
         }// DITHER_BARTLETT
 
@@ -235,7 +402,13 @@ bool CScriptHandler::HandleCommand(const char* sCommand, TargaImage*& pImage)
         case FILTER_GAUSS_N:
         {
             char *sN = strtok(NULL, c_sWhiteSpace);
-            int N = atoi(sN);
+            int N;
+            if (!ParseInt(sN, N))
+            {
+                cout << "Invalid N; N must be an odd number." << endl;
+                bParsed = bResult = false;
+                break;
+            }// if
             if (N % 2 != 1) {
                cout << "N \"" << N << "\" is not allowed; N must be an odd number." << endl;
                break;
@@ -244,17 +417,41 @@ bool CScriptHandler::HandleCommand(const char* sCommand, TargaImage*& pImage)
             break;
         }// FILTER_GUASS_N
 
-        case FILTER_EDGE:
+        case FILTER_GAUSS_SIGMA:
         {
-            bResult = pImage->Filter_Edge();
+            char *sSigma = strtok(NULL, c_sWhiteSpace);
+            float sigma;
+
+            if (!ParseFloat(sSigma, sigma) || sigma < 0.5f)
+            {
+                cout << "Invalid sigma; sigma must be at least 0.5." << endl;
+                bParsed = bResult = false;
+            }// if
+            else
+                bResult = pImage->Filter_Gaussian_Sigma(sigma);
             break;
-        }// FILTER_EDGE
+        }// FILTER_GAUSS_SIGMA
 
+        case FILTER_EDGE:
         case FILTER_ENHANCE:
         {
-            bResult = pImage->Filter_Enhance();
+            // optional blur radius and edge amount
+            char *sRadius = strtok(NULL, c_sWhiteSpace);
+            char *sAmount = sRadius ? strtok(NULL, c_sWhiteSpace) : NULL;
+            int radius = c_defaultUnsharpRadius;
+            float amount = 1.0f;
+
+            if ((sRadius && !ParseInt(sRadius, radius)) || (sAmount && !ParseFloat(sAmount, amount)) || radius < 1 || amount < 0)
+            {
+                cout << "Invalid radius or amount; radius must be at least 1 and amount not negative." << endl;
+                bParsed = bResult = false;
+            }// if
+            else if (command == FILTER_EDGE)
+                bResult = pImage->Filter_Edge(radius, amount);
+            else
+                bResult = pImage->Filter_Enhance(radius, amount);
             break;
-        }// FILTER_ENHANCE
+        }// FILTER_EDGE, FILTER_ENHANCE
 
         case NPR_PAINT:
         {
@@ -280,7 +477,7 @@ bool CScriptHandler::HandleCommand(const char* sCommand, TargaImage*& pImage)
             char *sScale = strtok(NULL, c_sWhiteSpace);
             float scale;
 
-            if (!sScale || !(scale = (float)atof(sScale)) || scale <= 0)
+            if (!ParseFloat(sScale, scale) || scale <= 0)
             {
                 cout << "Invalid scaling factor." << endl;
                 bParsed = bResult = false;
@@ -402,7 +599,7 @@ bool CScriptHandler::HandleCommand(const char* sCommand, TargaImage*& pImage)
             char *sAngle = strtok(NULL, c_sWhiteSpace);
             float angle;
 
-            if (!sAngle || !(angle = (float)atof(sAngle)))
+            if (!ParseFloat(sAngle, angle))
             {
                 cout << "Invalid rotation angle." << endl;
                 bResult = bParsed = false;
@@ -414,6 +611,126 @@ bool CScriptHandler::HandleCommand(const char* sCommand, TargaImage*& pImage)
             break;
         }// ROTATE
 
+        case CONVOLVE:
+        {
+            // the method and border names may follow the filename in any order
+            char* sFilename = strtok(NULL, c_sWhiteSpace);
+            int method = CONVOLVE_AUTO,
+                border = BORDER_ZERO;
+            bool bOptions = true;
+            for (char* sOption = strtok(NULL, c_sWhiteSpace); sOption && bOptions; sOption = strtok(NULL, c_sWhiteSpace))
+            {
+                int i;
+                for (i = 0; i <= CONVOLVE_FFT && strcmp(sOption, c_asConvolveMethods[i]); ++i);
+                if (i <= CONVOLVE_FFT)
+                {
+                    method = i;
+                    continue;
+                }// if
+
+                for (i = 0; i <= BORDER_WRAP && strcmp(sOption, c_asBorderModes[i]); ++i);
+                if (i <= BORDER_WRAP)
+                    border = i;
+                else
+                {
+                    cout << "Unknown convolution option:  " << sOption << endl;
+                    bOptions = false;
+                }// else
+            }// for
+
+            Kernel* pKernel = bOptions ? Kernel::Load(sFilename) : NULL;
+            if (!pKernel)
+                bParsed = false;
+            bResult = pKernel && pImage->Convolve(*pKernel, (EBorderMode)border, (EConvolveMethod)method);
+            delete pKernel;
+            break;
+        }// CONVOLVE
+
+        case THREADS:
+        {
+            // 0 uses one thread per processor
+            char* sCount = strtok(NULL, c_sWhiteSpace);
+            int count;
+            if (!ParseInt(sCount, count) || count < 0 || count > c_maxThreads)
+            {
+                cout << "Invalid thread count:  " << (sCount ? sCount : "") << "; give a number from 0, for one per processor, to " << c_maxThreads << endl;
+                bResult = bParsed = false;
+            }// if
+            else
+            {
+                ThreadPool::Set_Threads(count);
+                bResult = true;
+            }// else
+            break;
+        }// THREADS
+
+        case LAYOUT:
+        {
+            char* sLayout = strtok(NULL, c_sWhiteSpace);
+            int layout = LAYOUT_PLANAR + 1;
+            if (sLayout)
+                for (layout = 0; layout <= LAYOUT_PLANAR && strcmp(sLayout, c_asLayouts[layout]); ++layout);
+            if (layout > LAYOUT_PLANAR)
+            {
+                cout << "Invalid layout; use interleaved or planar." << endl;
+                bResult = bParsed = false;
+            }// if
+            else
+            {
+                pImage->Set_Layout((EPixelLayout)layout);
+                bResult = true;
+            }// else
+            break;
+        }// LAYOUT
+
+        case FORMAT:
+        {
+            char* sFormat = strtok(NULL, c_sWhiteSpace);
+            int format = FORMAT_16 + 1;
+            if (sFormat)
+                for (format = 0; format <= FORMAT_16 && strcmp(sFormat, c_asFormats[format]); ++format);
+            if (format > FORMAT_16)
+            {
+                cout << "Invalid format; use byte, float or 16." << endl;
+                bResult = bParsed = false;
+            }// if
+            else
+            {
+                pImage->Set_Format((EPixelFormat)format);
+                bResult = true;
+            }// else
+            break;
+        }// FORMAT
+
+        case STREAM:
+        {
+            // stream in out command, command, ...
+            char* sInFile = strtok(NULL, c_sWhiteSpace);
+            char* sOutFile = sInFile ? strtok(NULL, c_sWhiteSpace) : NULL;
+            char* sCommands = sOutFile ? strtok(NULL, "") : NULL;
+            // AddToStream tokenizes each command, so split them all first
+            std::vector<char*> vsStreamed;
+            for (char* sStreamed = sCommands ? strtok(sCommands, c_sStreamSeparator) : NULL; sStreamed; sStreamed = strtok(NULL, c_sStreamSeparator))
+                if (strspn(sStreamed, c_sWhiteSpace) < strlen(sStreamed))
+                    vsStreamed.push_back(sStreamed);
+
+            RowStream stream;
+            bParsed = !vsStreamed.empty();
+            for (size_t i = 0; i < vsStreamed.size() && bParsed; ++i)
+            {
+                if (!AddToStream(vsStreamed[i], stream))
+                {
+                    cout << "Unable to stream command:  " << vsStreamed[i] << endl;
+                    bParsed = false;
+                }// if
+            }// for
+
+            if (vsStreamed.empty())
+                cout << "Usage:  stream infile outfile command[, command ...]" << endl;
+            bResult = bParsed && stream.Run(sInFile, sOutFile);
+            break;
+        }// STREAM
+
         default:
         {
             cout << "Unable to parse command:  " << sCommand << endl;
@@ -425,7 +742,7 @@ bool CScriptHandler::HandleCommand(const char* sCommand, TargaImage*& pImage)
     delete[] sCommandLine;
 
     return bParsed;
-}// HandleCommand
+}// ExecuteCommand
 
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -433,7 +750,8 @@ bool CScriptHandler::HandleCommand(const char* sCommand, TargaImage*& pImage)
 //      The given script file is executed on the given image.  If the file is 
 //  not correctly parsed an error message is printed and false is returned.  
 //  If all commands in the script execute correctly true is returned,
-//  otherwise false is returned.
+//  otherwise false is returned.  With SetMemStats on, print a summary of
+//  the memory the script took.
 //
 ///////////////////////////////////////////////////////////////////////////////
 bool CScriptHandler::HandleScriptFile(const char* sFilename, TargaImage*& pImage)
@@ -452,6 +770,10 @@ bool CScriptHandler::HandleScriptFile(const char* sFilename, TargaImage*& pImage
         return false;
     }// if
 
+    long long startBytes = Scratch_Held_Bytes(),
+              outerPeakBytes = s_peakBytes;
+    s_peakBytes = startBytes;
+
     bool bResult = true;
     char sLine[c_maxLineLength + 1];
     while (!inFile.eof() && bResult)
@@ -463,8 +785,212 @@ bool CScriptHandler::HandleScriptFile(const char* sFilename, TargaImage*& pImage
     }// while
 
     inFile.close();
+
+    if (s_bMemStats)
+    {
+        string sWhat = string("script ") + sFilename;
+        PrintMemory(sWhat.c_str(), startBytes, s_peakBytes);
+    }// if
+    s_peakBytes = Max(outerPeakBytes, s_peakBytes);
     return bResult;
 }// CScriptHandler
 
 
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Execute a line of commands separated by ';'.  Consecutive neighborhood
+//  filters, such as "filter-gauss; filter-edge; filter-enhance", run as one
+//  FilterChain so the image is read once for all of them.  Every other
+//  command runs by itself.  Stops at the first command that fails.
+//
+///////////////////////////////////////////////////////////////////////////////
+bool CScriptHandler::HandleCommandList(const char* sCommands, TargaImage*& pImage)
+{
+    std::vector<std::string> vsCommands;
+    for (const char* sStart = sCommands; sStart; )
+    {
+        const char* sEnd = strchr(sStart, ';');
+        std::string sCommand(sStart, sEnd ? sEnd - sStart : strlen(sStart));
+        if (sCommand.find_first_not_of(c_sWhiteSpace) != std::string::npos)
+            vsCommands.push_back(sCommand);
+        sStart = sEnd ? sEnd + 1 : NULL;
+    }// for
+
+    bool bResult = true;
+    for (size_t i = 0; i < vsCommands.size() && bResult; )
+    {
+        FilterChain chain;
+        size_t j = i;
+        while (j < vsCommands.size() && AddToChain(vsCommands[j].c_str(), chain))
+            ++j;
+
+        if (pImage && j - i > 1)
+        {
+            bResult = pImage->Filter_Chain(chain);
+            i = j;
+        }// if
+        else
+            bResult = ExecuteCommand(vsCommands[i++].c_str(), pImage);
+    }// for
+
+    return bResult;
+}// HandleCommandList
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      If the command is a neighborhood filter that fits the chain, append it
+//  and return true.  Otherwise leave the chain alone and return false, and
+//  let HandleCommand run or reject the command.
+//
+///////////////////////////////////////////////////////////////////////////////
+bool CScriptHandler::AddToChain(const char* sCommand, FilterChain& chain)
+{
+    char* sCommandLine = new char[strlen(sCommand) + 1];
+    strcpy(sCommandLine, sCommand);
+    char* sToken = strtok(sCommandLine, c_sWhiteSpace);
+    char* sArgument = strtok(NULL, c_sWhiteSpace);
+    char* sAmount = NULL;
+
+    int command;
+    for (command = 0; command < NUM_COMMANDS; ++command)
+        if (!strcmp(sToken, c_asCommands[command]))
+            break;
 
+    // only filter-edge and filter-enhance take a second argument
+    if (sArgument && (command == FILTER_EDGE || command == FILTER_ENHANCE))
+        sAmount = strtok(NULL, c_sWhiteSpace);
+
+    bool bAdded = false;
+    if (!strtok(NULL, c_sWhiteSpace))
+    {
+        switch (command)
+        {
+            case FILTER_BOX:
+            case FILTER_BARTLETT:
+            {
+                int radius = c_defaultFilterRadius;
+                if ((!sArgument || ParseInt(sArgument, radius)) && radius >= 0 && chain.Fits(radius, radius))
+                    bAdded = chain.Add((command == FILTER_BOX) ? Kernel::Box(radius) : Kernel::Bartlett(radius));
+                break;
+            }// FILTER_BOX, FILTER_BARTLETT
+
+            case FILTER_GAUSS:
+            {
+                bAdded = !sArgument && chain.Add(Kernel::Gaussian(5));
+                break;
+            }// FILTER_GAUSS
+
+            case FILTER_GAUSS_N:
+            {
+                int N = 0;
+                if (ParseInt(sArgument, N) && N % 2 == 1 && chain.Fits(N / 2, N / 2))
+                    bAdded = chain.Add(Kernel::Gaussian(N));
+                break;
+            }// FILTER_GAUSS_N
+
+            case FILTER_EDGE:
+            case FILTER_ENHANCE:
+            {
+                int radius = c_defaultUnsharpRadius;
+                float amount = 1.0f;
+                if ((sArgument && !ParseInt(sArgument, radius)) || (sAmount && !ParseFloat(sAmount, amount)))
+                    bAdded = false;
+                else if (command == FILTER_EDGE)
+                    bAdded = chain.Add_Edge(radius, amount);
+                else
+                    bAdded = chain.Add_Enhance(radius, amount);
+                break;
+            }// FILTER_EDGE, FILTER_ENHANCE
+        }// switch
+    }// if
+
+    delete[] sCommandLine;
+    return bAdded;
+}// AddToChain
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      If the command is one a RowStream can run, a strip of rows at a time,
+//  append it and return true.  Otherwise leave the stream alone and return
+//  false.
+//
+///////////////////////////////////////////////////////////////////////////////
+bool CScriptHandler::AddToStream(const char* sCommand, RowStream& stream)
+{
+    char* sCommandLine = new char[strlen(sCommand) + 1];
+    strcpy(sCommandLine, sCommand);
+    char* sToken = strtok(sCommandLine, c_sWhiteSpace);
+    char* sArgument = strtok(NULL, c_sWhiteSpace);
+    char* sAmount = sArgument ? strtok(NULL, c_sWhiteSpace) : NULL;
+
+    int command;
+    for (command = 0; command < NUM_COMMANDS; ++command)
+        if (!strcmp(sToken, c_asCommands[command]))
+            break;
+
+    bool bAdded = true;
+    switch (command)
+    {
+        case GRAY:
+            stream.Add(0, [](TargaImage& image) { return image.To_Grayscale(); });
+            break;
+
+        case QUANT_UNIF:
+            stream.Add(0, [](TargaImage& image) { return image.Quant_Uniform(); });
+            break;
+
+        case DITHER_THRESH:
+            stream.Add(0, [](TargaImage& image) { return image.Dither_Threshold(); });
+            break;
+
+        case DITHER_CLUSTER:
+            stream.Add(0, [](TargaImage& image) { return image.Dither_Cluster(); });
+            break;
+
+        case FILTER_BOX:
+        case FILTER_BARTLETT:
+        {
+            int radius = c_defaultFilterRadius;
+            bAdded = (!sArgument || ParseInt(sArgument, radius)) && radius >= 0;
+            if (bAdded && command == FILTER_BOX)
+                stream.Add(radius, [radius](TargaImage& image) { return image.Filter_Box(radius); });
+            else if (bAdded)
+                stream.Add(radius, [radius](TargaImage& image) { return image.Filter_Bartlett(radius); });
+            break;
+        }// FILTER_BOX, FILTER_BARTLETT
+
+        case FILTER_GAUSS:
+            stream.Add(2, [](TargaImage& image) { return image.Filter_Gaussian(); });
+            break;
+
+        case FILTER_GAUSS_N:
+        {
+            int N = 0;
+            bAdded = ParseInt(sArgument, N) && N > 0 && N % 2 == 1;
+            if (bAdded)
+                stream.Add(N / 2, [N](TargaImage& image) { return image.Filter_Gaussian_N(N); });
+            break;
+        }// FILTER_GAUSS_N
+
+        case FILTER_EDGE:
+        case FILTER_ENHANCE:
+        {
+            int radius = c_defaultUnsharpRadius;
+            float amount = 1.0f;
+            bAdded = (!sArgument || ParseInt(sArgument, radius)) && (!sAmount || ParseFloat(sAmount, amount)) && radius >= 1 && amount >= 0;
+            if (bAdded && command == FILTER_EDGE)
+                stream.Add(radius, [radius, amount](TargaImage& image) { return image.Filter_Edge(radius, amount); });
+            else if (bAdded)
+                stream.Add(radius, [radius, amount](TargaImage& image) { return image.Filter_Enhance(radius, amount); });
+            break;
+        }// FILTER_EDGE, FILTER_ENHANCE
+
+        default:
+            bAdded = false;
+    }// switch
+
+    delete[] sCommandLine;
+    return bAdded;
+}// AddToStream
@@ -14,6 +14,8 @@
 #define _C_SCRIPT_HANDLER
 
 class TargaImage;
+class FilterChain;
+class RowStream;
 
 class CScriptHandler
 {
@@ -37,6 +39,49 @@ class CScriptHandler
         //
         ///////////////////////////////////////////////////////////////////////////////
         static bool HandleScriptFile(const char* sFilename, TargaImage*& pImage);
+
+        ///////////////////////////////////////////////////////////////////////////////
+        //
+        //      Turn on or off printing, after every command, the change in memory
+        //  held by images, scratch buffers, file mappings and display buffers
+        //  and the most held while it ran, and a summary at the end of every
+        //  script.
+        //
+        ///////////////////////////////////////////////////////////////////////////////
+        static void SetMemStats(bool bMemStats);
+
+    private:
+        ///////////////////////////////////////////////////////////////////////////////
+        //
+        //      HandleCommand without the memory report.
+        //
+        ///////////////////////////////////////////////////////////////////////////////
+        static bool ExecuteCommand(const char* sCommand, TargaImage*& pImage);
+
+        ///////////////////////////////////////////////////////////////////////////////
+        //
+        //      Execute a line of commands separated by ';'.  Runs of two or more
+        //  neighborhood filters are fused into one FilterChain.
+        //
+        ///////////////////////////////////////////////////////////////////////////////
+        static bool HandleCommandList(const char* sCommands, TargaImage*& pImage);
+
+        ///////////////////////////////////////////////////////////////////////////////
+        //
+        //      If the command is a neighborhood filter that fits the chain, append it
+        //  and return true.  Otherwise leave the chain alone and return false.
+        //
+        ///////////////////////////////////////////////////////////////////////////////
+        static bool AddToChain(const char* sCommand, FilterChain& chain);
+
+        ///////////////////////////////////////////////////////////////////////////////
+        //
+        //      If the command is one a RowStream can run, a strip of rows at a time,
+        //  append it and return true.  Otherwise leave the stream alone and return
+        //  false.
+        //
+        ///////////////////////////////////////////////////////////////////////////////
+        static bool AddToStream(const char* sCommand, RowStream& stream);
 };// CScriptHandler
 
 #endif // _C_SCRIPT_HANDLER
@@ -0,0 +1,852 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Simd.cpp
+//
+//      Scalar, SSE4.1 and AVX2 versions of the fixed point inner loops, and
+//  the runtime dispatch between them.  Un-premultiplying multiplies by a
+//  table of 255 / alpha in 16.16 fixed point, rounded up, which gives the
+//  exact floor for every 8-bit value and alpha.  The vector versions are compiled with
+//  per-function target attributes, so the rest of the program needs no
+//  special compiler flags.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include "Globals.h"
+#include "Simd.h"
+#include <string.h>
+#include <stdlib.h>
+#include <new>
+#ifdef _MSC_VER
+	#include <malloc.h>
+#endif
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+	#define SIMD_X86
+	#include <immintrin.h>
+	#ifdef _MSC_VER
+		#include <intrin.h>
+		#define TARGET_SSE41
+		#define TARGET_AVX2
+	#else
+		#define TARGET_SSE41 __attribute__((target("sse4.1")))
+		#define TARGET_AVX2 __attribute__((target("avx2")))
+	#endif
+#endif
+
+const char c_asSimdLevels[NUM_SIMD_LEVELS][8] = { "scalar", "sse4.1", "avx2" };
+
+static int s_level = -1;       // level in use, -1 until first asked for
+
+// s_reciprocals.table[a] = ceil(255 * 2^16 / a), and 0 for a = 0 so
+// transparent pixels come out black
+static struct Reciprocals
+{
+	Reciprocals()
+	{
+		table[0] = 0;
+		for (unsigned int a = 1; a < 256; a++)
+			table[a] = (255u * 65536u + a - 1) / a;
+	}
+
+	unsigned int table[256];
+} s_reciprocals;
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Scalar versions, used on other processors and for the tails of the
+//  vector loops.
+//
+///////////////////////////////////////////////////////////////////////////////
+static void Multiply_Add_U8_Scalar(const unsigned char* in, int n, unsigned short weight, unsigned short* total)
+{
+	for (int e = 0; e < n; e++)
+		total[e] = (unsigned short)(total[e] + weight * in[e]);
+}// Multiply_Add_U8_Scalar
+
+
+static void Multiply_Add_U16_Scalar(const unsigned short* in, int n, unsigned short weight, unsigned short* total)
+{
+	for (int e = 0; e < n; e++)
+		total[e] = (unsigned short)(total[e] + weight * in[e]);
+}// Multiply_Add_U16_Scalar
+
+
+static void Divide_U16_Scalar(const unsigned short* total, int n, unsigned int divisor, unsigned char* out)
+{
+	for (int e = 0; e < n; e++)
+	{
+		unsigned int val = total[e] / divisor;
+		out[e] = (unsigned char)(val > 255 ? 255 : val);
+	}
+}// Divide_U16_Scalar
+
+
+static void Unpremultiply_Row_Scalar(const unsigned char* rgba, int n, unsigned char* rgb)
+{
+	for (int p = 0; p < n; p++, rgba += 4, rgb += 3)
+	{
+		unsigned int reciprocal = s_reciprocals.table[rgba[3]];
+		for (int k = 0; k < 3; k++)
+		{
+			unsigned int val = (rgba[k] * reciprocal) >> 16;
+			rgb[k] = (unsigned char)(val > 255 ? 255 : val);
+		}
+	}
+}// Unpremultiply_Row_Scalar
+
+
+// x / 255 rounded down, exact for x up to 255 * 255
+static inline unsigned int Divide_255(unsigned int x)
+{
+	return (x + 1 + (x >> 8)) >> 8;
+}// Divide_255
+
+
+static void Premultiply_Row_Scalar(unsigned char* rgba, int n)
+{
+	for (int p = 0; p < n; p++, rgba += 4)
+	{
+		for (int k = 0; k < 3; k++)
+			rgba[k] = (unsigned char)Divide_255(rgba[k] * rgba[3]);
+	}
+}// Premultiply_Row_Scalar
+
+
+static void Strip_Alpha_Row_Scalar(const unsigned char* rgba, int n, unsigned char* rgb)
+{
+	for (int p = 0; p < n; p++, rgba += 4, rgb += 3)
+	{
+		rgb[0] = rgba[0];
+		rgb[1] = rgba[1];
+		rgb[2] = rgba[2];
+	}
+}// Strip_Alpha_Row_Scalar
+
+
+static bool All_Opaque_Scalar(const unsigned char* rgba, int n)
+{
+	unsigned char all = 255;
+	for (int p = 0; p < n; p++)
+		all &= rgba[p * 4 + 3];
+	return all == 255;
+}// All_Opaque_Scalar
+
+
+static void Deinterleave_Row_Scalar(const unsigned char* rgba, int n, unsigned char* r, unsigned char* g, unsigned char* b, unsigned char* a)
+{
+	for (int p = 0; p < n; p++, rgba += 4)
+	{
+		r[p] = rgba[0];
+		g[p] = rgba[1];
+		b[p] = rgba[2];
+		a[p] = rgba[3];
+	}
+}// Deinterleave_Row_Scalar
+
+
+static void Interleave_Row_Scalar(const unsigned char* r, const unsigned char* g, const unsigned char* b, const unsigned char* a, int n, unsigned char* rgba)
+{
+	for (int p = 0; p < n; p++, rgba += 4)
+	{
+		rgba[0] = r[p];
+		rgba[1] = g[p];
+		rgba[2] = b[p];
+		rgba[3] = a[p];
+	}
+}// Interleave_Row_Scalar
+
+
+static void Bgr_To_Rgba_Row_Scalar(const unsigned char* bgr, int n, unsigned char* rgba)
+{
+	for (int p = 0; p < n; p++, bgr += 3, rgba += 4)
+	{
+		rgba[0] = bgr[2];
+		rgba[1] = bgr[1];
+		rgba[2] = bgr[0];
+		rgba[3] = 255;
+	}
+}// Bgr_To_Rgba_Row_Scalar
+
+
+static void Bgra_To_Rgba_Row_Scalar(const unsigned char* bgra, int n, bool keepAlpha, unsigned char* rgba)
+{
+	for (int p = 0; p < n; p++, bgra += 4, rgba += 4)
+	{
+		rgba[0] = bgra[2];
+		rgba[1] = bgra[1];
+		rgba[2] = bgra[0];
+		rgba[3] = keepAlpha ? bgra[3] : 255;
+	}
+}// Bgra_To_Rgba_Row_Scalar
+
+
+static void Unpremultiply_Plane_Scalar(const unsigned char* c, const unsigned char* a, int n, unsigned char* out)
+{
+	for (int p = 0; p < n; p++)
+	{
+		unsigned int val = (c[p] * s_reciprocals.table[a[p]]) >> 16;
+		out[p] = (unsigned char)(val > 255 ? 255 : val);
+	}
+}// Unpremultiply_Plane_Scalar
+
+
+#ifdef SIMD_X86
+
+// The vector division is (total + 0.5) * (1 / divisor) in single precision,
+// truncated.  For totals below 2^16 the exact quotient plus 0.5 / divisor is
+// at least 0.5 / divisor away from either neighboring integer, while the two
+// roundings move it by less than 2^-7 / divisor, so truncation gives the
+// integer quotient.
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      SSE4.1 versions, 8 values per multiply-add and 4 per division.
+//
+///////////////////////////////////////////////////////////////////////////////
+TARGET_SSE41 static void Multiply_Add_U8_SSE41(const unsigned char* in, int n, unsigned short weight, unsigned short* total)
+{
+	__m128i w = _mm_set1_epi16((short)weight);
+	int e = 0;
+	for (; e + 8 <= n; e += 8)
+	{
+		__m128i x = _mm_cvtepu8_epi16(_mm_loadl_epi64((const __m128i*)(in + e)));
+		__m128i t = _mm_loadu_si128((const __m128i*)(total + e));
+		_mm_storeu_si128((__m128i*)(total + e), _mm_add_epi16(t, _mm_mullo_epi16(x, w)));
+	}
+	Multiply_Add_U8_Scalar(in + e, n - e, weight, total + e);
+}// Multiply_Add_U8_SSE41
+
+
+TARGET_SSE41 static void Multiply_Add_U16_SSE41(const unsigned short* in, int n, unsigned short weight, unsigned short* total)
+{
+	__m128i w = _mm_set1_epi16((short)weight);
+	int e = 0;
+	for (; e + 8 <= n; e += 8)
+	{
+		__m128i x = _mm_loadu_si128((const __m128i*)(in + e));
+		__m128i t = _mm_loadu_si128((const __m128i*)(total + e));
+		_mm_storeu_si128((__m128i*)(total + e), _mm_add_epi16(t, _mm_mullo_epi16(x, w)));
+	}
+	Multiply_Add_U16_Scalar(in + e, n - e, weight, total + e);
+}// Multiply_Add_U16_SSE41
+
+
+TARGET_SSE41 static void Divide_U16_SSE41(const unsigned short* total, int n, unsigned int divisor, unsigned char* out)
+{
+	__m128 reciprocal = _mm_set1_ps(1.0f / divisor);
+	__m128 half = _mm_set1_ps(0.5f);
+	__m128i limit = _mm_set1_epi32(255);
+	int e = 0;
+	for (; e + 4 <= n; e += 4)
+	{
+		// clamp before packing, as the byte pack reads quotients past 32767 as negative
+		__m128i x = _mm_cvtepu16_epi32(_mm_loadl_epi64((const __m128i*)(total + e)));
+		__m128 q = _mm_mul_ps(_mm_add_ps(_mm_cvtepi32_ps(x), half), reciprocal);
+		__m128i v = _mm_packus_epi32(_mm_min_epi32(_mm_cvttps_epi32(q), limit), _mm_setzero_si128());
+		v = _mm_packus_epi16(v, v);
+		int bytes = _mm_cvtsi128_si32(v);
+		memcpy(out + e, &bytes, 4);
+	}
+	Divide_U16_Scalar(total + e, n - e, divisor, out + e);
+}// Divide_U16_SSE41
+
+
+// One pixel per 32-bit lane: each channel is multiplied by the reciprocal
+// of the lane's alpha, and the channels are packed back into 3 bytes.
+TARGET_SSE41 static inline __m128i Unpremultiply_Lanes_SSE41(__m128i pixels, __m128i reciprocals)
+{
+	__m128i mask = _mm_set1_epi32(0xFF);
+	__m128i limit = _mm_set1_epi32(255);
+	__m128i r = _mm_and_si128(pixels, mask);
+	__m128i g = _mm_and_si128(_mm_srli_epi32(pixels, 8), mask);
+	__m128i b = _mm_and_si128(_mm_srli_epi32(pixels, 16), mask);
+	r = _mm_min_epi32(_mm_srli_epi32(_mm_mullo_epi32(r, reciprocals), 16), limit);
+	g = _mm_min_epi32(_mm_srli_epi32(_mm_mullo_epi32(g, reciprocals), 16), limit);
+	b = _mm_min_epi32(_mm_srli_epi32(_mm_mullo_epi32(b, reciprocals), 16), limit);
+	return _mm_or_si128(r, _mm_or_si128(_mm_slli_epi32(g, 8), _mm_slli_epi32(b, 16)));
+}// Unpremultiply_Lanes_SSE41
+
+
+TARGET_SSE41 static void Unpremultiply_Row_SSE41(const unsigned char* rgba, int n, unsigned char* rgb)
+{
+	const unsigned int* table = s_reciprocals.table;
+	__m128i squeeze = _mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+	int p = 0;
+	for (; p + 4 <= n; p += 4)
+	{
+		const unsigned char* in = rgba + p * 4;
+		__m128i reciprocals = _mm_setr_epi32(table[in[3]], table[in[7]], table[in[11]], table[in[15]]);
+		__m128i v = _mm_shuffle_epi8(Unpremultiply_Lanes_SSE41(_mm_loadu_si128((const __m128i*)in), reciprocals), squeeze);
+		int last = _mm_extract_epi32(v, 2);
+		_mm_storel_epi64((__m128i*)(rgb + p * 3), v);
+		memcpy(rgb + p * 3 + 8, &last, 4);
+	}
+	Unpremultiply_Row_Scalar(rgba + p * 4, n - p, rgb + p * 3);
+}// Unpremultiply_Row_SSE41
+
+
+TARGET_SSE41 static void Premultiply_Row_SSE41(unsigned char* rgba, int n)
+{
+	__m128i one = _mm_set1_epi16(1);
+	int p = 0;
+	for (; p + 2 <= n; p += 2)
+	{
+		__m128i x = _mm_cvtepu8_epi16(_mm_loadl_epi64((const __m128i*)(rgba + p * 4)));
+		__m128i alpha = _mm_shufflehi_epi16(_mm_shufflelo_epi16(x, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(3, 3, 3, 3));
+		__m128i product = _mm_mullo_epi16(x, alpha);
+		__m128i quotient = _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(product, one), _mm_srli_epi16(product, 8)), 8);
+		quotient = _mm_blend_epi16(quotient, x, 0x88);
+		_mm_storel_epi64((__m128i*)(rgba + p * 4), _mm_packus_epi16(quotient, quotient));
+	}
+	Premultiply_Row_Scalar(rgba + p * 4, n - p);
+}// Premultiply_Row_SSE41
+
+
+TARGET_SSE41 static void Strip_Alpha_Row_SSE41(const unsigned char* rgba, int n, unsigned char* rgb)
+{
+	__m128i squeeze = _mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+	int p = 0;
+	for (; p + 4 <= n; p += 4)
+	{
+		__m128i v = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(rgba + p * 4)), squeeze);
+		int last = _mm_extract_epi32(v, 2);
+		_mm_storel_epi64((__m128i*)(rgb + p * 3), v);
+		memcpy(rgb + p * 3 + 8, &last, 4);
+	}
+	Strip_Alpha_Row_Scalar(rgba + p * 4, n - p, rgb + p * 3);
+}// Strip_Alpha_Row_SSE41
+
+
+TARGET_SSE41 static bool All_Opaque_SSE41(const unsigned char* rgba, int n)
+{
+	__m128i all = _mm_set1_epi8(-1);
+	int p = 0;
+	for (; p + 4 <= n; p += 4)
+		all = _mm_and_si128(all, _mm_loadu_si128((const __m128i*)(rgba + p * 4)));
+	__m128i alpha = _mm_set1_epi32((int)0xFF000000);
+	return _mm_testc_si128(all, alpha) && All_Opaque_Scalar(rgba + p * 4, n - p);
+}// All_Opaque_SSE41
+
+
+// 16 pixels at a time: each register is regrouped into its 4 r, 4 g, 4 b
+// and 4 a bytes, then the 4x4 grid of those groups is transposed.
+TARGET_SSE41 static void Deinterleave_Row_SSE41(const unsigned char* rgba, int n, unsigned char* r, unsigned char* g, unsigned char* b, unsigned char* a)
+{
+	__m128i group = _mm_setr_epi8(0, 4, 8, 12, 1, 5, 9, 13, 2, 6, 10, 14, 3, 7, 11, 15);
+	int p = 0;
+	for (; p + 16 <= n; p += 16)
+	{
+		const __m128i* in = (const __m128i*)(rgba + p * 4);
+		__m128i v0 = _mm_shuffle_epi8(_mm_loadu_si128(in), group);
+		__m128i v1 = _mm_shuffle_epi8(_mm_loadu_si128(in + 1), group);
+		__m128i v2 = _mm_shuffle_epi8(_mm_loadu_si128(in + 2), group);
+		__m128i v3 = _mm_shuffle_epi8(_mm_loadu_si128(in + 3), group);
+		__m128i rg01 = _mm_unpacklo_epi32(v0, v1), ba01 = _mm_unpackhi_epi32(v0, v1);
+		__m128i rg23 = _mm_unpacklo_epi32(v2, v3), ba23 = _mm_unpackhi_epi32(v2, v3);
+		_mm_storeu_si128((__m128i*)(r + p), _mm_unpacklo_epi64(rg01, rg23));
+		_mm_storeu_si128((__m128i*)(g + p), _mm_unpackhi_epi64(rg01, rg23));
+		_mm_storeu_si128((__m128i*)(b + p), _mm_unpacklo_epi64(ba01, ba23));
+		_mm_storeu_si128((__m128i*)(a + p), _mm_unpackhi_epi64(ba01, ba23));
+	}
+	Deinterleave_Row_Scalar(rgba + p * 4, n - p, r + p, g + p, b + p, a + p);
+}// Deinterleave_Row_SSE41
+
+
+TARGET_SSE41 static void Interleave_Row_SSE41(const unsigned char* r, const unsigned char* g, const unsigned char* b, const unsigned char* a, int n, unsigned char* rgba)
+{
+	int p = 0;
+	for (; p + 16 <= n; p += 16)
+	{
+		__m128i vr = _mm_loadu_si128((const __m128i*)(r + p)), vg = _mm_loadu_si128((const __m128i*)(g + p));
+		__m128i vb = _mm_loadu_si128((const __m128i*)(b + p)), va = _mm_loadu_si128((const __m128i*)(a + p));
+		__m128i rgLow = _mm_unpacklo_epi8(vr, vg), rgHigh = _mm_unpackhi_epi8(vr, vg);
+		__m128i baLow = _mm_unpacklo_epi8(vb, va), baHigh = _mm_unpackhi_epi8(vb, va);
+		__m128i* out = (__m128i*)(rgba + p * 4);
+		_mm_storeu_si128(out, _mm_unpacklo_epi16(rgLow, baLow));
+		_mm_storeu_si128(out + 1, _mm_unpackhi_epi16(rgLow, baLow));
+		_mm_storeu_si128(out + 2, _mm_unpacklo_epi16(rgHigh, baHigh));
+		_mm_storeu_si128(out + 3, _mm_unpackhi_epi16(rgHigh, baHigh));
+	}
+	Interleave_Row_Scalar(r + p, g + p, b + p, a + p, n - p, rgba + p * 4);
+}// Interleave_Row_SSE41
+
+
+// 4 pixels of 3 bytes per register; the load reads 4 bytes past them, so the
+// loop stops 2 pixels early
+TARGET_SSE41 static void Bgr_To_Rgba_Row_SSE41(const unsigned char* bgr, int n, unsigned char* rgba)
+{
+	__m128i spread = _mm_setr_epi8(2, 1, 0, -1, 5, 4, 3, -1, 8, 7, 6, -1, 11, 10, 9, -1);
+	__m128i alpha = _mm_set1_epi32((int)0xFF000000);
+	int p = 0;
+	for (; p + 6 <= n; p += 4)
+	{
+		__m128i v = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(bgr + p * 3)), spread);
+		_mm_storeu_si128((__m128i*)(rgba + p * 4), _mm_or_si128(v, alpha));
+	}
+	Bgr_To_Rgba_Row_Scalar(bgr + p * 3, n - p, rgba + p * 4);
+}// Bgr_To_Rgba_Row_SSE41
+
+
+TARGET_SSE41 static void Bgra_To_Rgba_Row_SSE41(const unsigned char* bgra, int n, bool keepAlpha, unsigned char* rgba)
+{
+	__m128i swap = _mm_setr_epi8(2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15);
+	__m128i alpha = _mm_set1_epi32(keepAlpha ? 0 : (int)0xFF000000);
+	int p = 0;
+	for (; p + 4 <= n; p += 4)
+	{
+		__m128i v = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(bgra + p * 4)), swap);
+		_mm_storeu_si128((__m128i*)(rgba + p * 4), _mm_or_si128(v, alpha));
+	}
+	Bgra_To_Rgba_Row_Scalar(bgra + p * 4, n - p, keepAlpha, rgba + p * 4);
+}// Bgra_To_Rgba_Row_SSE41
+
+
+TARGET_SSE41 static void Unpremultiply_Plane_SSE41(const unsigned char* c, const unsigned char* a, int n, unsigned char* out)
+{
+	const unsigned int* table = s_reciprocals.table;
+	__m128i limit = _mm_set1_epi32(255);
+	int p = 0;
+	for (; p + 8 <= n; p += 8)
+	{
+		__m128i bytes = _mm_loadl_epi64((const __m128i*)(c + p));
+		__m128i low = _mm_cvtepu8_epi32(bytes);
+		__m128i high = _mm_cvtepu8_epi32(_mm_srli_si128(bytes, 4));
+		low = _mm_mullo_epi32(low, _mm_setr_epi32(table[a[p]], table[a[p + 1]], table[a[p + 2]], table[a[p + 3]]));
+		high = _mm_mullo_epi32(high, _mm_setr_epi32(table[a[p + 4]], table[a[p + 5]], table[a[p + 6]], table[a[p + 7]]));
+		low = _mm_min_epi32(_mm_srli_epi32(low, 16), limit);
+		high = _mm_min_epi32(_mm_srli_epi32(high, 16), limit);
+		__m128i words = _mm_packus_epi32(low, high);
+		_mm_storel_epi64((__m128i*)(out + p), _mm_packus_epi16(words, words));
+	}
+	Unpremultiply_Plane_Scalar(c + p, a + p, n - p, out + p);
+}// Unpremultiply_Plane_SSE41
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      AVX2 versions, 16 values per multiply-add and 8 per division.
+//
+///////////////////////////////////////////////////////////////////////////////
+TARGET_AVX2 static void Multiply_Add_U8_AVX2(const unsigned char* in, int n, unsigned short weight, unsigned short* total)
+{
+	__m256i w = _mm256_set1_epi16((short)weight);
+	int e = 0;
+	for (; e + 16 <= n; e += 16)
+	{
+		__m256i x = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)(in + e)));
+		__m256i t = _mm256_loadu_si256((const __m256i*)(total + e));
+		_mm256_storeu_si256((__m256i*)(total + e), _mm256_add_epi16(t, _mm256_mullo_epi16(x, w)));
+	}
+	Multiply_Add_U8_Scalar(in + e, n - e, weight, total + e);
+}// Multiply_Add_U8_AVX2
+
+
+TARGET_AVX2 static void Multiply_Add_U16_AVX2(const unsigned short* in, int n, unsigned short weight, unsigned short* total)
+{
+	__m256i w = _mm256_set1_epi16((short)weight);
+	int e = 0;
+	for (; e + 16 <= n; e += 16)
+	{
+		__m256i x = _mm256_loadu_si256((const __m256i*)(in + e));
+		__m256i t = _mm256_loadu_si256((const __m256i*)(total + e));
+		_mm256_storeu_si256((__m256i*)(total + e), _mm256_add_epi16(t, _mm256_mullo_epi16(x, w)));
+	}
+	Multiply_Add_U16_Scalar(in + e, n - e, weight, total + e);
+}// Multiply_Add_U16_AVX2
+
+
+TARGET_AVX2 static void Divide_U16_AVX2(const unsigned short* total, int n, unsigned int divisor, unsigned char* out)
+{
+	__m256 reciprocal = _mm256_set1_ps(1.0f / divisor);
+	__m256 half = _mm256_set1_ps(0.5f);
+	__m256i limit = _mm256_set1_epi32(255);
+	int e = 0;
+	for (; e + 8 <= n; e += 8)
+	{
+		__m256i x = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*)(total + e)));
+		__m256 q = _mm256_mul_ps(_mm256_add_ps(_mm256_cvtepi32_ps(x), half), reciprocal);
+		__m256i v = _mm256_min_epi32(_mm256_cvttps_epi32(q), limit);
+		__m128i packed = _mm_packus_epi32(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1));
+		_mm_storel_epi64((__m128i*)(out + e), _mm_packus_epi16(packed, packed));
+	}
+	Divide_U16_Scalar(total + e, n - e, divisor, out + e);
+}// Divide_U16_AVX2
+
+
+TARGET_AVX2 static void Unpremultiply_Row_AVX2(const unsigned char* rgba, int n, unsigned char* rgb)
+{
+	__m256i mask = _mm256_set1_epi32(0xFF);
+	__m256i limit = _mm256_set1_epi32(255);
+	__m256i squeeze = _mm256_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1,
+	                                   0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+	int p = 0;
+	for (; p + 8 <= n; p += 8)
+	{
+		__m256i pixels = _mm256_loadu_si256((const __m256i*)(rgba + p * 4));
+		__m256i reciprocals = _mm256_i32gather_epi32((const int*)s_reciprocals.table, _mm256_srli_epi32(pixels, 24), 4);
+		__m256i r = _mm256_and_si256(pixels, mask);
+		__m256i g = _mm256_and_si256(_mm256_srli_epi32(pixels, 8), mask);
+		__m256i b = _mm256_and_si256(_mm256_srli_epi32(pixels, 16), mask);
+		r = _mm256_min_epi32(_mm256_srli_epi32(_mm256_mullo_epi32(r, reciprocals), 16), limit);
+		g = _mm256_min_epi32(_mm256_srli_epi32(_mm256_mullo_epi32(g, reciprocals), 16), limit);
+		b = _mm256_min_epi32(_mm256_srli_epi32(_mm256_mullo_epi32(b, reciprocals), 16), limit);
+		__m256i v = _mm256_or_si256(r, _mm256_or_si256(_mm256_slli_epi32(g, 8), _mm256_slli_epi32(b, 16)));
+		v = _mm256_shuffle_epi8(v, squeeze);
+
+		//12 bytes from each half
+		__m128i low = _mm256_castsi256_si128(v), high = _mm256_extracti128_si256(v, 1);
+		int lowLast = _mm_extract_epi32(low, 2), highLast = _mm_extract_epi32(high, 2);
+		unsigned char* out = rgb + p * 3;
+		_mm_storel_epi64((__m128i*)out, low);
+		memcpy(out + 8, &lowLast, 4);
+		_mm_storel_epi64((__m128i*)(out + 12), high);
+		memcpy(out + 20, &highLast, 4);
+	}
+	Unpremultiply_Row_Scalar(rgba + p * 4, n - p, rgb + p * 3);
+}// Unpremultiply_Row_AVX2
+
+
+TARGET_AVX2 static void Premultiply_Row_AVX2(unsigned char* rgba, int n)
+{
+	__m256i one = _mm256_set1_epi16(1);
+	int p = 0;
+	for (; p + 4 <= n; p += 4)
+	{
+		__m256i x = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)(rgba + p * 4)));
+		__m256i alpha = _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(x, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(3, 3, 3, 3));
+		__m256i product = _mm256_mullo_epi16(x, alpha);
+		__m256i quotient = _mm256_srli_epi16(_mm256_add_epi16(_mm256_add_epi16(product, one), _mm256_srli_epi16(product, 8)), 8);
+		quotient = _mm256_blend_epi16(quotient, x, 0x88);
+		__m256i packed = _mm256_permute4x64_epi64(_mm256_packus_epi16(quotient, quotient), _MM_SHUFFLE(3, 1, 2, 0));
+		_mm_storeu_si128((__m128i*)(rgba + p * 4), _mm256_castsi256_si128(packed));
+	}
+	Premultiply_Row_Scalar(rgba + p * 4, n - p);
+}// Premultiply_Row_AVX2
+
+
+TARGET_AVX2 static void Strip_Alpha_Row_AVX2(const unsigned char* rgba, int n, unsigned char* rgb)
+{
+	__m256i squeeze = _mm256_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1,
+	                                   0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+	__m256i gather = _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 3, 7);
+	int p = 0;
+	for (; p + 8 <= n; p += 8)
+	{
+		//24 bytes, in the low 6 dwords once the halves are pulled together
+		__m256i v = _mm256_shuffle_epi8(_mm256_loadu_si256((const __m256i*)(rgba + p * 4)), squeeze);
+		v = _mm256_permutevar8x32_epi32(v, gather);
+		unsigned char* out = rgb + p * 3;
+		_mm_storeu_si128((__m128i*)out, _mm256_castsi256_si128(v));
+		_mm_storel_epi64((__m128i*)(out + 16), _mm256_extracti128_si256(v, 1));
+	}
+	Strip_Alpha_Row_Scalar(rgba + p * 4, n - p, rgb + p * 3);
+}// Strip_Alpha_Row_AVX2
+
+
+TARGET_AVX2 static bool All_Opaque_AVX2(const unsigned char* rgba, int n)
+{
+	__m256i all = _mm256_set1_epi8(-1);
+	int p = 0;
+	for (; p + 8 <= n; p += 8)
+		all = _mm256_and_si256(all, _mm256_loadu_si256((const __m256i*)(rgba + p * 4)));
+	__m256i alpha = _mm256_set1_epi32((int)0xFF000000);
+	return _mm256_testc_si256(all, alpha) && All_Opaque_Scalar(rgba + p * 4, n - p);
+}// All_Opaque_AVX2
+
+
+TARGET_AVX2 static void Unpremultiply_Plane_AVX2(const unsigned char* c, const unsigned char* a, int n, unsigned char* out)
+{
+	const int* table = (const int*)s_reciprocals.table;
+	__m256i limit = _mm256_set1_epi32(255);
+	int p = 0;
+	for (; p + 16 <= n; p += 16)
+	{
+		__m256i low = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)(c + p)));
+		__m256i high = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)(c + p + 8)));
+		__m256i alphaLow = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)(a + p)));
+		__m256i alphaHigh = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)(a + p + 8)));
+		low = _mm256_mullo_epi32(low, _mm256_i32gather_epi32(table, alphaLow, 4));
+		high = _mm256_mullo_epi32(high, _mm256_i32gather_epi32(table, alphaHigh, 4));
+		low = _mm256_min_epi32(_mm256_srli_epi32(low, 16), limit);
+		high = _mm256_min_epi32(_mm256_srli_epi32(high, 16), limit);
+
+		//packing works within 128-bit halves, so put the quarters back in order
+		__m256i words = _mm256_permute4x64_epi64(_mm256_packus_epi32(low, high), _MM_SHUFFLE(3, 1, 2, 0));
+		__m256i bytes = _mm256_permute4x64_epi64(_mm256_packus_epi16(words, words), _MM_SHUFFLE(3, 1, 2, 0));
+		_mm_storeu_si128((__m128i*)(out + p), _mm256_castsi256_si128(bytes));
+	}
+	Unpremultiply_Plane_Scalar(c + p, a + p, n - p, out + p);
+}// Unpremultiply_Plane_AVX2
+
+#endif // SIMD_X86
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Return the best level this processor and operating system support.
+//  AVX2 also needs the OS to save the upper halves of the ymm registers.
+//
+///////////////////////////////////////////////////////////////////////////////
+ESimdLevel Simd_Detect()
+{
+#if defined(SIMD_X86) && defined(_MSC_VER)
+	int info[4];
+	__cpuid(info, 0);
+	int maxLeaf = info[0];
+
+	__cpuid(info, 1);
+	bool sse41 = (info[2] & (1 << 19)) != 0;
+	bool osSavesYmm = (info[2] & (1 << 27)) && (_xgetbv(0) & 6) == 6;
+
+	bool avx2 = false;
+	if (maxLeaf >= 7)
+	{
+		__cpuidex(info, 7, 0);
+		avx2 = osSavesYmm && (info[1] & (1 << 5));
+	}
+
+	return avx2 ? SIMD_AVX2 : (sse41 ? SIMD_SSE41 : SIMD_SCALAR);
+#elif defined(SIMD_X86)
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+		return SIMD_AVX2;
+	if (__builtin_cpu_supports("sse4.1"))
+		return SIMD_SSE41;
+	return SIMD_SCALAR;
+#else
+	return SIMD_SCALAR;
+#endif
+}// Simd_Detect
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Return the level in use.
+//
+///////////////////////////////////////////////////////////////////////////////
+ESimdLevel Simd_Level()
+{
+	if (s_level < 0)
+		s_level = Simd_Detect();
+	return (ESimdLevel)s_level;
+}// Simd_Level
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Use the given level, or the detected one if the processor can not run
+//  it.
+//
+///////////////////////////////////////////////////////////////////////////////
+void Simd_Set_Level(ESimdLevel level)
+{
+	s_level = Min(level, Simd_Detect());
+}// Simd_Set_Level
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Dispatch to the version for the level in use.
+//
+///////////////////////////////////////////////////////////////////////////////
+void Multiply_Add_U8(const unsigned char* in, int n, unsigned short weight, unsigned short* total)
+{
+#ifdef SIMD_X86
+	switch (Simd_Level())
+	{
+	case SIMD_AVX2:     Multiply_Add_U8_AVX2(in, n, weight, total); return;
+	case SIMD_SSE41:    Multiply_Add_U8_SSE41(in, n, weight, total); return;
+	default:            break;
+	}
+#endif
+	Multiply_Add_U8_Scalar(in, n, weight, total);
+}// Multiply_Add_U8
+
+
+void Multiply_Add_U16(const unsigned short* in, int n, unsigned short weight, unsigned short* total)
+{
+#ifdef SIMD_X86
+	switch (Simd_Level())
+	{
+	case SIMD_AVX2:     Multiply_Add_U16_AVX2(in, n, weight, total); return;
+	case SIMD_SSE41:    Multiply_Add_U16_SSE41(in, n, weight, total); return;
+	default:            break;
+	}
+#endif
+	Multiply_Add_U16_Scalar(in, n, weight, total);
+}// Multiply_Add_U16
+
+
+void Divide_U16(const unsigned short* total, int n, unsigned int divisor, unsigned char* out)
+{
+#ifdef SIMD_X86
+	switch (Simd_Level())
+	{
+	case SIMD_AVX2:     Divide_U16_AVX2(total, n, divisor, out); return;
+	case SIMD_SSE41:    Divide_U16_SSE41(total, n, divisor, out); return;
+	default:            break;
+	}
+#endif
+	Divide_U16_Scalar(total, n, divisor, out);
+}// Divide_U16
+
+
+void Unpremultiply_Row(const unsigned char* rgba, int n, unsigned char* rgb)
+{
+#ifdef SIMD_X86
+	switch (Simd_Level())
+	{
+	case SIMD_AVX2:     Unpremultiply_Row_AVX2(rgba, n, rgb); return;
+	case SIMD_SSE41:    Unpremultiply_Row_SSE41(rgba, n, rgb); return;
+	default:            break;
+	}
+#endif
+	Unpremultiply_Row_Scalar(rgba, n, rgb);
+}// Unpremultiply_Row
+
+
+void Premultiply_Row(unsigned char* rgba, int n)
+{
+#ifdef SIMD_X86
+	switch (Simd_Level())
+	{
+	case SIMD_AVX2:     Premultiply_Row_AVX2(rgba, n); return;
+	case SIMD_SSE41:    Premultiply_Row_SSE41(rgba, n); return;
+	default:            break;
+	}
+#endif
+	Premultiply_Row_Scalar(rgba, n);
+}// Premultiply_Row
+
+
+void Strip_Alpha_Row(const unsigned char* rgba, int n, unsigned char* rgb)
+{
+#ifdef SIMD_X86
+	switch (Simd_Level())
+	{
+	case SIMD_AVX2:     Strip_Alpha_Row_AVX2(rgba, n, rgb); return;
+	case SIMD_SSE41:    Strip_Alpha_Row_SSE41(rgba, n, rgb); return;
+	default:            break;
+	}
+#endif
+	Strip_Alpha_Row_Scalar(rgba, n, rgb);
+}// Strip_Alpha_Row
+
+
+bool All_Opaque(const unsigned char* rgba, int n)
+{
+#ifdef SIMD_X86
+	switch (Simd_Level())
+	{
+	case SIMD_AVX2:     return All_Opaque_AVX2(rgba, n);
+	case SIMD_SSE41:    return All_Opaque_SSE41(rgba, n);
+	default:            break;
+	}
+#endif
+	return All_Opaque_Scalar(rgba, n);
+}// All_Opaque
+
+
+// byte shuffles gain nothing from the wider registers, so AVX2 uses the SSE4.1
+// versions, here and for the targa rows
+void Deinterleave_Row(const unsigned char* rgba, int n, unsigned char* r, unsigned char* g, unsigned char* b, unsigned char* a)
+{
+#ifdef SIMD_X86
+	if (Simd_Level() >= SIMD_SSE41)
+	{
+		Deinterleave_Row_SSE41(rgba, n, r, g, b, a);
+		return;
+	}
+#endif
+	Deinterleave_Row_Scalar(rgba, n, r, g, b, a);
+}// Deinterleave_Row
+
+
+void Interleave_Row(const unsigned char* r, const unsigned char* g, const unsigned char* b, const unsigned char* a, int n, unsigned char* rgba)
+{
+#ifdef SIMD_X86
+	if (Simd_Level() >= SIMD_SSE41)
+	{
+		Interleave_Row_SSE41(r, g, b, a, n, rgba);
+		return;
+	}
+#endif
+	Interleave_Row_Scalar(r, g, b, a, n, rgba);
+}// Interleave_Row
+
+
+void Bgr_To_Rgba_Row(const unsigned char* bgr, int n, unsigned char* rgba)
+{
+#ifdef SIMD_X86
+	if (Simd_Level() >= SIMD_SSE41)
+	{
+		Bgr_To_Rgba_Row_SSE41(bgr, n, rgba);
+		return;
+	}
+#endif
+	Bgr_To_Rgba_Row_Scalar(bgr, n, rgba);
+}// Bgr_To_Rgba_Row
+
+
+void Bgra_To_Rgba_Row(const unsigned char* bgra, int n, bool keepAlpha, unsigned char* rgba)
+{
+#ifdef SIMD_X86
+	if (Simd_Level() >= SIMD_SSE41)
+	{
+		Bgra_To_Rgba_Row_SSE41(bgra, n, keepAlpha, rgba);
+		return;
+	}
+#endif
+	Bgra_To_Rgba_Row_Scalar(bgra, n, keepAlpha, rgba);
+}// Bgra_To_Rgba_Row
+
+
+void Unpremultiply_Plane(const unsigned char* c, const unsigned char* a, int n, unsigned char* out)
+{
+#ifdef SIMD_X86
+	switch (Simd_Level())
+	{
+	case SIMD_AVX2:     Unpremultiply_Plane_AVX2(c, a, n, out); return;
+	case SIMD_SSE41:    Unpremultiply_Plane_SSE41(c, a, n, out); return;
+	default:            break;
+	}
+#endif
+	Unpremultiply_Plane_Scalar(c, a, n, out);
+}// Unpremultiply_Plane
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Aligned buffers.  Both allocators fail like new does, by throwing.
+//
+///////////////////////////////////////////////////////////////////////////////
+int Aligned_Stride(int rowBytes)
+{
+	return (rowBytes + c_rowAlignment - 1) / c_rowAlignment * c_rowAlignment;
+}// Aligned_Stride
+
+
+unsigned char* Aligned_New(size_t bytes)
+{
+	void* buffer;
+#ifdef _MSC_VER
+	buffer = _aligned_malloc(Max(bytes, (size_t)1), c_rowAlignment);
+#else
+	if (posix_memalign(&buffer, c_rowAlignment, Max(bytes, (size_t)1)) != 0)
+		buffer = NULL;
+#endif
+	if (!buffer)
+		throw std::bad_alloc();
+	return (unsigned char*)buffer;
+}// Aligned_New
+
+
+void Aligned_Delete(unsigned char* buffer)
+{
+#ifdef _MSC_VER
+	_aligned_free(buffer);
+#else
+	free(buffer);
+#endif
+}// Aligned_Delete
@@ -0,0 +1,79 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Simd.h
+//
+//      Vector inner loops for the convolution engine, in 16-bit fixed point,
+//  for converting rows between premultiplied and straight alpha, for
+//  converting between interleaved RGBA and separate channel planes, and for
+//  turning the BGR(A) rows of targa files into RGBA.
+//  The instruction set is picked when the program runs, so one binary uses
+//  AVX2 where it exists, SSE4.1 where it does not, and plain C++ elsewhere.
+//  Every level gives exactly the same results.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef _SIMD_H_
+#define _SIMD_H_
+
+#include <stddef.h>
+
+// instruction sets, in increasing order
+enum ESimdLevel
+{
+	SIMD_SCALAR,
+	SIMD_SSE41,
+	SIMD_AVX2,
+	NUM_SIMD_LEVELS
+};
+
+extern const char c_asSimdLevels[NUM_SIMD_LEVELS][8];      // names of the levels
+
+ESimdLevel Simd_Detect();                  // best level this processor and OS support
+ESimdLevel Simd_Level();                   // level in use, the detected one unless overridden
+void Simd_Set_Level(ESimdLevel level);     // use a lower level, for timing and testing
+
+// total[e] += weight * in[e] for e < n.  The caller makes sure no total passes 65535.
+void Multiply_Add_U8(const unsigned char* in, int n, unsigned short weight, unsigned short* total);
+void Multiply_Add_U16(const unsigned short* in, int n, unsigned short weight, unsigned short* total);
+
+// out[e] = min(total[e] / divisor, 255) for e < n, with integer division
+void Divide_U16(const unsigned short* total, int n, unsigned int divisor, unsigned char* out);
+
+// rgb[3p + k] = min(floor(255 * rgba[4p + k] / rgba[4p + 3]), 255) for p < n, black where alpha is 0
+void Unpremultiply_Row(const unsigned char* rgba, int n, unsigned char* rgb);
+
+// rgba[4p + k] = floor(rgba[4p + k] * rgba[4p + 3] / 255) for p < n and k < 3
+void Premultiply_Row(unsigned char* rgba, int n);
+
+// rgb[3p + k] = rgba[4p + k] for p < n, which is the un-premultiplied row when every alpha is 255
+void Strip_Alpha_Row(const unsigned char* rgba, int n, unsigned char* rgb);
+
+// true if rgba[4p + 3] == 255 for every p < n
+bool All_Opaque(const unsigned char* rgba, int n);
+
+// split n RGBA pixels into the planes r, g, b and a, and join them back
+void Deinterleave_Row(const unsigned char* rgba, int n, unsigned char* r, unsigned char* g, unsigned char* b, unsigned char* a);
+void Interleave_Row(const unsigned char* r, const unsigned char* g, const unsigned char* b, const unsigned char* a, int n, unsigned char* rgba);
+
+// out[p] = min(floor(255 * c[p] / a[p]), 255) for p < n, 0 where a[p] is 0; Unpremultiply_Row for a plane
+void Unpremultiply_Plane(const unsigned char* c, const unsigned char* a, int n, unsigned char* out);
+
+// rgba[4p + k] = bgr[3p + 2 - k] for p < n and k < 3, and alpha 255: a 24-bit targa row
+void Bgr_To_Rgba_Row(const unsigned char* bgr, int n, unsigned char* rgba);
+
+// rgba[4p + k] = bgra[4p + 2 - k] for p < n and k < 3, and alpha bgra[4p + 3],
+// or 255 if not keepAlpha: a 32-bit targa row, still straight alpha
+void Bgra_To_Rgba_Row(const unsigned char* bgra, int n, bool keepAlpha, unsigned char* rgba);
+
+// pixel buffers start on this many bytes, a cache line and a 512-bit register,
+// and so does every row of an image with an aligned stride
+const int c_rowAlignment = 64;
+
+// rowBytes rounded up to a multiple of c_rowAlignment
+int Aligned_Stride(int rowBytes);
+
+// allocate and free a buffer that starts on a c_rowAlignment boundary
+unsigned char* Aligned_New(size_t bytes);
+void Aligned_Delete(unsigned char* buffer);
+
+#endif
@@ -0,0 +1,833 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+//      TargaFile.cpp
+//
+//      Implementation of the targa reader and writer.  A raw file's rows are
+//  converted straight from the bytes read; a run length encoded file is
+//  expanded a row at a time into scratch, packets carrying over from one row
+//  to the next, and converted from there.  Files are read through a
+//  MappedFile, so the rows are converted straight out of the page cache.
+//  The results match tga_load's to the byte: its float premultiply comes out
+//  as floor(c * a / 255) for every channel and alpha, which is what
+//  Premultiply_Row computes.  Written files match tga_write_raw's the same
+//  way, through a table of its float division.
+//
+//      TargaReader reads the file through a buffer of two rows' worth of its
+//  bytes at most, topped up before each row, so a row never runs past the
+//  end of what has been read unless the file itself ends there.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include "Globals.h"
+#include "TargaFile.h"
+#include "libtarga.h"
+#include "Simd.h"
+#include "Scratch.h"
+#include "MappedFile.h"
+#include "ThreadPool.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+using namespace std;
+
+// rows are gathered into this many bytes, at least one row, for each write
+const size_t c_saveChunkBytes = 1 << 20;
+
+// the image id tga_write_raw puts in every file
+const char c_sTargaId[] = "written with libtarga";
+
+// s_straight.table[a][c] is what tga_write_raw's float division makes of
+// channel c with alpha a.  It is not always floor(255 * c / a), so
+// Unpremultiply_Row can not stand in for it
+static struct StraightTable
+{
+	StraightTable()
+	{
+		for (int a = 0; a < 256; a++)
+		{
+			for (int c = 0; c < 256; c++)
+			{
+				float value = c / 255.0f, alpha = a / 255.0f;
+				if (alpha > 0.0001)
+					value /= alpha;
+				table[a][c] = (unsigned char)(value > 1.0f ? 255.0f : value * 255.0f);
+			}
+		}
+	}
+
+	unsigned char table[256][256];
+} s_straight;
+
+// where the pixels of the files TargaWriter writes start
+const int c_targaDataOffset = c_targaHeaderSize + sizeof(c_sTargaId) - 1;
+
+// a run length encoded file TargaWriter writes keeps where every
+// c_rowIndexRows'th row starts in a tag of its developer area, found
+// through the TGA 2.0 footer, which ends with the signature and its 0.
+// Readers that do not know the tag skip it
+const int c_rowIndexRows = 32;
+const int c_rowIndexTag = 0x5249;                       // developer tags are 0 to 32767
+const char c_sTargaSignature[] = "TRUEVISION-XFILE.";
+const int c_targaFooterSize = 8 + sizeof(c_sTargaSignature);
+const int c_devDirectorySize = 2 + 10;                  // a tag count and one tag: its number, offset and size
+
+
+// a little endian 16-bit field of the header
+static int Field_16(const unsigned char* bytes)
+{
+	return bytes[0] | (bytes[1] << 8);
+}// Field_16
+
+
+// a little endian 32-bit field of the footer or developer area
+static size_t Field_32(const unsigned char* bytes)
+{
+	return bytes[0] | (bytes[1] << 8) | (bytes[2] << 16) | ((size_t)bytes[3] << 24);
+}// Field_32
+
+
+// write value as a little endian field of count bytes
+static void Put_Field(unsigned char* bytes, size_t value, int count)
+{
+	for (int i = 0; i < count; i++)
+		bytes[i] = (unsigned char)(value >> (8 * i));
+}// Put_Field
+
+
+// copy bytes bytes of whole pixels from in, the pixels there are before end
+// and zeros for the rest, and move in past them.  A pixel cut short by the
+// end is zero, as in tga_load
+static void Copy_Padded(unsigned char* out, const unsigned char*& in, const unsigned char* end, size_t bytes, int bytesPerPixel)
+{
+	size_t available = in < end ? Min(bytes, (size_t)(end - in)) : 0;
+	size_t whole = available / bytesPerPixel * bytesPerPixel;
+	memcpy(out, in, whole);
+	memset(out + whole, 0, bytes - whole);
+	in += available;
+}// Copy_Padded
+
+
+// a premultiplied RGBA row as a targa's straight BGRA.  Opaque pixels come
+// out unchanged, so opaque rows only need red and blue swapped
+static void Straight_Bgra_Row(const unsigned char* rgba, int n, bool opaque, unsigned char* bgra)
+{
+	if (opaque || All_Opaque(rgba, n))
+	{
+		Bgra_To_Rgba_Row(rgba, n, true, bgra);
+		return;
+	}
+
+	for (int p = 0; p < n; p++, rgba += 4, bgra += 4)
+	{
+		const unsigned char* straight = s_straight.table[rgba[3]];
+		bgra[0] = straight[rgba[2]];
+		bgra[1] = straight[rgba[1]];
+		bgra[2] = straight[rgba[0]];
+		bgra[3] = rgba[3];
+	}
+}// Straight_Bgra_Row
+
+
+// the four bytes of a pixel as one number, for comparing
+static unsigned int Pixel_Bits(const unsigned char* pixel)
+{
+	unsigned int bits;
+	memcpy(&bits, pixel, 4);
+	return bits;
+}// Pixel_Bits
+
+
+// the most bytes Rle_Encode_Row writes for a row of width pixels: every
+// pixel raw, with a packet header for every 128
+static size_t Rle_Row_Limit(int width)
+{
+	return (size_t)width * 4 + (width + 127) / 128;
+}// Rle_Row_Limit
+
+
+// run length encode a row of width BGRA pixels into out: two or more equal
+// pixels to a run packet, and the pixels between runs to raw packets.
+// Returns the bytes written
+static size_t Rle_Encode_Row(const unsigned char* bgra, int width, unsigned char* out)
+{
+	unsigned char* start = out;
+	for (int x = 0; x < width; )
+	{
+		unsigned int value = Pixel_Bits(bgra + x * 4);
+		int run = 1;
+		while (x + run < width && run < 128 && Pixel_Bits(bgra + (x + run) * 4) == value)
+			run++;
+
+		if (run > 1)
+		{
+			*out++ = (unsigned char)(0x80 | (run - 1));
+			memcpy(out, bgra + x * 4, 4);
+			out += 4;
+			x += run;
+			continue;
+		}
+
+		// up to the next pair of equal pixels
+		int raw = 1;
+		while (x + raw < width && raw < 128
+			&& !(x + raw + 1 < width && Pixel_Bits(bgra + (x + raw) * 4) == Pixel_Bits(bgra + (x + raw + 1) * 4)))
+			raw++;
+		*out++ = (unsigned char)(raw - 1);
+		memcpy(out, bgra + x * 4, raw * 4);
+		out += raw * 4;
+		x += raw;
+	}
+	return out - start;
+}// Rle_Encode_Row
+
+
+// move to offset bytes into a file, which may be past 2 GB
+static bool Seek_File(FILE* file, long long offset)
+{
+#ifdef _WIN32
+	return _fseeki64(file, offset, SEEK_SET) == 0;
+#else
+	return fseeko(file, (off_t)offset, SEEK_SET) == 0;
+#endif
+}// Seek_File
+
+
+// count copies of the BPP bytes at value.  Short runs are a store a pixel;
+// longer ones copy what has been written so far onto the rest, doubling it
+// each time, so most of the run goes out in wide copies
+template <int BPP>
+static void Fill_Pixels(unsigned char* out, const unsigned char* value, int count)
+{
+	if (count <= 8)
+	{
+		for (int p = 0; p < count; p++)
+			memcpy(out + p * BPP, value, BPP);
+		return;
+	}
+
+	for (int p = 0; p < 8; p++)
+		memcpy(out + p * BPP, value, BPP);
+	size_t total = (size_t)count * BPP;
+	for (size_t filled = 8 * BPP; filled < total; )
+	{
+		size_t copy = Min(filled, total - filled);
+		memcpy(out + filled, out, copy);
+		filled += copy;
+	}
+}// Fill_Pixels
+
+
+// Rle_Row for a cursor with at least a row's worth of bytes left, a packet
+// header and a pixel for every pixel of the row, so no packet can run off
+// the end and nothing needs checking
+template <int BPP>
+static void Rle_Row_Unchecked(RleCursor& cursor, int width, unsigned char* row)
+{
+	const unsigned char* in = cursor.in;
+	for (int x = 0; x < width; )
+	{
+		if (cursor.left == 0)
+		{
+			unsigned char packet = *in++;
+			cursor.left = (packet & 0x7F) + 1;
+			cursor.run = (packet & 0x80) != 0;
+			if (cursor.run)
+			{
+				memcpy(cursor.value, in, BPP);
+				in += BPP;
+			}
+		}
+
+		int count = Min(cursor.left, width - x);
+		unsigned char* out = row + (size_t)x * BPP;
+		if (cursor.run)
+			Fill_Pixels<BPP>(out, cursor.value, count);
+		else
+		{
+			memcpy(out, in, (size_t)count * BPP);
+			in += (size_t)count * BPP;
+		}
+
+		x += count;
+		cursor.left -= count;
+	}
+	cursor.in = in;
+}// Rle_Row_Unchecked
+
+
+// expand the next width pixels of a run length encoded file into row.  A
+// missing packet header reads as a raw packet, as in tga_load
+static void Rle_Row(RleCursor& cursor, int width, int bytesPerPixel, unsigned char* row)
+{
+	if (cursor.in < cursor.end && (size_t)(cursor.end - cursor.in) >= (size_t)width * (bytesPerPixel + 1))
+	{
+		if (bytesPerPixel == 4)
+			Rle_Row_Unchecked<4>(cursor, width, row);
+		else
+			Rle_Row_Unchecked<3>(cursor, width, row);
+		return;
+	}
+
+	for (int x = 0; x < width; )
+	{
+		if (cursor.left == 0)
+		{
+			unsigned char packet = cursor.in < cursor.end ? *cursor.in++ : 1;
+			cursor.left = (packet & 0x7F) + 1;
+			cursor.run = (packet & 0x80) != 0;
+			if (cursor.run)
+				Copy_Padded(cursor.value, cursor.in, cursor.end, bytesPerPixel, bytesPerPixel);
+		}
+
+		int count = Min(cursor.left, width - x);
+		unsigned char* out = row + (size_t)x * bytesPerPixel;
+		if (!cursor.run)
+			Copy_Padded(out, cursor.in, cursor.end, (size_t)count * bytesPerPixel, bytesPerPixel);
+		else if (bytesPerPixel == 4)
+			Fill_Pixels<4>(out, cursor.value, count);
+		else
+			Fill_Pixels<3>(out, cursor.value, count);
+
+		x += count;
+		cursor.left -= count;
+	}
+}// Rle_Row
+
+
+// the bytes of the next row of the file, expanded into row if they are run
+// length encoded or cut short by the end of the file
+static const unsigned char* Next_Row(const TargaHeader& header, RleCursor& cursor, unsigned char* row)
+{
+	int bytesPerPixel = header.pixelDepth / 8;
+	size_t rowBytes = (size_t)header.width * bytesPerPixel;
+	if (header.imageType == c_targaTruecolorRle)
+		Rle_Row(cursor, header.width, bytesPerPixel, row);
+	else if (cursor.in < cursor.end && (size_t)(cursor.end - cursor.in) >= rowBytes)
+	{
+		cursor.in += rowBytes;
+		return cursor.in - rowBytes;
+	}
+	else
+		Copy_Padded(row, cursor.in, cursor.end, rowBytes, bytesPerPixel);
+	return row;
+}// Next_Row
+
+
+// the row index of a run length encoded file TargaWriter wrote, where the
+// pixels and what follows them are size bytes: rows of the file to an
+// entry, and an entry for every rowsPerEntry rows, each the offset from
+// pixels of the first of them.  False, and the file decodes a row after
+// another, if there is none or it does not fit the file
+static bool Find_Row_Index(const TargaHeader& header, const unsigned char* pixels, size_t size, int& rowsPerEntry, const unsigned char*& entries)
+{
+	if (header.imageType != c_targaTruecolorRle || size < (size_t)c_targaFooterSize)
+		return false;
+
+	// the footer's offsets count from the start of the file
+	const unsigned char* footer = pixels + size - c_targaFooterSize;
+	size_t directory = Field_32(footer + 4);
+	if (memcmp(footer + 8, c_sTargaSignature, sizeof(c_sTargaSignature)) || directory < header.dataOffset
+		|| directory - header.dataOffset > size - c_targaFooterSize - 2)
+		return false;
+
+	const unsigned char* tags = pixels + directory - header.dataOffset;
+	size_t tagCount = Field_16(tags);
+	if (tagCount > (size - c_targaFooterSize - (tags + 2 - pixels)) / 10)
+		return false;
+
+	for (size_t t = 0; t < tagCount; t++)
+	{
+		const unsigned char* tag = tags + 2 + t * 10;
+		size_t offset = Field_32(tag + 2), bytes = Field_32(tag + 6);
+		if (Field_16(tag) != c_rowIndexTag || offset < header.dataOffset || offset - header.dataOffset > size || bytes > size - (offset - header.dataOffset) || bytes < 4)
+			continue;
+
+		const unsigned char* index = pixels + offset - header.dataOffset;
+		rowsPerEntry = (int)Min(Field_32(index), (size_t)header.height);
+		size_t count = rowsPerEntry ? ((size_t)header.height + rowsPerEntry - 1) / rowsPerEntry : 0;
+		if (!rowsPerEntry || bytes != 4 + 4 * count || Field_32(index + 4))
+			return false;
+
+		// the offsets go up and stay inside the file
+		entries = index + 4;
+		for (size_t e = 1; e < count; e++)
+		{
+			if (Field_32(entries + 4 * e) < Field_32(entries + 4 * e - 4) || Field_32(entries + 4 * e) > size)
+				return false;
+		}
+		return true;
+	}
+	return false;
+}// Find_Row_Index
+
+
+// a row of the file as premultiplied RGBA.  A 32-bit file with no alpha
+// bits is opaque, whatever its fourth bytes hold
+static void Rgba_Row(const TargaHeader& header, const unsigned char* source, unsigned char* rgba)
+{
+	if (header.pixelDepth == 24)
+		Bgr_To_Rgba_Row(source, header.width, rgba);
+	else
+	{
+		Bgra_To_Rgba_Row(source, header.width, header.alphaBits != 0, rgba);
+		if (header.alphaBits != 0)
+			Premultiply_Row(rgba, header.width);
+	}
+}// Rgba_Row
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Read the header fields.  The pixels start after the image id and the
+//  colormap, if the file has them.
+//
+///////////////////////////////////////////////////////////////////////////////
+bool Parse_Targa_Header(const unsigned char* bytes, size_t size, TargaHeader& header)
+{
+	if (size < (size_t)c_targaHeaderSize)
+		return false;
+
+	int colorMapLength = Field_16(bytes + 5);
+	int colorMapEntryBytes = (bytes[7] + 7) / 8;
+
+	header.imageType = bytes[2];
+	header.colorMap = bytes[1] != 0;
+	header.width = Field_16(bytes + 12);
+	header.height = Field_16(bytes + 14);
+	header.pixelDepth = bytes[16];
+	header.alphaBits = bytes[17] & 0x0F;
+	header.rightOrigin = (bytes[17] & 0x10) != 0;
+	header.topOrigin = (bytes[17] & 0x20) != 0;
+	header.dataOffset = c_targaHeaderSize + bytes[0] + (header.colorMap ? colorMapLength * colorMapEntryBytes : 0);
+	return true;
+}// Parse_Targa_Header
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Truecolor files of whole bytes per pixel with rows left to right.
+//  libtarga looks truecolor pixels up in a colormap if there is one, so
+//  those go to it too.
+//
+///////////////////////////////////////////////////////////////////////////////
+bool Targa_Fast_Path(const TargaHeader& header)
+{
+	return (header.imageType == c_targaTruecolor || header.imageType == c_targaTruecolorRle)
+		&& (header.pixelDepth == 24 || header.pixelDepth == 32)
+		&& !header.colorMap && !header.rightOrigin
+		&& header.width > 0 && header.height > 0;
+}// Targa_Fast_Path
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Convert the file a row at a time, checking the alpha of each row
+//  while it is in cache.  A run length encoded file with a row index is
+//  decoded in bands of its entries on every thread instead, each band
+//  starting where the index says.  Each entry's rows must end where the
+//  index says the next entry starts, with no packet left over, for the
+//  rows to be what decoding from the start would give; if any do not, the
+//  file is decoded again a row after another.
+//
+///////////////////////////////////////////////////////////////////////////////
+bool Decode_Targa(const TargaHeader& header, const unsigned char* pixels, size_t size, unsigned char* rgba, int stride)
+{
+	int width = header.width;
+	int bytesPerPixel = header.pixelDepth / 8;
+	bool keepAlpha = bytesPerPixel == 4 && header.alphaBits != 0;
+
+	Scratch scratch;
+	int rowsPerEntry;
+	const unsigned char* entries;
+	if (Find_Row_Index(header, pixels, size, rowsPerEntry, entries))
+	{
+		int count = (header.height + rowsPerEntry - 1) / rowsPerEntry;
+		bool* entryOpaque = scratch.New<bool>(count);
+		bool* entryGood = scratch.New<bool>(count);
+		ThreadPool::Run_Bands(count, [&](int begin, int end)
+		{
+			Scratch bandScratch;
+			unsigned char* row = bandScratch.New<unsigned char>((size_t)width * bytesPerPixel);
+			RleCursor cursor = { pixels + Field_32(entries + 4 * begin), pixels + size, 0, false, { 0, 0, 0, 0 } };
+			for (int e = begin; e < end; e++)
+			{
+				entryOpaque[e] = true;
+				for (int y = e * rowsPerEntry; y < Min((e + 1) * rowsPerEntry, header.height); y++)
+				{
+					unsigned char* out = rgba + (ptrdiff_t)(header.topOrigin ? header.height - 1 - y : y) * stride;
+					Rgba_Row(header, Next_Row(header, cursor, row), out);
+					if (keepAlpha)
+						entryOpaque[e] = entryOpaque[e] && All_Opaque(out, width);
+				}
+				entryGood[e] = e + 1 == count || (cursor.left == 0 && cursor.in == pixels + Field_32(entries + 4 * e + 4));
+			}
+		});
+
+		bool good = true, opaque = true;
+		for (int e = 0; e < count; e++)
+		{
+			good = good && entryGood[e];
+			opaque = opaque && entryOpaque[e];
+		}
+		if (good)
+			return opaque;
+	}
+
+	unsigned char* row = scratch.New<unsigned char>((size_t)width * bytesPerPixel);
+	RleCursor cursor = { pixels, pixels + size, 0, false, { 0, 0, 0, 0 } };
+	bool opaque = true;
+
+	for (int y = 0; y < header.height; y++)
+	{
+		unsigned char* out = rgba + (ptrdiff_t)(header.topOrigin ? header.height - 1 - y : y) * stride;
+		Rgba_Row(header, Next_Row(header, cursor, row), out);
+		if (keepAlpha)
+			opaque = opaque && All_Opaque(out, width);
+	}
+	return opaque;
+}// Decode_Targa
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Find the header and pixels of a mapped file.
+//
+///////////////////////////////////////////////////////////////////////////////
+bool Open_Targa(const MappedFile& file, TargaHeader& header, const unsigned char*& pixels, size_t& size)
+{
+	if (!file.Data() || !Parse_Targa_Header(file.Data(), file.Size(), header) || !Targa_Fast_Path(header))
+		return false;
+
+	size_t offset = Min(header.dataOffset, file.Size());
+	pixels = file.Data() + offset;
+	size = file.Size() - offset;
+	return true;
+}// Open_Targa
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Map the file and decode it from the mapping.  Anything Decode_Targa
+//  does not take, including a file that will not open, goes to tga_load,
+//  which also sets the error.
+//
+///////////////////////////////////////////////////////////////////////////////
+unsigned char* Load_Targa(const char* filename, int* width, int* height)
+{
+	MappedFile file(filename);
+	TargaHeader header;
+	const unsigned char* pixels;
+	size_t size;
+	if (!Open_Targa(file, header, pixels, size))
+		return (unsigned char*)tga_load(filename, width, height, TGA_TRUECOLOR_32);
+
+	unsigned char* rgba = (unsigned char*)malloc((size_t)header.width * header.height * 4);
+	if (!rgba)
+		return NULL;
+
+	Decode_Targa(header, pixels, size, rgba, header.width * 4);
+	*width = header.width;
+	*height = header.height;
+	return rgba;
+}// Load_Targa
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Write the rows from the bottom up through a TargaWriter.
+//
+///////////////////////////////////////////////////////////////////////////////
+bool Save_Targa(const char* filename, int width, int height, bool opaque,
+	const std::function<const unsigned char*(int, unsigned char*)>& row, bool rle)
+{
+	TargaWriter writer(filename, width, height, rle);
+	if (!writer.Opened())
+		return false;
+
+	Scratch scratch;
+	unsigned char* buffer = scratch.New<unsigned char>((size_t)width * 4);
+	for (int i = height - 1; i >= 0; i--)
+	{
+		if (!writer.Write_Row(i, row(i, buffer), opaque))
+			break;
+	}
+	return writer.Close();
+}// Save_Targa
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Constructor.  Read the header and skip to the pixels.  A run length
+//  encoded row takes at most a packet header for every pixel on top of the
+//  pixels themselves.
+//
+///////////////////////////////////////////////////////////////////////////////
+TargaReader::TargaReader(const char* filename) : file(NULL), buffer(NULL), capacity(0), rowLimit(0), row(NULL), rowsRead(0), atEnd(false)
+{
+	memset(&header, 0, sizeof(header));
+	memset(&cursor, 0, sizeof(cursor));
+	FILE* opened = filename ? fopen(filename, "rb") : NULL;
+	if (!opened)
+		return;
+
+	unsigned char bytes[c_targaHeaderSize];
+	size_t got = fread(bytes, 1, c_targaHeaderSize, opened);
+	if (!Parse_Targa_Header(bytes, got, header) || !Targa_Fast_Path(header) || !Seek_File(opened, header.dataOffset))
+	{
+		fclose(opened);
+		return;
+	}
+
+	file = opened;
+	int bytesPerPixel = header.pixelDepth / 8;
+	rowLimit = (size_t)header.width * (bytesPerPixel + (header.imageType == c_targaTruecolorRle ? 1 : 0));
+	capacity = 2 * rowLimit;
+	buffer = scratch.New<unsigned char>(capacity);
+	row = scratch.New<unsigned char>((size_t)header.width * bytesPerPixel);
+	cursor.in = cursor.end = buffer;
+}// TargaReader
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Destructor.  Close the file.
+//
+///////////////////////////////////////////////////////////////////////////////
+TargaReader::~TargaReader()
+{
+	Close();
+}// ~TargaReader
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Top up the buffer to at least a row's worth of bytes, moving what is
+//  left of it to the front, then decode the row from it.
+//
+///////////////////////////////////////////////////////////////////////////////
+bool TargaReader::Read_Row(unsigned char* rgba)
+{
+	if (!file || rowsRead == header.height)
+		return false;
+
+	size_t left = cursor.in < cursor.end ? cursor.end - cursor.in : 0;
+	if (left < rowLimit && !atEnd)
+	{
+		memmove(buffer, cursor.in, left);
+		size_t wanted = capacity - left;
+		size_t got = fread(buffer + left, 1, wanted, file);
+		atEnd = got < wanted;
+		cursor.in = buffer;
+		cursor.end = buffer + left + got;
+	}
+
+	Rgba_Row(header, Next_Row(header, cursor, row), rgba);
+	rowsRead++;
+	return true;
+}// Read_Row
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Close the file.  The buffers stay until the reader goes away.
+//
+///////////////////////////////////////////////////////////////////////////////
+void TargaReader::Close()
+{
+	if (file)
+		fclose(file);
+	file = NULL;
+}// Close
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Constructor.  Create the file and write the header and id that
+//  tga_write_raw writes, with the run length encoded image type for
+//  runLength.  Sizes the header can not hold are refused before the file
+//  is created, rather than cut down to 16 bits.
+//
+///////////////////////////////////////////////////////////////////////////////
+TargaWriter::TargaWriter(const char* filename, int w, int h, bool runLength, bool rowIndex)
+	: file(NULL), width(w), height(h), rle(runLength), chunk(NULL), chunkRows(0), first(0), pending(0), chunkOpaque(true),
+	encoded(NULL), encodedBytes(NULL), rowOffsets(NULL), dataBytes(0), failed(false)
+{
+	if (!filename || width < 0 || height < 0 || width > c_maxTargaSide || height > c_maxTargaSide)
+		return;
+
+	file = fopen(filename, "wb");
+	if (!file)
+		return;
+
+	unsigned char header[c_targaHeaderSize] = { 0 };
+	header[0] = sizeof(c_sTargaId) - 1;
+	header[2] = rle ? c_targaTruecolorRle : c_targaTruecolor;
+	header[12] = (unsigned char)width;
+	header[13] = (unsigned char)(width >> 8);
+	header[14] = (unsigned char)height;
+	header[15] = (unsigned char)(height >> 8);
+	header[16] = 32;
+	header[17] = 8;
+	failed = fwrite(header, 1, c_targaHeaderSize, file) != (size_t)c_targaHeaderSize
+		|| fwrite(c_sTargaId, 1, header[0], file) != header[0];
+
+	size_t rowBytes = (size_t)width * 4;
+	chunkRows = (int)Min(Max((size_t)1, c_saveChunkBytes / Max(rowBytes, (size_t)1)), (size_t)Max(height, 1));
+	chunk = scratch.New<unsigned char>(rowBytes * chunkRows);
+	if (rle)
+	{
+		encoded = scratch.New<unsigned char>(Rle_Row_Limit(width) * chunkRows);
+		encodedBytes = scratch.New<size_t>(chunkRows);
+		if (rowIndex && height > c_rowIndexRows)
+			rowOffsets = scratch.New<size_t>((height + c_rowIndexRows - 1) / c_rowIndexRows);
+	}
+}// TargaWriter
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Destructor.  Close the file.
+//
+///////////////////////////////////////////////////////////////////////////////
+TargaWriter::~TargaWriter()
+{
+	Close();
+}// ~TargaWriter
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Convert the row into the chunk, after the rows already there if it
+//  goes just above them in the file.  Otherwise write them and start the
+//  chunk again where this row goes.  Rows to run length encode are copied
+//  as they are, to be converted as they are encoded.
+//
+///////////////////////////////////////////////////////////////////////////////
+bool TargaWriter::Write_Row(int y, const unsigned char* rgba, bool opaque)
+{
+	if (!file || failed || y < 0 || y >= height)
+		return false;
+
+	size_t rowBytes = (size_t)width * 4;
+	int index = height - 1 - y;
+	if (index != first + pending)
+	{
+		// an encoded row's place in the file depends on every row below it
+		if (rle || (Flush() && !Seek_File(file, c_targaDataOffset + (long long)index * rowBytes)))
+			failed = true;
+		first = index;
+	}
+
+	if (rle)
+	{
+		memcpy(chunk + pending * rowBytes, rgba, rowBytes);
+		chunkOpaque = chunkOpaque && opaque;
+	}
+	else
+		Straight_Bgra_Row(rgba, width, opaque, chunk + pending * rowBytes);
+	if (++pending == chunkRows)
+		Flush();
+	return !failed;
+}// Write_Row
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Write the rows in the chunk.  Packets end with each row, so bands of
+//  rows are converted and encoded on separate threads and the rows written
+//  one after another.  False once a write has failed.
+//
+///////////////////////////////////////////////////////////////////////////////
+bool TargaWriter::Flush()
+{
+	size_t rowBytes = (size_t)width * 4;
+	if (pending && !failed && rle)
+	{
+		size_t limit = Rle_Row_Limit(width);
+		ThreadPool::Run_Bands(pending, [&](int begin, int end)
+		{
+			Scratch bandScratch;
+			unsigned char* bgra = bandScratch.New<unsigned char>(rowBytes);
+			for (int r = begin; r < end; r++)
+			{
+				Straight_Bgra_Row(chunk + r * rowBytes, width, chunkOpaque, bgra);
+				encodedBytes[r] = Rle_Encode_Row(bgra, width, encoded + r * limit);
+			}
+		});
+
+		for (int r = 0; r < pending && !failed; r++)
+		{
+			if (rowOffsets && (first + r) % c_rowIndexRows == 0)
+				rowOffsets[(first + r) / c_rowIndexRows] = dataBytes;
+			failed = fwrite(encoded + r * limit, 1, encodedBytes[r], file) != encodedBytes[r];
+			dataBytes += encodedBytes[r];
+		}
+	}
+	else if (pending && !failed)
+		failed = fwrite(chunk, 1, pending * rowBytes, file) != pending * rowBytes;
+
+	first += pending;
+	pending = 0;
+	chunkOpaque = true;
+	return !failed;
+}// Flush
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Write the row index as the only tag of a developer area after the
+//  pixels, then its directory and the TGA 2.0 footer, with no extension
+//  area.  Offsets in the footer and directory count from the start of the
+//  file and those in the index from the pixels, all in 32 bits, so a file
+//  past 4 GB gets no index.
+//
+///////////////////////////////////////////////////////////////////////////////
+bool TargaWriter::Write_Row_Index()
+{
+	int count = (height + c_rowIndexRows - 1) / c_rowIndexRows;
+	size_t indexBytes = 4 + 4 * (size_t)count;
+	size_t indexOffset = c_targaDataOffset + dataBytes;
+	size_t directory = indexOffset + indexBytes;
+	if (directory + c_devDirectorySize > 0xFFFFFFFF)
+		return true;
+
+	Scratch areaScratch;
+	size_t areaBytes = indexBytes + c_devDirectorySize + c_targaFooterSize;
+	unsigned char* area = areaScratch.New<unsigned char>(areaBytes);
+	Put_Field(area, c_rowIndexRows, 4);
+	for (int e = 0; e < count; e++)
+		Put_Field(area + 4 + 4 * e, rowOffsets[e], 4);
+
+	unsigned char* tags = area + indexBytes;
+	Put_Field(tags, 1, 2);
+	Put_Field(tags + 2, c_rowIndexTag, 2);
+	Put_Field(tags + 4, indexOffset, 4);
+	Put_Field(tags + 8, indexBytes, 4);
+
+	unsigned char* footer = tags + c_devDirectorySize;
+	Put_Field(footer, 0, 4);
+	Put_Field(footer + 4, directory, 4);
+	memcpy(footer + 8, c_sTargaSignature, sizeof(c_sTargaSignature));
+	return fwrite(area, 1, areaBytes, file) == areaBytes;
+}// Write_Row_Index
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Flush the chunk and close the file.  A run length encoded file with
+//  every row written gets its row index.
+//
+///////////////////////////////////////////////////////////////////////////////
+bool TargaWriter::Close()
+{
+	if (!file)
+		return !failed;
+
+	Flush();
+	if (rowOffsets && !failed && first == height)
+		failed = !Write_Row_Index();
+	failed = fclose(file) != 0 || failed;
+	file = NULL;
+	return !failed;
+}// Close
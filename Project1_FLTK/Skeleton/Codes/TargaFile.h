@@ -0,0 +1,184 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+//      TargaFile.h
+//
+//      A targa reader for the files the program writes and most others:
+//  truecolor, 24 or 32 bits, raw or run length encoded, with the first row
+//  on the left.  It maps the file and converts whole rows at a time straight
+//  from the mapping, where libtarga reads and converts a pixel at a time.
+//  Other files go to libtarga.  The writer takes the rows of an image where
+//  they are, bottom row first, instead of a flipped copy of the image.
+//
+//      TargaReader and TargaWriter do the same a row at a time, holding a
+//  few rows of the file rather than all of it, for images too big to load.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef _TARGA_FILE_H_
+#define _TARGA_FILE_H_
+
+#include <stddef.h>
+#include <stdio.h>
+#include <functional>
+#include "Scratch.h"
+
+class MappedFile;
+
+// the length of a targa header, and the image types Decode_Targa handles
+const int c_targaHeaderSize = 18;
+const int c_targaTruecolor = 2;
+const int c_targaTruecolorRle = 10;
+
+// the widest and tallest image a targa holds, in its 16-bit header fields
+const int c_maxTargaSide = 65535;
+
+// the fields of a targa header
+struct TargaHeader
+{
+	int		width;
+	int		height;
+	int		imageType;              // c_targaTruecolor, c_targaTruecolorRle, or one of the others libtarga reads
+	int		pixelDepth;             // bits per pixel, or per colormap index
+	int		alphaBits;              // 0 for a 32-bit file means the fourth byte is not alpha
+	bool	topOrigin;              // the first row is the top one, rather than the bottom
+	bool	rightOrigin;            // the first pixel of a row is its right one
+	bool	colorMap;
+	size_t	dataOffset;             // bytes from the start of the file to the pixels, past the id and colormap
+};
+
+// where a run length decode has got to between rows
+struct RleCursor
+{
+	const unsigned char*	in;
+	const unsigned char*	end;
+	int						left;               // pixels of the current packet not yet written
+	bool					run;                // the packet repeats value, rather than being raw pixels
+	unsigned char			value[4];
+};
+
+// read the header from the first size bytes of a file; false if they are too few
+bool Parse_Targa_Header(const unsigned char* bytes, size_t size, TargaHeader& header);
+
+// true if Decode_Targa reads files with this header
+bool Targa_Fast_Path(const TargaHeader& header);
+
+// the header of a mapped file, and its size bytes of pixels, if
+// Targa_Fast_Path takes it
+bool Open_Targa(const MappedFile& file, TargaHeader& header, const unsigned char*& pixels, size_t& size);
+
+// decode the size bytes of pixels that follow the header of a file that
+// Targa_Fast_Path takes into premultiplied RGBA rows stride bytes apart, bottom
+// row first like tga_load; a negative stride from the last row puts the top
+// row first.  Bytes past the end of a short file read as 0.  A run length
+// encoded file with the row index TargaWriter writes is decoded in bands
+// on every thread.  Returns whether every pixel is opaque
+bool Decode_Targa(const TargaHeader& header, const unsigned char* pixels, size_t size, unsigned char* rgba, int stride);
+
+// tga_load with TGA_TRUECOLOR_32: a malloc'd buffer of width * height
+// premultiplied RGBA pixels, bottom row first, or NULL with the libtarga
+// error set.  Files Decode_Targa does not take go to tga_load
+unsigned char* Load_Targa(const char* filename, int* width, int* height);
+
+// write the file tga_write_raw writes with TGA_TRUECOLOR_32, byte for byte:
+// 32-bit straight alpha, bottom row first.  row(i, buffer) gives row i of
+// the premultiplied RGBA image, counting from the top, either where it is or
+// written into buffer, which holds width pixels; rows are asked for bottom
+// up.  opaque says every alpha is 255.  With rle the same pixels are run
+// length encoded instead, no packet crossing from one row to the next, and
+// followed by TargaWriter's row index.  False if the file can not be written
+// or the image is wider or taller than c_maxTargaSide
+bool Save_Targa(const char* filename, int width, int height, bool opaque,
+	const std::function<const unsigned char*(int, unsigned char*)>& row, bool rle = false);
+
+
+// a file Targa_Fast_Path takes, read a row at a time in the order the file
+// stores them: top row first if Top_First, else bottom row first.  Only a
+// few rows of the file are held at once.  Like a Scratch, a reader must go
+// away before the Scratches made after it
+class TargaReader
+{
+	// methods
+public:
+	TargaReader(const char* filename);          // Opened() is false if the file can not be read or Targa_Fast_Path does not take it
+	~TargaReader();
+
+	bool Opened() const { return file != NULL; }
+	int Width() const { return header.width; }
+	int Height() const { return header.height; }
+	bool Top_First() const { return header.topOrigin; }
+
+	// the next row of the file as Width() premultiplied RGBA pixels, as
+	// Decode_Targa would give it.  False once every row has been read
+	bool Read_Row(unsigned char* rgba);
+
+	void Close();
+
+private:
+	TargaReader(const TargaReader&);
+	TargaReader& operator=(const TargaReader&);
+
+	// members
+	Scratch			scratch;                    // buffer and row, for as long as the reader is open
+	FILE*			file;
+	TargaHeader		header;
+	RleCursor		cursor;                     // over the bytes read into buffer and not yet decoded
+	unsigned char*	buffer;
+	size_t			capacity;                   // bytes buffer holds
+	size_t			rowLimit;                   // the most bytes one row can take from the file
+	unsigned char*	row;                        // a run length encoded row, expanded
+	int				rowsRead;
+	bool			atEnd;                      // everything in the file has been read into buffer
+};
+
+// the file Save_Targa would write, written a row at a time.  Rows may come
+// in any order; bottom up they are gathered into chunks, otherwise each one
+// is written where it goes.  A run length encoded file takes its rows bottom
+// up only, and each chunk is encoded in bands on every thread.  With
+// rowIndex such a file also keeps where every few rows start after its
+// pixels, for Decode_Targa to decode it in bands on every thread; readers
+// that do not know it skip it.  Like a Scratch, a writer must go away
+// before the Scratches made after it
+class TargaWriter
+{
+	// methods
+public:
+	TargaWriter(const char* filename, int width, int height, bool runLength = false, bool rowIndex = true);   // Opened() is false if the file can not be created or a side is over c_maxTargaSide
+	~TargaWriter();
+
+	bool Opened() const { return file != NULL; }
+
+	// write row y, counting from the top, of premultiplied RGBA pixels.
+	// opaque says every alpha is 255.  False once a write has failed, or for
+	// a run length encoded file once a row has come out of order
+	bool Write_Row(int y, const unsigned char* rgba, bool opaque = false);
+
+	// write what is left and close the file; false if any write failed.
+	// Rows never written read as black
+	bool Close();
+
+private:
+	TargaWriter(const TargaWriter&);
+	TargaWriter& operator=(const TargaWriter&);
+
+	bool Flush();
+	bool Write_Row_Index();
+
+	// members
+	Scratch			scratch;                    // chunk, for as long as the writer is open
+	FILE*			file;
+	int				width;
+	int				height;
+	bool			rle;
+	unsigned char*	chunk;                      // rows not yet written, in file order: converted, or as given for run length encoding
+	int				chunkRows;                  // rows chunk holds
+	int				first;                      // where the rows in chunk go: rows of the file from the bottom
+	int				pending;                    // rows in chunk
+	bool			chunkOpaque;                // every row in chunk came as opaque
+	unsigned char*	encoded;                    // each row of chunk run length encoded, a row's worst case apart
+	size_t*			encodedBytes;               // the length of each
+	size_t*			rowOffsets;                 // where each c_rowIndexRows'th row starts, from the pixels, for the row index; NULL for none
+	size_t			dataBytes;                  // pixel bytes written so far
+	bool			failed;
+};
+
+#endif
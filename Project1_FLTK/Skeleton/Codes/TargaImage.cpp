@@ -12,14 +12,24 @@
 #include "Globals.h"
 #include "TargaImage.h"
 #include "libtarga.h"
+#include "TargaFile.h"
+#include "MappedFile.h"
+#include "FFT.h"
+#include "Simd.h"
+#include "ThreadPool.h"
+#include "FilterChain.h"
+#include "ColorSpace.h"
+#include "Scratch.h"
 #include <stdlib.h>
 #include <assert.h>
 #include <memory.h>
 #include <math.h>
+#include <limits.h>
 #include <iostream>
 #include <sstream>
 #include <vector>
 #include <algorithm>
+#include <utility>
 
 using namespace std;
 
@@ -30,17 +40,517 @@ const int           BLUE = 2;                // blue channel
 const unsigned char BACKGROUND[3] = { 0, 0, 0 };      // background color
 
 
-// Computes n choose s, efficiently
-double Binomial(int n, int s)
+// Largest radius accepted by the box and Bartlett filters, so a Bartlett row
+// total of 255 * (c_maxFilterRadius + 1)^2 still fits the int row pass.
+const int           c_maxFilterRadius = 2047;
+
+// Largest N of Filter_Gaussian_N, whose kernel is stored with all its taps.
+const unsigned int  c_maxGaussianN = 2 * c_maxFilterRadius + 1;
+
+// Largest radius of Filter_Edge and Filter_Enhance, whose blur kernel is
+// stored with all its taps.
+const int           c_maxUnsharpRadius = 64;
+
+// Sums each window of taps elements of a line of n elements, span values
+// apart, into out, which receives n - taps + 1 elements.  Each step adds one
+// element and drops one, so the cost does not depend on the window size.
+template <class Sum>
+void Box_Sum(const Sum* in, int n, int span, int taps, Sum* out)
+{
+	for (int m = 0; m < span; m++)
+	{
+		Sum sum = 0;
+		for (int u = 0; u < taps; u++)
+			sum += in[u * span + m];
+		out[m] = sum;
+	}
+
+	const Sum* add = in + taps * span;
+	for (int e = span; e < (n - taps + 1) * span; e++)
+		out[e] = out[e - span] + add[e - span] - in[e - span];
+}// Box_Sum
+
+// Divides a row of RGB totals by divisor and writes it as opaque RGBA.
+template <class Sum>
+void Emit_Row(const Sum* total, int width, long long divisor, unsigned char* out)
+{
+	for (int j = 0; j < width; j++)
+	{
+		for (int k = 0; k < 3; k++)
+		{
+			long long val = total[j * 3 + k] / divisor;
+			out[j * 4 + k] = (unsigned char)(val < 0 ? 0 : (val > 255 ? 255 : val));
+		}
+		out[j * 4 + 3] = 255;
+	}
+}// Emit_Row
+
+// Column pass of a separable convolution.  rows holds count row pointers,
+// already extended past the top and bottom of the image by the border mode,
+// and row i of the output is written to out + i * stride.
+template <class Sum>
+void Column_Pass(const int* const* rows, int count, int width, const Kernel& kernel, unsigned char* out, int stride)
+{
+	int rowSize = width * 3;
+	int outputs = count - kernel.height + 1;
+	Scratch scratch;
+	Sum* total = scratch.New<Sum>(rowSize, (Sum)0);
+
+	if (kernel.boxes <= 0)
+	{
+		for (int i = 0; i < outputs; i++)
+		{
+			std::fill(total, total + rowSize, (Sum)0);
+			for (int v = 0; v < kernel.height; v++)
+			{
+				Sum weight = kernel.column[v];
+				const int* in = rows[i + v];
+				for (int m = 0; m < rowSize; m++)
+					total[m] += in[m] * weight;
+			}
+			Emit_Row(total, width, kernel.divisor, out + i * stride);
+		}
+		return;
+	}
+
+	//cascaded boxes: the first runs straight off the rows, each later one
+	//keeps the last taps outputs of the box before it in a ring
+	int taps = (kernel.height - 1) / kernel.boxes + 1;
+	Sum* ring = scratch.New<Sum>((kernel.boxes - 1) * taps * rowSize);
+	Sum* sums = scratch.New<Sum>((kernel.boxes - 1) * rowSize, (Sum)0);
+	int* pushed = scratch.New<int>(kernel.boxes - 1, 0);
+	int i = 0;
+	for (int t = 0; t < count; t++)
+	{
+		const int* in = rows[t];
+		for (int m = 0; m < rowSize; m++)
+			total[m] += in[m];
+		if (t >= taps)
+		{
+			in = rows[t - taps];
+			for (int m = 0; m < rowSize; m++)
+				total[m] -= in[m];
+		}
+		if (t < taps - 1)
+			continue;
+
+		const Sum* box = total;
+		for (int b = 0; b < kernel.boxes - 1 && box; b++)
+		{
+			Sum* slot = &ring[(b * taps + pushed[b] % taps) * rowSize];
+			Sum* sum = &sums[b * rowSize];
+			if (pushed[b] >= taps)
+			{
+				for (int m = 0; m < rowSize; m++)
+					sum[m] -= slot[m];
+			}
+			for (int m = 0; m < rowSize; m++)
+			{
+				sum[m] += box[m];
+				slot[m] = box[m];
+			}
+			box = (++pushed[b] >= taps) ? sum : NULL;
+		}
+
+		if (box)
+			Emit_Row(box, width, kernel.divisor, out + i++ * stride);
+	}
+}// Column_Pass
+
+// Copies a row of width pixels of the given number of channels into line,
+// extended by radius pixels at each end with the pixels the border mode
+// stands in for.
+template <class T, class U>
+void Extend_Line(const U* row, int width, int channels, int radius, EBorderMode border, T* line)
 {
-	double        res;
+	for (int e = 0; e < width * channels; e++)
+		line[radius * channels + e] = row[e];
 
-	res = 1;
-	for (int i = 1; i <= s; i++)
-		res = (n - i + 1) * res / i;
+	for (int j = -radius; j < 0; j++)
+	{
+		int left = Border_Index(j, width, border);
+		int right = Border_Index(width - 1 - j, width, border);
+		for (int k = 0; k < channels; k++)
+		{
+			line[(j + radius) * channels + k] = (left < 0) ? 0 : row[left * channels + k];
+			line[(width - 1 - j + radius) * channels + k] = (right < 0) ? 0 : row[right * channels + k];
+		}
+	}
+}// Extend_Line
+
+// Writes a row of RGB pixels as opaque RGBA.
+static void Expand_Row(const unsigned char* rgb, int width, unsigned char* out)
+{
+	for (int j = 0; j < width; j++)
+	{
+		out[j * 4] = rgb[j * 3];
+		out[j * 4 + 1] = rgb[j * 3 + 1];
+		out[j * 4 + 2] = rgb[j * 3 + 2];
+		out[j * 4 + 3] = 255;
+	}
+}// Expand_Row
+
+// Separable convolution for kernels whose sums fit 16 bits, see
+// Kernel::Fits_16_Bits.  The passes run through the vector multiply-adds in
+// Simd.h, and the results match the wider paths.  An RGB image (3 channels)
+// is written to data as opaque RGBA; a single plane (1 channel) is written
+// as a plane.  Rows of data are stride bytes apart.
+static void Separable_16(const unsigned char* rgb, int width, int height, int channels, const Kernel& kernel, EBorderMode border, unsigned char* data, int stride)
+{
+	int hRadius = kernel.width / 2;
+	int vRadius = kernel.height / 2;
+	int rowSize = width * channels;
+
+	//row pass
+	Scratch scratch;
+	unsigned short* horizontal = scratch.New<unsigned short>(width * height * channels);
+	ThreadPool::Run_Bands(height, [&](int begin, int end)
+	{
+		Scratch bandScratch;
+		unsigned char* line = bandScratch.New<unsigned char>((width + 2 * hRadius) * channels);
+		for (int i = begin; i < end; i++)
+		{
+			Extend_Line(rgb + i * rowSize, width, channels, hRadius, border, line);
 
-	return res;
-}// Binomial
+			unsigned short* out = horizontal + i * rowSize;
+			memset(out, 0, rowSize * sizeof(unsigned short));
+			for (int u = 0; u < kernel.width; u++)
+			{
+				if (kernel.row[u])
+					Multiply_Add_U8(line + u * channels, rowSize, (unsigned short)kernel.row[u], out);
+			}
+		}
+	});
+
+	//column pass, each band reads the rows within the kernel radius of its own
+	unsigned short* zero = scratch.New<unsigned short>(rowSize, 0);
+	ThreadPool::Run_Bands(height, [&](int begin, int end)
+	{
+		Scratch bandScratch;
+		unsigned short* total = bandScratch.New<unsigned short>(rowSize);
+		unsigned char* rgbRow = bandScratch.New<unsigned char>(rowSize);
+		for (int i = begin; i < end; i++)
+		{
+			memset(total, 0, rowSize * sizeof(unsigned short));
+			for (int v = 0; v < kernel.height; v++)
+			{
+				int l = Border_Index(i + v - vRadius, height, border);
+				if (kernel.column[v])
+					Multiply_Add_U16((l < 0) ? zero : horizontal + l * rowSize, rowSize, (unsigned short)kernel.column[v], total);
+			}
+
+			if (channels == 1)
+				Divide_U16(total, rowSize, (unsigned int)kernel.divisor, data + i * stride);
+			else
+			{
+				Divide_U16(total, rowSize, (unsigned int)kernel.divisor, rgbRow);
+				Expand_Row(rgbRow, width, data + i * stride);
+			}
+		}
+	});
+}// Separable_16
+
+// Writes a row of convolution totals over the kernel divisor: floats as
+// they are, 16-bit channels truncated and clamped like the bytes.
+static void Emit_Totals(const float* total, int n, long long divisor, float* out)
+{
+	float scale = 1.0f / divisor;
+	for (int m = 0; m < n; m++)
+		out[m] = total[m] * scale;
+}// Emit_Totals
+
+// Negative totals come out as 0 either way, so a power of two divisor can
+// be a shift.
+template <class Sum>
+static void Emit_Totals(const Sum* total, int n, long long divisor, unsigned short* out)
+{
+	if ((divisor & (divisor - 1)) == 0)
+	{
+		int shift = 0;
+		while ((1LL << shift) < divisor)
+			shift++;
+		for (int m = 0; m < n; m++)
+		{
+			Sum val = total[m] >> shift;
+			out[m] = (unsigned short)(val < 0 ? 0 : (val > 65535 ? 65535 : val));
+		}
+		return;
+	}
+
+	for (int m = 0; m < n; m++)
+	{
+		Sum val = total[m] / (Sum)divisor;
+		out[m] = (unsigned short)(val < 0 ? 0 : (val > 65535 ? 65535 : val));
+	}
+}// Emit_Totals
+
+// Convolution of a float or 16-bit image of the given number of channels
+// into out, which must not overlap it, adding up in Sum.  A separable kernel
+// is run a band of rows at a time: each input row the band needs is filtered
+// along the row into a ring of kernel.height rows, and each output row is
+// the column pass over the ring.  Any other kernel adds up an extended copy
+// of each input row under each row of taps.
+template <class T, class Sum>
+static void Convolve_Image(const T* image, int width, int height, int channels, const Kernel& kernel, EBorderMode border, T* out)
+{
+	int hRadius = kernel.width / 2;
+	int vRadius = kernel.height / 2;
+	int rowSize = width * channels;
+
+	ThreadPool::Run_Bands(height, [&](int begin, int end)
+	{
+		Scratch scratch;
+		Sum* line = scratch.New<Sum>((width + 2 * hRadius) * channels);
+		Sum* total = scratch.New<Sum>(rowSize);
+		if (kernel.Is_Separable())
+		{
+			Sum* ring = scratch.New<Sum>(kernel.height * rowSize);
+			for (int t = begin - vRadius; t < end + vRadius; t++)
+			{
+				Sum* row = ring + ((t - begin + vRadius) % kernel.height) * rowSize;
+				memset(row, 0, rowSize * sizeof(Sum));
+				int l = Border_Index(t, height, border);
+				if (l >= 0)
+				{
+					Extend_Line(image + l * rowSize, width, channels, hRadius, border, line);
+					for (int u = 0; u < kernel.width; u++)
+					{
+						Sum weight = (Sum)kernel.row[u];
+						const Sum* in = line + u * channels;
+						for (int m = 0; m < rowSize; m++)
+							row[m] += in[m] * weight;
+					}
+				}
+
+				int i = t - vRadius;
+				if (i < begin)
+					continue;
+
+				memset(total, 0, rowSize * sizeof(Sum));
+				for (int v = 0; v < kernel.height; v++)
+				{
+					Sum weight = (Sum)kernel.column[v];
+					const Sum* in = ring + ((i + v - begin) % kernel.height) * rowSize;
+					for (int m = 0; m < rowSize; m++)
+						total[m] += in[m] * weight;
+				}
+				Emit_Totals(total, rowSize, kernel.divisor, out + i * rowSize);
+			}
+		}
+		else
+		{
+			for (int i = begin; i < end; i++)
+			{
+				memset(total, 0, rowSize * sizeof(Sum));
+				for (int v = 0; v < kernel.height; v++)
+				{
+					int l = Border_Index(i + v - vRadius, height, border);
+					if (l < 0)
+						continue;
+
+					Extend_Line(image + l * rowSize, width, channels, hRadius, border, line);
+					for (int u = 0; u < kernel.width; u++)
+					{
+						Sum weight = (Sum)kernel.taps[v * kernel.width + u];
+						if (weight == 0)
+							continue;
+
+						const Sum* in = line + u * channels;
+						for (int m = 0; m < rowSize; m++)
+							total[m] += in[m] * weight;
+					}
+				}
+				Emit_Totals(total, rowSize, kernel.divisor, out + i * rowSize);
+			}
+		}
+	});
+}// Convolve_Image
+
+// Whether the largest total a kernel can reach from 16-bit channels fits in
+// int.
+static bool Wide_Sums_Fit_Int(const Kernel& kernel)
+{
+	long long bound = 65535;
+	if (kernel.Is_Separable())
+	{
+		long long rowBound = 0, columnBound = 0;
+		for (int u = 0; u < kernel.width; u++)
+			rowBound += abs(kernel.row[u]);
+		for (int v = 0; v < kernel.height; v++)
+			columnBound += abs(kernel.column[v]);
+		bound *= rowBound * columnBound;
+	}
+	else
+	{
+		long long tapBound = 0;
+		for (int t = 0; t < kernel.width * kernel.height; t++)
+			tapBound += abs(kernel.taps[t]);
+		bound *= tapBound;
+	}
+	return bound <= INT_MAX;
+}// Wide_Sums_Fit_Int
+
+// Convolve_Image for 16-bit channels.  Totals add up in int when the largest
+// the kernel can reach fits, and in long long when it does not.
+static void Convolve_Wide(const unsigned short* image, int width, int height, int channels, const Kernel& kernel, EBorderMode border, unsigned short* out)
+{
+	if (Wide_Sums_Fit_Int(kernel))
+		Convolve_Image<unsigned short, int>(image, width, height, channels, kernel, border, out);
+	else
+		Convolve_Image<unsigned short, long long>(image, width, height, channels, kernel, border, out);
+}// Convolve_Wide
+
+// Bayer's 8 x 8 ordered dither matrix
+static const unsigned char c_bayer[8][8] =
+{
+	{  0, 32,  8, 40,  2, 34, 10, 42 },
+	{ 48, 16, 56, 24, 50, 18, 58, 26 },
+	{ 12, 44,  4, 36, 14, 46,  6, 38 },
+	{ 60, 28, 52, 20, 62, 30, 54, 22 },
+	{  3, 35, 11, 43,  1, 33,  9, 41 },
+	{ 51, 19, 59, 27, 49, 17, 57, 25 },
+	{ 15, 47,  7, 39, 13, 45,  5, 37 },
+	{ 63, 31, 55, 23, 61, 29, 53, 21 }
+};
+
+// Converts n 16-bit RGBA pixels of image row i to bytes by ordered
+// dithering.  Each channel rounds up when its fraction of a byte step
+// passes the pixel's threshold, so a flat area keeps its average.  Every
+// channel of a pixel has the same threshold, so premultiplied colors stay
+// at or below their alpha, and the threshold is under a whole step, so
+// the bytes times 257 come back exactly.
+static void Narrow_Row(const unsigned short* wide, int n, int i, unsigned char* rgba)
+{
+	const unsigned char* bayer = c_bayer[i % 8];
+	for (int j = 0; j < n; j++, wide += 4, rgba += 4)
+	{
+		unsigned int threshold = bayer[j % 8] * 1024u + 512u;
+		for (int k = 0; k < 4; k++)
+			rgba[k] = (unsigned char)((wide[k] * 255u + threshold) / 65535u);
+	}
+}// Narrow_Row
+
+// Converts n RGBA pixels of bytes to 16 bits, exactly.
+static void Widen_Row(const unsigned char* rgba, int n, unsigned short* wide)
+{
+	for (int e = 0; e < n * 4; e++)
+		wide[e] = (unsigned short)(rgba[e] * 257);
+}// Widen_Row
+
+// Halves an image of 4 channel pixels by keeping every other pixel of every
+// other row, into half.  Rows are stride and halfStride elements apart.
+template <class T>
+static void Half_Pixels(const T* pixels, int width, int height, int stride, T* half, int halfStride)
+{
+	ThreadPool::Run_Bands(height / 2, [&](int begin, int end)
+	{
+		for (int i = begin; i < end; i++)
+		{
+			for (int j = 0; j < width / 2; j++)
+				memcpy(half + i * halfStride + j * 4, pixels + (i * 2) * stride + (j * 2) * 4, 4 * sizeof(T));
+		}
+	});
+}// Half_Pixels
+
+// Doubles an RGB image into doubled, which holds 4 times the pixels.  Each
+// output row is 2 4 2 / 8 of the input rows around it when even, 1 3 3 1 / 8
+// when odd, and the same along the rows.  Sums go through Sum and are
+// truncated like the bytes.
+template <class T, class Sum>
+static void Double_RGB(const T* rgb, int width, int height, T* doubled)
+{
+	const int c_weights[2][4] = { { 2, 4, 2, 0 }, { 1, 3, 3, 1 } };
+	int rowSize = width * 3;
+
+	Scratch scratch;
+	Sum* tall = scratch.New<Sum>(height * 2 * rowSize);
+	ThreadPool::Run_Bands(height * 2, [&](int begin, int end)
+	{
+		for (int i = begin; i < end; i++)
+		{
+			Sum* out = tall + i * rowSize;
+			memset(out, 0, rowSize * sizeof(Sum));
+			for (int t = 0; t < 4; t++)
+			{
+				int l = i / 2 - 1 + t;
+				Sum weight = (Sum)c_weights[i % 2][t];
+				if (l < 0 || l >= height || weight == 0)
+					continue;
+
+				const T* in = rgb + l * rowSize;
+				for (int m = 0; m < rowSize; m++)
+					out[m] += in[m] * weight;
+			}
+		}
+	});
+
+	ThreadPool::Run_Bands(height * 2, [&](int begin, int end)
+	{
+		for (int i = begin; i < end; i++)
+		{
+			const Sum* in = tall + i * rowSize;
+			for (int j = 0; j < width * 2; j++)
+			{
+				Sum total[3] = { 0, 0, 0 };
+				for (int t = 0; t < 4; t++)
+				{
+					int m = j / 2 - 1 + t;
+					Sum weight = (Sum)c_weights[j % 2][t];
+					if (m < 0 || m >= width || weight == 0)
+						continue;
+
+					for (int k = 0; k < 3; k++)
+						total[k] += in[m * 3 + k] * weight;
+				}
+				for (int k = 0; k < 3; k++)
+					doubled[(i * width * 2 + j) * 3 + k] = (T)(total[k] / 64);
+			}
+		}
+	});
+}// Double_RGB
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Un-premultiply a row of n pixels into rgb.  Opaque rows only need the
+//  alpha dropped.
+//
+///////////////////////////////////////////////////////////////////////////////
+static void Row_To_RGB(const unsigned char* rgba, int n, unsigned char* rgb, bool opaque)
+{
+	if (opaque)
+		Strip_Alpha_Row(rgba, n, rgb);
+	else
+		Unpremultiply_Row(rgba, n, rgb);
+}// Row_To_RGB
+
+
+// Row_To_RGB for n float pixels.  Transparent pixels are black.
+static void Row_To_Linear_RGB(const float* rgba, int n, float* rgb, bool opaque)
+{
+	for (int p = 0; p < n; p++)
+	{
+		const float* in = rgba + p * 4;
+		float reciprocal = opaque ? 1.0f : ((in[3] > 0) ? 1.0f / in[3] : 0.0f);
+		for (int k = 0; k < 3; k++)
+			rgb[p * 3 + k] = in[k] * reciprocal;
+	}
+}// Row_To_Linear_RGB
+
+
+// Row_To_RGB for n 16-bit pixels, truncating like Unpremultiply_Row.
+static void Row_To_Wide_RGB(const unsigned short* rgba, int n, unsigned short* rgb, bool opaque)
+{
+	for (int p = 0; p < n; p++)
+	{
+		const unsigned short* in = rgba + p * 4;
+		for (int k = 0; k < 3; k++)
+		{
+			unsigned int straight = opaque ? in[k] : (in[3] ? in[k] * 65535u / in[3] : 0);
+			rgb[p * 3 + k] = (unsigned short)Min(straight, 65535u);
+		}
+	}
+}// Row_To_Wide_RGB
 
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -48,17 +558,20 @@ double Binomial(int n, int s)
 //      Constructor.  Initialize member variables.
 //
 ///////////////////////////////////////////////////////////////////////////////
-TargaImage::TargaImage() : width(0), height(0), data(NULL)
-{}// TargaImage
+TargaImage::TargaImage() : width(0), height(0), data(NULL), stride(0), owned(true), opaque(false), layout(LAYOUT_INTERLEAVED), format(FORMAT_BYTE), linear(NULL), wide(NULL)
+{
+	Mark_Changed();
+}// TargaImage
 
 ///////////////////////////////////////////////////////////////////////////////
 //
 //      Constructor.  Initialize member variables.
 //
 ///////////////////////////////////////////////////////////////////////////////
-TargaImage::TargaImage(int w, int h) : width(w), height(h)
+TargaImage::TargaImage(int w, int h) : width(w), height(h), data(NULL), stride(0), owned(true), layout(LAYOUT_INTERLEAVED), format(FORMAT_BYTE), linear(NULL), wide(NULL)
 {
-	data = new unsigned char[width * height * 4];
+	Mark_Changed();
+	New_Data();
 	ClearToBlack();
 }// TargaImage
 
@@ -66,38 +579,111 @@ TargaImage::TargaImage(int w, int h) : width(w), height(h)
 
 ///////////////////////////////////////////////////////////////////////////////
 //
-//      Constructor.  Initialize member variables to values given.
+//      Constructor.  Initialize member variables to values given, d being
+//  width * height pixels with no gaps between the rows.
 //
 ///////////////////////////////////////////////////////////////////////////////
 TargaImage::TargaImage(int w, int h, unsigned char* d)
 {
-	int i;
-
 	width = w;
 	height = h;
-	data = new unsigned char[width * height * 4];
-
-	for (i = 0; i < width * height * 4; i++)
-		data[i] = d[i];
+	layout = LAYOUT_INTERLEAVED;
+	format = FORMAT_BYTE;
+	data = NULL;
+	owned = true;
+	linear = NULL;
+	wide = NULL;
+	Mark_Changed();
+	New_Data();
+
+	opaque = true;
+	for (int i = 0; i < height; i++)
+	{
+		memcpy(data + i * stride, d + i * width * 4, width * 4);
+		opaque = opaque && All_Opaque(data + i * stride, width);
+	}
 }// TargaImage
 
 ///////////////////////////////////////////////////////////////////////////////
 //
-//      Copy Constructor.  Initialize member to that of input
+//      Copy Constructor.  Initialize member to that of input.  The copy has
+//  pixels of its own, even when the input was made from a view.
 //
 ///////////////////////////////////////////////////////////////////////////////
 TargaImage::TargaImage(const TargaImage& image)
 {
 	width = image.width;
 	height = image.height;
+	opaque = image.opaque;
+	layout = image.layout;
+	format = image.format;
+	Mark_Changed();
 	data = NULL;
+	stride = Aligned_Stride(width * 4);
+	owned = true;
+	linear = NULL;
+	wide = NULL;
 	if (image.data != NULL) {
-		data = new unsigned char[width * height * 4];
-		memcpy(data, image.data, sizeof(unsigned char) * width * height * 4);
+		if (layout == LAYOUT_PLANAR) {
+			data = Pixels_New<unsigned char>(width * height * 4);
+			memcpy(data, image.data, sizeof(unsigned char) * width * height * 4);
+		}
+		else {
+			data = New_Rows(width, height, stride);
+			for (int i = 0; i < height; i++)
+				memcpy(data + i * stride, image.data + i * image.stride, width * 4);
+		}
+	}
+	if (image.linear != NULL) {
+		linear = Pixels_New<float>(width * height * 4);
+		memcpy(linear, image.linear, sizeof(float) * width * height * 4);
+	}
+	if (image.wide != NULL) {
+		wide = Pixels_New<unsigned short>(width * height * 4);
+		memcpy(wide, image.wide, sizeof(unsigned short) * width * height * 4);
 	}
 }
 
 
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Move Constructor.  Take the pixels of the input, no copying, and
+//  leave it an empty image.
+//
+///////////////////////////////////////////////////////////////////////////////
+TargaImage::TargaImage(TargaImage&& image) : width(0), height(0), data(NULL), stride(0), owned(true), opaque(false), layout(LAYOUT_INTERLEAVED), format(FORMAT_BYTE), linear(NULL), wide(NULL)
+{
+	Mark_Changed();
+	Swap(image);
+}// TargaImage
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Constructor.  The image's pixels are the view's, so every op works on
+//  them in place.  Ops that would change the size of the image fail, and
+//  the image stays in interleaved bytes.  The view must outlive the image.
+//
+///////////////////////////////////////////////////////////////////////////////
+TargaImage::TargaImage(const ImageView& view)
+{
+	width = view.width;
+	height = view.height;
+	data = view.data;
+	stride = view.stride;
+	owned = false;
+	layout = LAYOUT_INTERLEAVED;
+	format = FORMAT_BYTE;
+	linear = NULL;
+	wide = NULL;
+	Mark_Changed();
+
+	opaque = true;
+	for (int i = 0; i < height && opaque; i++)
+		opaque = All_Opaque(view.Row(i), width);
+}// TargaImage
+
+
 ///////////////////////////////////////////////////////////////////////////////
 //
 //      Destructor.  Free image memory.
@@ -105,11 +691,151 @@ TargaImage::TargaImage(const TargaImage& image)
 ///////////////////////////////////////////////////////////////////////////////
 TargaImage::~TargaImage()
 {
-	if (data)
-		delete[] data;
+	Free_Data();
+	Pixels_Delete(linear);
+	Pixels_Delete(wide);
 }// ~TargaImage
 
 
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Assignment.  A copy is made and swapped in, and a moved image is
+//  swapped in directly, leaving the input empty; either way the old pixels
+//  are freed.  An image made from a view becomes one with pixels of its own.
+//
+///////////////////////////////////////////////////////////////////////////////
+TargaImage& TargaImage::operator=(const TargaImage& image)
+{
+	if (this != &image)
+	{
+		TargaImage copy(image);
+		Swap(copy);
+	}
+	return *this;
+}// operator=
+
+TargaImage& TargaImage::operator=(TargaImage&& image)
+{
+	if (this != &image)
+	{
+		TargaImage taken(std::move(image));
+		Swap(taken);
+	}
+	return *this;
+}// operator=
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Exchange the contents of two images.  Only pointers and sizes move,
+//  and each image keeps the generation of the pixels it ends up with.
+//
+///////////////////////////////////////////////////////////////////////////////
+void TargaImage::Swap(TargaImage& image)
+{
+	std::swap(width, image.width);
+	std::swap(height, image.height);
+	std::swap(data, image.data);
+	std::swap(stride, image.stride);
+	std::swap(owned, image.owned);
+	std::swap(opaque, image.opaque);
+	std::swap(generation, image.generation);
+	std::swap(layout, image.layout);
+	std::swap(format, image.format);
+	std::swap(linear, image.linear);
+	std::swap(wide, image.wide);
+}// Swap
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Allocate width x height interleaved pixels, each row starting on a
+//  c_rowAlignment boundary, and set stride to the bytes between the rows.
+//  The padding at the end of each row is cleared, so whole buffers of the
+//  same size compare equal when their pixels do.
+//
+///////////////////////////////////////////////////////////////////////////////
+unsigned char* TargaImage::New_Rows(int width, int height, int& stride)
+{
+	stride = Aligned_Stride(width * 4);
+	unsigned char* rows = Pixels_New<unsigned char>((size_t)stride * height);
+	if (stride > width * 4)
+	{
+		for (int i = 0; i < height; i++)
+			memset(rows + i * stride + width * 4, 0, stride - width * 4);
+	}
+	return rows;
+}// New_Rows
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Free the pixel data and give the image new interleaved rows of its
+//  current size, which the image owns.
+//
+///////////////////////////////////////////////////////////////////////////////
+void TargaImage::New_Data()
+{
+	Free_Data();
+	data = New_Rows(width, height, stride);
+	owned = true;
+}// New_Data
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Make newData the pixel data.  An image made from a view keeps its
+//  pixels where they are: the new rows are copied into them and freed.
+//
+///////////////////////////////////////////////////////////////////////////////
+void TargaImage::Replace_Data(unsigned char* newData, int newStride)
+{
+	if (!owned)
+	{
+		for (int i = 0; i < height; i++)
+			memcpy(data + i * stride, newData + i * newStride, width * 4);
+		Pixels_Delete(newData);
+		return;
+	}
+
+	Free_Data();
+	data = newData;
+	stride = newStride;
+}// Replace_Data
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Free the pixel data, unless it belongs to a view.
+//
+///////////////////////////////////////////////////////////////////////////////
+void TargaImage::Free_Data()
+{
+	if (owned && data)
+		Pixels_Delete(data);
+	data = NULL;
+}// Free_Data
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      The pixels of the whole image, or of a rectangle inside it, as a view.
+//
+///////////////////////////////////////////////////////////////////////////////
+ImageView TargaImage::View()
+{
+	return View(0, 0, width, height);
+}// View
+
+
+ImageView TargaImage::View(int x, int y, int w, int h)
+{
+	Set_Format(FORMAT_BYTE);
+	Set_Layout(LAYOUT_INTERLEAVED);
+	return ImageView(data + y * stride + x * 4, w, h, stride);
+}// View
+
+
 ///////////////////////////////////////////////////////////////////////////////
 //
 //      Converts an image to RGB form, and returns the rgb pixel data - 24 
@@ -119,47 +845,153 @@ TargaImage::~TargaImage()
 ///////////////////////////////////////////////////////////////////////////////
 unsigned char* TargaImage::To_RGB(void)
 {
+	if (!data && !linear && !wide)
+		return NULL;
+
 	unsigned char* rgb = new unsigned char[width * height * 3];
-	int		    i, j;
+	To_RGB(rgb);
 
-	if (!data)
-		return NULL;
+	return rgb;
+}// TargaImage
 
-	// Divide out the alpha
-	for (i = 0; i < height; i++)
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Convert the image to RGB form into the given buffer, which must hold
+//  width * height * 3 bytes.
+//
+///////////////////////////////////////////////////////////////////////////////
+void TargaImage::To_RGB(unsigned char* rgb) const
+{
+	if (format == FORMAT_FLOAT)
 	{
-		int in_offset = i * width * 4;
-		int out_offset = i * width * 3;
+		ThreadPool::Run_Bands(height, [&](int begin, int end)
+		{
+			Scratch scratch;
+			unsigned char* rgba = scratch.New<unsigned char>(width * 4);
+			for (int i = begin; i < end; i++)
+			{
+				Delinearize_Row(linear + i * width * 4, width, rgba);
+				Row_To_RGB(rgba, width, rgb + i * width * 3, opaque);
+			}
+		});
+		return;
+	}
 
-		for (j = 0; j < width; j++)
+	if (format == FORMAT_16)
+	{
+		ThreadPool::Run_Bands(height, [&](int begin, int end)
 		{
-			RGBA_To_RGB(data + (in_offset + j * 4), rgb + (out_offset + j * 3));
-		}
+			Scratch scratch;
+			unsigned char* rgba = scratch.New<unsigned char>(width * 4);
+			for (int i = begin; i < end; i++)
+			{
+				Narrow_Row(wide + i * width * 4, width, i, rgba);
+				Row_To_RGB(rgba, width, rgb + i * width * 3, opaque);
+			}
+		});
+		return;
 	}
 
-	return rgb;
-}// TargaImage
+	if (layout == LAYOUT_PLANAR)
+	{
+		int n = width * height;
+		ThreadPool::Run_Bands(height, [&](int begin, int end)
+		{
+			Scratch scratch;
+			unsigned char* straight = scratch.New<unsigned char>(width);
+			for (int i = begin; i < end; i++)
+			{
+				unsigned char* out = rgb + i * width * 3;
+				for (int k = 0; k < 3; k++)
+				{
+					const unsigned char* plane = data + k * n + i * width;
+					if (!opaque)
+					{
+						Unpremultiply_Plane(plane, data + 3 * n + i * width, width, straight);
+						plane = straight;
+					}
+					for (int j = 0; j < width; j++)
+						out[j * 3 + k] = plane[j];
+				}
+			}
+		});
+		return;
+	}
+
+	// Divide out the alpha
+	ThreadPool::Run_Bands(height, [&](int begin, int end)
+	{
+		for (int i = begin; i < end; i++)
+		{
+			Row_To_RGB(data + i * stride, width, rgb + i * width * 3, opaque);
+		}
+	});
+}// To_RGB
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      True if a file name ends in c_sRaw16Extension, in any case.
+//
+///////////////////////////////////////////////////////////////////////////////
+static bool Has_Raw_16_Extension(const char* filename)
+{
+	size_t length = strlen(filename), extension = strlen(c_sRaw16Extension);
+	if (length < extension)
+		return false;
+
+	for (size_t m = 0; m < extension; m++)
+	{
+		if (tolower((unsigned char)filename[length - extension + m]) != c_sRaw16Extension[m])
+			return false;
+	}
+	return true;
+}// Has_Raw_16_Extension
 
 
 ///////////////////////////////////////////////////////////////////////////////
 //
-//      Save the image to a targa file. Returns 1 on success, 0 on failure.
+//      Save the image to a targa file, or to a raw 16-bit file when the name
+//  ends in c_sRaw16Extension.  With rle the targa is run length encoded,
+//  which a raw 16-bit file ignores.  Returns 1 on success, 0 on failure.
 //
 ///////////////////////////////////////////////////////////////////////////////
-bool TargaImage::Save_Image(const char* filename)
+bool TargaImage::Save_Image(const char* filename, bool rle)
 {
-	TargaImage* out_image = Reverse_Rows();
+	if (Has_Raw_16_Extension(filename))
+		return Save_Raw_16(filename);
 
-	if (!out_image)
+	if (!data && !linear && !wide)
 		return false;
 
-	if (!tga_write_raw(filename, width, height, out_image->data, TGA_TRUECOLOR_32))
+	if (width > c_maxTargaSide || height > c_maxTargaSide)
 	{
-		cout << "TGA Save Error: %s\n", tga_error_string(tga_get_last_error());
+		cout << "TGA Save Error: " << width << "x" << height << " is bigger than a targa holds, " << c_maxTargaSide << " pixels on a side" << endl;
 		return false;
 	}
 
-	delete out_image;
+	// rows go to the file from where they are, bottom up, or from a buffer
+	// when they have to be converted to interleaved bytes first
+	int size = width * height;
+	bool saved = Save_Targa(filename, width, height, opaque, [&](int row, unsigned char* buffer) -> const unsigned char*
+	{
+		if (format == FORMAT_FLOAT)
+			Delinearize_Row(linear + row * width * 4, width, buffer);
+		else if (format == FORMAT_16)
+			Narrow_Row(wide + row * width * 4, width, row, buffer);
+		else if (layout == LAYOUT_PLANAR)
+			Interleave_Row(data + row * width, data + size + row * width, data + 2 * size + row * width, data + 3 * size + row * width, width, buffer);
+		else
+			return data + row * stride;
+		return buffer;
+	}, rle);
+
+	if (!saved)
+	{
+		cout << "TGA Save Error: unable to write " << filename << endl;
+		return false;
+	}
 
 	return true;
 }// Save_Image
@@ -168,13 +1000,15 @@ bool TargaImage::Save_Image(const char* filename)
 ///////////////////////////////////////////////////////////////////////////////
 //
 //      Load a targa image from a file.  Return a new TargaImage object which 
-//  must be deleted by caller.  Return NULL on failure.
+//  must be deleted by caller.  Return NULL on failure.  The usual truecolor
+//  files are mapped and decoded straight from the mapping into the image's
+//  rows, which is the only copy made of their pixels.  The rest go through
+//  libtarga.
 //
 ///////////////////////////////////////////////////////////////////////////////
 TargaImage* TargaImage::Load_Image(char* filename)
 {
 	unsigned char* temp_data;
-	TargaImage* temp_image;
 	TargaImage* result;
 	int		        width, height;
 
@@ -184,6 +1018,25 @@ TargaImage* TargaImage::Load_Image(char* filename)
 		return NULL;
 	}// if
 
+	if (Has_Raw_16_Extension(filename))
+		return Load_Raw_16(filename);
+
+	{
+		MappedFile file(filename);
+		TargaHeader header;
+		const unsigned char* pixels;
+		size_t size;
+		if (Open_Targa(file, header, pixels, size))
+		{
+			result = new TargaImage();
+			result->width = header.width;
+			result->height = header.height;
+			result->New_Data();
+			result->opaque = Decode_Targa(header, pixels, size, result->data + (size_t)(header.height - 1) * result->stride, -result->stride);
+			return result;
+		}
+	}
+
 	temp_data = (unsigned char*)tga_load(filename, &width, &height, TGA_TRUECOLOR_32);
 	if (!temp_data)
 	{
@@ -191,15 +1044,183 @@ TargaImage* TargaImage::Load_Image(char* filename)
 		width = height = 0;
 		return NULL;
 	}
-	temp_image = new TargaImage(width, height, temp_data);
+
+	// libtarga's rows are bottom up
+	size_t tempBytes = (size_t)width * height * 4;
+	Count_Other_Bytes(tempBytes);
+	result = new TargaImage();
+	result->width = width;
+	result->height = height;
+	result->New_Data();
+	for (int i = 0; i < height; i++)
+		memcpy(result->data + i * result->stride, temp_data + (size_t)(height - 1 - i) * width * 4, width * 4);
+	result->opaque = All_Opaque(temp_data, width * height);
 	free(temp_data);
+	Count_Other_Bytes(-(long long)tempBytes);
+
+	return result;
+}// Load_Image
+
+
+// the first bytes of a raw 16-bit file, see c_sRaw16Extension
+static const char c_sRaw16Magic[] = "RGBA16\n";
+const int c_raw16MagicSize = 7;
 
-	result = temp_image->Reverse_Rows();
 
-	delete temp_image;
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Write a 32-bit number or a row of 16-bit channels little endian,
+//  whatever the byte order of the machine, and read them back.
+//
+///////////////////////////////////////////////////////////////////////////////
+static void Put_32(unsigned int value, unsigned char* bytes)
+{
+	for (int b = 0; b < 4; b++)
+		bytes[b] = (unsigned char)(value >> (8 * b));
+}// Put_32
+
+static unsigned int Get_32(const unsigned char* bytes)
+{
+	return bytes[0] | (bytes[1] << 8) | (bytes[2] << 16) | ((unsigned int)bytes[3] << 24);
+}// Get_32
+
+static void Put_Row_16(const unsigned short* channels, int n, unsigned char* bytes)
+{
+	for (int m = 0; m < n; m++)
+	{
+		bytes[m * 2] = (unsigned char)channels[m];
+		bytes[m * 2 + 1] = (unsigned char)(channels[m] >> 8);
+	}
+}// Put_Row_16
+
+static void Get_Row_16(const unsigned char* bytes, int n, unsigned short* channels)
+{
+	for (int m = 0; m < n; m++)
+		channels[m] = (unsigned short)(bytes[m * 2] | (bytes[m * 2 + 1] << 8));
+}// Get_Row_16
 
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Save the image as a raw 16-bit file, converting each row from the
+//  image's format as it goes; byte images come out as their bytes times 257.
+//  Returns success of operation.
+//
+///////////////////////////////////////////////////////////////////////////////
+bool TargaImage::Save_Raw_16(const char* filename)
+{
+	if (!data && !linear && !wide)
+		return false;
+
+	FILE* file = fopen(filename, "wb");
+	if (!file)
+	{
+		cout << "Raw 16-bit Save Error: cannot open " << filename << endl;
+		return false;
+	}
+
+	unsigned char header[c_raw16MagicSize + 8];
+	memcpy(header, c_sRaw16Magic, c_raw16MagicSize);
+	Put_32(width, header + c_raw16MagicSize);
+	Put_32(height, header + c_raw16MagicSize + 4);
+	bool written = fwrite(header, sizeof(header), 1, file) == 1;
+
+	int n = width * height;
+	Scratch scratch;
+	unsigned char* rgba = scratch.New<unsigned char>(width * 4);
+	unsigned short* row = scratch.New<unsigned short>(width * 4);
+	unsigned char* bytes = scratch.New<unsigned char>(width * 8);
+	for (int i = 0; i < height && written; i++)
+	{
+		int offset = i * width;
+		if (format == FORMAT_16)
+			Put_Row_16(wide + offset * 4, width * 4, bytes);
+		else
+		{
+			if (format == FORMAT_FLOAT)
+				Delinearize_Row_16(linear + offset * 4, width, row);
+			else if (layout == LAYOUT_PLANAR)
+			{
+				Interleave_Row(data + offset, data + n + offset, data + 2 * n + offset, data + 3 * n + offset, width, rgba);
+				Widen_Row(rgba, width, row);
+			}
+			else
+				Widen_Row(data + i * stride, width, row);
+			Put_Row_16(row, width * 4, bytes);
+		}
+		written = fwrite(bytes, width * 8, 1, file) == 1;
+	}
+
+	if (fclose(file) != 0 || !written)
+	{
+		cout << "Raw 16-bit Save Error: cannot write " << filename << endl;
+		return false;
+	}
+	return true;
+}// Save_Raw_16
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Load a raw 16-bit file into a new 16-bit image, which must be deleted
+//  by the caller.  Return NULL on failure.
+//
+///////////////////////////////////////////////////////////////////////////////
+TargaImage* TargaImage::Load_Raw_16(const char* filename)
+{
+	FILE* file = fopen(filename, "rb");
+	if (!file)
+	{
+		cout << "Raw 16-bit Error: cannot open " << filename << endl;
+		return NULL;
+	}
+
+	unsigned char header[c_raw16MagicSize + 8];
+	if (fread(header, sizeof(header), 1, file) != 1 || memcmp(header, c_sRaw16Magic, c_raw16MagicSize) != 0)
+	{
+		cout << "Raw 16-bit Error: " << filename << " is not a raw 16-bit image" << endl;
+		fclose(file);
+		return NULL;
+	}
+
+	unsigned int width = Get_32(header + c_raw16MagicSize);
+	unsigned int height = Get_32(header + c_raw16MagicSize + 4);
+	if (width == 0 || height == 0 || (unsigned long long)width * height * 4 > INT_MAX)
+	{
+		cout << "Raw 16-bit Error: bad size in " << filename << endl;
+		fclose(file);
+		return NULL;
+	}
+
+	TargaImage* result = new TargaImage();
+	result->width = width;
+	result->height = height;
+	result->format = FORMAT_16;
+	result->wide = Pixels_New<unsigned short>(width * height * 4);
+
+	Scratch scratch;
+	unsigned char* bytes = scratch.New<unsigned char>(width * 8);
+	bool opaque = true;
+	for (unsigned int i = 0; i < height; i++)
+	{
+		if (fread(bytes, width * 8, 1, file) != 1)
+		{
+			cout << "Raw 16-bit Error: " << filename << " is cut short" << endl;
+			fclose(file);
+			delete result;
+			return NULL;
+		}
+
+		unsigned short* row = result->wide + i * width * 4;
+		Get_Row_16(bytes, width * 4, row);
+		for (unsigned int j = 0; j < width; j++)
+			opaque = opaque && row[j * 4 + 3] == 65535;
+	}
+	fclose(file);
+
+	result->opaque = opaque;
 	return result;
-}// Load_Image
+}// Load_Raw_16
 
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -211,6 +1232,8 @@ TargaImage* TargaImage::Load_Image(char* filename)
 ///////////////////////////////////////////////////////////////////////////////
 bool TargaImage::To_Grayscale()
 {
+	Mark_Changed();
+	Set_Format(FORMAT_BYTE);
 
 	if ((width == 0) && (height == 0))
 	{
@@ -221,16 +1244,55 @@ bool TargaImage::To_Grayscale()
 	}// if
 	else
 	{
-		for (int i = 0; i < height; i++) {
-			for (int j = 0; j < width; j++) {
-				int index = (i * width + j) * 4;
-				unsigned char   rgbGray[3];
+		if (layout == LAYOUT_PLANAR)
+		{
+			int n = width * height;
+			ThreadPool::Run_Bands(height, [&](int begin, int end)
+			{
+				Scratch scratch;
+				unsigned char* straight = scratch.New<unsigned char>(opaque ? 0 : width * 3);
+				for (int i = begin; i < end; i++)
+				{
+					unsigned char* r = data + i * width;
+					unsigned char* g = r + n;
+					unsigned char* b = g + n;
+					const unsigned char* sr = r;
+					const unsigned char* sg = g;
+					const unsigned char* sb = b;
+					if (!opaque)
+					{
+						const unsigned char* a = b + n;
+						Unpremultiply_Plane(r, a, width, straight);
+						Unpremultiply_Plane(g, a, width, &straight[width]);
+						Unpremultiply_Plane(b, a, width, &straight[2 * width]);
+						sr = straight;
+						sg = &straight[width];
+						sb = &straight[2 * width];
+					}
+					for (int j = 0; j < width; j++)
+						r[j] = (unsigned char)(0.299 * sr[j] + 0.587 * sg[j] + 0.114 * sb[j]);
+					memcpy(g, r, width);
+					memcpy(b, r, width);
+				}
+			});
+			return true;
+		}
+
+		ThreadPool::Run_Bands(height, [&](int begin, int end) {
+			Scratch scratch;
+			unsigned char* row = scratch.New<unsigned char>(opaque ? 0 : width * 3);
+			for (int i = begin; i < end; i++) {
+				if (!opaque)
+					Unpremultiply_Row(data + i * stride, width, row);
+				for (int j = 0; j < width; j++) {
+					int index = i * stride + j * 4;
+					unsigned char*  rgbGray = opaque ? data + index : &row[j * 3];
 
-				RGBA_To_RGB(data + index, rgbGray);
-				data[index] = data[index + 1] = data[index + 2] = 0.299 * rgbGray[0] + 0.587 * rgbGray[1] + 0.114 * rgbGray[2];//grayscale function
-					//This operation should not affect alpha in any way.
+					data[index] = data[index + 1] = data[index + 2] = 0.299 * rgbGray[0] + 0.587 * rgbGray[1] + 0.114 * rgbGray[2];//grayscale function
+						//This operation should not affect alpha in any way.
+				}
 			}
-		}
+		});
 		//for (int i = 0; i < width * height * 4; i += 4)
 		//{
 		//    unsigned char   rgbGray[3];
@@ -252,6 +1314,8 @@ bool TargaImage::To_Grayscale()
 ///////////////////////////////////////////////////////////////////////////////
 bool TargaImage::Quant_Uniform()
 {
+	Mark_Changed();
+	Set_Format(FORMAT_BYTE);
 	if ((width == 0) && (height == 0))
 	{
 		//Quant_Uniform before load image
@@ -259,20 +1323,53 @@ bool TargaImage::Quant_Uniform()
 		cout << "Quant_Uniform: no image\n";
 		return false;
 	}// if
+	else if (layout == LAYOUT_PLANAR)
+	{
+		int n = width * height;
+		ThreadPool::Run_Bands(height, [&](int begin, int end)
+		{
+			for (int i = begin; i < end; i++)
+			{
+				unsigned char* alpha = data + 3 * n + i * width;
+				for (int k = 0; k < 3; k++)
+				{
+					unsigned char* plane = data + k * n + i * width;
+					unsigned char keep = (k < 2) ? ~31 : ~63;     //8 shades of red and green, 4 of blue
+					if (!opaque)
+						Unpremultiply_Plane(plane, alpha, width, plane);
+					for (int j = 0; j < width; j++)
+						plane[j] &= keep;
+				}
+				memset(alpha, 255, width);
+			}
+		});
+		opaque = true;
+		return true;
+	}
 	else
 	{
-		for (int i = 0; i < width * height * 4; i += 4)
+		ThreadPool::Run_Bands(height, [&](int begin, int end)
 		{
-			unsigned char   rgbUni[3];
-
-			RGBA_To_RGB(data + i, rgbUni);
-
-			//0-31->0, 224-255->224
-			data[i] = rgbUni[0] / 32 * 32;//r: 8 shades of red
-			data[i + 1] = rgbUni[1] / 32 * 32;//g: 8 shades of green
-			data[i + 2] = rgbUni[2] / 64 * 64;//b: 4 shades of blue
-			data[i + 3] = 255;
-		}
+			Scratch scratch;
+			unsigned char* row = scratch.New<unsigned char>(opaque ? 0 : width * 3);
+			for (int r = begin; r < end; r++)
+			{
+				if (!opaque)
+					Unpremultiply_Row(data + r * stride, width, row);
+				for (int j = 0; j < width; j++)
+				{
+					int i = r * stride + j * 4;
+					unsigned char*  rgbUni = opaque ? data + i : &row[j * 3];
+
+					//0-31->0, 224-255->224
+					data[i] = rgbUni[0] / 32 * 32;//r: 8 shades of red
+					data[i + 1] = rgbUni[1] / 32 * 32;//g: 8 shades of green
+					data[i + 2] = rgbUni[2] / 64 * 64;//b: 4 shades of blue
+					data[i + 3] = 255;
+				}
+			}
+		});
+		opaque = true;
 		return true;
 	}
 }// Quant_Uniform
@@ -286,6 +1383,9 @@ bool TargaImage::Quant_Uniform()
 ///////////////////////////////////////////////////////////////////////////////
 bool TargaImage::Quant_Populosity()
 {
+	Mark_Changed();
+	Set_Format(FORMAT_BYTE);
+	Set_Layout(LAYOUT_INTERLEAVED);
 	if ((width == 0) && (height == 0))
 	{
 		//Quant_Populosity before load image
@@ -297,36 +1397,42 @@ bool TargaImage::Quant_Populosity()
 	{
 		std::vector<populoData> populo;
 		populo.reserve(32768);
-		for (int i = 0; i < width * height * 4; i += 4)
+		for (int r = 0; r < height; r++)
 		{
-			unsigned char   rgbUni[3];
+			for (int i = r * stride; i < r * stride + width * 4; i += 4)
+			{
+				unsigned char   rgbUni[3];
 
-			RGBA_To_RGB(data + i, rgbUni);
+				if (opaque)
+					memcpy(rgbUni, data + i, 3);
+				else
+					RGBA_To_RGB(data + i, rgbUni);
 
-			//32 shades: 0-7->0, 248-255->248
-			populoData temp;
-			temp.rgb[0] = data[i] = rgbUni[0] / 8;
-			temp.rgb[1] = data[i + 1] = rgbUni[1] / 8;
-			temp.rgb[2] = data[i + 2] = rgbUni[2] / 8;
+				//32 shades: 0-7->0, 248-255->248
+				populoData temp;
+				temp.rgb[0] = data[i] = rgbUni[0] / 8;
+				temp.rgb[1] = data[i + 1] = rgbUni[1] / 8;
+				temp.rgb[2] = data[i + 2] = rgbUni[2] / 8;
 
-			unsigned int sameInd = -1;
-			for (int j = 0; j < populo.size(); j++)
-			{
-				if (temp == populo[j])//call populoData opoerator==
+				unsigned int sameInd = -1;
+				for (int j = 0; j < populo.size(); j++)
 				{
-					//duplicate
-					sameInd = j;
-					populo.at(sameInd).count++;
-					break;
+					if (temp == populo[j])//call populoData opoerator==
+					{
+						//duplicate
+						sameInd = j;
+						populo.at(sameInd).count++;
+						break;
+					}
 				}
+				if (sameInd == -1)
+				{
+					//unique or empty array
+					temp.count = 1;
+					populo.push_back(temp);
+				}
+				//std::cout << (int)temp.rgb[0] << ' ' << (int)temp.rgb[1] << ' ' << (int)temp.rgb[2] << std::endl;
 			}
-			if (sameInd == -1)
-			{
-				//unique or empty array
-				temp.count = 1;
-				populo.push_back(temp);
-			}
-			//std::cout << (int)temp.rgb[0] << ' ' << (int)temp.rgb[1] << ' ' << (int)temp.rgb[2] << std::endl;
 		}
 
 
@@ -343,40 +1449,47 @@ bool TargaImage::Quant_Populosity()
 
 		if (populo.size() > 0)
 		{
-			for (int i = 0; i < width * height * 4; i += 4)
+			for (int r = 0; r < height; r++)
 			{
-				//find the closest color
-				unsigned int minInd = 0;
-				double min = euclideanDistance(populo.at(0), data, i);
-				for (int j = 1; j < populo.size(); j++) {
-					double temp = euclideanDistance(populo.at(j), data, i);
-					if (min > temp)
-					{
-						minInd = j;
-						min = temp;
+				for (int i = r * stride; i < r * stride + width * 4; i += 4)
+				{
+					//find the closest color
+					unsigned int minInd = 0;
+					double min = euclideanDistance(populo.at(0), data, i);
+					for (int j = 1; j < populo.size(); j++) {
+						double temp = euclideanDistance(populo.at(j), data, i);
+						if (min > temp)
+						{
+							minInd = j;
+							min = temp;
+						}
 					}
-				}
 
-				//change to this color
-				for (int j = 0; j < 3; j++)
-				{
-					data[i + j] = populo.at(minInd).rgb[j] * 8;
+					//change to this color
+					for (int j = 0; j < 3; j++)
+					{
+						data[i + j] = populo.at(minInd).rgb[j] * 8;
+					}
+					data[i + 3] = 255;
 				}
-				data[i + 3] = 255;
 			}
 		}
 		else
 		{
-			for (int i = 0; i < width * height * 4; i += 4)
+			for (int r = 0; r < height; r++)
 			{
-				//change to this color
-				for (int j = 0; j < 3; j++)
+				for (int i = r * stride; i < r * stride + width * 4; i += 4)
 				{
-					data[i + j] *= 8;
+					//change to this color
+					for (int j = 0; j < 3; j++)
+					{
+						data[i + j] *= 8;
+					}
+					data[i + 3] = 255;
 				}
-				data[i + 3] = 255;
 			}
 		}
+		opaque = true;
 		return true;
 	}
 }// Quant_Populosity
@@ -389,6 +1502,9 @@ bool TargaImage::Quant_Populosity()
 ///////////////////////////////////////////////////////////////////////////////
 bool TargaImage::Dither_Threshold()
 {
+	Mark_Changed();
+	Set_Format(FORMAT_BYTE);
+	Set_Layout(LAYOUT_INTERLEAVED);
 	if ((width == 0) && (height == 0))
 	{
 		//Dither_Threshold before load image
@@ -400,12 +1516,19 @@ bool TargaImage::Dither_Threshold()
 	{
 		if (To_Grayscale())
 		{
-			for (int i = 0; i < width * height * 4; i += 4)
+			ThreadPool::Run_Bands(height, [&](int begin, int end)
 			{
-				data[i] = data[i + 1] = data[i + 2] = (unsigned char)thresholdFunc((double)data[i], 255 * 0.5);
-				data[i + 3] = (unsigned char)255;
-				//std::cout << (int)data[i] << ' ' << (int)data[i + 1] << ' ' << (int)data[i + 2] << std::endl;
-			}
+				for (int r = begin; r < end; r++)
+				{
+					for (int i = r * stride; i < r * stride + width * 4; i += 4)
+					{
+						data[i] = data[i + 1] = data[i + 2] = (unsigned char)thresholdFunc((double)data[i], 255 * 0.5);
+						data[i + 3] = (unsigned char)255;
+						//std::cout << (int)data[i] << ' ' << (int)data[i + 1] << ' ' << (int)data[i + 2] << std::endl;
+					}
+				}
+			});
+			opaque = true;
 			return true;
 		}
 		else {
@@ -423,6 +1546,9 @@ bool TargaImage::Dither_Threshold()
 ///////////////////////////////////////////////////////////////////////////////
 bool TargaImage::Dither_Random()
 {
+	Mark_Changed();
+	Set_Format(FORMAT_BYTE);
+	Set_Layout(LAYOUT_INTERLEAVED);
 	if ((width == 0) && (height == 0))
 	{
 		//Dither_Threshold before load image
@@ -434,12 +1560,16 @@ bool TargaImage::Dither_Random()
 	{
 		if (To_Grayscale())
 		{
-			for (int i = 0; i < width * height * 4; i += 4)
+			for (int r = 0; r < height; r++)
 			{
-				data[i] = data[i + 1] = data[i + 2] = (unsigned char)thresholdFunc((double)(data[i] + (rand() % 102) - 51), 255 * 0.5);
-				data[i + 3] = (unsigned char)255;
-				//std::cout << (int)data[i] << ' ' << (int)data[i + 1] << ' ' << (int)data[i + 2] << std::endl;
+				for (int i = r * stride; i < r * stride + width * 4; i += 4)
+				{
+					data[i] = data[i + 1] = data[i + 2] = (unsigned char)thresholdFunc((double)(data[i] + (rand() % 102) - 51), 255 * 0.5);
+					data[i + 3] = (unsigned char)255;
+					//std::cout << (int)data[i] << ' ' << (int)data[i + 1] << ' ' << (int)data[i + 2] << std::endl;
+				}
 			}
+			opaque = true;
 			return true;
 		}
 		else {
@@ -452,12 +1582,26 @@ bool TargaImage::Dither_Random()
 
 ///////////////////////////////////////////////////////////////////////////////
 //
-//      Perform Floyd-Steinberg dithering on the image.  Return success of 
-//  operation.
+//      Perform Floyd-Steinberg dithering on the image.  A 16-bit image is
+//  dithered from its 16-bit grays, so the error it diffuses includes the
+//  bits a byte cannot hold.  Return success of operation.
 //
 ///////////////////////////////////////////////////////////////////////////////
 bool TargaImage::Dither_FS()
 {
+	Mark_Changed();
+	Scratch scratch;
+	double* fineGray = NULL;
+	if (format == FORMAT_16)
+	{
+		unsigned short* rgb = scratch.New<unsigned short>(width * height * 3);
+		Wide_RGB(rgb);
+		fineGray = scratch.New<double>(width * height);
+		for (int p = 0; p < width * height; p++)
+			fineGray[p] = (0.299 * rgb[p * 3] + 0.587 * rgb[p * 3 + 1] + 0.114 * rgb[p * 3 + 2]) / 257.0;
+	}
+	Set_Format(FORMAT_BYTE);
+	Set_Layout(LAYOUT_INTERLEAVED);
 	if ((width == 0) && (height == 0))
 	{
 		//Dither_Bright before load image
@@ -469,14 +1613,14 @@ bool TargaImage::Dither_FS()
 	{
 		if (To_Grayscale())
 		{
-			double* gray = new double[height * width];
+			double* gray = scratch.New<double>(height * width);
 
 			for (int i = 0; i < height; i++)
 			{
 				for (int j = 0; j < width; j++)
 				{
 					int dataIndex = (i * width + j);
-					gray[dataIndex] = data[dataIndex * 4];
+					gray[dataIndex] = fineGray ? fineGray[dataIndex] : data[i * stride + j * 4];
 				}
 			}
 
@@ -573,8 +1717,9 @@ bool TargaImage::Dither_FS()
 				for (int j = 0; j < width; j++)
 				{
 					int dataIndex = (i * width + j);
+					unsigned char* pixel = data + i * stride + j * 4;
 
-					data[dataIndex * 4] = data[dataIndex * 4 + 1] = data[dataIndex * 4 + 2] = thresholdFunc(gray[dataIndex], 255 * 0.5);
+					pixel[0] = pixel[1] = pixel[2] = thresholdFunc(gray[dataIndex], 255 * 0.5);
 				}
 			}
 			return true;
@@ -596,6 +1741,9 @@ bool TargaImage::Dither_FS()
 	///////////////////////////////////////////////////////////////////////////////
 bool TargaImage::Dither_Bright()
 {
+	Mark_Changed();
+	Set_Format(FORMAT_BYTE);
+	Set_Layout(LAYOUT_INTERLEAVED);
 	if ((width == 0) && (height == 0))
 	{
 		//Dither_Bright before load image
@@ -617,10 +1765,13 @@ bool TargaImage::Dither_Bright()
 		{
 			unsigned long long int count = 0;//the total intensity
 
-			for (int i = 0; i < width * height * 4; i += 4)
+			for (int r = 0; r < height; r++)
 			{
-				count += (unsigned long long int)data[i];//the intensity total
-				intensityCount[(int)data[i]]++;//the number of a certain intensity
+				for (int i = r * stride; i < r * stride + width * 4; i += 4)
+				{
+					count += (unsigned long long int)data[i];//the intensity total
+					intensityCount[(int)data[i]]++;//the number of a certain intensity
+				}
 			}
 
 			long long int countReal = count / 255;//[0, 255] to [0, 1]
@@ -642,11 +1793,15 @@ bool TargaImage::Dither_Bright()
 			threshold = (unsigned char)ind;
 			//std::cout << ind << ' ' << (int)threshold << std::endl;
 
-			for (int i = 0; i < width * height * 4; i += 4)
+			for (int r = 0; r < height; r++)
 			{
-				data[i] = data[i + 1] = data[i + 2] = (unsigned char)thresholdFunc((double)data[i], threshold);
-				data[i + 3] = (unsigned char)255;
+				for (int i = r * stride; i < r * stride + width * 4; i += 4)
+				{
+					data[i] = data[i + 1] = data[i + 2] = (unsigned char)thresholdFunc((double)data[i], threshold);
+					data[i + 3] = (unsigned char)255;
+				}
 			}
+			opaque = true;
 			return true;
 		}
 		else {
@@ -664,6 +1819,9 @@ bool TargaImage::Dither_Bright()
 ///////////////////////////////////////////////////////////////////////////////
 bool TargaImage::Dither_Cluster()
 {
+	Mark_Changed();
+	Set_Format(FORMAT_BYTE);
+	Set_Layout(LAYOUT_INTERLEAVED);
 	if ((width == 0) && (height == 0))
 	{
 		//Dither_Threshold before load image
@@ -695,19 +1853,26 @@ bool TargaImage::Dither_Cluster()
 			}*/
 
 			//int count = 0;
-			for (int i = 0; i < height; i++)
+			ThreadPool::Run_Bands(height, [&](int begin, int end)
 			{
-				for (int j = 0; j < width; j++) {
-					int index = (i * width + j) * 4;
-					unsigned char   rgbGray[3];
-
-					RGBA_To_RGB(data + index, rgbGray);
-					double grayscale = 0.299 * (double)rgbGray[0] + 0.587 * (double)rgbGray[1] + 0.114 * (double)rgbGray[2];//grayscale function
-					//count++;
-					data[index] = data[index + 1] = data[index + 2] = (unsigned char)thresholdFunc(grayscale, mask[i % 4][j % 4]);//I[x][y] >= mask[x % 4][y % 4]
-					data[index + 3] = 255;
+				Scratch scratch;
+				unsigned char* row = scratch.New<unsigned char>(opaque ? 0 : width * 3);
+				for (int i = begin; i < end; i++)
+				{
+					if (!opaque)
+						Unpremultiply_Row(data + i * stride, width, row);
+					for (int j = 0; j < width; j++) {
+						int index = i * stride + j * 4;
+						unsigned char*  rgbGray = opaque ? data + index : &row[j * 3];
+
+						double grayscale = 0.299 * (double)rgbGray[0] + 0.587 * (double)rgbGray[1] + 0.114 * (double)rgbGray[2];//grayscale function
+						//count++;
+						data[index] = data[index + 1] = data[index + 2] = (unsigned char)thresholdFunc(grayscale, mask[i % 4][j % 4]);//I[x][y] >= mask[x % 4][y % 4]
+						data[index + 3] = 255;
+					}
 				}
-			}
+			});
+			opaque = true;
 			return true;
 		}
 	}
@@ -717,12 +1882,27 @@ bool TargaImage::Dither_Cluster()
 ///////////////////////////////////////////////////////////////////////////////
 //
 //  Convert the image to an 8 bit image using Floyd-Steinberg dithering over
-//  a uniform quantization - the same quantization as in Quant_Uniform.
+//  a uniform quantization - the same quantization as in Quant_Uniform.  A
+//  16-bit image is dithered from its 16-bit channels, like Dither_FS.
 //  Return success of operation.
 //
 ///////////////////////////////////////////////////////////////////////////////
 bool TargaImage::Dither_Color()
 {
+	Mark_Changed();
+	Scratch scratch;
+	double* fineRGB = NULL;
+	if (format == FORMAT_16)
+	{
+		fineRGB = scratch.New<double>(width * height * 3);
+		for (int p = 0; p < width * height; p++)
+		{
+			for (int k = 0; k < 3; k++)
+				fineRGB[p * 3 + k] = wide[p * 4 + k] / 257.0;
+		}
+	}
+	Set_Format(FORMAT_BYTE);
+	Set_Layout(LAYOUT_INTERLEAVED);
 	if ((width == 0) && (height == 0))
 	{
 		//Dither_Bright before load image
@@ -732,16 +1912,16 @@ bool TargaImage::Dither_Color()
 	}// if
 	else
 	{
-		double* rgb = new double[height * width * 3];
+		double* rgb = fineRGB ? fineRGB : scratch.New<double>(height * width * 3);
 
-		for (int i = 0; i < height; i++)
+		for (int i = 0; i < height && !fineRGB; i++)
 		{
 			for (int j = 0; j < width; j++)
 			{
 				int dataIndex = (i * width + j);
-				rgb[dataIndex * 3] = data[dataIndex * 4];
-				rgb[dataIndex * 3 + 1] = data[dataIndex * 4 + 1];
-				rgb[dataIndex * 3 + 2] = data[dataIndex * 4 + 2];
+				rgb[dataIndex * 3] = data[i * stride + j * 4];
+				rgb[dataIndex * 3 + 1] = data[i * stride + j * 4 + 1];
+				rgb[dataIndex * 3 + 2] = data[i * stride + j * 4 + 2];
 			}
 		}
 
@@ -857,13 +2037,15 @@ bool TargaImage::Dither_Color()
 			for (int j = 0; j < width; j++)
 			{
 				int dataIndex = (i * width + j);
+				unsigned char* pixel = data + i * stride + j * 4;
 
-				data[dataIndex * 4] = Quantthreshold(rgb[dataIndex * 3], 0);
-				data[dataIndex * 4 + 1] = Quantthreshold(rgb[dataIndex * 3 + 1], 1);
-				data[dataIndex * 4 + 2] = Quantthreshold(rgb[dataIndex * 3 + 2], 2);
-				data[dataIndex * 4 + 3] = 255;
+				pixel[0] = Quantthreshold(rgb[dataIndex * 3], 0);
+				pixel[1] = Quantthreshold(rgb[dataIndex * 3 + 1], 1);
+				pixel[2] = Quantthreshold(rgb[dataIndex * 3 + 2], 2);
+				pixel[3] = 255;
 			}
 		}
+		opaque = true;
 		return true;
 	}
 }// Dither_Color
@@ -877,6 +2059,7 @@ bool TargaImage::Dither_Color()
 ///////////////////////////////////////////////////////////////////////////////
 bool TargaImage::Comp_Over(TargaImage* pImage)
 {
+	Mark_Changed();
 	if (width != pImage->width || height != pImage->height)
 	{
 		cout << "Comp_Over: Images not the same size\n";
@@ -896,6 +2079,7 @@ bool TargaImage::Comp_Over(TargaImage* pImage)
 ///////////////////////////////////////////////////////////////////////////////
 bool TargaImage::Comp_In(TargaImage* pImage)
 {
+	Mark_Changed();
 	if (width != pImage->width || height != pImage->height)
 	{
 		cout << "Comp_In: Images not the same size\n";
@@ -915,6 +2099,7 @@ bool TargaImage::Comp_In(TargaImage* pImage)
 ///////////////////////////////////////////////////////////////////////////////
 bool TargaImage::Comp_Out(TargaImage* pImage)
 {
+	Mark_Changed();
 	if (width != pImage->width || height != pImage->height)
 	{
 		cout << "Comp_Out: Images not the same size\n";
@@ -934,6 +2119,7 @@ bool TargaImage::Comp_Out(TargaImage* pImage)
 ///////////////////////////////////////////////////////////////////////////////
 bool TargaImage::Comp_Atop(TargaImage* pImage)
 {
+	Mark_Changed();
 	if (width != pImage->width || height != pImage->height)
 	{
 		cout << "Comp_Atop: Images not the same size\n";
@@ -953,6 +2139,7 @@ bool TargaImage::Comp_Atop(TargaImage* pImage)
 ///////////////////////////////////////////////////////////////////////////////
 bool TargaImage::Comp_Xor(TargaImage* pImage)
 {
+	Mark_Changed();
 	if (width != pImage->width || height != pImage->height)
 	{
 		cout << "Comp_Xor: Images not the same size\n";
@@ -972,8 +2159,13 @@ bool TargaImage::Comp_Xor(TargaImage* pImage)
 ///////////////////////////////////////////////////////////////////////////////
 bool TargaImage::Difference(TargaImage* pImage)
 {
+	Mark_Changed();
+	Set_Format(FORMAT_BYTE);
+	Set_Layout(LAYOUT_INTERLEAVED);
 	if (!pImage)
 		return false;
+	pImage->Set_Format(FORMAT_BYTE);
+	pImage->Set_Layout(LAYOUT_INTERLEAVED);
 
 	if (width != pImage->width || height != pImage->height)
 	{
@@ -1011,31 +2203,48 @@ bool TargaImage::Difference(TargaImage* pImage)
 	//    }
 	//}
 	//std::cout << count << std::endl;
-	for (int i = 0; i < width * height * 4; i += 4)
+	bool bothOpaque = opaque && pImage->opaque;
+	ThreadPool::Run_Bands(height, [&](int begin, int end)
 	{
-		unsigned char        rgb1[3];
-		unsigned char        rgb2[3];
-
-		RGBA_To_RGB(data + i, rgb1);
-		RGBA_To_RGB(pImage->data + i, rgb2);
+		Scratch scratch;
+		unsigned char* row1 = scratch.New<unsigned char>(bothOpaque ? 0 : width * 3);
+		unsigned char* row2 = scratch.New<unsigned char>(bothOpaque ? 0 : width * 3);
+		for (int r = begin; r < end; r++)
+		{
+			if (!bothOpaque)
+			{
+				Unpremultiply_Row(data + r * stride, width, row1);
+				Unpremultiply_Row(pImage->data + r * pImage->stride, width, row2);
+			}
+			for (int j = 0; j < width; j++)
+			{
+				int i = r * stride + j * 4;
+				unsigned char*       rgb1 = bothOpaque ? data + i : &row1[j * 3];
+				unsigned char*       rgb2 = bothOpaque ? pImage->data + r * pImage->stride + j * 4 : &row2[j * 3];
 
-		data[i] = abs(rgb1[0] - rgb2[0]);
-		data[i + 1] = abs(rgb1[1] - rgb2[1]);
-		data[i + 2] = abs(rgb1[2] - rgb2[2]);
-		data[i + 3] = 255;
-	}
+				data[i] = abs(rgb1[0] - rgb2[0]);
+				data[i + 1] = abs(rgb1[1] - rgb2[1]);
+				data[i + 2] = abs(rgb1[2] - rgb2[2]);
+				data[i + 3] = 255;
+			}
+		}
+	});
 
+	opaque = true;
 	return true;
 }// Difference
 
 
 ///////////////////////////////////////////////////////////////////////////////
 //
-//      Perform 5x5 box filter on this image.  Return success of operation.
+//      Perform a (2 * radius + 1) square box filter on this image, 5x5 by
+//  default.  Both passes are running sums, so the cost per pixel does not
+//  depend on the radius.  Return success of operation.
 //
 ///////////////////////////////////////////////////////////////////////////////
-bool TargaImage::Filter_Box()
+bool TargaImage::Filter_Box(int radius)
 {
+	Mark_Changed();
 	if ((width == 0) && (height == 0))
 	{
 		//Filter_Box before load image
@@ -1043,895 +2252,1710 @@ bool TargaImage::Filter_Box()
 		cout << "Filter_Box: no image\n";
 		return false;
 	}// if
+	else if (radius < 0 || radius > c_maxFilterRadius)
+	{
+		cout << "Filter_Box: radius must be between 0 and " << c_maxFilterRadius << "\n";
+		return false;
+	}
 	else
 	{
-		unsigned char* temp = new unsigned char[width * height * 4];
-		for (int i = 0; i < height; i++)
-		{
-			for (int j = 0; j < width; j++) {
-				//find the range limit
-				int left = j - 2;
-				int right = j + 2;
-				int up = i - 2;
-				int down = i + 2;
-				if (left < 0)    left = 0;
-				if (right >= width)    right = width - 1;
-				if (up < 0)     up = 0;
-				if (down >= height)     down = height - 1;;
+		return Convolve(Kernel::Box(radius), BORDER_ZERO, CONVOLVE_SEPARABLE);
+	}
+}// Filter_Box
 
 
-				int rgbTotal[3] = { 0,0,0 };//add the neer together
-				for (int l = up; l <= down; l++)
-				{
-					for (int m = left; m <= right; m++)
-					{
-						int ind = ((l * width) + m) * 4;
-						unsigned char   rgbNeer[3];
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Perform a (2 * radius + 1) square Bartlett filter on this image, 5x5
+//  by default.  The triangle along each axis is two cascaded box passes of
+//  radius + 1 taps, so the cost per pixel does not depend on the radius.
+//  Return success of operation.
+//
+///////////////////////////////////////////////////////////////////////////////
+bool TargaImage::Filter_Bartlett(int radius)
+{
+	Mark_Changed();
+	if ((width == 0) && (height == 0))
+	{
+		//Filter_Bartlett before load image
+		ClearToBlack();
+		cout << "Filter_Bartlett: no image\n";
+		return false;
+	}// if
+	else if (radius < 0 || radius > c_maxFilterRadius)
+	{
+		cout << "Filter_Bartlett: radius must be between 0 and " << c_maxFilterRadius << "\n";
+		return false;
+	}
+	else
+	{
+		return Convolve(Kernel::Bartlett(radius), BORDER_ZERO, CONVOLVE_SEPARABLE);
+	}
+}// Filter_Bartlett
 
-						RGBA_To_RGB(data + ind, rgbNeer);
 
-						for (int k = 0; k < 3; k++)
-						{
-							rgbTotal[k] += (int)rgbNeer[k];
-						}
-					}
-				}
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Perform 5x5 Gaussian filter on this image.  Return success of 
+//  operation.
+//
+///////////////////////////////////////////////////////////////////////////////
+bool TargaImage::Filter_Gaussian()
+{
+	Mark_Changed();
+	if ((width == 0) && (height == 0))
+	{
+		//Filter_Gaussian before load image
+		ClearToBlack();
+		cout << "Filter_Gaussian: no image\n";
+		return false;
+	}// if
+	else
+	{
+		//the 5x5 gaussian is the outer product of the binomial row 1 4 6 4 1
+		return Filter_Gaussian_N(5);
+	}
+}// Filter_Gaussian
 
-				int ind = ((i * width) + j) * 4;
-				for (int k = 0; k < 3; k++)
-				{
-					rgbTotal[k] /= 25;//average
-					temp[ind + k] = (unsigned char)rgbTotal[k];//assign to the data
-				}
-				temp[ind + 3] = 255;
-			}
-		}
-		for (int i = 0; i < width * height * 4; i++)
-		{
-			data[i] = temp[i];
-		}
-		return true;
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Perform NxN Gaussian filter on this image.  The filter is separable so
+//  it is run as a horizontal and a vertical pass of the binomial row, which
+//  costs O(N) per pixel instead of O(N^2).  Return success of operation.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+bool TargaImage::Filter_Gaussian_N(unsigned int N)
+{
+	Mark_Changed();
+	if ((width == 0) && (height == 0))
+	{
+		//Filter_Gaussian_N before load image
+		ClearToBlack();
+		cout << "Filter_Gaussian_N: no image\n";
+		return false;
+	}// if
+	else if (N % 2 != 1 || N > c_maxGaussianN)
+	{
+		cout << "Filter_Gaussian_N: N must be an odd number no larger than " << c_maxGaussianN << "\n";
+		return false;
 	}
-}// Filter_Box
+	else
+	{
+		return Convolve(Kernel::Gaussian(N), BORDER_ZERO, CONVOLVE_SEPARABLE);
+	}
+}// Filter_Gaussian_N
 
 
 ///////////////////////////////////////////////////////////////////////////////
 //
-//      Perform 5x5 Bartlett filter on this image.  Return success of 
-//  operation.
+//      Perform a Gaussian filter of standard deviation sigma on this image
+//  with the recursive filter of Young and van Vliet.  A causal and an
+//  anti-causal third order pass run along each axis, so the cost per pixel
+//  is the same for any sigma.  Pixels outside the image count as black.
+//  Return success of operation.
 //
 ///////////////////////////////////////////////////////////////////////////////
-bool TargaImage::Filter_Bartlett()
+bool TargaImage::Filter_Gaussian_Sigma(float sigma)
 {
+	Mark_Changed();
+	Set_Layout(LAYOUT_INTERLEAVED);
 	if ((width == 0) && (height == 0))
 	{
-		//Filter_Bartlett before load image
+		//Filter_Gaussian_Sigma before load image
 		ClearToBlack();
-		cout << "Filter_Bartlett: no image\n";
+		cout << "Filter_Gaussian_Sigma: no image\n";
 		return false;
 	}// if
+	else if (!(sigma >= 0.5f))
+	{
+		cout << "Filter_Gaussian_Sigma: sigma must be at least 0.5\n";
+		return false;
+	}
 	else
 	{
-		int bartlett[5][5];
-		for (int i = 0; i < 3; i++) {
-			for (int j = 0; j < 3; j++) {
-				bartlett[i][j] = bartlett[4 - i][j] = bartlett[i][4 - j] = bartlett[4 - i][4 - j] = (i + 1) * (j + 1);
-			}
-		}
-
-		unsigned char* temp = new unsigned char[width * height * 4];
-		for (int i = 0; i < height; i++)
+		//Young & van Vliet, "Recursive implementation of the Gaussian filter", 1995
+		double q = (sigma >= 2.5f) ? 0.98711 * sigma - 0.96330 : 3.97156 - 4.14554 * sqrt(1 - 0.26891 * sigma);
+		double b0 = 1.57825 + 2.44413 * q + 1.4281 * q * q + 0.422205 * q * q * q;
+		double a1 = (2.44413 * q + 2.85619 * q * q + 1.26661 * q * q * q) / b0;
+		double a2 = -(1.4281 * q * q + 1.26661 * q * q * q) / b0;
+		double a3 = 0.422205 * q * q * q / b0;
+		float b1 = (float)a1, b2 = (float)a2, b3 = (float)a3;
+		float B = (float)(1 - (a1 + a2 + a3));
+
+		//Triggs & Sdika, "Boundary conditions for Young-van Vliet recursive
+		//filtering", 2006: the anti-causal outputs at and past the end of a
+		//black-padded line, from the last three causal outputs
+		double scale = B / ((1 + a1 - a2 + a3) * (1 - a1 - a2 - a3) * (1 + a2 + (a1 - a3) * a3));
+		float M[3][3] =
 		{
-			for (int j = 0; j < width; j++) {
-				//find the matrix limit
-				int LLimit = 0;
-				int uLimit = 0;
-				//find the range limit
-				int left = j - 2;
-				int right = j + 2;
-				int up = i - 2;
-				int down = i + 2;
-				if (left < 0)
-				{
-					LLimit = -left;
-					left = 0;
-				}
-				if (right >= width)
+			{ (float)(scale * (-a3 * a1 + 1 - a3 * a3 - a2)), (float)(scale * (a3 + a1) * (a2 + a3 * a1)), (float)(scale * a3 * (a1 + a3 * a2)) },
+			{ (float)(scale * (a1 + a3 * a2)), (float)(-scale * (a2 - 1) * (a2 + a3 * a1)), (float)(-scale * a3 * (a3 * a1 + a3 * a3 + a2 - 1)) },
+			{ (float)(scale * (a3 * a1 + a2 + a1 * a1 - a2 * a2)), (float)(scale * (a1 * a2 + a3 * a2 * a2 - a1 * a3 * a3 - a3 * a3 * a3 - a3 * a2 + a3)), (float)(scale * a3 * (a1 + a3 * a2)) }
+		};
+
+		int rowSize = width * 3;
+		bool isFloat = (format == FORMAT_FLOAT);
+		bool is16 = (format == FORMAT_16);
+		Scratch scratch;
+		float* rgb = scratch.New<float>(width * height * 3);
+		unsigned short* wideRGB = is16 ? scratch.New<unsigned short>(width * height * 3) : NULL;
+		if (isFloat)
+			Linear_RGB(rgb);
+		if (is16)
+			Wide_RGB(wideRGB);
+
+		//horizontal passes, a band of rows per thread
+		ThreadPool::Run_Bands(height, [&](int begin, int end)
+		{
+			Scratch bandScratch;
+			unsigned char* rgbRow = bandScratch.New<unsigned char>(rowSize);
+			for (int i = begin; i < end; i++)
+			{
+				float* row = rgb + i * rowSize;
+				if (is16)
 				{
-					right = width - 1;
+					for (int j = 0; j < rowSize; j++)
+						row[j] = wideRGB[i * rowSize + j];
 				}
-				if (up < 0)
+				else if (!isFloat)
 				{
-					uLimit = -up;
-					up = 0;
+					Row_To_RGB(data + i * stride, width, rgbRow, opaque);
+					for (int j = 0; j < rowSize; j++)
+						row[j] = rgbRow[j];
 				}
-				if (down >= height)
+
+				for (int k = 0; k < 3; k++)
 				{
-					down = height - 1;
-				}
+					float w1 = 0, w2 = 0, w3 = 0;
+					for (int j = 0; j < width; j++)
+					{
+						float w0 = B * row[j * 3 + k] + b1 * w1 + b2 * w2 + b3 * w3;
+						row[j * 3 + k] = w0;
+						w3 = w2; w2 = w1; w1 = w0;
+					}
 
+					float last[3] = { w1, w2, w3 };
+					row[(width - 1) * 3 + k] = w1 = M[0][0] * last[0] + M[0][1] * last[1] + M[0][2] * last[2];
+					w2 = M[1][0] * last[0] + M[1][1] * last[1] + M[1][2] * last[2];
+					w3 = M[2][0] * last[0] + M[2][1] * last[1] + M[2][2] * last[2];
+					for (int j = width - 2; j >= 0; j--)
+					{
+						float w0 = B * row[j * 3 + k] + b1 * w1 + b2 * w2 + b3 * w3;
+						row[j * 3 + k] = w0;
+						w3 = w2; w2 = w1; w1 = w0;
+					}
+				}
+			}
+		});
 
-				int rgbTotal[3] = { 0, 0, 0 };//add the neer together
+		//vertical passes, whole rows at a time so memory is walked in order;
+		//each thread takes a band of columns
+		float* zero = scratch.New<float>(rowSize, 0.0f);
+		float* below = scratch.New<float>(rowSize * 2);
+		ThreadPool::Run_Bands(rowSize, [&](int begin, int end)
+		{
+			for (int i = 0; i < height; i++)
+			{
+				float* row = rgb + i * rowSize;
+				const float* w1 = (i > 0) ? row - rowSize : zero;
+				const float* w2 = (i > 1) ? row - 2 * rowSize : zero;
+				const float* w3 = (i > 2) ? row - 3 * rowSize : zero;
+				for (int m = begin; m < end; m++)
+					row[m] = B * row[m] + b1 * w1[m] + b2 * w2[m] + b3 * w3[m];
+			}
 
-				int BU = uLimit;
-				for (int l = up; l <= down; l++)
-				{
-					int BL = LLimit;
-					for (int m = left; m <= right; m++)
-					{
-						int ind = ((l * width) + m) * 4;
-						unsigned char   rgbNeer[3];
+			float* bottom = rgb + (height - 1) * rowSize;
+			const float* last2 = (height > 1) ? bottom - rowSize : zero;
+			const float* last3 = (height > 2) ? bottom - 2 * rowSize : zero;
+			for (int m = begin; m < end; m++)
+			{
+				float last[3] = { bottom[m], last2[m], last3[m] };
+				bottom[m] = M[0][0] * last[0] + M[0][1] * last[1] + M[0][2] * last[2];
+				below[m] = M[1][0] * last[0] + M[1][1] * last[1] + M[1][2] * last[2];
+				below[rowSize + m] = M[2][0] * last[0] + M[2][1] * last[1] + M[2][2] * last[2];
+			}
+			for (int i = height - 2; i >= 0; i--)
+			{
+				float* row = rgb + i * rowSize;
+				const float* w1 = row + rowSize;
+				const float* w2 = (i < height - 2) ? row + 2 * rowSize : below;
+				const float* w3 = (i < height - 3) ? row + 3 * rowSize : below + (i + 3 - height) * rowSize;
+				for (int m = begin; m < end; m++)
+					row[m] = B * row[m] + b1 * w1[m] + b2 * w2[m] + b3 * w3[m];
+			}
+		});
 
-						RGBA_To_RGB(data + ind, rgbNeer);
+		if (isFloat)
+		{
+			Set_Linear_RGB(rgb);
+			return true;
+		}
 
-						for (int k = 0; k < 3; k++)
-						{
-							rgbTotal[k] += ((int)rgbNeer[k] * bartlett[BU][BL]);
-						}
-						BL++;
-					}
-					BU++;
+		if (is16)
+		{
+			ThreadPool::Run_Bands(width * height * 3, [&](int begin, int end)
+			{
+				for (int m = begin; m < end; m++)
+				{
+					float val = rgb[m];
+					wideRGB[m] = (unsigned short)(val < 0 ? 0 : (val > 65535 ? 65535 : val));
 				}
-				int ind = ((i * width) + j) * 4;
-				for (int k = 0; k < 3; k++)
+			});
+			Set_Wide_RGB(wideRGB);
+			return true;
+		}
+
+		ThreadPool::Run_Bands(height, [&](int begin, int end)
+		{
+			for (int i = begin; i < end; i++)
+			{
+				for (int j = 0; j < width; j++)
 				{
-					rgbTotal[k] /= 81;//average
-					temp[ind + k] = (unsigned char)rgbTotal[k];//assign to the data
+					unsigned char* pixel = data + i * stride + j * 4;
+					for (int k = 0; k < 3; k++)
+					{
+						float val = rgb[(i * width + j) * 3 + k];
+						pixel[k] = (unsigned char)(val < 0 ? 0 : (val > 255 ? 255 : val));
+					}
+					pixel[3] = 255;
 				}
-				temp[ind + 3] = 255;
 			}
+		});
+		opaque = true;
+		return true;
+	}
+}// Filter_Gaussian_Sigma
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Convolve this image with an arbitrary kernel.  Tap (x, y) of the
+//  kernel weighs the pixel x - width / 2 columns and y - height / 2 rows away
+//  from the output pixel, and pixels outside the image are filled in by the
+//  border mode.  With CONVOLVE_AUTO the kernel picks the cheapest of the
+//  direct, separable and FFT methods for this image size.  Every filter that
+//  averages a neighborhood runs through here.  Return success of operation.
+//
+///////////////////////////////////////////////////////////////////////////////
+bool TargaImage::Convolve(const Kernel& kernel, EBorderMode border, EConvolveMethod method)
+{
+	Mark_Changed();
+	if ((width == 0) && (height == 0))
+	{
+		//Convolve before load image
+		ClearToBlack();
+		cout << "Convolve: no image\n";
+		return false;
+	}// if
+	else if (kernel.width % 2 != 1 || kernel.height % 2 != 1 || kernel.divisor <= 0)
+	{
+		cout << "Convolve: kernel sizes must be odd and its divisor positive\n";
+		return false;
+	}
+	else
+	{
+		if (method == CONVOLVE_AUTO)
+			method = kernel.Plan(width, height);
+
+		if (method == CONVOLVE_SEPARABLE && !kernel.Is_Separable())
+		{
+			cout << "Convolve: kernel is not separable\n";
+			return false;
+		}
+
+		if (format == FORMAT_FLOAT)
+			return Convolve_Float(kernel, border);
+		if (format == FORMAT_16)
+			return Convolve_16(kernel, border);
+
+		if (layout == LAYOUT_PLANAR)
+		{
+			if (method == CONVOLVE_SEPARABLE && kernel.Fits_16_Bits())
+				return Convolve_Planar(kernel, border);
+			Set_Layout(LAYOUT_INTERLEAVED);
 		}
-		for (int i = 0; i < width * height * 4; i++)
+
+		switch (method)
 		{
-			data[i] = temp[i];
+		case CONVOLVE_SEPARABLE:
+			return Convolve_Separable(kernel, border);
+
+		case CONVOLVE_FFT:
+			return Convolve_FFT(kernel, border);
+
+		default:
+			return Convolve_Direct(kernel, border);
 		}
+	}
+}// Convolve
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Run a chain of neighborhood filters over this image one cache sized
+//  tile at a time.  The result is the same as running the filters in turn.
+//  Return success of operation.
+//
+///////////////////////////////////////////////////////////////////////////////
+bool TargaImage::Filter_Chain(const FilterChain& chain)
+{
+	Mark_Changed();
+	Set_Format(FORMAT_BYTE);
+	Set_Layout(LAYOUT_INTERLEAVED);
+	if ((width == 0) && (height == 0))
+	{
+		//Filter_Chain before load image
+		ClearToBlack();
+		cout << "Filter_Chain: no image\n";
+		return false;
+	}// if
+
+	int filteredStride;
+	unsigned char* filtered = New_Rows(width, height, filteredStride);
+	chain.Run(View(), ImageView(filtered, width, height, filteredStride), opaque);
+	Replace_Data(filtered, filteredStride);
+	opaque = true;
+	return true;
+}// Filter_Chain
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Perform an edge detect (high pass) filter on this image: amount times
+//  what each pixel has above its binomial Gaussian blur of the given radius.
+//  The defaults give the original 5x5 filter.  Return success of operation.
+//
+///////////////////////////////////////////////////////////////////////////////
+bool TargaImage::Filter_Edge(int radius, float amount)
+{
+	Mark_Changed();
+	Set_Layout(LAYOUT_INTERLEAVED);
+	if ((width == 0) && (height == 0))
+	{
+		//Filter_Edge before load image
+		ClearToBlack();
+		cout << "Filter_Edge: no image\n";
+		return false;
+	}// if
+	else if (radius < 1 || radius > c_maxUnsharpRadius || !(amount >= 0))
+	{
+		cout << "Filter_Edge: radius must be from 1 to " << c_maxUnsharpRadius << " and amount not negative\n";
+		return false;
+	}
+	else
+	{
+		if (format == FORMAT_FLOAT)
+			Unsharp_Mask_Float(radius, amount, true);
+		else if (format == FORMAT_16)
+			Unsharp_Mask_16(radius, amount, true);
+		else
+			Unsharp_Mask(radius, amount, true);
 		return true;
 	}
-}// Filter_Bartlett
+}// Filter_Edge
 
 
 ///////////////////////////////////////////////////////////////////////////////
 //
-//      Perform 5x5 Gaussian filter on this image.  Return success of 
-//  operation.
+//      Perform an enhancement (unsharp mask) filter on this image: each pixel
+//  plus amount times the edges of Filter_Edge.  The defaults give the
+//  original 5x5 filter.  Return success of operation.
 //
 ///////////////////////////////////////////////////////////////////////////////
-bool TargaImage::Filter_Gaussian()
+bool TargaImage::Filter_Enhance(int radius, float amount)
 {
+	Mark_Changed();
+	Set_Layout(LAYOUT_INTERLEAVED);
 	if ((width == 0) && (height == 0))
 	{
-		//Filter_Gaussian before load image
+		//Filter_Enhance before load image
 		ClearToBlack();
-		cout << "Filter_Gaussian: no image\n";
+		cout << "Filter_Enhance: no image\n";
 		return false;
 	}// if
+	else if (radius < 1 || radius > c_maxUnsharpRadius || !(amount >= 0))
+	{
+		cout << "Filter_Enhance: radius must be from 1 to " << c_maxUnsharpRadius << " and amount not negative\n";
+		return false;
+	}
 	else
 	{
-		int guassian[5][5];
-		guassian[0][0] = 1; guassian[0][1] = 4; guassian[0][2] = 6;
-		guassian[1][0] = 4; guassian[1][1] = 16; guassian[1][2] = 24;
-		guassian[2][0] = 6; guassian[2][1] = 24; guassian[2][2] = 36;
-		for (int i = 0; i < 3; i++) {
-			for (int j = 0; j < 3; j++) {
-				guassian[4 - i][j] = guassian[i][4 - j] = guassian[4 - i][4 - j] = guassian[i][j];
+		if (format == FORMAT_FLOAT)
+			Unsharp_Mask_Float(radius, amount, false);
+		else if (format == FORMAT_16)
+			Unsharp_Mask_16(radius, amount, false);
+		else
+			Unsharp_Mask(radius, amount, false);
+		return true;
+	}
+}// Filter_Enhance
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      The one pass behind Filter_Edge and Filter_Enhance.  Each row band
+//  streams down its rows keeping the last 2 * radius + 1 input rows and
+//  their row sums in rings, so the blur, the difference and the output all
+//  come out of one read of the image and the image is filtered in place.
+//  Before any band writes, the radius rows just outside every band are
+//  copied aside, as the neighboring band will overwrite them.  Kernels too
+//  big for 16 bits keep their row sums in int, which holds 255 times a
+//  Kernel::Gaussian row of at most 4096, and their column totals in long
+//  long, as 255 times 4096 times 4096 does not fit in int.
+//
+///////////////////////////////////////////////////////////////////////////////
+void TargaImage::Unsharp_Mask(int radius, float amount, bool edgeOnly)
+{
+	Kernel blur = Kernel::Gaussian(2 * radius + 1);
+	bool narrow = blur.Fits_16_Bits();
+	int taps = 2 * radius + 1;
+	int rowSize = width * 3;
+	int scale = Amount_Scale(amount);
+
+	int bands = Min(ThreadPool::Threads(), height);
+	Scratch scratch;
+	unsigned char* halo = scratch.New<unsigned char>((size_t)bands * 2 * radius * rowSize);
+	ThreadPool::Run_Bands(bands, [&](int begin, int end)
+	{
+		for (int b = begin; b < end; b++)
+		{
+			int top = height * b / bands, bottom = height * (b + 1) / bands;
+			for (int r = 0; r < 2 * radius; r++)
+			{
+				int i = (r < radius) ? top - radius + r : bottom + r - radius;
+				if (i < 0 || i >= height)
+					continue;
+
+				Row_To_RGB(data + i * stride, width, &halo[((size_t)b * 2 * radius + r) * rowSize], opaque);
 			}
 		}
-		/*for (int i = 0; i < 5; i++) {
-			for (int j = 0; j < 5; j++) {
-				std::cout << guassian[i][j] << ' ';
-			}
-			std::cout << std::endl;
-		}*/
+	});
 
-		unsigned char* temp = new unsigned char[width * height * 4];
-		for (int i = 0; i < height; i++)
+	ThreadPool::Run_Bands(bands, [&](int begin, int end)
+	{
+		Scratch bandScratch;
+		unsigned char* line = bandScratch.New<unsigned char>((width + 2 * radius) * 3, 0);
+		unsigned char* rgbRing = bandScratch.New<unsigned char>(taps * rowSize);
+		unsigned short* narrowRing = narrow ? bandScratch.New<unsigned short>(taps * rowSize + rowSize) : NULL;
+		int* ring = narrow ? NULL : bandScratch.New<int>(taps * rowSize);
+		long long* total = narrow ? NULL : bandScratch.New<long long>(rowSize);
+		unsigned char* blurred = bandScratch.New<unsigned char>(rowSize);
+
+		for (int b = begin; b < end; b++)
 		{
-			for (int j = 0; j < width; j++) {
-				int LLimit = 0;
-				int uLimit = 0;
-				//find the range limit
-				int left = j - 2;
-				int right = j + 2;
-				int up = i - 2;
-				int down = i + 2;
-				if (left < 0)
-				{
-					LLimit = -left;
-					left = 0;
-				}
-				if (right >= width)
-				{
-					right = width - 1;
-				}
-				if (up < 0)
+			int top = height * b / bands, bottom = height * (b + 1) / bands;
+
+			//un-premultiply input row i into its ring slot and sum it along the row
+			auto Load_Row = [&](int i)
+			{
+				int slot = (i - top + taps) % taps;
+				unsigned char* rgb = rgbRing + slot * rowSize;
+				if (i < 0 || i >= height)
+					memset(rgb, 0, rowSize);
+				else if (i < top || i >= bottom)
+					memcpy(rgb, &halo[((size_t)b * 2 * radius + ((i < top) ? i - top + radius : i - bottom + radius)) * rowSize], rowSize);
+				else
+					Row_To_RGB(data + i * stride, width, rgb, opaque);
+
+				memcpy(line + radius * 3, rgb, rowSize);
+				if (narrow)
 				{
-					uLimit = -up;
-					up = 0;
+					unsigned short* sum = narrowRing + slot * rowSize;
+					memset(sum, 0, rowSize * sizeof(unsigned short));
+					for (int u = 0; u < taps; u++)
+						if (blur.row[u])
+							Multiply_Add_U8(line + u * 3, rowSize, (unsigned short)blur.row[u], sum);
 				}
-				if (down >= height)
+				else
 				{
-					down = height - 1;
+					int* sum = ring + slot * rowSize;
+					memset(sum, 0, rowSize * sizeof(int));
+					for (int u = 0; u < taps; u++)
+					{
+						int weight = blur.row[u];
+						const unsigned char* in = line + u * 3;
+						for (int m = 0; m < rowSize; m++)
+							sum[m] += in[m] * weight;
+					}
 				}
+			};
 
+			for (int i = top - radius; i < top + radius; i++)
+				Load_Row(i);
 
-				int rgbTotal[3] = { 0, 0, 0 };//add the neer together
+			for (int i = top; i < bottom; i++)
+			{
+				Load_Row(i + radius);
 
-				int BU = uLimit;
-				for (int l = up; l <= down; l++)
+				//column pass over the ring, oldest row first
+				if (narrow)
+				{
+					unsigned short* total = narrowRing + taps * rowSize;
+					memset(total, 0, rowSize * sizeof(unsigned short));
+					for (int v = 0; v < taps; v++)
+						if (blur.column[v])
+							Multiply_Add_U16(narrowRing + ((i - radius + v - top + taps) % taps) * rowSize, rowSize, (unsigned short)blur.column[v], total);
+					Divide_U16(total, rowSize, (unsigned int)blur.divisor, blurred);
+				}
+				else
 				{
-					int BL = LLimit;
-					for (int m = left; m <= right; m++)
+					memset(total, 0, rowSize * sizeof(long long));
+					for (int v = 0; v < taps; v++)
 					{
-						int ind = ((l * width) + m) * 4;
-						unsigned char   rgbNeer[3];
-
-						RGBA_To_RGB(data + ind, rgbNeer);
-
-						for (int k = 0; k < 3; k++)
-						{
-							rgbTotal[k] += ((int)rgbNeer[k] * guassian[BU][BL]);
-						}
-						BL++;
+						long long weight = blur.column[v];
+						const int* sum = ring + ((i - radius + v - top + taps) % taps) * rowSize;
+						for (int m = 0; m < rowSize; m++)
+							total[m] += sum[m] * weight;
 					}
-					BU++;
+					for (int m = 0; m < rowSize; m++)
+						blurred[m] = (unsigned char)Min(total[m] / blur.divisor, 255LL);
 				}
-				int ind = ((i * width) + j) * 4;
-				for (int k = 0; k < 3; k++)
+
+				const unsigned char* center = rgbRing + ((i - top + taps) % taps) * rowSize;
+				unsigned char* out = data + i * stride;
+				for (int j = 0; j < width; j++)
 				{
-					rgbTotal[k] /= 256;//average
-					temp[ind + k] = (unsigned char)rgbTotal[k];//assign to the data
+					for (int k = 0; k < 3; k++)
+					{
+						int edge = (Max(center[j * 3 + k] - blurred[j * 3 + k], 0) * scale) >> c_amountShift;
+						out[j * 4 + k] = (unsigned char)Min(edgeOnly ? edge : center[j * 3 + k] + edge, 255);
+					}
+					out[j * 4 + 3] = 255;
 				}
-				temp[ind + 3] = 255;
 			}
 		}
-		for (int i = 0; i < width * height * 4; i++)
-		{
-			data[i] = temp[i];
-		}
-		return true;
-	}
-}// Filter_Gaussian
+	});
+	opaque = true;
+}// Unsharp_Mask
+
 
 ///////////////////////////////////////////////////////////////////////////////
 //
-//      Perform NxN Gaussian filter on this image.  Return success of 
-//  operation.
+//      The streaming pass of Unsharp_Mask_Float and Unsharp_Mask_16, the
+//  blur adding up in Sum.  As in Unsharp_Mask, each row band keeps the last
+//  2 * radius + 1 straight rows and their row sums in rings, after the rows
+//  just outside every band are copied aside, so only a few rows per thread
+//  are held besides the image.  Load_Row(i, rgb) un-premultiplies row i
+//  into rgb and Store_Row(i, center, blurred) writes row i from its straight
+//  pixels and their blur.  The sums are made in the order Convolve_Image
+//  makes them, so the blur matches it exactly.
 //
 ///////////////////////////////////////////////////////////////////////////////
-
-bool TargaImage::Filter_Gaussian_N(unsigned int N)
+template <class T, class Sum, class Load, class Store>
+static void Unsharp_Rows(int width, int height, int radius, const Load& Load_Row, const Store& Store_Row)
 {
-	if ((width == 0) && (height == 0))
-	{
-		//Filter_Gaussian_N before load image
-		ClearToBlack();
-		cout << "Filter_Gaussian_N: no image\n";
-		return false;
-	}// if
-	else
+	Kernel blur = Kernel::Gaussian(2 * radius + 1);
+	int taps = 2 * radius + 1;
+	int rowSize = width * 3;
+
+	int bands = Min(ThreadPool::Threads(), height);
+	Scratch scratch;
+	T* halo = scratch.New<T>((size_t)bands * 2 * radius * rowSize);
+	ThreadPool::Run_Bands(bands, [&](int begin, int end)
 	{
-		int count = 0;
-		int** pascalRow = new int* [N];
-		for (int i = 0; i < N; i++) {
-			pascalRow[i] = new int[N];
-		}
-
-		//calculate pascal triangle
-		for (int i = 0; i < N; i++) {
-			pascalRow[0][i] = 1;
-			for (int j = N - 1; j > N - 1 - i; j--)
-			{
-				pascalRow[0][i] *= j;
-			}
-			int divisor = 1;
-			for (int j = 1; j <= i; j++)
+		for (int b = begin; b < end; b++)
+		{
+			int top = height * b / bands, bottom = height * (b + 1) / bands;
+			for (int r = 0; r < 2 * radius; r++)
 			{
-				divisor *= j;
-			}
-			pascalRow[0][i] /= divisor;
-			pascalRow[i][0] = pascalRow[0][i];
-			count += pascalRow[i][0];
-			//C(Ni) - > (row)*(row-1)*..*(row-i+1)
-			//pascal[i]=
-		}
-		count = pow(count, 2);//divisor
-
-		for (int i = 0; i < N; i++) {
-			for (int j = 0; j < N; j++) {
-				pascalRow[i][j] = pascalRow[i][0] * pascalRow[0][j];
+				int i = (r < radius) ? top - radius + r : bottom + r - radius;
+				if (i >= 0 && i < height)
+					Load_Row(i, &halo[((size_t)b * 2 * radius + r) * rowSize]);
 			}
 		}
+	});
 
-
-		unsigned char* temp = new unsigned char[width * height * 4];
-		for (int i = 0; i < height; i++)
+	ThreadPool::Run_Bands(bands, [&](int begin, int end)
+	{
+		Scratch bandScratch;
+		Sum* line = bandScratch.New<Sum>((width + 2 * radius) * 3);
+		T* rgbRing = bandScratch.New<T>(taps * rowSize);
+		Sum* ring = bandScratch.New<Sum>(taps * rowSize);
+		Sum* total = bandScratch.New<Sum>(rowSize);
+		T* blurred = bandScratch.New<T>(rowSize);
+
+		for (int b = begin; b < end; b++)
 		{
-			for (int j = 0; j < width; j++) {
-				int LLimit = 0;
-				int uLimit = 0;
-				//find the range limit
-				int left = j - 2;
-				int right = j + 2;
-				int up = i - 2;
-				int down = i + 2;
-				if (left < 0)
-				{
-					LLimit = -left;
-					left = 0;
-				}
-				if (right >= width)
-				{
-					right = width - 1;
-				}
-				if (up < 0)
+			int top = height * b / bands, bottom = height * (b + 1) / bands;
+
+			//un-premultiply input row i into its ring slot and sum it along the row
+			auto Ring_Row = [&](int i)
+			{
+				int slot = (i - top + taps) % taps;
+				T* rgb = rgbRing + slot * rowSize;
+				Sum* sum = ring + slot * rowSize;
+				memset(sum, 0, rowSize * sizeof(Sum));
+				if (i < 0 || i >= height)
 				{
-					uLimit = -up;
-					up = 0;
+					memset(rgb, 0, rowSize * sizeof(T));
+					return;
 				}
-				if (down >= height)
+
+				if (i < top || i >= bottom)
+					memcpy(rgb, &halo[((size_t)b * 2 * radius + ((i < top) ? i - top + radius : i - bottom + radius)) * rowSize], rowSize * sizeof(T));
+				else
+					Load_Row(i, rgb);
+
+				Extend_Line(rgb, width, 3, radius, BORDER_ZERO, line);
+				for (int u = 0; u < taps; u++)
 				{
-					down = height - 1;
+					Sum weight = (Sum)blur.row[u];
+					const Sum* in = line + u * 3;
+					for (int m = 0; m < rowSize; m++)
+						sum[m] += in[m] * weight;
 				}
+			};
 
+			for (int i = top - radius; i < top + radius; i++)
+				Ring_Row(i);
 
-				int rgbTotal[3] = { 0, 0, 0 };//add the neer together
+			for (int i = top; i < bottom; i++)
+			{
+				Ring_Row(i + radius);
 
-				int BU = uLimit;
-				for (int l = up; l <= down; l++)
+				//column pass over the ring, oldest row first
+				memset(total, 0, rowSize * sizeof(Sum));
+				for (int v = 0; v < taps; v++)
 				{
-					int BL = LLimit;
-					for (int m = left; m <= right; m++)
-					{
-						int ind = ((l * width) + m) * 4;
-						unsigned char   rgbNeer[3];
+					Sum weight = (Sum)blur.column[v];
+					const Sum* in = ring + ((i - radius + v - top + taps) % taps) * rowSize;
+					for (int m = 0; m < rowSize; m++)
+						total[m] += in[m] * weight;
+				}
+				Emit_Totals(total, rowSize, blur.divisor, blurred);
+				Store_Row(i, rgbRing + ((i - top + taps) % taps) * rowSize, blurred);
+			}
+		}
+	});
+}// Unsharp_Rows
 
-						RGBA_To_RGB(data + ind, rgbNeer);
 
-						for (int k = 0; k < 3; k++)
-						{
-							if ((BL < N)&&(BU<N))
-							{
-								rgbTotal[k] += ((int)rgbNeer[k] * pascalRow[BU][BL]);
-							}
-						}
-							BL++;
-					}
-						BU++;
-				}
-				int ind = ((i * width) + j) * 4;
-				for (int k = 0; k < 3; k++)
-				{
-					rgbTotal[k] /= count;//average
-					temp[ind + k] = (unsigned char)rgbTotal[k];//assign to the data
-				}
-				temp[ind + 3] = 255;
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Unsharp_Mask for a float image.  The amount is used as it is rather
+//  than in fixed point, and nothing is clamped above, so bright edges keep
+//  their full strength until the image is quantized.
+//
+///////////////////////////////////////////////////////////////////////////////
+void TargaImage::Unsharp_Mask_Float(int radius, float amount, bool edgeOnly)
+{
+	Unsharp_Rows<float, float>(width, height, radius, [&](int i, float* rgb)
+	{
+		Row_To_Linear_RGB(linear + (size_t)i * width * 4, width, rgb, opaque);
+	},
+	[&](int i, const float* center, const float* blurred)
+	{
+		float* out = linear + (size_t)i * width * 4;
+		for (int j = 0; j < width; j++)
+		{
+			for (int k = 0; k < 3; k++)
+			{
+				float edge = Max(center[j * 3 + k] - blurred[j * 3 + k], 0.0f) * amount;
+				out[j * 4 + k] = edgeOnly ? edge : center[j * 3 + k] + edge;
 			}
+			out[j * 4 + 3] = 1.0f;
 		}
-		for (int i = 0; i < width * height * 4; i++)
+	});
+	opaque = true;
+}// Unsharp_Mask_Float
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Unsharp_Mask for a 16-bit image, with the same fixed point amount as
+//  the byte version and the results clamped to 16 bits.
+//
+///////////////////////////////////////////////////////////////////////////////
+void TargaImage::Unsharp_Mask_16(int radius, float amount, bool edgeOnly)
+{
+	int scale = Amount_Scale(amount);
+	auto Load_Row = [&](int i, unsigned short* rgb)
+	{
+		Row_To_Wide_RGB(wide + (size_t)i * width * 4, width, rgb, opaque);
+	};
+	auto Store_Row = [&](int i, const unsigned short* center, const unsigned short* blurred)
+	{
+		unsigned short* out = wide + (size_t)i * width * 4;
+		for (int j = 0; j < width; j++)
 		{
-			data[i] = temp[i];
+			for (int k = 0; k < 3; k++)
+			{
+				long long edge = ((long long)Max(center[j * 3 + k] - blurred[j * 3 + k], 0) * scale) >> c_amountShift;
+				if (!edgeOnly)
+					edge += center[j * 3 + k];
+				out[j * 4 + k] = (unsigned short)Min(edge, 65535LL);
+			}
+			out[j * 4 + 3] = 65535;
 		}
-		return true;
-	}
-}// Filter_Gaussian_N
+	};
+
+	if (Wide_Sums_Fit_Int(Kernel::Gaussian(2 * radius + 1)))
+		Unsharp_Rows<unsigned short, int>(width, height, radius, Load_Row, Store_Row);
+	else
+		Unsharp_Rows<unsigned short, long long>(width, height, radius, Load_Row, Store_Row);
+	opaque = true;
+}// Unsharp_Mask_16
 
 
 ///////////////////////////////////////////////////////////////////////////////
 //
-//      Perform 5x5 edge detect (high pass) filter on this image.  Return 
-//  success of operation.
+//      Run simplified version of Hertzmann's painterly image filter.
+//      You probably will want to use the Draw_Stroke funciton and the
+//      Stroke class to help.
+// Return success of operation.
+//
+///////////////////////////////////////////////////////////////////////////////
+bool TargaImage::NPR_Paint()
+{
+	Mark_Changed();
+	ClearToBlack();
+	return false;
+}
+
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Halve the dimensions of this image.  Return success of operation.
 //
 ///////////////////////////////////////////////////////////////////////////////
-bool TargaImage::Filter_Edge()
+bool TargaImage::Half_Size()
 {
+	Mark_Changed();
+	if (!owned)
+	{
+		cout << "Half_Size: cannot resize an image made from a view\n";
+		return false;
+	}
+	Set_Layout(LAYOUT_INTERLEAVED);
 	if ((width == 0) && (height == 0))
 	{
 		//Filter_Bartlett before load image
 		ClearToBlack();
-		cout << "Filter_Enhance: no image\n";
+		cout << "Half_Size: no image\n";
 		return false;
 	}// if
 	else
 	{
-		int* enhanceData = new int[width * height * 4];
+		//smooth with the 3x3 Bartlett filter before dropping every other pixel
+		if (!Convolve(Kernel::Bartlett(1)))
+			return false;
 
-		for (int i = 0; i < height*width*4; i++)
+		if (format == FORMAT_FLOAT)
 		{
-			enhanceData[i] = data[i];
+			float* half = Pixels_New<float>((height / 2) * (width / 2) * 4);
+			Half_Pixels(linear, width, height, width * 4, half, (width / 2) * 4);
+			Pixels_Delete(linear);
+			linear = half;
 		}
-		Filter_Gaussian();
-
-		for (int i = 0; i < height; i++)
+		else if (format == FORMAT_16)
 		{
-			for (int j = 0; j < width; j++)
-			{
-				for (int k = 0; k < 3; k++)
-				{
-					int doubleIndex = (i * width + j) * 4 + k;
-					if (enhanceData[doubleIndex]- data[doubleIndex]>0)
-					{
-						data[doubleIndex] = enhanceData[doubleIndex] - data[doubleIndex];
-					}
-					else
-					{
-						data[doubleIndex] = 0;
-					}
-				}
-			}
+			unsigned short* half = Pixels_New<unsigned short>((height / 2) * (width / 2) * 4);
+			Half_Pixels(wide, width, height, width * 4, half, (width / 2) * 4);
+			Pixels_Delete(wide);
+			wide = half;
 		}
+		else
+		{
+			int halfStride;
+			unsigned char* half = New_Rows(width / 2, height / 2, halfStride);
+			Half_Pixels(data, width, height, stride, half, halfStride);
+			Replace_Data(half, halfStride);
+		}
+		height /= 2;
+		width /= 2;
 		return true;
 	}
-}// Filter_Edge
+}// Half_Size
 
 
 ///////////////////////////////////////////////////////////////////////////////
 //
-//      Perform a 5x5 enhancement filter to this image.  Return success of 
-//  operation.
+//      Double the dimensions of this image.  Each new pixel is a Bartlett
+//  weighted average of the pixels around it.  Float and 16-bit images are
+//  interpolated along each axis in turn.  Return success of operation.
 //
 ///////////////////////////////////////////////////////////////////////////////
-bool TargaImage::Filter_Enhance()
+bool TargaImage::Double_Size()
 {
+	Mark_Changed();
+	if (!owned)
+	{
+		cout << "Double_Size: cannot resize an image made from a view\n";
+		return false;
+	}
+	Set_Layout(LAYOUT_INTERLEAVED);
 	if ((width == 0) && (height == 0))
 	{
 		//Filter_Bartlett before load image
 		ClearToBlack();
-		cout << "Filter_Enhance: no image\n";
+		cout << "Half_Size: no image\n";
 		return false;
 	}// if
+	else if (format == FORMAT_FLOAT)
+	{
+		Scratch scratch;
+		float* rgb = scratch.New<float>(width * height * 3);
+		float* doubled = scratch.New<float>(width * height * 12);
+		Linear_RGB(rgb);
+		Double_RGB<float, float>(rgb, width, height, doubled);
+
+		Pixels_Delete(linear);
+		height *= 2;
+		width *= 2;
+		linear = Pixels_New<float>(width * height * 4);
+		Set_Linear_RGB(doubled);
+		return true;
+	}
+	else if (format == FORMAT_16)
+	{
+		Scratch scratch;
+		unsigned short* rgb = scratch.New<unsigned short>(width * height * 3);
+		unsigned short* doubled = scratch.New<unsigned short>(width * height * 12);
+		Wide_RGB(rgb);
+		Double_RGB<unsigned short, int>(rgb, width, height, doubled);
+
+		Pixels_Delete(wide);
+		height *= 2;
+		width *= 2;
+		wide = Pixels_New<unsigned short>(width * height * 4);
+		Set_Wide_RGB(doubled);
+		return true;
+	}
 	else
 	{
-		int* enhanceData = new int[width * height * 4];
+		int bartlettEven[3][3] = { {1,2,1},{2,4,2},{1,2,1} };
+		int bartlettOdd[4][4] = { {1,3,3,1},{3,9,9,3},{3,9,9,3},{1,3,3,1 } };
+		int bartlettOther[4][3] = { {1,2,1},{3,6,3},{3,6,3},{1,2,1 } };
 
-		for (int i = 0; i < height * width * 4; i++)
-		{
-			enhanceData[i] = data[i];
-		}
-		Filter_Edge();
+		int doubleStride;
+		unsigned char* doubleData = New_Rows(width * 2, height * 2, doubleStride);
+		Scratch scratch;
+		unsigned char* rgb = scratch.New<unsigned char>(width * height * 3);
+		To_RGB(rgb);
 
-		for (int i = 0; i < height; i++)
+		ThreadPool::Run_Bands(height * 2, [&](int begin, int end)
 		{
-			for (int j = 0; j < width; j++)
+			for (int i = begin; i < end; i++)
 			{
-				for (int k = 0; k < 3; k++)
+				for (int j = 0; j < (width * 2); j++)
 				{
-					int doubleIndex = (i * width + j) * 4 + k;
-					if (enhanceData[doubleIndex] + data[doubleIndex] < 255)
+					int doubleIndex = i * doubleStride + j * 4;
+					int Urow = i / 2 - 1;
+					int Drow = i / 2 + 1;
+					int Lcol = j / 2 - 1;
+					int Rcol = j / 2 + 1;
+					//std::cout << Urow << " " << Drow << " " << Lcol << " " << Rcol << " ";
+					if ((i % 2 == 0) && (j % 2 == 0))
+					{
+
+					}
+					else if ((i % 2 == 1) && (j % 2 == 1))
+					{
+						Drow++;
+						Rcol++;
+					}
+					else
+					{
+						Drow++;
+					}
+					int rgbTotal[3] = { 0, 0, 0 };//add the neer together
+					for (int k = Urow; k <= Drow; k++)
+					{
+						for (int l = Lcol; l <= Rcol; l++)
+						{
+
+							if ((k >= 0) && (k < height) && (l >= 0) && (l < width))
+							{
+								//std::cout << k << " " << l << " ";
+								unsigned char*  rgbNeer = rgb + ((k * width) + l) * 3;
+
+								if ((i % 2 == 0) && (j % 2 == 0))
+								{
+									for (int m = 0; m < 3; m++)
+									{
+										rgbTotal[m] += ((int)rgbNeer[m] * bartlettEven[k - Urow][l - Lcol]);
+									}
+								}
+								else if ((i % 2 == 1) && (j % 2 == 1))
+								{
+									for (int m = 0; m < 3; m++)
+									{
+										rgbTotal[m] += ((int)rgbNeer[m] * bartlettOdd[k - Urow][l - Lcol]);
+									}
+								}
+								else
+								{
+									for (int m = 0; m < 3; m++)
+									{
+										rgbTotal[m] += ((int)rgbNeer[m] * bartlettOther[k - Urow][l - Lcol]);
+									}
+								}
+							}
+						}
+						//std::cout << std::endl;
+					}
+					if ((i % 2 == 0) && (j % 2 == 0))
 					{
-						data[doubleIndex] = enhanceData[doubleIndex] + data[doubleIndex];
+						for (int m = 0; m < 3; m++)
+						{
+							doubleData[doubleIndex + m] = rgbTotal[m] / 16;
+						}
+					}
+					else if ((i % 2 == 1) && (j % 2 == 1))
+					{
+						for (int m = 0; m < 3; m++)
+						{
+							doubleData[doubleIndex + m] = rgbTotal[m] / 64;
+						}
 					}
 					else
 					{
-						data[doubleIndex] = 255;
+						for (int m = 0; m < 3; m++)
+						{
+							doubleData[doubleIndex + m] = rgbTotal[m] / 32;
+						}
 					}
+					doubleData[doubleIndex + 3] = 255;
 				}
 			}
-		}
+		});
+
+		Replace_Data(doubleData, doubleStride);
+		height *= 2;
+		width *= 2;
+		opaque = true;
+		return true;
 	}
-}// Filter_Enhance
+}// Double_Size
 
 
 ///////////////////////////////////////////////////////////////////////////////
 //
-//      Run simplified version of Hertzmann's painterly image filter.
-//      You probably will want to use the Draw_Stroke funciton and the
-//      Stroke class to help.
-// Return success of operation.
+//      Scale the image dimensions by the given factor.  The given factor is 
+//  assumed to be greater than one.  Return success of operation.
 //
 ///////////////////////////////////////////////////////////////////////////////
-bool TargaImage::NPR_Paint()
+bool TargaImage::Resize(float scale)
 {
+	Mark_Changed();
 	ClearToBlack();
 	return false;
-}
-
+}// Resize
 
 
-///////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////
 //
-//      Halve the dimensions of this image.  Return success of operation.
+//      Rotate the image clockwise by the given angle.  Do not resize the 
+//  image.  Return success of operation.
 //
 ///////////////////////////////////////////////////////////////////////////////
-bool TargaImage::Half_Size()
+bool TargaImage::Rotate(float angleDegrees)
 {
+	Mark_Changed();
 	if ((width == 0) && (height == 0))
 	{
 		//Filter_Bartlett before load image
 		ClearToBlack();
-		cout << "Half_Size: no image\n";
+		cout << "Rotate: no image\n";
 		return false;
 	}// if
 	else
 	{
-		int bartlett[3][3] = { {1,2,1},{2,4,2},{1,2,1} };
+		//smooth with the 3x3 window around each pixel, weighted 1 2 2 along each axis
+		int weights[3] = { 1, 2, 2 };
+		return Convolve(Kernel(3, weights, 3, weights, 16));
+	}
+}// Rotate
 
-		unsigned char* temp = new unsigned char[width * height * 4];
-		for (int i = 0; i < height; i++)
+
+//////////////////////////////////////////////////////////////////////////////
+//
+//      Given a single RGBA pixel return, via the second argument, the RGB
+//      equivalent composited with a black background.  Whole rows should go
+//      through Unpremultiply_Row, which this is one pixel of.
+//
+///////////////////////////////////////////////////////////////////////////////
+void TargaImage::RGBA_To_RGB(unsigned char* rgba, unsigned char* rgb)
+{
+	Unpremultiply_Row(rgba, 1, rgb);
+}// RGA_To_RGB
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Convolve by applying every tap of the kernel at every pixel.  Pixels
+//  whose window lies inside the image are summed without any bounds checks,
+//  a whole row at a time in 16-bit vectors when the kernel allows; only the
+//  strips within a kernel radius of the edges look up the border mode for
+//  each tap.  Return success of operation.
+//
+///////////////////////////////////////////////////////////////////////////////
+bool TargaImage::Convolve_Direct(const Kernel& kernel, EBorderMode border)
+{
+	int hRadius = kernel.width / 2;
+	int vRadius = kernel.height / 2;
+	Scratch scratch;
+	unsigned char* rgb = scratch.New<unsigned char>(width * height * 3);
+	To_RGB(rgb);
+
+	//interior runs of small non-negative kernels go through the 16-bit vector path
+	int run = width - 2 * hRadius;
+	bool narrow = kernel.Fits_16_Bits() && run > 0;
+
+	ThreadPool::Run_Bands(height, [&](int begin, int end)
+	{
+		Scratch bandScratch;
+		unsigned short* total = narrow ? bandScratch.New<unsigned short>(run * 3) : NULL;
+		unsigned char* rgbRun = narrow ? bandScratch.New<unsigned char>(run * 3) : NULL;
+
+		for (int i = begin; i < end; i++)
 		{
-			for (int j = 0; j < width; j++) {
-				//find the matrix limit
-				int LLimit = 0;
-				int uLimit = 0;
-				//find the range limit
-				int left = j - 1;
-				int right = j + 1;
-				int up = i - 1;
-				int down = i + 1;
-				if (left < 0)
-				{
-					LLimit = -left;
-					left = 0;
-				}
-				if (right >= width)
-				{
-					right = width - 1;
-				}
-				if (up < 0)
-				{
-					uLimit = -up;
-					up = 0;
-				}
-				if (down >= height)
+			bool interiorRow = i >= vRadius && i < height - vRadius;
+			if (interiorRow && narrow)
+			{
+				memset(total, 0, run * 3 * sizeof(unsigned short));
+				for (int v = 0; v < kernel.height; v++)
 				{
-					down = height - 1;
+					const unsigned char* in = rgb + (i + v - vRadius) * width * 3;
+					for (int u = 0; u < kernel.width; u++)
+					{
+						int weight = kernel.taps[v * kernel.width + u];
+						if (weight)
+							Multiply_Add_U8(in + u * 3, run * 3, (unsigned short)weight, total);
+					}
 				}
 
+				Divide_U16(total, run * 3, (unsigned int)kernel.divisor, rgbRun);
+				Expand_Row(rgbRun, run, data + i * stride + hRadius * 4);
+			}
 
-				int rgbTotal[3] = { 0, 0, 0 };//add the neer together
-
-				int BU = uLimit;
-				for (int l = up; l <= down; l++)
+			for (int j = 0; j < width; j++)
+			{
+				long long rgbTotal[3] = { 0, 0, 0 };
+				if (interiorRow && j >= hRadius && j < width - hRadius)
 				{
-					int BL = LLimit;
-					for (int m = left; m <= right; m++)
+					if (narrow)
 					{
-						int ind = ((l * width) + m) * 4;
-						unsigned char   rgbNeer[3];
-
-						RGBA_To_RGB(data + ind, rgbNeer);
+						j = width - hRadius - 1;
+						continue;
+					}
 
-						for (int k = 0; k < 3; k++)
+					//interior: the whole window is inside the image
+					for (int v = 0; v < kernel.height; v++)
+					{
+						const int* weight = &kernel.taps[v * kernel.width];
+						const unsigned char* in = rgb + ((i + v - vRadius) * width + j - hRadius) * 3;
+						for (int u = 0; u < kernel.width; u++, in += 3)
 						{
-							rgbTotal[k] += ((int)rgbNeer[k] * bartlett[BU][BL]);
+							for (int k = 0; k < 3; k++)
+								rgbTotal[k] += (long long)in[k] * weight[u];
 						}
-						BL++;
 					}
-					BU++;
 				}
-				int ind = ((i * width) + j) * 4;
-				for (int k = 0; k < 3; k++)
+				else
 				{
-					rgbTotal[k] /= 16;//average
-					temp[ind + k] = (unsigned char)rgbTotal[k];//assign to the data
+					//border strip: look up every tap
+					for (int v = 0; v < kernel.height; v++)
+					{
+						int l = Border_Index(i + v - vRadius, height, border);
+						if (l < 0)
+							continue;
+
+						const int* weight = &kernel.taps[v * kernel.width];
+						for (int u = 0; u < kernel.width; u++)
+						{
+							int m = Border_Index(j + u - hRadius, width, border);
+							if (m < 0)
+								continue;
+
+							const unsigned char* in = rgb + (l * width + m) * 3;
+							for (int k = 0; k < 3; k++)
+								rgbTotal[k] += (long long)in[k] * weight[u];
+						}
+					}
 				}
-				temp[ind + 3] = 255;
-			}
-		}
-		delete[] temp;
-		unsigned char* half = new unsigned char[(height / 2) * (width / 2) * 4];
-		for (int i = 0; i < height / 2; i++)
-		{
-			for (int j = 0; j < width / 2; j++)
-			{
-				int halfIndex = (i * (width / 2) + j) * 4;
-				int index = ((i * 2) * width + (j * 2)) * 4;
-				half[halfIndex] = data[index];
-				half[halfIndex + 1] = data[index + 1];
-				half[halfIndex + 2] = data[index + 2];
-				half[halfIndex + 3] = data[index + 3];
-			}
-		}
 
-		for (int i = 0; i < height / 2; i++)
-		{
-			for (int j = 0; j < width / 2; j++)
-			{
-				int halfIndex = (i * (width / 2) + j) * 4;
-				data[halfIndex] = half[halfIndex];
-				data[halfIndex + 1] = half[halfIndex + 1];
-				data[halfIndex + 2] = half[halfIndex + 2];
-				data[halfIndex + 3] = half[halfIndex + 3];
+				Emit_Row(rgbTotal, 1, kernel.divisor, data + i * stride + j * 4);
 			}
 		}
-		delete[] half;
-		height /= 2;
-		width /= 2;
-		return true;
-	}
-}// Half_Size
+	});
+
+	opaque = true;
+	return true;
+}// Convolve_Direct
 
 
 ///////////////////////////////////////////////////////////////////////////////
 //
-//      Double the dimensions of this image.  Return success of operation.
+//      Convolve with the row factor and then the column factor of a separable
+//  kernel.  Each row is extended past its ends by the border mode before the
+//  row pass, and the column pass reads a list of row pointers extended the
+//  same way, so neither pass checks bounds.  Factors made of cascaded boxes
+//  are applied as running sums.  Small non-negative kernels run in 16-bit
+//  vectors; otherwise the column pass accumulates in 64 bits only when 32
+//  could overflow.  Return success of operation.
 //
 ///////////////////////////////////////////////////////////////////////////////
-bool TargaImage::Double_Size()
+bool TargaImage::Convolve_Separable(const Kernel& kernel, EBorderMode border)
 {
-	if ((width == 0) && (height == 0))
-	{
-		//Filter_Bartlett before load image
-		ClearToBlack();
-		cout << "Half_Size: no image\n";
-		return false;
-	}// if
-	else
+	int hRadius = kernel.width / 2;
+	int vRadius = kernel.height / 2;
+	int rowSize = width * 3;
+	int lineSize = (width + 2 * hRadius) * 3;
+
+	long long rowBound = 0, columnBound = 0;
+	for (int u = 0; u < kernel.width; u++)
+		rowBound += abs(kernel.row[u]);
+	for (int v = 0; v < kernel.height; v++)
+		columnBound += abs(kernel.column[v]);
+	rowBound *= 255;
+	if (rowBound > INT_MAX)
+		return Convolve_Direct(kernel, border);
+
+	Scratch scratch;
+	unsigned char* rgb = scratch.New<unsigned char>(width * height * 3);
+	To_RGB(rgb);
+	if (kernel.Fits_16_Bits())
 	{
-		int bartlettEven[3][3] = { {1,2,1},{2,4,2},{1,2,1} };
-		int bartlettOdd[4][4] = { {1,3,3,1},{3,9,9,3},{3,9,9,3},{1,3,3,1 } };
-		int bartlettOther[4][3] = { {1,2,1},{3,6,3},{3,6,3},{1,2,1 } };
+		Separable_16(rgb, width, height, 3, kernel, border, data, stride);
+		return true;
+	}
 
-		unsigned char* doubleData = new unsigned char[(width * 2) * (height * 2) * 4];
+	int* horizontal = scratch.New<int>(width * height * 3);
 
-		for (int i = 0; i < (height * 2); i++)
+	//row pass
+	ThreadPool::Run_Bands(height, [&](int begin, int end)
+	{
+		Scratch bandScratch;
+		int* line = bandScratch.New<int>(lineSize);
+		int* boxes = bandScratch.New<int>(2 * lineSize);
+		for (int i = begin; i < end; i++)
 		{
-			for (int j = 0; j < (width * 2); j++)
+			Extend_Line(rgb + i * rowSize, width, 3, hRadius, border, line);
+
+			int* out = horizontal + i * rowSize;
+			if (kernel.boxes > 0)
 			{
-				int doubleIndex = (i * width * 2 + j) * 4;
-				int Urow = i / 2 - 1;
-				int Drow = i / 2 + 1;
-				int Lcol = j / 2 - 1;
-				int Rcol = j / 2 + 1;
-				//std::cout << Urow << " " << Drow << " " << Lcol << " " << Rcol << " ";
-				if ((i % 2 == 0) && (j % 2 == 0))
+				int taps = (kernel.width - 1) / kernel.boxes + 1;
+				const int* in = line;
+				int n = width + 2 * hRadius;
+				for (int b = 0; b < kernel.boxes; b++)
 				{
-
+					int* box = (b == kernel.boxes - 1) ? out : boxes + (b % 2) * lineSize;
+					Box_Sum(in, n, 3, taps, box);
+					in = box;
+					n -= taps - 1;
 				}
-				else if ((i % 2 == 1) && (j % 2 == 1))
+			}
+			else
+			{
+				memset(out, 0, rowSize * sizeof(int));
+				for (int u = 0; u < kernel.width; u++)
 				{
-					Drow++;
-					Rcol++;
+					int weight = kernel.row[u];
+					const int* in = line + u * 3;
+					for (int m = 0; m < rowSize; m++)
+						out[m] += in[m] * weight;
 				}
-				else
+			}
+		}
+	});
+
+	//column pass over the rows, extended by the border mode.  Each band
+	//restarts its running sums on the kernel.height - 1 rows above it, so
+	//the result does not depend on where the bands fall.
+	int* zero = scratch.New<int>(rowSize, 0);
+	const int** rows = scratch.New<const int*>(height + 2 * vRadius);
+	for (int t = 0; t < height + 2 * vRadius; t++)
+	{
+		int l = Border_Index(t - vRadius, height, border);
+		rows[t] = (l < 0) ? zero : horizontal + l * rowSize;
+	}
+
+	bool longTotals = rowBound * columnBound > INT_MAX;
+	ThreadPool::Run_Bands(height, [&](int begin, int end)
+	{
+		int count = end - begin + kernel.height - 1;
+		if (longTotals)
+			Column_Pass<long long>(&rows[begin], count, width, kernel, data + begin * stride, stride);
+		else
+			Column_Pass<int>(&rows[begin], count, width, kernel, data + begin * stride, stride);
+	});
+
+	opaque = true;
+	return true;
+}// Convolve_Separable
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Convolve by overlap-add in the frequency domain.  The image is cut into
+//  tiles that, grown by the kernel, fill one FFT of kernel.FFT_Size() points
+//  per axis.  Red and green share one complex transform as its real and
+//  imaginary parts, blue takes a second.  The tiles of one band of rows are
+//  added into an accumulator that covers the band plus the rows it spills
+//  into; rows no later band can reach are written out and the rest shift up.
+//  For borders other than black the image is first extended by the kernel
+//  radius.  Return success of operation.
+//
+///////////////////////////////////////////////////////////////////////////////
+bool TargaImage::Convolve_FFT(const Kernel& kernel, EBorderMode border)
+{
+	const float	c_roundingSlack = 1e-3f;	// keeps exact integers from truncating down after round off
+
+	int size = kernel.FFT_Size();
+	int hRadius = kernel.width / 2;
+	int vRadius = kernel.height / 2;
+	int tileWidth = size - kernel.width + 1;
+	int tileHeight = size - kernel.height + 1;
+	int points = size * size;
+
+	FFTPlan plan(size);
+
+	//spectrum of the flipped kernel, with the divisor and the inverse
+	//transform scale folded in
+	Scratch scratch;
+	std::complex<float>* spectrum = scratch.New<std::complex<float> >(points, std::complex<float>());
+	float scale = 1.0f / ((float)kernel.divisor * points);
+	for (int v = 0; v < kernel.height; v++)
+		for (int u = 0; u < kernel.width; u++)
+			spectrum[v * size + u] = kernel.taps[(kernel.height - 1 - v) * kernel.width + (kernel.width - 1 - u)] * scale;
+	plan.Transform_2D(spectrum, false);
+
+	//the source is the image, extended by the kernel radius unless the
+	//border is black; image pixel (j, i) is source pixel (j + left, i + top)
+	unsigned char* rgb = scratch.New<unsigned char>(width * height * 3);
+	To_RGB(rgb);
+	int sourceWidth = width, sourceHeight = height, left = 0, top = 0;
+	if (border != BORDER_ZERO)
+	{
+		left = hRadius;
+		top = vRadius;
+		sourceWidth = width + 2 * hRadius;
+		sourceHeight = height + 2 * vRadius;
+		unsigned char* extended = scratch.New<unsigned char>(sourceWidth * sourceHeight * 3);
+		ThreadPool::Run_Bands(sourceHeight, [&](int begin, int end)
+		{
+			for (int y = begin; y < end; y++)
+			{
+				int l = Border_Index(y - top, height, border);
+				for (int x = 0; x < sourceWidth; x++)
 				{
-					Drow++;
+					int m = Border_Index(x - left, width, border);
+					for (int k = 0; k < 3; k++)
+						extended[(y * sourceWidth + x) * 3 + k] = (l < 0 || m < 0) ? 0 : rgb[(l * width + m) * 3 + k];
 				}
-				int rgbTotal[3] = { 0, 0, 0 };//add the neer together
-				for (int k = Urow; k <= Drow; k++)
+			}
+		});
+		rgb = extended;
+	}
+
+	//accumulator row r, column c holds source pixel (c - hRadius, y0 - vRadius + r).
+	//The tiles of a band are transformed in parallel, then added in order of
+	//x0 so the sums round the same way for any number of threads.
+	int accumulatorWidth = sourceWidth + 2 * hRadius;
+	int tiles = (sourceWidth + tileWidth - 1) / tileWidth;
+	int accumulatorSize = size * accumulatorWidth * 3;
+	float* accumulator = scratch.New<float>(accumulatorSize, 0.0f);
+	std::complex<float>* redGreen = scratch.New<std::complex<float> >(tiles * points);
+	std::complex<float>* blue = scratch.New<std::complex<float> >(tiles * points);
+
+	for (int y0 = 0; y0 - vRadius < top + height; y0 += tileHeight)
+	{
+		int rows = Min(tileHeight, sourceHeight - y0);
+		if (rows > 0)
+		{
+			ThreadPool::Run_Bands(tiles, [&](int begin, int end)
+			{
+				for (int t = begin; t < end; t++)
 				{
-					for (int l = Lcol; l <= Rcol; l++)
+					std::complex<float>* tileRedGreen = &redGreen[t * points];
+					std::complex<float>* tileBlue = &blue[t * points];
+					int x0 = t * tileWidth;
+					int columns = Min(tileWidth, sourceWidth - x0);
+					std::fill(tileRedGreen, tileRedGreen + points, std::complex<float>());
+					std::fill(tileBlue, tileBlue + points, std::complex<float>());
+					for (int r = 0; r < rows; r++)
 					{
-
-						if ((k >= 0) && (k < height) && (l >= 0) && (l < width))
+						const unsigned char* in = rgb + ((y0 + r) * sourceWidth + x0) * 3;
+						for (int c = 0; c < columns; c++, in += 3)
 						{
-							int ind = ((k * width) + l) * 4;
-							//std::cout << k << " " << l << " ";
-							unsigned char   rgbNeer[3];
-
-							RGBA_To_RGB(data + ind, rgbNeer);
-
-							if ((i % 2 == 0) && (j % 2 == 0))
-							{
-								for (int m = 0; m < 3; m++)
-								{
-									rgbTotal[m] += ((int)rgbNeer[m] * bartlettEven[k - Urow][l - Lcol]);
-								}
-							}
-							else if ((i % 2 == 1) && (j % 2 == 1))
-							{
-								for (int m = 0; m < 3; m++)
-								{
-									rgbTotal[m] += ((int)rgbNeer[m] * bartlettOdd[k - Urow][l - Lcol]);
-								}
-							}
-							else
-							{
-								for (int m = 0; m < 3; m++)
-								{
-									rgbTotal[m] += ((int)rgbNeer[m] * bartlettOther[k - Urow][l - Lcol]);
-								}
-							}
+							tileRedGreen[r * size + c] = std::complex<float>(in[0], in[1]);
+							tileBlue[r * size + c] = in[2];
 						}
 					}
-					//std::cout << std::endl;
-				}
-				if ((i % 2 == 0) && (j % 2 == 0))
-				{
-					for (int m = 0; m < 3; m++)
+
+					plan.Transform_2D(tileRedGreen, false);
+					plan.Transform_2D(tileBlue, false);
+					for (int p = 0; p < points; p++)
 					{
-						doubleData[doubleIndex + m] = rgbTotal[m] / 16;
+						tileRedGreen[p] *= spectrum[p];
+						tileBlue[p] *= spectrum[p];
 					}
+					plan.Transform_2D(tileRedGreen, true);
+					plan.Transform_2D(tileBlue, true);
 				}
-				else if ((i % 2 == 1) && (j % 2 == 1))
+			});
+
+			ThreadPool::Run_Bands(Min(size, rows + kernel.height - 1), [&](int begin, int end)
+			{
+				for (int t = 0; t < tiles; t++)
 				{
-					for (int m = 0; m < 3; m++)
+					int x0 = t * tileWidth;
+					int spill = Min(size, accumulatorWidth - x0);
+					for (int r = begin; r < end; r++)
 					{
-						doubleData[doubleIndex + m] = rgbTotal[m] / 64;
+						const std::complex<float>* inRedGreen = &redGreen[t * points + r * size];
+						const std::complex<float>* inBlue = &blue[t * points + r * size];
+						float* out = &accumulator[(r * accumulatorWidth + x0) * 3];
+						for (int c = 0; c < spill; c++, out += 3)
+						{
+							out[0] += inRedGreen[c].real();
+							out[1] += inRedGreen[c].imag();
+							out[2] += inBlue[c].real();
+						}
 					}
 				}
-				else
+			});
+		}
+
+		//source rows y0 - vRadius up to y0 - vRadius + tileHeight are complete
+		ThreadPool::Run_Bands(tileHeight, [&](int begin, int end)
+		{
+			for (int r = begin; r < end; r++)
+			{
+				int i = y0 - vRadius + r - top;
+				if (i < 0 || i >= height)
+					continue;
+
+				const float* in = &accumulator[(r * accumulatorWidth + left + hRadius) * 3];
+				unsigned char* out = data + i * stride;
+				for (int j = 0; j < width; j++)
 				{
-					for (int m = 0; m < 3; m++)
+					for (int k = 0; k < 3; k++)
 					{
-						doubleData[doubleIndex + m] = rgbTotal[m] / 32;
+						float val = in[j * 3 + k] + c_roundingSlack;
+						out[j * 4 + k] = (unsigned char)(val < 0 ? 0 : (val > 255 ? 255 : val));
 					}
+					out[j * 4 + 3] = 255;
 				}
-				doubleData[doubleIndex + 3] = 255;
 			}
-		}
+		});
+
+		std::copy(accumulator + tileHeight * accumulatorWidth * 3, accumulator + accumulatorSize, accumulator);
+		std::fill(accumulator + accumulatorSize - tileHeight * accumulatorWidth * 3, accumulator + accumulatorSize, 0.0f);
+	}
+
+	opaque = true;
+	return true;
+}// Convolve_FFT
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Convolve a planar image with a separable kernel small enough for the
+//  16-bit passes.  Each color plane is un-premultiplied against the alpha
+//  plane, unless the image is opaque, and filtered as a one channel image,
+//  so the passes run over contiguous bytes.  Return success of operation.
+//
+///////////////////////////////////////////////////////////////////////////////
+bool TargaImage::Convolve_Planar(const Kernel& kernel, EBorderMode border)
+{
+	int n = width * height;
+	const unsigned char* alpha = data + 3 * n;
+	unsigned char* out = Pixels_New<unsigned char>(n * 4);
+	Scratch scratch;
+	unsigned char* straight = opaque ? NULL : scratch.New<unsigned char>(n);
 
-		data = new unsigned char[height * width * 16];
-		for (int i = 0; i < height * 2; i++)
+	for (int k = 0; k < 3; k++)
+	{
+		const unsigned char* plane = data + k * n;
+		if (straight)
 		{
-			for (int j = 0; j < width * 2; j++)
+			ThreadPool::Run_Bands(height, [&](int begin, int end)
 			{
-				int doubleIndex = (i * width * 2 + j) * 4;
-				data[doubleIndex] = doubleData[doubleIndex];
-				data[doubleIndex + 1] = doubleData[doubleIndex + 1];
-				data[doubleIndex + 2] = doubleData[doubleIndex + 2];
-				data[doubleIndex + 3] = 255;
-			}
+				Unpremultiply_Plane(plane + begin * width, alpha + begin * width, (end - begin) * width, straight + begin * width);
+			});
+			plane = straight;
 		}
-		height *= 2;
-		width *= 2;
-		return true;
+		Separable_16(plane, width, height, 1, kernel, border, out + k * n, width);
 	}
-}// Double_Size
+	memset(out + 3 * n, 255, n);
+
+	Free_Data();
+	data = out;
+	opaque = true;
+	return true;
+}// Convolve_Planar
 
 
 ///////////////////////////////////////////////////////////////////////////////
 //
-//      Scale the image dimensions by the given factor.  The given factor is 
-//  assumed to be greater than one.  Return success of operation.
+//      Convolve a float image with any kernel, in linear light.  Nothing is
+//  rounded or clamped, so the result can go on to the next op as it is.  An
+//  opaque image is its own straight color and is filtered as it stands,
+//  alpha with it, and the alpha set back to 1.  Return success of operation.
 //
 ///////////////////////////////////////////////////////////////////////////////
-bool TargaImage::Resize(float scale)
+bool TargaImage::Convolve_Float(const Kernel& kernel, EBorderMode border)
 {
-	ClearToBlack();
-	return false;
-}// Resize
+	if (opaque)
+	{
+		float* out = Pixels_New<float>(width * height * 4);
+		Convolve_Image<float, float>(linear, width, height, 4, kernel, border, out);
+		ThreadPool::Run_Bands(height, [&](int begin, int end)
+		{
+			for (int p = begin * width; p < end * width; p++)
+				out[p * 4 + 3] = 1.0f;
+		});
+		Pixels_Delete(linear);
+		linear = out;
+		return true;
+	}
 
+	Scratch scratch;
+	float* rgb = scratch.New<float>(width * height * 3);
+	float* out = scratch.New<float>(width * height * 3);
+	Linear_RGB(rgb);
+	Convolve_Image<float, float>(rgb, width, height, 3, kernel, border, out);
 
-//////////////////////////////////////////////////////////////////////////////
+	Set_Linear_RGB(out);
+	return true;
+}// Convolve_Float
+
+
+///////////////////////////////////////////////////////////////////////////////
 //
-//      Rotate the image clockwise by the given angle.  Do not resize the 
-//  image.  Return success of operation.
+//      Convolve a 16-bit image with any kernel.  Opaque images are filtered
+//  as they stand, like Convolve_Float.  Return success of operation.
 //
 ///////////////////////////////////////////////////////////////////////////////
-bool TargaImage::Rotate(float angleDegrees)
+bool TargaImage::Convolve_16(const Kernel& kernel, EBorderMode border)
 {
-	if ((width == 0) && (height == 0))
-	{
-		//Filter_Bartlett before load image
-		ClearToBlack();
-		cout << "Rotate: no image\n";
-		return false;
-	}// if
-	else
+	if (opaque)
 	{
-		int bartlettHighPass[4][4] = { {1,2,2,1},{2,4,4,2},{2,4,4,2},{1,2,2,1} };
-
-		unsigned char* enhanceData = new unsigned char[width * height * 4];
-
-		for (int i = 0; i < height; i++)
+		unsigned short* out = Pixels_New<unsigned short>(width * height * 4);
+		Convolve_Wide(wide, width, height, 4, kernel, border, out);
+		ThreadPool::Run_Bands(height, [&](int begin, int end)
 		{
-			for (int j = 0; j < width; j++)
-			{
-				int doubleIndex = (i * width + j) * 4;
-				int Urow = i - 1;
-				int Drow = i + 1;
-				int Lcol = j - 1;
-				int Rcol = j + 1;
-				//std::cout << Urow << " " << Drow << " " << Lcol << " " << Rcol << " ";
-
-				int rgbTotal[3] = { 0, 0, 0 };//add the neer together
-				for (int k = Urow; k <= Drow; k++)
-				{
-					for (int l = Lcol; l <= Rcol; l++)
-					{
+			for (int p = begin * width; p < end * width; p++)
+				out[p * 4 + 3] = 65535;
+		});
+		Pixels_Delete(wide);
+		wide = out;
+		return true;
+	}
 
-						if ((k >= 0) && (k < height) && (l >= 0) && (l < width))
-						{
-							int ind = ((k * width) + l) * 4;
-							//std::cout << k << " " << l << " ";
-							unsigned char   rgbNeer[3];
+	Scratch scratch;
+	unsigned short* rgb = scratch.New<unsigned short>(width * height * 3);
+	unsigned short* out = scratch.New<unsigned short>(width * height * 3);
+	Wide_RGB(rgb);
+	Convolve_Wide(rgb, width, height, 3, kernel, border, out);
 
-							RGBA_To_RGB(data + ind, rgbNeer);
+	Set_Wide_RGB(out);
+	return true;
+}// Convolve_16
 
 
-							for (int m = 0; m < 3; m++)
-							{
-								rgbTotal[m] += ((int)rgbNeer[m] * bartlettHighPass[k - Urow][l - Lcol]);
-							}
-						}
-					}
-					//std::cout << std::endl;
-				}
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Divide the alpha out of a float image, into a buffer of width *
+//  height * 3 floats.  Transparent pixels are black.
+//
+///////////////////////////////////////////////////////////////////////////////
+void TargaImage::Linear_RGB(float* rgb) const
+{
+	ThreadPool::Run_Bands(height, [&](int begin, int end)
+	{
+		Row_To_Linear_RGB(linear + begin * width * 4, (end - begin) * width, rgb + begin * width * 3, opaque);
+	});
+}// Linear_RGB
 
-				for (int m = 0; m < 3; m++)
-				{
-					enhanceData[doubleIndex + m] = rgbTotal[m] / 16;
-				}
-			}
-		}
 
-		for (int i = 0; i < height; i++)
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Fill a float image from straight linear RGB, opaque, as the filters
+//  leave it.
+//
+///////////////////////////////////////////////////////////////////////////////
+void TargaImage::Set_Linear_RGB(const float* rgb)
+{
+	ThreadPool::Run_Bands(height, [&](int begin, int end)
+	{
+		for (int p = begin * width; p < end * width; p++)
 		{
-			for (int j = 0; j < width; j++)
-			{
-				int doubleIndex = (i * width + j) * 4;
-				data[doubleIndex] = enhanceData[doubleIndex];
-				data[doubleIndex + 1] = enhanceData[doubleIndex + 1];
-				data[doubleIndex + 2] = enhanceData[doubleIndex + 2];
-				data[doubleIndex + 3] = enhanceData[doubleIndex + 3];
-			}
+			float* out = linear + p * 4;
+			for (int k = 0; k < 3; k++)
+				out[k] = rgb[p * 3 + k];
+			out[3] = 1.0f;
 		}
-		return true;
-	}
-}// Rotate
+	});
+	opaque = true;
+}// Set_Linear_RGB
 
 
-//////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////
 //
-//      Given a single RGBA pixel return, via the second argument, the RGB
-//      equivalent composited with a black background.
+//      Divide the alpha out of a 16-bit image, into a buffer of width *
+//  height * 3 channels, truncating like Unpremultiply_Row.
 //
 ///////////////////////////////////////////////////////////////////////////////
-void TargaImage::RGBA_To_RGB(unsigned char* rgba, unsigned char* rgb)
+void TargaImage::Wide_RGB(unsigned short* rgb) const
 {
-	const unsigned char	BACKGROUND[3] = { 0, 0, 0 };
+	ThreadPool::Run_Bands(height, [&](int begin, int end)
+	{
+		Row_To_Wide_RGB(wide + begin * width * 4, (end - begin) * width, rgb + begin * width * 3, opaque);
+	});
+}// Wide_RGB
 
-	unsigned char  alpha = rgba[3];
 
-	if (alpha == 0)
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Fill a 16-bit image from straight RGB, opaque.
+//
+///////////////////////////////////////////////////////////////////////////////
+void TargaImage::Set_Wide_RGB(const unsigned short* rgb)
+{
+	ThreadPool::Run_Bands(height, [&](int begin, int end)
 	{
-		rgb[0] = BACKGROUND[0];
-		rgb[1] = BACKGROUND[1];
-		rgb[2] = BACKGROUND[2];
-	}
+		for (int p = begin * width; p < end * width; p++)
+		{
+			unsigned short* out = wide + p * 4;
+			for (int k = 0; k < 3; k++)
+				out[k] = rgb[p * 3 + k];
+			out[3] = 65535;
+		}
+	});
+	opaque = true;
+}// Set_Wide_RGB
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Convert the pixels between premultiplied sRGB bytes in data,
+//  premultiplied linear light floats in linear and premultiplied 16-bit
+//  sRGB in wide; the buffers not in use are freed.  Float and 16-bit images
+//  are always interleaved.  Going from bytes to either and back gives the
+//  bytes that were there, so like Set_Layout this keeps the generation.
+//  16 bits go down to bytes by ordered dithering, see Narrow_Row.
+//
+///////////////////////////////////////////////////////////////////////////////
+void TargaImage::Set_Format(EPixelFormat newFormat)
+{
+	if (newFormat == format || !owned)
+		return;
+
+	Set_Layout(LAYOUT_INTERLEAVED);
+	int n = width * height;
+	if (newFormat == FORMAT_BYTE)
+		data = New_Rows(width, height, stride);
+	else if (newFormat == FORMAT_FLOAT)
+		linear = Pixels_New<float>(n * 4);
 	else
-	{
-		float	alpha_scale = (float)255 / (float)alpha;
-		int	val;
-		int	i;
+		wide = Pixels_New<unsigned short>(n * 4);
 
-		for (i = 0; i < 3; i++)
+	ThreadPool::Run_Bands(height, [&](int begin, int end)
+	{
+		for (int i = begin; i < end; i++)
 		{
-			val = (int)floor(rgba[i] * alpha_scale);
-			if (val < 0)
-				rgb[i] = 0;
-			else if (val > 255)
-				rgb[i] = 255;
+			int offset = i * width * 4;
+			unsigned char* row = data + i * stride;
+			if (format == FORMAT_BYTE)
+			{
+				if (newFormat == FORMAT_FLOAT)
+					Linearize_Row(row, width, linear + offset);
+				else
+					Widen_Row(row, width, wide + offset);
+			}
+			else if (format == FORMAT_FLOAT)
+			{
+				if (newFormat == FORMAT_BYTE)
+					Delinearize_Row(linear + offset, width, row);
+				else
+					Delinearize_Row_16(linear + offset, width, wide + offset);
+			}
 			else
-				rgb[i] = val;
+			{
+				if (newFormat == FORMAT_BYTE)
+					Narrow_Row(wide + offset, width, i, row);
+				else
+					Linearize_Row_16(wide + offset, width, linear + offset);
+			}
 		}
+	});
+
+	if (format == FORMAT_BYTE)
+		Free_Data();
+	else if (format == FORMAT_FLOAT)
+	{
+		Pixels_Delete(linear);
+		linear = NULL;
 	}
-}// RGA_To_RGB
+	else
+	{
+		Pixels_Delete(wide);
+		wide = NULL;
+	}
+	format = newFormat;
+}// Set_Format
 
 
 ///////////////////////////////////////////////////////////////////////////////
 //
-//      Copy this into a new image, reversing the rows as it goes. A pointer
-//  to the new image is returned.
+//      Rearrange the pixel data into the given layout.  The image itself does
+//  not change, so neither does its generation.
 //
 ///////////////////////////////////////////////////////////////////////////////
-TargaImage* TargaImage::Reverse_Rows(void)
+void TargaImage::Set_Layout(EPixelLayout newLayout)
 {
-	unsigned char* dest = new unsigned char[width * height * 4];
-	TargaImage* result;
-	int 	        i, j;
-
-	if (!data)
-		return NULL;
-
-	for (i = 0; i < height; i++)
+	if (newLayout == LAYOUT_PLANAR)
+		Set_Format(FORMAT_BYTE);
+	if (!owned)
+		return;
+	if (newLayout == layout || !data)
 	{
-		int in_offset = (height - i - 1) * width * 4;
-		int out_offset = i * width * 4;
+		layout = newLayout;
+		return;
+	}
 
-		for (j = 0; j < width; j++)
+	// planes are packed tight; interleaved rows get their aligned stride
+	int n = width * height;
+	int newStride = width * 4;
+	unsigned char* rearranged = (newLayout == LAYOUT_PLANAR) ? Pixels_New<unsigned char>(n * 4) : New_Rows(width, height, newStride);
+	ThreadPool::Run_Bands(height, [&](int begin, int end)
+	{
+		for (int i = begin; i < end; i++)
 		{
-			dest[out_offset + j * 4] = data[in_offset + j * 4];
-			dest[out_offset + j * 4 + 1] = data[in_offset + j * 4 + 1];
-			dest[out_offset + j * 4 + 2] = data[in_offset + j * 4 + 2];
-			dest[out_offset + j * 4 + 3] = data[in_offset + j * 4 + 3];
+			int offset = i * width;
+			if (newLayout == LAYOUT_PLANAR)
+				Deinterleave_Row(data + i * stride, width, rearranged + offset, rearranged + n + offset, rearranged + 2 * n + offset, rearranged + 3 * n + offset);
+			else
+				Interleave_Row(data + offset, data + n + offset, data + 2 * n + offset, data + 3 * n + offset, width, rearranged + i * newStride);
 		}
-	}
+	});
 
-	result = new TargaImage(width, height, dest);
-	delete[] dest;
-	return result;
-}// Reverse_Rows
+	Free_Data();
+	data = rearranged;
+	stride = newStride;
+	layout = newLayout;
+}// Set_Layout
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Give the image a new generation.  Generations are never reused, so
+//  anything cached from an image is current while the image's generation
+//  matches the one it was made from.
+//
+///////////////////////////////////////////////////////////////////////////////
+void TargaImage::Mark_Changed()
+{
+	static unsigned int s_lastGeneration = 0;
+
+	generation = ++s_lastGeneration;
+}// Mark_Changed
 
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -1941,7 +3965,23 @@ TargaImage* TargaImage::Reverse_Rows(void)
 ///////////////////////////////////////////////////////////////////////////////
 void TargaImage::ClearToBlack()
 {
-	memset(data, 0, width * height * 4);
+	if (format != FORMAT_BYTE)
+	{
+		Pixels_Delete(linear);
+		Pixels_Delete(wide);
+		linear = NULL;
+		wide = NULL;
+		data = New_Rows(width, height, stride);
+		format = FORMAT_BYTE;
+	}
+	if (layout == LAYOUT_PLANAR)
+		memset(data, 0, width * height * 4);
+	else
+	{
+		for (int i = 0; i < height; i++)
+			memset(data + i * stride, 0, width * 4);
+	}
+	opaque = false;
 }// ClearToBlack
 
 
@@ -1952,6 +3992,8 @@ void TargaImage::ClearToBlack()
 //
 ///////////////////////////////////////////////////////////////////////////////
 void TargaImage::Paint_Stroke(const Stroke& s) {
+	if (s.a != 255)
+		opaque = false;
 	int radius_squared = (int)s.radius * (int)s.radius;
 	for (int x_off = -((int)s.radius); x_off <= (int)s.radius; x_off++) {
 		for (int y_off = -((int)s.radius); y_off <= (int)s.radius; y_off++) {
@@ -1961,20 +4003,20 @@ void TargaImage::Paint_Stroke(const Stroke& s) {
 			if ((x_loc >= 0 && x_loc < width && y_loc >= 0 && y_loc < height)) {
 				int dist_squared = x_off * x_off + y_off * y_off;
 				if (dist_squared <= radius_squared) {
-					data[(y_loc * width + x_loc) * 4 + 0] = s.r;
-					data[(y_loc * width + x_loc) * 4 + 1] = s.g;
-					data[(y_loc * width + x_loc) * 4 + 2] = s.b;
-					data[(y_loc * width + x_loc) * 4 + 3] = s.a;
+					data[y_loc * stride + x_loc * 4 + 0] = s.r;
+					data[y_loc * stride + x_loc * 4 + 1] = s.g;
+					data[y_loc * stride + x_loc * 4 + 2] = s.b;
+					data[y_loc * stride + x_loc * 4 + 3] = s.a;
 				}
 				else if (dist_squared == radius_squared + 1) {
-					data[(y_loc * width + x_loc) * 4 + 0] =
-						(data[(y_loc * width + x_loc) * 4 + 0] + s.r) / 2;
-					data[(y_loc * width + x_loc) * 4 + 1] =
-						(data[(y_loc * width + x_loc) * 4 + 1] + s.g) / 2;
-					data[(y_loc * width + x_loc) * 4 + 2] =
-						(data[(y_loc * width + x_loc) * 4 + 2] + s.b) / 2;
-					data[(y_loc * width + x_loc) * 4 + 3] =
-						(data[(y_loc * width + x_loc) * 4 + 3] + s.a) / 2;
+					data[y_loc * stride + x_loc * 4 + 0] =
+						(data[y_loc * stride + x_loc * 4 + 0] + s.r) / 2;
+					data[y_loc * stride + x_loc * 4 + 1] =
+						(data[y_loc * stride + x_loc * 4 + 1] + s.g) / 2;
+					data[y_loc * stride + x_loc * 4 + 2] =
+						(data[y_loc * stride + x_loc * 4 + 2] + s.b) / 2;
+					data[y_loc * stride + x_loc * 4 + 3] =
+						(data[y_loc * stride + x_loc * 4 + 3] + s.a) / 2;
 				}
 			}
 		}
@@ -21,7 +21,11 @@
 #include <stdlib.h>
 #include <algorithm>
 
+#include "Kernel.h"
+#include "ImageView.h"
+
 class Stroke;
+class FilterChain;
 class DistanceImage;
 struct populoData;
 
@@ -31,6 +35,27 @@ const double euclideanDistance(const populoData& popular, const unsigned char* o
 const double thresholdFunc(const double gray, const double threshold);
 const double Quantthreshold(const double rgb, const int color);
 
+// files with this extension are raw 16-bit images rather than targas: the
+// bytes "RGBA16", a newline, the width and height as 32-bit little endian
+// numbers, and then the premultiplied 16-bit RGBA pixels, little endian, top
+// row first.  TGA has no 16-bit per channel format
+const char c_sRaw16Extension[] = ".rgba16";
+
+// how the pixels are laid out in TargaImage::data
+enum EPixelLayout
+{
+	LAYOUT_INTERLEAVED,         // RGBA RGBA ..., row by row
+	LAYOUT_PLANAR               // every R, then every G, then every B, then every A, each row by row
+};
+
+// what the pixels are stored as
+enum EPixelFormat
+{
+	FORMAT_BYTE,                // premultiplied 8-bit sRGB in TargaImage::data
+	FORMAT_FLOAT,               // premultiplied linear light floats in TargaImage::linear
+	FORMAT_16                   // premultiplied 16-bit sRGB, the bytes times 257, in TargaImage::wide
+};
+
 
 class TargaImage
 {
@@ -40,10 +65,17 @@ public:
 	TargaImage(int w, int h);
 	TargaImage(int w, int h, unsigned char* d);
 	TargaImage(const TargaImage& image);
+	TargaImage(TargaImage&& image);             // takes the pixels of image, which is left empty
+	TargaImage(const ImageView& view);          // an image whose pixels are the view's, worked on in place
 	~TargaImage(void);
 
+	TargaImage& operator=(const TargaImage& image);
+	TargaImage& operator=(TargaImage&& image);
+	void Swap(TargaImage& image);               // exchange pixels and everything about them, copying none
+
 	unsigned char* To_RGB(void);	            // Convert the image to RGB format,
-	bool Save_Image(const char*);               // save the image to a file
+	void To_RGB(unsigned char* rgb) const;      // into a width * height * 3 buffer
+	bool Save_Image(const char*, bool rle = false); // save the image to a file, raw 16-bit if the name ends in c_sRaw16Extension, else a targa, run length encoded for rle
 	static TargaImage* Load_Image(char*);       // Load a file and return a pointer to a new TargaImage object.  Returns NULL on failure
 
 	bool To_Grayscale();
@@ -67,12 +99,16 @@ public:
 
 	bool Difference(TargaImage* pImage);
 
-	bool Filter_Box();
-	bool Filter_Bartlett();
+	bool Filter_Box(int radius = 2);
+	bool Filter_Bartlett(int radius = 2);
 	bool Filter_Gaussian();
 	bool Filter_Gaussian_N(unsigned int N);
-	bool Filter_Edge();
-	bool Filter_Enhance();
+	bool Filter_Gaussian_Sigma(float sigma);
+	bool Filter_Edge(int radius = 2, float amount = 1.0f);
+	bool Filter_Enhance(int radius = 2, float amount = 1.0f);
+
+	bool Convolve(const Kernel& kernel, EBorderMode border = BORDER_ZERO, EConvolveMethod method = CONVOLVE_AUTO);
+	bool Filter_Chain(const FilterChain& chain);
 
 	bool NPR_Paint();
 
@@ -81,12 +117,74 @@ public:
 	bool Resize(float scale);
 	bool Rotate(float angleDegrees);
 
-private:
 	// helper function for format conversion
-	void RGBA_To_RGB(unsigned char* rgba, unsigned char* rgb);
+	static void RGBA_To_RGB(unsigned char* rgba, unsigned char* rgb);
+
+	// the pixels of the whole image, or of the w x h rectangle at (x, y),
+	// which must lie inside it.  The image is made interleaved bytes first
+	ImageView View();
+	ImageView View(int x, int y, int w, int h);
+
+	// call after changing data directly; every op calls it
+	void Mark_Changed();
+
+	// rearrange the pixel data.  Ops without a planar version, and file I/O,
+	// work on interleaved data and put a planar image back to interleaved.
+	// An image made from a view stays interleaved
+	void Set_Layout(EPixelLayout newLayout);
+
+	// convert the pixels between bytes, linear light floats and 16 bits.
+	// Filters and resampling stay in float or 16 bits, so a run of them
+	// rounds to bytes once, when the image is saved, shown, or given to an op
+	// without a version for its format.  16 bits go down to bytes by ordered
+	// dithering.  An image made from a view stays in bytes
+	void Set_Format(EPixelFormat newFormat);
+
+private:
+
+	// give the image new interleaved byte pixels with aligned rows, and make
+	// a width x height buffer of them
+	void New_Data();
+	static unsigned char* New_Rows(int width, int height, int& stride);
+
+	// make an interleaved buffer of width x height pixels, stride bytes a
+	// row, the pixel data.  An image made from a view copies it into the
+	// view's rows and frees it
+	void Replace_Data(unsigned char* newData, int newStride);
+
+	// free the pixel data, unless it belongs to a view
+	void Free_Data();
+
+	// the three ways Convolve can apply a kernel
+	bool Convolve_Direct(const Kernel& kernel, EBorderMode border);
+	bool Convolve_Separable(const Kernel& kernel, EBorderMode border);
+	bool Convolve_FFT(const Kernel& kernel, EBorderMode border);
+
+	// Convolve for a planar image, one plane at a time; the kernel must be
+	// separable and fit 16 bits
+	bool Convolve_Planar(const Kernel& kernel, EBorderMode border);
+
+	// Convolve and Unsharp_Mask for a float image and for a 16-bit one
+	bool Convolve_Float(const Kernel& kernel, EBorderMode border);
+	void Unsharp_Mask_Float(int radius, float amount, bool edgeOnly);
+	bool Convolve_16(const Kernel& kernel, EBorderMode border);
+	void Unsharp_Mask_16(int radius, float amount, bool edgeOnly);
+
+	// the straight linear RGB of a float image, into width * height * 3
+	// floats, and the reverse, which leaves the image opaque
+	void Linear_RGB(float* rgb) const;
+	void Set_Linear_RGB(const float* rgb);
+
+	// the same for the straight RGB of a 16-bit image
+	void Wide_RGB(unsigned short* rgb) const;
+	void Set_Wide_RGB(const unsigned short* rgb);
+
+	// raw 16-bit files, see c_sRaw16Extension
+	bool Save_Raw_16(const char* filename);
+	static TargaImage* Load_Raw_16(const char* filename);
 
-	// reverse the rows of the image, some targas are stored bottom to top
-	TargaImage* Reverse_Rows(void);
+	// blur, difference and sum of Filter_Edge and Filter_Enhance in one pass
+	void Unsharp_Mask(int radius, float amount, bool edgeOnly);
 
 	// clear image to all black
 	void ClearToBlack();
@@ -99,6 +197,14 @@ public:
 	int		width;	    // width of the image in pixels
 	int		height;	    // height of the image in pixels
 	unsigned char* data;	    // pixel data for the image, assumed to be in pre-multiplied RGBA format.
+	int		stride;	    // bytes from one row of data to the next while interleaved; the rows of images the class allocates start on c_rowAlignment boundaries
+	bool	owned;	    // the image allocated data, rather than being made from a view
+	bool	opaque;	    // every alpha is 255 (1 in float), so the pixel data is also straight RGB.  Ops that write data keep it up to date
+	unsigned int generation;    // changes whenever the pixel data does, see Mark_Changed
+	EPixelLayout layout;        // interleaved unless asked for otherwise, see Set_Layout
+	EPixelFormat format;        // bytes unless asked for otherwise, see Set_Format
+	float*	linear;	    // width * height * 4 floats while the format is FORMAT_FLOAT, when data is NULL
+	unsigned short* wide;       // width * height * 4 channels while the format is FORMAT_16, when data is NULL
 };
 
 class Stroke { // Data structure for holding painterly strokes.
@@ -0,0 +1,170 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+//      ThreadPool.cpp
+//
+//      Implementation of ThreadPool methods.  The workers sleep on a
+//  condition variable between jobs and take bands of the current job until
+//  none are left; the thread that posted the job takes bands too.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include "Globals.h"
+#include "ThreadPool.h"
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <vector>
+
+using namespace std;
+
+// the current job and the workers, all guarded by s_mutex
+static mutex                                s_mutex;
+static condition_variable                   s_wake;         // a job was posted or the workers should stop
+static condition_variable                   s_done;         // the last band of a job finished
+static vector<thread>                       s_workers;
+static const function<void(int, int)>*      s_pBody = NULL;
+static int                                  s_count = 0;        // loop length of the job
+static int                                  s_bands = 0;        // bands in the job
+static int                                  s_nextBand = 0;     // first band nobody has taken
+static int                                  s_unfinished = 0;   // bands not yet done
+static unsigned int                         s_generation = 0;   // bumped for every job
+static bool                                 s_stop = false;
+static int                                  s_threads = 0;      // 0 until first set
+
+static thread_local bool                    t_bInBand = false;  // this thread is running a band
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Take and run bands of the current job until none are left.  The lock
+//  is held on entry and exit, and dropped while a band runs.
+//
+///////////////////////////////////////////////////////////////////////////////
+static void Run_Job(unique_lock<mutex>& lock)
+{
+	while (s_nextBand < s_bands)
+	{
+		int band = s_nextBand++;
+		int begin = (int)((long long)s_count * band / s_bands);
+		int end = (int)((long long)s_count * (band + 1) / s_bands);
+		const function<void(int, int)>& body = *s_pBody;
+
+		lock.unlock();
+		t_bInBand = true;
+		body(begin, end);
+		t_bInBand = false;
+		lock.lock();
+
+		if (--s_unfinished == 0)
+			s_done.notify_all();
+	}
+}// Run_Job
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Worker thread: wait for a new job, help run it, repeat.
+//
+///////////////////////////////////////////////////////////////////////////////
+static void Worker()
+{
+	unique_lock<mutex> lock(s_mutex);
+	unsigned int seen = s_generation;
+	for (;;)
+	{
+		s_wake.wait(lock, [&seen]() { return s_stop || s_generation != seen; });
+		if (s_stop)
+			return;
+
+		seen = s_generation;
+		Run_Job(lock);
+	}
+}// Worker
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Stop and join every worker.
+//
+///////////////////////////////////////////////////////////////////////////////
+static void Stop_Workers()
+{
+	{
+		lock_guard<mutex> lock(s_mutex);
+		s_stop = true;
+	}
+	s_wake.notify_all();
+
+	for (size_t i = 0; i < s_workers.size(); i++)
+		s_workers[i].join();
+	s_workers.clear();
+	s_stop = false;
+}// Stop_Workers
+
+
+// joins the workers when the program exits
+static struct Shutdown
+{
+	~Shutdown() { Stop_Workers(); }
+} s_shutdown;
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Use count threads in total, or one per processor if count is 0.
+//
+///////////////////////////////////////////////////////////////////////////////
+void ThreadPool::Set_Threads(int count)
+{
+	if (count <= 0)
+		count = Max((int)thread::hardware_concurrency(), 1);
+
+	Stop_Workers();
+	s_threads = count;
+	for (int i = 1; i < count; i++)
+		s_workers.push_back(thread(Worker));
+}// Set_Threads
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Return the number of threads in use, starting the workers the first
+//  time.
+//
+///////////////////////////////////////////////////////////////////////////////
+int ThreadPool::Threads()
+{
+	if (!s_threads)
+		Set_Threads(0);
+	return s_threads;
+}// Threads
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Split [0, count) into one band per thread and run body on every band.
+//
+///////////////////////////////////////////////////////////////////////////////
+void ThreadPool::Run_Bands(int count, const function<void(int, int)>& body)
+{
+	int bands = Min(Threads(), count);
+	if (bands <= 1 || t_bInBand)
+	{
+		if (count > 0)
+			body(0, count);
+		return;
+	}// if
+
+	unique_lock<mutex> lock(s_mutex);
+	s_pBody = &body;
+	s_count = count;
+	s_bands = bands;
+	s_nextBand = 0;
+	s_unfinished = bands;
+	s_generation++;
+	s_wake.notify_all();
+
+	Run_Job(lock);
+	s_done.wait(lock, []() { return s_unfinished == 0; });
+	s_pBody = NULL;
+}// Run_Bands
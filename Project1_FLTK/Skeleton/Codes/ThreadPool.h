@@ -0,0 +1,32 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+//      ThreadPool.h
+//
+//      A fixed set of worker threads that run a loop over horizontal bands of
+//  an image in parallel.  Every band writes its own rows, so the result does
+//  not depend on the number of threads.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef _THREAD_POOL_H_
+#define _THREAD_POOL_H_
+
+#include <functional>
+
+// most threads Set_Threads is given from the command line or a script
+const int c_maxThreads = 1024;
+
+class ThreadPool
+{
+	// methods
+public:
+	// use count threads, including the calling one; 0 picks one per processor
+	static void Set_Threads(int count);
+	static int Threads();
+
+	// call body(begin, end) on bands that cover [0, count) and return once all
+	// are done.  Called from inside a band it runs on the calling thread.
+	static void Run_Bands(int count, const std::function<void(int, int)>& body);
+};
+
+#endif
@@ -4,6 +4,7 @@
 
 #include <stdio.h>
 #include <malloc.h>
+#include <string.h>
 
 #include "libtarga.h"
 
@@ -51,6 +52,7 @@
 #define TGA_ERR_READ_FAILS              (9)
 #define TGA_ERR_BAD_IMAGE_TYPE          (10)
 #define TGA_ERR_BAD_DIMENSIONS          (11)
+#define TGA_ERR_MEM                     (12)
 
 
 static uint32 TargaError;
@@ -62,11 +64,17 @@ static int32 ttohl( int32 val );
 static int32 htotl( int32 val );
 
 
-static uint32 tga_get_pixel( FILE * tga, ubyte bytes_per_pix, 
-                            ubyte * colormap, ubyte cmap_bytes_entry );
+static uint32 tga_get_pixel( const ubyte ** cursor, const ubyte * end, ubyte bytes_per_pix, 
+                            ubyte * colormap, ubyte cmap_bytes_entry, uint16 cmap_length );
 static uint32 tga_convert_color( uint32 pixel, uint32 bpp_in, ubyte alphabits, uint32 format_out );
 static void tga_write_pixel_to_mem( ubyte * dat, ubyte img_spec, uint32 number, 
                                    uint32 w, uint32 h, uint32 pixel, uint32 format );
+static void tga_fill_run_to_mem( ubyte * dat, ubyte img_spec, uint32 number, uint32 count,
+                                uint32 w, uint32 h, uint32 pixel, uint32 format );
+static uint32 tga_pixel_index( ubyte img_spec, uint32 number, uint32 w, uint32 h );
+static long long tga_tell( FILE * file );
+static int tga_seek( FILE * file, long long offset, int origin );
+static uint16 tga_header_16( const ubyte * field );
 
 
 /* returns the last error encountered */
@@ -116,6 +124,9 @@ const char * tga_error_string( int error_code ) {
     case TGA_ERR_BAD_DIMENSIONS:
         return( "image has size 0 width or height (or both)" );
 
+    case TGA_ERR_MEM:
+        return( "not enough memory for the image" );
+
     default:
         return( "unknown error" );
 
@@ -193,10 +204,18 @@ void * tga_load( const char * filename,
 
     ubyte true_bits_per_pixel;
 
-    uint32 bytes_total = 0;
+    size_t bytes_total = 0;
 
     ubyte packet_header;
     ubyte repcount;
+
+    ubyte * payload;            // everything after the colormap, read in one go
+    const ubyte * cursor;
+    const ubyte * payload_end;
+    long long payload_start;
+    long long payload_end_offset;
+    unsigned long long payload_max;
+    size_t payload_len;
     
 
     switch( format ) {
@@ -222,10 +241,16 @@ void * tga_load( const char * filename,
 
     /* allocate memory for the header */
     tga_hdr = (ubyte *)malloc( HDR_LENGTH );
+    if( tga_hdr == NULL ) {
+        fclose( targafile );
+        TargaError = TGA_ERR_MEM;
+        return( NULL );
+    }
 
     /* read the header in. */
     if( fread( (void *)tga_hdr, 1, HDR_LENGTH, targafile ) != HDR_LENGTH ) {
         free( tga_hdr );
+        fclose( targafile );
         TargaError = TGA_ERR_BAD_HEADER;
         return( NULL );
     }
@@ -237,23 +262,24 @@ void * tga_load( const char * filename,
     image_type         = (ubyte)tga_hdr[HDR_IMAGE_TYPE];
     
     cmap_type          = (ubyte)tga_hdr[HDR_CMAP_TYPE];
-    cmap_first         = ttohs( *(uint16 *)(&tga_hdr[HDR_CMAP_FIRST]) );
-    cmap_length        = ttohs( *(uint16 *)(&tga_hdr[HDR_CMAP_LENGTH]) );
+    cmap_first         = tga_header_16( &tga_hdr[HDR_CMAP_FIRST] );
+    cmap_length        = tga_header_16( &tga_hdr[HDR_CMAP_LENGTH] );
     cmap_entry_size    = (ubyte)tga_hdr[HDR_CMAP_ENTRY_SIZE];
 
-    img_spec_xorig     = ttohs( *(uint16 *)(&tga_hdr[HDR_IMG_SPEC_XORIGIN]) );
-    img_spec_yorig     = ttohs( *(uint16 *)(&tga_hdr[HDR_IMG_SPEC_YORIGIN]) );
-    img_spec_width     = ttohs( *(uint16 *)(&tga_hdr[HDR_IMG_SPEC_WIDTH]) );
-    img_spec_height    = ttohs( *(uint16 *)(&tga_hdr[HDR_IMG_SPEC_HEIGHT]) );
+    img_spec_xorig     = tga_header_16( &tga_hdr[HDR_IMG_SPEC_XORIGIN] );
+    img_spec_yorig     = tga_header_16( &tga_hdr[HDR_IMG_SPEC_YORIGIN] );
+    img_spec_width     = tga_header_16( &tga_hdr[HDR_IMG_SPEC_WIDTH] );
+    img_spec_height    = tga_header_16( &tga_hdr[HDR_IMG_SPEC_HEIGHT] );
     img_spec_pix_depth = (ubyte)tga_hdr[HDR_IMG_SPEC_PIX_DEPTH];
     img_spec_img_desc  = (ubyte)tga_hdr[HDR_IMG_SPEC_IMG_DESC];
 
     free( tga_hdr );
 
 
-    num_pixels = img_spec_width * img_spec_height;
+    num_pixels = (uint32)img_spec_width * img_spec_height;
 
     if( num_pixels == 0 ) {
+        fclose( targafile );
         TargaError = TGA_ERR_BAD_DIMENSIONS;
         return( NULL );
     }
@@ -265,6 +291,7 @@ void * tga_load( const char * filename,
     /* seek past the image id, if there is one */
     if( idlen ) {
         if( fseek( targafile, idlen, SEEK_CUR ) ) {
+            fclose( targafile );
             TargaError = TGA_ERR_UNEXPECTED_EOF;
             return( NULL );
         }
@@ -273,6 +300,7 @@ void * tga_load( const char * filename,
 
     /* if this is a 'nodata' image, just jump out. */
     if( image_type == TGA_IMG_NODATA ) {
+        fclose( targafile );
         TargaError = TGA_ERR_NODATA_IMAGE;
         return( NULL );
     }
@@ -299,6 +327,7 @@ void * tga_load( const char * filename,
             
         case TGA_IMG_UNC_GRAYSCALE:
         case TGA_IMG_RLE_GRAYSCALE:
+            fclose( targafile );
             TargaError = TGA_ERR_COLORMAP_FOR_GRAY;
             return( NULL );
         }
@@ -308,6 +337,7 @@ void * tga_load( const char * filename,
             cmap_entry_size == 16 ||
             cmap_entry_size == 24 ||
             cmap_entry_size == 32) ) {
+            fclose( targafile );
             TargaError = TGA_ERR_BAD_COLORMAP_ENTRY_SIZE;
             return( NULL );
         }
@@ -322,6 +352,11 @@ void * tga_load( const char * filename,
         
         cmap_bytes = cmap_bytes_entry * cmap_length;
         colormap = (ubyte *)malloc( cmap_bytes );
+        if( colormap == NULL && cmap_bytes != 0 ) {
+            fclose( targafile );
+            TargaError = TGA_ERR_MEM;
+            return( NULL );
+        }
         
         
         for( i = 0; i < cmap_length; i++ ) {
@@ -335,6 +370,7 @@ void * tga_load( const char * filename,
             for( j = 0; j < cmap_bytes_entry; j++ ) {
                 if( !fread( &tmp_byte, 1, 1, targafile ) ) {
                     free( colormap );
+                    fclose( targafile );
                     TargaError = TGA_ERR_BAD_COLORMAP;
                     return( NULL );
                 }
@@ -367,16 +403,65 @@ void * tga_load( const char * filename,
     }
 
 
-    /* compute how many bytes of storage we need for the image */
-    bytes_total = img_spec_width * img_spec_height * format;
+    /* compute how many bytes of storage we need for the image; pixel
+       offsets are 32 bits, so a bigger image can not be loaded */
+    if( num_pixels > 0xFFFFFFFFu / format ) {
+        free( colormap );
+        fclose( targafile );
+        TargaError = TGA_ERR_MEM;
+        return( NULL );
+    }
+    bytes_total = (size_t)num_pixels * format;
 
     image_data = (ubyte *)malloc( bytes_total );
+    if( image_data == NULL ) {
+        free( colormap );
+        fclose( targafile );
+        TargaError = TGA_ERR_MEM;
+        return( NULL );
+    }
 
     img_dat_len = img_spec_width * img_spec_height * bytes_per_pix;
 
     // compute the true number of bits per pixel
     true_bits_per_pixel = cmap_type ? cmap_entry_size : img_spec_pix_depth;
 
+
+    /* read the rest of the file at once rather than a byte at a time; pixels
+       past the end of a short file come out as zero, as before.  No more is
+       read than the pixels can take, a packet header and a pixel for every
+       pixel, so whatever follows them is left alone.  Offsets are 64 bits,
+       as the file may be bigger than a long can count */
+    payload_max = (unsigned long long)num_pixels * (bytes_per_pix + 1);
+    payload_start = tga_tell( targafile );
+    if( payload_start < 0 || tga_seek( targafile, 0, SEEK_END ) ||
+        ( payload_end_offset = tga_tell( targafile ) ) < 0 ||
+        tga_seek( targafile, payload_start, SEEK_SET ) ) {
+        free( colormap );
+        free( image_data );
+        fclose( targafile );
+        TargaError = TGA_ERR_READ_FAILS;
+        return( NULL );
+    }
+    if( payload_end_offset < payload_start ) {
+        payload_end_offset = payload_start;
+    }
+    if( (unsigned long long)( payload_end_offset - payload_start ) < payload_max ) {
+        payload_max = (unsigned long long)( payload_end_offset - payload_start );
+    }
+
+    payload = payload_max < (size_t)-1 ? (ubyte *)malloc( (size_t)payload_max + 1 ) : NULL;
+    if( payload == NULL ) {
+        free( colormap );
+        free( image_data );
+        fclose( targafile );
+        TargaError = TGA_ERR_MEM;
+        return( NULL );
+    }
+    payload_len = fread( payload, 1, (size_t)payload_max, targafile );
+    cursor = payload;
+    payload_end = payload + payload_len;
+
     switch( image_type ) {
 
     case TGA_IMG_UNC_TRUECOLOR:
@@ -388,7 +473,7 @@ void * tga_load( const char * filename,
         for( i = 0; i < num_pixels; i++ ) {
 
             // get the color value.
-            tmp_col = tga_get_pixel( targafile, bytes_per_pix, colormap, cmap_bytes_entry );
+            tmp_col = tga_get_pixel( &cursor, payload_end, bytes_per_pix, colormap, cmap_bytes_entry, cmap_length );
             tmp_col = tga_convert_color( tmp_col, true_bits_per_pixel, alphabits, format );
             
             // now write the data out.
@@ -409,24 +494,29 @@ void * tga_load( const char * filename,
         for( i = 0; i < num_pixels; ) {
 
             /* a bit of work to do to read the data.. */
-            if( fread( &packet_header, 1, 1, targafile ) < 1 ) {
+            if( cursor >= payload_end ) {
                 // well, just let them fill the rest with null pixels then...
                 packet_header = 1;
+            } else {
+                packet_header = *cursor++;
             }
 
             if( packet_header & 0x80 ) {
                 /* run length packet */
 
-                tmp_col = tga_get_pixel( targafile, bytes_per_pix, colormap, cmap_bytes_entry );
+                tmp_col = tga_get_pixel( &cursor, payload_end, bytes_per_pix, colormap, cmap_bytes_entry, cmap_length );
                 tmp_col = tga_convert_color( tmp_col, true_bits_per_pixel, alphabits, format );
                 
                 repcount = (packet_header & 0x7F) + 1;
-                
-                /* write all the data out */
-                for( j = 0; j < repcount; j++ ) {
-                    tga_write_pixel_to_mem( image_data, img_spec_img_desc, 
-                        i + j, img_spec_width, img_spec_height, tmp_col, format );
+
+                /* a packet may not run past the last pixel */
+                if( repcount > num_pixels - i ) {
+                    repcount = (ubyte)(num_pixels - i);
                 }
+                
+                /* write all the data out, a row at a time */
+                tga_fill_run_to_mem( image_data, img_spec_img_desc, 
+                    i, repcount, img_spec_width, img_spec_height, tmp_col, format );
 
                 i += repcount;
 
@@ -435,10 +525,14 @@ void * tga_load( const char * filename,
                 /* get pixel from file */
                 
                 repcount = (packet_header & 0x7F) + 1;
+
+                if( repcount > num_pixels - i ) {
+                    repcount = (ubyte)(num_pixels - i);
+                }
                 
                 for( j = 0; j < repcount; j++ ) {
                     
-                    tmp_col = tga_get_pixel( targafile, bytes_per_pix, colormap, cmap_bytes_entry );
+                    tmp_col = tga_get_pixel( &cursor, payload_end, bytes_per_pix, colormap, cmap_bytes_entry, cmap_length );
                     tmp_col = tga_convert_color( tmp_col, true_bits_per_pixel, alphabits, format );
                     
                     tga_write_pixel_to_mem( image_data, img_spec_img_desc, 
@@ -457,11 +551,17 @@ void * tga_load( const char * filename,
 
     default:
 
+        free( payload );
+        free( colormap );
+        free( image_data );
+        fclose( targafile );
         TargaError = TGA_ERR_BAD_IMAGE_TYPE;
         return( NULL );
 
     }
 
+    free( payload );
+    free( colormap );
     fclose( targafile );
 
     *width  = img_spec_width;
@@ -590,7 +690,7 @@ int tga_write_raw( const char * file, int width, int height, unsigned char * dat
             alpha = alpha > 1.0f ? 255.0f : alpha * 255.0f;
 
             pixbuf = (ubyte)blue + (((ubyte)green) << 8) + 
-                (((ubyte)red) << 16) + (((ubyte)alpha) << 24);
+                (((ubyte)red) << 16) + ((uint32)(ubyte)alpha << 24);
                 
             pixbuf = htotl( pixbuf );
            
@@ -743,7 +843,7 @@ int tga_write_rle( const char * file, int width, int height, unsigned char * dat
             alpha = alpha > 1.0f ? 255.0f : alpha * 255.0f;
 
             pixbuf = (ubyte)blue + (((ubyte)green) << 8) + 
-                (((ubyte)red) << 16) + (((ubyte)alpha) << 24);
+                (((ubyte)red) << 16) + ((uint32)(ubyte)alpha << 24);
                 
             pixbuf = htotl( pixbuf );
             break;
@@ -969,21 +1069,62 @@ int tga_write_rle( const char * file, int width, int height, unsigned char * dat
 
 
 
-static void tga_write_pixel_to_mem( ubyte * dat, ubyte img_spec, uint32 number, 
-                                   uint32 w, uint32 h, uint32 pixel, uint32 format ) {
+static long long tga_tell( FILE * file ) {
 
-    // write the pixel to the data regarding how the
-    // header says the data is ordered.
+    // the file position, which may be past what a long holds.
+
+#ifdef _WIN32
+    return( _ftelli64( file ) );
+#else
+    return( (long long)ftello( file ) );
+#endif
+
+}
+
+
+
+
+static uint16 tga_header_16( const ubyte * field ) {
+
+    // a 16-bit header field, which is not aligned for reading as one.
+
+    uint16 val;
+
+    memcpy( &val, field, sizeof( val ) );
+    return( (uint16)ttohs( (int16)val ) );
+
+}
+
+
+
+
+static int tga_seek( FILE * file, long long offset, int origin ) {
+
+    // fseek to a position that may be past what a long holds; 0 on success.
+
+#ifdef _WIN32
+    return( _fseeki64( file, offset, origin ) );
+#else
+    return( fseeko( file, (off_t)offset, origin ) );
+#endif
+
+}
+
+
+
+
+static uint32 tga_pixel_index( ubyte img_spec, uint32 number, uint32 w, uint32 h ) {
+
+    // where pixel number of the file goes in the data, regarding
+    // how the header says the data is ordered.
 
-    uint32 j;
     uint32 x, y;
-    uint32 addy;
 
     switch( (img_spec & 0x30) >> 4 ) {
 
     case TGA_LOWER_RIGHT:
         x = w - 1 - (number % w);
-        y = number / h;
+        y = number / w;
         break;
 
     case TGA_UPPER_LEFT:
@@ -1004,7 +1145,23 @@ static void tga_write_pixel_to_mem( ubyte * dat, ubyte img_spec, uint32 number,
 
     }
 
-    addy = (y * w + x) * format;
+    return( y * w + x );
+
+}
+
+
+
+
+static void tga_write_pixel_to_mem( ubyte * dat, ubyte img_spec, uint32 number, 
+                                   uint32 w, uint32 h, uint32 pixel, uint32 format ) {
+
+    // write the pixel to the data regarding how the
+    // header says the data is ordered.
+
+    uint32 j;
+    uint32 addy;
+
+    addy = tga_pixel_index( img_spec, number, w, h ) * format;
     for( j = 0; j < format; j++ ) {
         dat[addy + j] = (ubyte)((pixel >> (j * 8)) & 0xFF);
     }
@@ -1014,23 +1171,61 @@ static void tga_write_pixel_to_mem( ubyte * dat, ubyte img_spec, uint32 number,
 
 
 
-static uint32 tga_get_pixel( FILE * tga, ubyte bytes_per_pix, 
-                            ubyte * colormap, ubyte cmap_bytes_entry ) {
+static void tga_fill_run_to_mem( ubyte * dat, ubyte img_spec, uint32 number, uint32 count,
+                                uint32 w, uint32 h, uint32 pixel, uint32 format ) {
+
+    // write count copies of the pixel from pixel number on.  the part
+    // of the run in each row is one span of the data, so the first
+    // copy is written by hand and the rest copied from what is
+    // already there, doubling each time.
+
+    uint32 j;
+    uint32 span, filled, copy;
+    ubyte * first;
+
+    while( count > 0 ) {
+
+        span = w - number % w;
+        if( span > count ) {
+            span = count;
+        }
+
+        /* right to left rows start the span at its last pixel */
+        first = dat + tga_pixel_index( img_spec, (img_spec & 0x10) ? number + span - 1 : number, w, h ) * format;
+        for( j = 0; j < format; j++ ) {
+            first[j] = (ubyte)((pixel >> (j * 8)) & 0xFF);
+        }
+
+        for( filled = 1; filled < span; filled += copy ) {
+            copy = filled < span - filled ? filled : span - filled;
+            memcpy( first + filled * format, first, copy * format );
+        }
+
+        number += span;
+        count -= span;
+
+    }
+
+}
+
+
+
+static uint32 tga_get_pixel( const ubyte ** cursor, const ubyte * end, ubyte bytes_per_pix, 
+                            ubyte * colormap, ubyte cmap_bytes_entry, uint16 cmap_length ) {
     
     /* get the image data value out */
 
     uint32 tmp_col;
     uint32 tmp_int32;
-    ubyte tmp_byte;
 
     uint32 j;
 
     tmp_int32 = 0;
     for( j = 0; j < bytes_per_pix; j++ ) {
-        if( fread( &tmp_byte, 1, 1, tga ) < 1 ) {
+        if( *cursor >= end ) {
             tmp_int32 = 0;
         } else {
-            tmp_int32 += tmp_byte << (j * 8);
+            tmp_int32 += (uint32)*(*cursor)++ << (j * 8);
         }
     }
     
@@ -1049,10 +1244,13 @@ static uint32 tga_get_pixel( FILE * tga, ubyte bytes_per_pix,
     }
     
     if( colormap != NULL ) {
-        /* need to look up value to get real color */
+        /* need to look up value to get real color; indices past the
+           colormap come out black */
         tmp_col = 0;
-        for( j = 0; j < cmap_bytes_entry; j++ ) {
-            tmp_col += colormap[cmap_bytes_entry * tmp_int32 + j] << (8 * j);
+        if( tmp_int32 < cmap_length ) {
+            for( j = 0; j < cmap_bytes_entry; j++ ) {
+                tmp_col += colormap[cmap_bytes_entry * tmp_int32 + j] << (8 * j);
+            }
         }
     } else {
         tmp_col = tmp_int32;
@@ -1124,7 +1322,7 @@ is_15_bit_in_disguise:
     g = (ubyte)(((float)g / 255.0f) * ((float)a / 255.0f) * 255.0f);
     b = (ubyte)(((float)b / 255.0f) * ((float)a / 255.0f) * 255.0f);
 
-    pixel = r + (g << 8) + (b << 16) + (a << 24);
+    pixel = r + (g << 8) + (b << 16) + ((uint32)a << 24);
 
     /* now convert from 32-bit to whatever they want. */
     